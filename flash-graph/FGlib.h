@@ -53,6 +53,7 @@ class FG_graph
 	std::string index_file;
 	std::shared_ptr<in_mem_graph> graph_data;
 	std::shared_ptr<vertex_index> index_data;
+	std::shared_ptr<graph_delta> delta;
 	config_map::ptr configs;
 
 	// In this case, the graph file is kept in SAFS and the index is read to
@@ -118,6 +119,25 @@ public:
 
 	graph_engine::ptr create_engine(graph_index::ptr index);
 
+	/**
+	 * \brief Attach the updates of the graph to the graph object.
+	 *        The graph engines created afterwards merge the updates into
+	 *        the adjacency lists read from the graph image on the fly.
+	 *
+	 * \param delta The updates of the graph. It's detached if it's NULL.
+	 */
+	void set_delta(std::shared_ptr<graph_delta> delta) {
+		this->delta = delta;
+	}
+
+	/**
+	 * \brief Get the updates attached to the graph object.
+	 * \return The updates of the graph. NULL if no updates are attached.
+	 */
+	std::shared_ptr<graph_delta> get_delta() const {
+		return delta;
+	}
+
 	/**
 	 * \brief Get the header of the graph that contains basic information of the graph.
 	 * \return The graph header.
@@ -338,6 +358,40 @@ fm::vector::ptr compute_transitivity(FG_graph::ptr fg);
 fm::vector::ptr compute_betweenness_centrality(FG_graph::ptr fg,
 		const std::vector<vertex_id_t>& vids);
 
+/**
+  * \brief Compute the shortest distance from a set of source vertices to
+  *        every vertex in a graph. Only the vertices whose distance is
+  *        reduced are activated and read their edge lists.
+  *
+  * \param fg The FlashGraph graph object for which you want to compute.
+  * \param sources The source vertices. The distance of a vertex is
+  *        the distance to its nearest source.
+  * \param weight_type The type of the edge data used as edge weights.
+  *        Edge weights must be non-negative. If it's NULL, every edge
+  *        has weight 1.
+  * \param traverse_e The type of edges to traverse in a directed graph:
+  *        IN_EDGE, OUT_EDGE, BOTH_EDGES.
+  * \return A vector with the distance of each vertex. Unreachable vertices
+  *         get the maximal value of the weight type.
+*/
+fm::vector::ptr compute_sssp(FG_graph::ptr fg,
+		const std::vector<vertex_id_t> &sources,
+		const fm::scalar_type *weight_type, edge_type traverse_e = OUT_EDGE);
+
+/**
+  * \brief Compute the shortest distance from a source vertex to every vertex
+  *        in a graph.
+  *
+  * \param fg The FlashGraph graph object for which you want to compute.
+  * \param source The source vertex.
+  * \param weight_type The type of the edge data used as edge weights.
+  *        If it's NULL, every edge has weight 1.
+  * \param traverse_e The type of edges to traverse in a directed graph.
+  * \return A vector with the distance of each vertex.
+*/
+fm::vector::ptr compute_sssp(FG_graph::ptr fg, vertex_id_t source,
+		const fm::scalar_type *weight_type, edge_type traverse_e = OUT_EDGE);
+
 /**
  * \brief Get the degree of all vertices in a specified time interval in
  *        a time-series graph.
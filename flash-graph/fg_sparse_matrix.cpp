@@ -366,7 +366,8 @@ public:
 	}
 
 	virtual fm::detail::block_exec_order::ptr get_multiply_order(
-			size_t num_block_rows, size_t num_block_cols) const {
+			size_t num_block_rows, size_t num_block_cols,
+			size_t row_size) const {
 		return fm::detail::block_exec_order::ptr(new fm::detail::seq_exec_order());
 	}
 
@@ -499,7 +500,8 @@ public:
 	}
 
 	virtual fm::detail::block_exec_order::ptr get_multiply_order(
-			size_t num_block_rows, size_t num_block_cols) const {
+			size_t num_block_rows, size_t num_block_cols,
+			size_t row_size) const {
 		return fm::detail::block_exec_order::ptr(new fm::detail::seq_exec_order());
 	}
 
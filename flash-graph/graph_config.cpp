@@ -45,6 +45,7 @@ void graph_config::print_help()
 	printf("\tin_mem_graph: indicate whether to load the entire graph to memory in advance\n");
 	printf("\tnum_vparts: the number of vertical partitions\n");
 	printf("\tmin_vpart_degree: the min degree of a vertex to perform vertical partitioning\n");
+	printf("\tauto_vpart: vertically partition high-degree vertices automatically\n");
 	printf("\tserial_run: run the user code on a vertex in serial\n");
 	printf("\tvertex_merge_gap: the gap size allowed when merging two vertex requests\n");
 }
@@ -63,6 +64,7 @@ void graph_config::print()
 	BOOST_LOG_TRIVIAL(info) << "\tin_mem_graph: " << _in_mem_graph;
 	BOOST_LOG_TRIVIAL(info) << "\tnum_vparts: " << num_vparts;
 	BOOST_LOG_TRIVIAL(info) << "\tmin_vpart_degree: " << min_vpart_degree;
+	BOOST_LOG_TRIVIAL(info) << "\tauto_vpart: " << auto_vpart;
 	BOOST_LOG_TRIVIAL(info) << "\tserial_run: " << serial_run;
 	BOOST_LOG_TRIVIAL(info) << "\tvertex_merge_gap: " << vertex_merge_gap;
 }
@@ -92,6 +94,7 @@ void graph_config::init(config_map::ptr map)
 	map->read_option_bool("in_mem_graph", _in_mem_graph);
 	map->read_option_int("num_vparts", num_vparts);
 	map->read_option_int("min_vpart_degree", min_vpart_degree);
+	map->read_option_bool("auto_vpart", auto_vpart);
 	map->read_option_bool("serial_run", serial_run);
 	map->read_option_int("vertex_merge_gap", vertex_merge_gap);
 }
@@ -45,6 +45,7 @@ class graph_config
 	bool _in_mem_graph;
 	int num_vparts;
 	int min_vpart_degree;
+	bool auto_vpart;
 	bool serial_run;
 	// in pages.
 	int vertex_merge_gap;
@@ -63,6 +64,7 @@ public:
 		_in_mem_graph = false;
 		num_vparts = 1;
 		min_vpart_degree = std::numeric_limits<int>::max();
+		auto_vpart = false;
 		serial_run = false;
 		// When the gap is 0, it means two vertices either in the same page
 		// or two adjacent pages.
@@ -186,6 +188,25 @@ public:
 		return min_vpart_degree;
 	}
 
+	/**
+	 * \brief Determine whether the graph engine chooses the vertices to be
+	 * vertically partitioned automatically.
+	 * \return true if the graph engine chooses the vertices automatically.
+	 */
+	bool is_auto_vpart() const {
+		return auto_vpart;
+	}
+
+	/**
+	 * \brief Set the number of vertical partitions and the min degree
+	 * of a vertex to perform vertical partitioning.
+	 * The graph engine uses it when it partitions vertices automatically.
+	 */
+	void set_vparts(int num_vparts, int min_vpart_degree) {
+		this->num_vparts = num_vparts;
+		this->min_vpart_degree = min_vpart_degree;
+	}
+
 	/**
 	 * \brief Get the size of a gap that is allowed when merging two vertex
 	 * requests.
@@ -0,0 +1,481 @@
+/*
+ * Copyright 2014 Open Connectome Project (http://openconnecto.me)
+ * Written by Da Zheng (zhengda1936@gmail.com)
+ *
+ * This file is part of FlashGraph.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdio.h>
+
+#include <algorithm>
+
+#include <boost/format.hpp>
+
+#include "log.h"
+#include "cache.h"
+#include "comm_exception.h"
+
+#include "graph_delta.h"
+#include "vertex_index.h"
+#include "fg_utils.h"
+
+using namespace safs;
+
+namespace fg
+{
+
+/*
+ * This byte array wraps the merged adjacency list in memory, so it can be
+ * accessed by the page vertex. The memory is contiguous, so a page is
+ * always followed by the next page.
+ */
+class mem_page_byte_array: public page_byte_array
+{
+	const char *buf;
+	size_t size;
+public:
+	mem_page_byte_array(const char *buf, size_t size) {
+		this->buf = buf;
+		this->size = size;
+	}
+
+	virtual void lock() {
+		throw unsupported_exception("lock");
+	}
+
+	virtual void unlock() {
+		throw unsupported_exception("unlock");
+	}
+
+	virtual size_t get_size() const {
+		return size;
+	}
+
+	virtual page_byte_array *clone() {
+		throw unsupported_exception("clone");
+	}
+
+	virtual off_t get_offset() const {
+		return 0;
+	}
+
+	virtual off_t get_offset_in_first_page() const {
+		return 0;
+	}
+
+	virtual const char *get_page(int idx) const {
+		return buf + ((size_t) idx) * PAGE_SIZE;
+	}
+};
+
+namespace
+{
+
+struct entry_key_less
+{
+	bool operator()(const graph_delta::delta_entry &e, vertex_id_t id) const {
+		return e.key < id;
+	}
+
+	bool operator()(vertex_id_t id, const graph_delta::delta_entry &e) const {
+		return id < e.key;
+	}
+};
+
+/*
+ * Merge the neighbor list in the base image with the updates on the list.
+ * The neighbor list in a FlashGraph image is sorted, so is the merged list.
+ * Inserted edges whose neighbor doesn't exist are ignored.
+ */
+void merge_neighbors(const vertex_id_t *base, size_t num,
+		const graph_delta::delta_entry *begin,
+		const graph_delta::delta_entry *end, size_t num_vertices,
+		std::vector<vertex_id_t> &res)
+{
+	res.clear();
+	size_t i = 0;
+	const graph_delta::delta_entry *d = begin;
+	while (i < num || d < end) {
+		if (d == end || (i < num && base[i] < d->neigh))
+			res.push_back(base[i++]);
+		else if (i == num || d->neigh < base[i]) {
+			if (d->insert && d->neigh < num_vertices)
+				res.push_back(d->neigh);
+			d++;
+		}
+		else {
+			// Inserting an existing edge doesn't change the list.
+			// Deleting an edge deletes all of its copies.
+			vertex_id_t neigh = base[i];
+			for (; i < num && base[i] == neigh; i++)
+				if (d->insert)
+					res.push_back(neigh);
+			d++;
+		}
+	}
+}
+
+void write_vertex(vertex_id_t id, const std::vector<vertex_id_t> &neighs,
+		std::vector<char> &buf)
+{
+	buf.resize(ext_mem_undirected_vertex::num_edges2vsize(neighs.size(), 0));
+	ext_mem_undirected_vertex *v = new (buf.data()) ext_mem_undirected_vertex(
+			id, neighs.size(), 0);
+	for (size_t i = 0; i < neighs.size(); i++)
+		v->set_neighbor(i, neighs[i]);
+}
+
+}
+
+graph_delta::ptr graph_delta::create(const graph_header &header)
+{
+	if (header.has_edge_data()) {
+		BOOST_LOG_TRIVIAL(error)
+			<< "graph delta doesn't support graphs with edge data";
+		return graph_delta::ptr();
+	}
+	if (header.get_graph_type() != graph_type::DIRECTED
+			&& header.get_graph_type() != graph_type::UNDIRECTED) {
+		BOOST_LOG_TRIVIAL(error)
+			<< "graph delta doesn't support time-series graphs";
+		return graph_delta::ptr();
+	}
+	return graph_delta::ptr(new graph_delta(header));
+}
+
+void graph_delta::add_op(vertex_id_t src, vertex_id_t dst, bool insert)
+{
+	if (src == INVALID_VERTEX_ID || dst == INVALID_VERTEX_ID)
+		throw invalid_arg_exception("invalid vertex ID");
+	edge_op op;
+	op.src = src;
+	op.dst = dst;
+	op.insert = insert;
+	log.push_back(op);
+	finalized = false;
+}
+
+bool graph_delta::load(const std::string &file)
+{
+	FILE *f = fopen(file.c_str(), "r");
+	if (f == NULL) {
+		BOOST_LOG_TRIVIAL(error) << boost::format("can't open %1%: %2%")
+			% file % strerror(errno);
+		return false;
+	}
+
+	char *line = NULL;
+	size_t line_size = 0;
+	size_t line_no = 0;
+	bool ret = true;
+	while (getline(&line, &line_size, f) > 0) {
+		line_no++;
+		if (line[0] == '#' || line[0] == '\n')
+			continue;
+		char op;
+		unsigned long src, dst;
+		if (sscanf(line, " %c %lu %lu", &op, &src, &dst) != 3
+				|| (op != '+' && op != '-')
+				|| src >= INVALID_VERTEX_ID || dst >= INVALID_VERTEX_ID) {
+			BOOST_LOG_TRIVIAL(error) << boost::format(
+					"invalid update in line %1% of %2%") % line_no % file;
+			ret = false;
+			break;
+		}
+		add_op(src, dst, op == '+');
+	}
+	free(line);
+	fclose(f);
+	return ret;
+}
+
+bool graph_delta::dump(const std::string &file) const
+{
+	FILE *f = fopen(file.c_str(), "a");
+	if (f == NULL) {
+		BOOST_LOG_TRIVIAL(error) << boost::format("can't open %1%: %2%")
+			% file % strerror(errno);
+		return false;
+	}
+	for (size_t i = 0; i < log.size(); i++)
+		fprintf(f, "%c %u %u\n", log[i].insert ? '+' : '-', log[i].src,
+				log[i].dst);
+	fclose(f);
+	return true;
+}
+
+/*
+ * Only the last update on an edge takes effect. The entries are sorted
+ * in the order of updates before they are merged, so a stable sort
+ * keeps the last update of an edge at the end of its run.
+ */
+void graph_delta::merge_ops(std::vector<delta_entry> &entries)
+{
+	std::stable_sort(entries.begin(), entries.end());
+	size_t num = 0;
+	for (size_t i = 0; i < entries.size(); i++) {
+		if (i + 1 < entries.size() && entries[i].key == entries[i + 1].key
+				&& entries[i].neigh == entries[i + 1].neigh)
+			continue;
+		entries[num++] = entries[i];
+	}
+	entries.resize(num);
+}
+
+void graph_delta::finalize()
+{
+	if (finalized)
+		return;
+
+	in_entries.clear();
+	out_entries.clear();
+	for (size_t i = 0; i < log.size(); i++) {
+		delta_entry e;
+		e.key = log[i].src;
+		e.neigh = log[i].dst;
+		e.insert = log[i].insert;
+		out_entries.push_back(e);
+
+		std::swap(e.key, e.neigh);
+		if (is_directed())
+			in_entries.push_back(e);
+		else
+			out_entries.push_back(e);
+	}
+	merge_ops(in_entries);
+	merge_ops(out_entries);
+
+	updated_vertices.assign(get_num_base_vertices(), false);
+	for (size_t i = 0; i < in_entries.size(); i++)
+		if (in_entries[i].key < updated_vertices.size())
+			updated_vertices[in_entries[i].key] = true;
+	for (size_t i = 0; i < out_entries.size(); i++)
+		if (out_entries[i].key < updated_vertices.size())
+			updated_vertices[out_entries[i].key] = true;
+	finalized = true;
+}
+
+std::pair<const graph_delta::delta_entry *, const graph_delta::delta_entry *>
+graph_delta::get_updates(vertex_id_t id, edge_type type) const
+{
+	assert(finalized);
+	const std::vector<delta_entry> &entries
+		= is_directed() && type == IN_EDGE ? in_entries : out_entries;
+	assert(!is_directed() || type == IN_EDGE || type == OUT_EDGE);
+	auto range = std::equal_range(entries.begin(), entries.end(), id,
+			entry_key_less());
+	const delta_entry *begin = entries.data() + (range.first - entries.begin());
+	const delta_entry *end = entries.data() + (range.second - entries.begin());
+	return std::pair<const delta_entry *, const delta_entry *>(begin, end);
+}
+
+/*
+ * Merge the adjacency lists of one type in the base image with the updates
+ * and write them to the new image.
+ */
+bool graph_delta::merge_list(FILE *in_f, FILE *out_f,
+		const std::vector<off_t> &base_offs, size_t num_vertices,
+		edge_type type, std::vector<vsize_t> &num_edges) const
+{
+	size_t num_base_vertices = base_offs.size() - 1;
+	num_edges.resize(num_vertices);
+	if (fseek(in_f, base_offs.front(), SEEK_SET) != 0) {
+		BOOST_LOG_TRIVIAL(error) << boost::format(
+				"can't seek in the graph image: %1%") % strerror(errno);
+		return false;
+	}
+
+	std::vector<char> base_buf;
+	std::vector<char> out_buf;
+	std::vector<vertex_id_t> neighs;
+	for (size_t id = 0; id < num_vertices; id++) {
+		const vertex_id_t *base_neighs = NULL;
+		size_t num_base_neighs = 0;
+		if (id < num_base_vertices) {
+			size_t size = base_offs[id + 1] - base_offs[id];
+			base_buf.resize(size);
+			if (fread(base_buf.data(), size, 1, in_f) != 1) {
+				BOOST_LOG_TRIVIAL(error) << boost::format(
+						"can't read the adjacency list of vertex %1%") % id;
+				return false;
+			}
+			const ext_mem_undirected_vertex *v
+				= (const ext_mem_undirected_vertex *) base_buf.data();
+			assert(v->get_id() == id);
+			base_neighs = (const vertex_id_t *) (base_buf.data()
+					+ ext_mem_undirected_vertex::get_header_size());
+			num_base_neighs = v->get_num_edges();
+		}
+		auto updates = get_updates(id, type);
+		merge_neighbors(base_neighs, num_base_neighs, updates.first,
+				updates.second, num_vertices, neighs);
+		write_vertex(id, neighs, out_buf);
+		num_edges[id] = neighs.size();
+		if (fwrite(out_buf.data(), out_buf.size(), 1, out_f) != 1) {
+			BOOST_LOG_TRIVIAL(error) << boost::format(
+					"can't write the new graph image: %1%") % strerror(errno);
+			return false;
+		}
+	}
+	return true;
+}
+
+bool graph_delta::compact(const std::string &graph_file,
+		const std::string &index_file, const std::string &new_graph_file,
+		const std::string &new_index_file)
+{
+	finalize();
+	vertex_index::ptr vindex = vertex_index::load(index_file);
+	if (vindex == NULL)
+		return false;
+	const graph_header &base_header = vindex->get_graph_header();
+	if (base_header.get_num_vertices() != get_num_base_vertices()
+			|| base_header.is_directed_graph() != is_directed()
+			|| base_header.has_edge_data()) {
+		BOOST_LOG_TRIVIAL(error)
+			<< "the graph image doesn't match the graph delta";
+		return false;
+	}
+
+	// Inserted edges may add new vertices to the graph.
+	size_t num_vertices = get_num_base_vertices();
+	for (size_t i = 0; i < log.size(); i++)
+		if (log[i].insert)
+			num_vertices = std::max(num_vertices,
+					(size_t) std::max(log[i].src, log[i].dst) + 1);
+
+	FILE *in_f = fopen(graph_file.c_str(), "r");
+	if (in_f == NULL) {
+		BOOST_LOG_TRIVIAL(error) << boost::format("can't open %1%: %2%")
+			% graph_file % strerror(errno);
+		return false;
+	}
+	FILE *out_f = fopen(new_graph_file.c_str(), "w");
+	if (out_f == NULL) {
+		BOOST_LOG_TRIVIAL(error) << boost::format("can't open %1%: %2%")
+			% new_graph_file % strerror(errno);
+		fclose(in_f);
+		return false;
+	}
+
+	// We don't know the number of edges yet, so the header is written
+	// again when all adjacency lists are written.
+	graph_header header;
+	bool ret = fwrite(&header, sizeof(header), 1, out_f) == 1;
+	std::vector<vsize_t> num_in_edges;
+	std::vector<vsize_t> num_out_edges;
+	std::vector<off_t> offs(vindex->get_num_vertices() + 1);
+	if (ret && is_directed()) {
+		init_in_offs(vindex, offs);
+		ret = merge_list(in_f, out_f, offs, num_vertices, IN_EDGE, num_in_edges);
+	}
+	if (ret) {
+		init_out_offs(vindex, offs);
+		ret = merge_list(in_f, out_f, offs, num_vertices, OUT_EDGE,
+				num_out_edges);
+	}
+	size_t num_edges = 0;
+	for (size_t i = 0; i < num_out_edges.size(); i++)
+		num_edges += num_out_edges[i];
+	if (!is_directed())
+		num_edges /= 2;
+	header = graph_header(base_header.get_graph_type(), num_vertices,
+			num_edges, 0);
+	if (ret)
+		ret = fseek(out_f, 0, SEEK_SET) == 0
+			&& fwrite(&header, sizeof(header), 1, out_f) == 1;
+	fclose(in_f);
+	fclose(out_f);
+	if (!ret)
+		return false;
+
+	vertex_index::ptr new_index;
+	if (is_directed())
+		new_index = cdirected_vertex_index::construct(num_vertices,
+				num_in_edges.data(), num_out_edges.data(), header);
+	else
+		new_index = cundirected_vertex_index::construct(num_vertices,
+				num_out_edges.data(), header);
+	new_index->dump(new_index_file);
+	BOOST_LOG_TRIVIAL(info) << boost::format(
+			"compact %1% updates: the new graph has %2% vertices and %3% edges")
+		% log.size() % num_vertices % num_edges;
+	return true;
+}
+
+std::future<bool> graph_delta::compact_async(const std::string &graph_file,
+		const std::string &index_file, const std::string &new_graph_file,
+		const std::string &new_index_file) const
+{
+	graph_delta::ptr snapshot(new graph_delta(*this));
+	return std::async(std::launch::async, [=]() {
+			return snapshot->compact(graph_file, index_file, new_graph_file,
+				new_index_file);
+			});
+}
+
+delta_page_vertex::delta_page_vertex(const page_vertex &vertex,
+		const graph_delta &delta)
+{
+	vertex_id_t id = vertex.get_id();
+	size_t num_vertices = delta.get_num_base_vertices();
+	std::vector<vertex_id_t> base;
+	std::vector<vertex_id_t> neighs;
+	if (vertex.is_directed()) {
+		const page_directed_vertex &dv = (const page_directed_vertex &) vertex;
+		if (dv.has_in_part()) {
+			base.resize(dv.get_num_edges(IN_EDGE));
+			dv.read_edges(IN_EDGE, base.data(), base.size());
+			auto updates = delta.get_updates(id, IN_EDGE);
+			merge_neighbors(base.data(), base.size(), updates.first,
+					updates.second, num_vertices, neighs);
+			write_vertex(id, neighs, in_buf);
+			in_arr.reset(new mem_page_byte_array(in_buf.data(), in_buf.size()));
+		}
+		if (dv.has_out_part()) {
+			base.resize(dv.get_num_edges(OUT_EDGE));
+			dv.read_edges(OUT_EDGE, base.data(), base.size());
+			auto updates = delta.get_updates(id, OUT_EDGE);
+			merge_neighbors(base.data(), base.size(), updates.first,
+					updates.second, num_vertices, neighs);
+			write_vertex(id, neighs, out_buf);
+			out_arr.reset(new mem_page_byte_array(out_buf.data(),
+						out_buf.size()));
+		}
+		if (in_arr && out_arr)
+			dvertex.reset(new page_directed_vertex(*in_arr, *out_arr));
+		else if (in_arr)
+			dvertex.reset(new page_directed_vertex(*in_arr, true));
+		else
+			dvertex.reset(new page_directed_vertex(*out_arr, false));
+	}
+	else {
+		const page_undirected_vertex &uv = (const page_undirected_vertex &) vertex;
+		base.resize(uv.get_num_edges());
+		uv.read_edges(OUT_EDGE, base.data(), base.size());
+		auto updates = delta.get_updates(id, OUT_EDGE);
+		merge_neighbors(base.data(), base.size(), updates.first,
+				updates.second, num_vertices, neighs);
+		write_vertex(id, neighs, out_buf);
+		out_arr.reset(new mem_page_byte_array(out_buf.data(), out_buf.size()));
+		uvertex.reset(new page_undirected_vertex(*out_arr));
+	}
+}
+
+delta_page_vertex::~delta_page_vertex()
+{
+}
+
+}
@@ -0,0 +1,214 @@
+#ifndef __GRAPH_DELTA_H__
+#define __GRAPH_DELTA_H__
+
+/*
+ * Copyright 2014 Open Connectome Project (http://openconnecto.me)
+ * Written by Da Zheng (zhengda1936@gmail.com)
+ *
+ * This file is part of FlashGraph.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <memory>
+#include <vector>
+#include <string>
+#include <future>
+
+#include "FG_basic_types.h"
+#include "graph_file_header.h"
+#include "vertex.h"
+
+namespace fg
+{
+
+/*
+ * This stores the updates to an immutable FlashGraph image: the edges
+ * inserted to the graph and the edges deleted from the graph.
+ * The graph engine merges the updates into the adjacency lists read from
+ * the image on the fly, so that graph algorithms run on the updated graph
+ * without rebuilding the image. compact() writes a new image that contains
+ * the updates.
+ *
+ * Updates are recorded in a log. The log has to be finalized before
+ * the graph engine or compaction uses it. The log can't be modified
+ * while the graph engine runs on it.
+ *
+ * Edge data isn't supported, so the image shouldn't have edge data.
+ */
+class graph_delta
+{
+public:
+	struct delta_entry
+	{
+		// The vertex whose adjacency list is updated.
+		vertex_id_t key;
+		vertex_id_t neigh;
+		// Whether the edge is inserted or deleted.
+		bool insert;
+
+		bool operator<(const delta_entry &e) const {
+			if (key != e.key)
+				return key < e.key;
+			else
+				return neigh < e.neigh;
+		}
+	};
+private:
+	struct edge_op
+	{
+		vertex_id_t src;
+		vertex_id_t dst;
+		bool insert;
+	};
+
+	graph_header header;
+	std::vector<edge_op> log;
+	bool finalized;
+
+	// The merged updates sorted on the vertex and its neighbor.
+	// For an undirected graph, we only use the out-edge updates.
+	std::vector<delta_entry> in_entries;
+	std::vector<delta_entry> out_entries;
+	// Indicate whether a vertex in the base image has updates.
+	std::vector<bool> updated_vertices;
+
+	graph_delta(const graph_header &header) {
+		this->header = header;
+		this->finalized = true;
+	}
+
+	static void merge_ops(std::vector<delta_entry> &entries);
+	void add_op(vertex_id_t src, vertex_id_t dst, bool insert);
+	bool merge_list(FILE *in_f, FILE *out_f,
+			const std::vector<off_t> &base_offs, size_t num_vertices,
+			edge_type type, std::vector<vsize_t> &num_edges) const;
+public:
+	typedef std::shared_ptr<graph_delta> ptr;
+
+	/*
+	 * Create an empty delta on top of a graph image.
+	 */
+	static ptr create(const graph_header &header);
+
+	/*
+	 * The number of vertices in the base image.
+	 */
+	size_t get_num_base_vertices() const {
+		return header.get_num_vertices();
+	}
+
+	bool is_directed() const {
+		return header.is_directed_graph();
+	}
+
+	/*
+	 * Record an edge insertion. A later update on the same edge
+	 * overrides an earlier one.
+	 */
+	void add_edge(vertex_id_t src, vertex_id_t dst) {
+		add_op(src, dst, true);
+	}
+
+	/*
+	 * Record an edge deletion.
+	 */
+	void remove_edge(vertex_id_t src, vertex_id_t dst) {
+		add_op(src, dst, false);
+	}
+
+	size_t get_num_updates() const {
+		return log.size();
+	}
+
+	/*
+	 * Load the updates from a text file. Each line has an update:
+	 * "+ src dst" inserts an edge and "- src dst" deletes an edge.
+	 */
+	bool load(const std::string &file);
+	/*
+	 * Append all updates to a text file in the same format.
+	 */
+	bool dump(const std::string &file) const;
+
+	/*
+	 * Merge the updates in the log, so they can be used by the graph engine.
+	 */
+	void finalize();
+
+	bool is_finalized() const {
+		return finalized;
+	}
+
+	/*
+	 * Test whether the adjacency list of a vertex in the base image
+	 * is updated.
+	 */
+	bool has_updates(vertex_id_t id) const {
+		return id < updated_vertices.size() && updated_vertices[id];
+	}
+
+	/*
+	 * Get the updates on the adjacency list of the specified type.
+	 * For an undirected graph, the edge type is ignored.
+	 */
+	std::pair<const delta_entry *, const delta_entry *> get_updates(
+			vertex_id_t id, edge_type type) const;
+
+	/*
+	 * Write a new graph image that contains all updates. The base image
+	 * is read from the Linux filesystem.
+	 */
+	bool compact(const std::string &graph_file, const std::string &index_file,
+			const std::string &new_graph_file,
+			const std::string &new_index_file);
+	/*
+	 * Compact the graph in the background. It compacts a snapshot of
+	 * the updates, so the delta can be modified while compaction runs.
+	 */
+	std::future<bool> compact_async(const std::string &graph_file,
+			const std::string &index_file, const std::string &new_graph_file,
+			const std::string &new_index_file) const;
+};
+
+class mem_page_byte_array;
+
+/*
+ * This is a page vertex whose adjacency lists are merged with the updates
+ * in a graph delta. The merged adjacency lists are kept in memory.
+ */
+class delta_page_vertex
+{
+	std::vector<char> in_buf;
+	std::vector<char> out_buf;
+	std::unique_ptr<mem_page_byte_array> in_arr;
+	std::unique_ptr<mem_page_byte_array> out_arr;
+	// page_vertex doesn't have a virtual destructor, so we keep
+	// the concrete page vertex.
+	std::unique_ptr<page_directed_vertex> dvertex;
+	std::unique_ptr<page_undirected_vertex> uvertex;
+public:
+	delta_page_vertex(const page_vertex &vertex, const graph_delta &delta);
+	~delta_page_vertex();
+
+	const page_vertex &get() const {
+		if (dvertex)
+			return *dvertex;
+		else
+			return *uvertex;
+	}
+};
+
+}
+
+#endif
@@ -295,6 +295,16 @@ void part_compute_vertex::broadcast_vpart(const vertex_message &msg)
 	}
 }
 
+std::pair<size_t, size_t> part_compute_vertex::get_part_edge_range(
+		size_t num_edges) const
+{
+	size_t num_vparts = graph_conf.get_num_vparts();
+	size_t part_size = ceil(((double) num_edges) / num_vparts);
+	size_t start = std::min(part_size * part_id, num_edges);
+	size_t end = std::min(part_size * (part_id + 1), num_edges);
+	return std::pair<size_t, size_t>(start, end);
+}
+
 void part_compute_vertex::request_vertices(vertex_id_t ids[], size_t num)
 {
 	if (num == 0)
@@ -539,12 +549,33 @@ void init_vpart_thread::run()
 	this->stop();
 }
 
+/*
+ * When the graph engine partitions vertices automatically, a vertex is
+ * vertically partitioned if its edge list is larger than this fraction
+ * of the edges a worker thread processes in a full pass over the graph.
+ */
+const size_t AUTO_VPART_WORK_FRAC = 8;
+/*
+ * The edge lists smaller than this aren't worth vertical partitioning.
+ */
+const size_t AUTO_VPART_MIN_DEGREE = 4096;
+
+int get_auto_vpart_degree(const graph_header &header, int num_threads)
+{
+	// Each edge appears in the edge lists of two vertices.
+	size_t tot_degree = header.get_num_edges() * 2;
+	size_t min_degree = tot_degree / num_threads / AUTO_VPART_WORK_FRAC;
+	min_degree = std::max(min_degree, AUTO_VPART_MIN_DEGREE);
+	return std::min(min_degree, (size_t) std::numeric_limits<int>::max());
+}
+
 }
 
 void graph_engine::init(graph_index::ptr index)
 {
 	int num_threads = graph_conf.get_num_threads();
 	this->num_nodes = params.get_num_nodes();
+	this->auto_vparts = false;
 
 	// Construct the vertex states.
 	index->init(num_threads, num_nodes);
@@ -576,6 +607,25 @@ void graph_engine::init(graph_index::ptr index)
 		preload_graph();
 #endif
 
+	// The graph engine partitions high-degree vertices automatically
+	// if users don't partition vertices manually. Each worker thread gets
+	// a vertical partition of a high-degree vertex. It only works if
+	// the vertex program provides a vertex type for the vertical partitions.
+	if (graph_conf.is_auto_vpart() && graph_conf.get_num_vparts() <= 1
+			&& num_threads > 1) {
+		if (index->has_part_vertices()) {
+			auto_vparts = true;
+			graph_conf.set_vparts(num_threads,
+					get_auto_vpart_degree(header, num_threads));
+			BOOST_LOG_TRIVIAL(info) << boost::format(
+					"vertically partition vertices with degree >= %1% into %2% parts")
+				% graph_conf.get_min_vpart_degree() % graph_conf.get_num_vparts();
+		}
+		else
+			BOOST_LOG_TRIVIAL(warning)
+				<< "The vertex program doesn't support vertical partitioning";
+	}
+
 	// If we need to perform vertical partitioning on the graph.
 	if (graph_conf.get_num_vparts() > 1) {
 		std::vector<init_vpart_thread *> threads(num_threads);
@@ -602,6 +652,18 @@ graph_engine::graph_engine(FG_graph &graph, graph_index::ptr index)
 
 	header = graph.get_graph_header();
 	header.verify();
+	delta = graph.get_delta();
+	if (delta && delta->get_num_base_vertices() != header.get_num_vertices()) {
+		BOOST_LOG_TRIVIAL(error)
+			<< "The graph delta isn't created for the graph. Ignore it";
+		delta = NULL;
+	}
+	else if (delta) {
+		delta->finalize();
+		BOOST_LOG_TRIVIAL(info) << boost::format(
+				"Merge %1% updates into the graph on the fly")
+			% delta->get_num_updates();
+	}
 	out_part_off = 0;
 	if (header.is_directed_graph()) {
 		assert(sizeof(vertex_index) == sizeof(header));
@@ -623,6 +685,8 @@ graph_engine::~graph_engine()
 	for (unsigned i = 0; i < worker_threads.size(); i++)
 		delete worker_threads[i];
 	graph_factory = file_io_factory::shared_ptr();
+	if (auto_vparts)
+		graph_conf.set_vparts(1, std::numeric_limits<int>::max());
 }
 
 static inline int get_node_id(int thread_idx, int num_nodes)
@@ -134,6 +134,15 @@ public:
 
 	void broadcast_vpart(const vertex_message &msg);
 
+	/**
+	 * \brief Get the range of edges that the vertical partition is
+	 * responsible for. The edge list is split evenly among all vertical
+	 * partitions of a vertex.
+	 * \param num_edges The number of edges in the edge list.
+	 * \return The start and end offsets in the edge list.
+	 */
+	std::pair<size_t, size_t> get_part_edge_range(size_t num_edges) const;
+
 	void run_on_message(vertex_program &vprog, const vertex_message &msg) {
 		throw unsupported_exception("run_on_message");
 	}
@@ -340,6 +349,8 @@ class graph_engine
 	graph_index::ptr vertices;
 	in_mem_query_vertex_index::ptr vindex;
 	std::shared_ptr<in_mem_graph> graph_data;
+	// The updates merged into the adjacency lists read from the image.
+	std::shared_ptr<graph_delta> delta;
 	vertex_scheduler::ptr scheduler;
 
 	// The number of activated vertices that haven't been processed
@@ -354,6 +365,10 @@ class graph_engine
 	pthread_barrier_t barrier2;
 
 	int num_nodes;
+	// Indicate whether the graph engine sets the vertical partitioning
+	// automatically. If so, the setting is reset when the engine is
+	// destroyed.
+	bool auto_vparts;
 	std::vector<worker_thread *> worker_threads;
 	std::vector<vertex_program::ptr> vprograms;
 
@@ -464,6 +479,14 @@ public:
 	const graph_header &get_graph_header() const {
 		return header;
 	}
+
+	/**
+	 * \brief Get the updates merged into the adjacency lists of the graph.
+	 * \return The graph delta. NULL if the graph doesn't have updates.
+	 */
+	const graph_delta *get_delta() const {
+		return delta.get();
+	}
     
     /**
      * \brief Set the graph computation to use a custom vertex scheduler.
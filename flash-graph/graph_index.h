@@ -21,6 +21,7 @@
  */
 
 #include <algorithm>
+#include <type_traits>
 #include <boost/foreach.hpp>
 #include <boost/format.hpp>
 
@@ -38,6 +39,7 @@ namespace fg
 
 class compute_vertex;
 class part_compute_vertex;
+class empty_part_compute_vertex;
 
 /*
  * A pointer to the vertically partitioned vertices in the graph index.
@@ -90,6 +92,11 @@ public:
 	}
 	virtual void init_vparts(int hpart_id, int num_vparts,
 			std::vector<vertex_id_t> &ids) = 0;
+	/*
+	 * Indicate whether the vertex program provides a vertex type for
+	 * vertically partitioned vertices.
+	 */
+	virtual bool has_part_vertices() const = 0;
 
 	virtual size_t get_vertices(const vertex_id_t ids[], int num,
 			compute_vertex *v_buf[]) const = 0;
@@ -380,6 +387,11 @@ public:
 		index_arr[hpart_id]->init_vparts(num_vparts, ids);
 	}
 
+	virtual bool has_part_vertices() const {
+		return !std::is_same<part_vertex_type,
+			   empty_part_compute_vertex>::value;
+	}
+
 	virtual size_t get_vertices(const vertex_id_t ids[], int num,
 			compute_vertex *v_buf[]) const {
 		for (int i = 0; i < num; i++) {
@@ -190,6 +190,56 @@ void pgrank_vertex2::run(vertex_program &prog, const page_vertex &vertex)
 	}
 }
 
+/*
+ * This is a vertical partition of a high-degree vertex in pagerank2.
+ * Each partition pushes the PageRank changes of the vertex to its own
+ * part of the out-edges. It mirrors the PageRank that has been pushed
+ * to its part of the out-edges, so the partitions of a vertex don't need
+ * to synchronize with each other. The messages to the vertex are still
+ * received and accumulated by the main vertex.
+ */
+class part_pgrank_vertex2: public part_compute_vertex
+{
+	float curr_itr_pr;
+public:
+	part_pgrank_vertex2(vertex_id_t id, int part_id): part_compute_vertex(id,
+			part_id) {
+		this->curr_itr_pr = 1 - DAMPING_FACTOR;
+	}
+
+	void run(vertex_program &prog) {
+		if (prog.get_graph().get_curr_level() >= max_num_iters)
+			return;
+		vertex_id_t id = get_id();
+		request_vertices(&id, 1);
+	}
+
+	void run(vertex_program &prog, const page_vertex &vertex);
+};
+
+void part_pgrank_vertex2::run(vertex_program &prog, const page_vertex &vertex)
+{
+	int num_dests = vertex.get_num_edges(OUT_EDGE);
+	std::pair<size_t, size_t> range = get_part_edge_range(num_dests);
+	if (range.first == range.second)
+		return;
+
+	const pgrank_vertex2 &main_v
+		= (const pgrank_vertex2 &) prog.get_graph().get_vertex(get_id());
+	float new_pr = main_v.get_result();
+	edge_seq_iterator it = vertex.get_neigh_seq_it(OUT_EDGE, range.first,
+			range.second);
+	if (prog.get_graph().get_curr_level() == 0) {
+		pr_message msg(curr_itr_pr / num_dests * DAMPING_FACTOR);
+		prog.multicast_msg(it, msg);
+	}
+	else if (std::fabs(new_pr - curr_itr_pr) > TOLERANCE) {
+		pr_message msg((new_pr - curr_itr_pr) / num_dests * DAMPING_FACTOR);
+		prog.multicast_msg(it, msg);
+		curr_itr_pr = new_pr;
+	}
+}
+
 }
 
 #include "save_result.h"
@@ -271,7 +321,8 @@ fm::vector::ptr compute_pagerank2(FG_graph::ptr fg, int num_iters,
 		return fm::vector::ptr();
 	}
 
-	graph_index::ptr index = NUMA_graph_index<pgrank_vertex2>::create(
+	graph_index::ptr index = NUMA_graph_index<pgrank_vertex2,
+		part_pgrank_vertex2>::create(
 			fg->get_graph_header());
 	graph_engine::ptr graph = fg->create_engine(index);
 	max_num_iters = num_iters;
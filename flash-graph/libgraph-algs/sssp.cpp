@@ -0,0 +1,269 @@
+/*
+ * Copyright 2014 Open Connectome Project (http://openconnecto.me)
+ * Written by Da Zheng (zhengda1936@gmail.com)
+ *
+ * This file is part of FlashGraph.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifdef PROFILER
+#include <gperftools/profiler.h>
+#endif
+
+#include <limits>
+#include <vector>
+
+#include "graph_engine.h"
+#include "graph_config.h"
+#include "FGlib.h"
+#include "save_result.h"
+
+using namespace safs;
+using namespace fg;
+
+namespace
+{
+
+edge_type traverse_edge = edge_type::OUT_EDGE;
+// If the graph doesn't have edge data or a user doesn't specify the type
+// of edge weights, every edge has weight 1.
+bool use_edge_weights = true;
+
+template<class WeightType>
+class dist_message: public vertex_message
+{
+	WeightType dist;
+public:
+	dist_message(WeightType dist): vertex_message(sizeof(dist_message),
+			true) {
+		this->dist = dist;
+	}
+
+	WeightType get_dist() const {
+		return dist;
+	}
+};
+
+/*
+ * This is an asynchronous label-correcting implementation of SSSP.
+ * A vertex is only activated when its distance to the source is reduced,
+ * and only the activated vertices read their edge lists and push
+ * the new distance to their neighbors.
+ */
+template<class WeightType>
+class sssp_vertex: public compute_directed_vertex
+{
+	WeightType dist;
+	// Indicates whether the distance has been reduced since the last time
+	// the vertex sent its distance to its neighbors.
+	bool updated;
+
+	void send_dists(vertex_program &prog, edge_seq_iterator &it,
+			page_byte_array::seq_const_iterator<WeightType> &data_it) const {
+		while (it.has_next()) {
+			vertex_id_t neigh = it.next();
+			WeightType w = data_it.next();
+			assert(w >= 0);
+			dist_message<WeightType> msg(dist + w);
+			prog.send_msg(neigh, msg);
+		}
+	}
+
+	void send_dists(vertex_program &prog, edge_seq_iterator &it) const {
+		dist_message<WeightType> msg(dist + 1);
+		prog.multicast_msg(it, msg);
+	}
+
+	void send_dists(vertex_program &prog, const page_directed_vertex &vertex,
+			edge_type type) const {
+		edge_seq_iterator it = vertex.get_neigh_seq_it(type);
+		if (use_edge_weights) {
+			page_byte_array::seq_const_iterator<WeightType> data_it
+				= vertex.get_data_seq_it<WeightType>(type);
+			send_dists(prog, it, data_it);
+		}
+		else
+			send_dists(prog, it);
+	}
+public:
+	sssp_vertex(vertex_id_t id): compute_directed_vertex(id) {
+		dist = std::numeric_limits<WeightType>::max();
+		updated = false;
+	}
+
+	void init_source() {
+		dist = 0;
+		updated = true;
+	}
+
+	WeightType get_result() const {
+		return dist;
+	}
+
+	void run(vertex_program &prog) {
+		if (!updated)
+			return;
+		updated = false;
+		vertex_id_t id = prog.get_vertex_id(*this);
+		if (prog.get_graph().is_directed() && traverse_edge != BOTH_EDGES) {
+			directed_vertex_request req(id, traverse_edge);
+			request_partial_vertices(&req, 1);
+		}
+		else
+			request_vertices(&id, 1);
+	}
+
+	void run(vertex_program &prog, const page_vertex &vertex);
+
+	void run_on_message(vertex_program &, const vertex_message &msg1) {
+		const dist_message<WeightType> &msg
+			= (const dist_message<WeightType> &) msg1;
+		if (msg.get_dist() < dist) {
+			dist = msg.get_dist();
+			updated = true;
+		}
+	}
+};
+
+template<class WeightType>
+void sssp_vertex<WeightType>::run(vertex_program &prog,
+		const page_vertex &vertex)
+{
+	if (vertex.is_directed()) {
+		const page_directed_vertex &dvertex
+			= (const page_directed_vertex &) vertex;
+		if (traverse_edge == BOTH_EDGES) {
+			send_dists(prog, dvertex, IN_EDGE);
+			send_dists(prog, dvertex, OUT_EDGE);
+		}
+		else
+			send_dists(prog, dvertex, traverse_edge);
+	}
+	else {
+		const page_undirected_vertex &uvertex
+			= (const page_undirected_vertex &) vertex;
+		edge_seq_iterator it = uvertex.get_neigh_seq_it(BOTH_EDGES);
+		if (use_edge_weights) {
+			page_byte_array::seq_const_iterator<WeightType> data_it
+				= uvertex.get_data_seq_it<WeightType>();
+			send_dists(prog, it, data_it);
+		}
+		else
+			send_dists(prog, it);
+	}
+}
+
+template<class WeightType>
+class source_initializer: public vertex_initializer
+{
+public:
+	virtual void init(compute_vertex &v) {
+		sssp_vertex<WeightType> &sv = (sssp_vertex<WeightType> &) v;
+		sv.init_source();
+	}
+};
+
+template<class WeightType>
+fm::vector::ptr run_sssp(FG_graph::ptr fg,
+		const std::vector<vertex_id_t> &sources)
+{
+	graph_index::ptr index = NUMA_graph_index<sssp_vertex<WeightType> >::create(
+			fg->get_graph_header());
+	graph_engine::ptr graph = fg->create_engine(index);
+
+	BOOST_LOG_TRIVIAL(info) << "Starting SSSP from " << sources.size()
+		<< " sources";
+#ifdef PROFILER
+	if (!graph_conf.get_prof_file().empty())
+		ProfilerStart(graph_conf.get_prof_file().c_str());
+#endif
+
+	struct timeval start, end;
+	gettimeofday(&start, NULL);
+	graph->start(sources.data(), sources.size(), vertex_initializer::ptr(
+				new source_initializer<WeightType>()));
+	graph->wait4complete();
+	gettimeofday(&end, NULL);
+
+#ifdef PROFILER
+	if (!graph_conf.get_prof_file().empty())
+		ProfilerStop();
+#endif
+	BOOST_LOG_TRIVIAL(info) << boost::format("SSSP takes %1% seconds")
+		% time_diff(start, end);
+
+	fm::detail::mem_vec_store::ptr res_store = fm::detail::mem_vec_store::create(
+			fg->get_num_vertices(), safs::params.get_num_nodes(),
+			fm::get_scalar_type<WeightType>());
+	graph->query_on_all(vertex_query::ptr(
+				new save_query<WeightType, sssp_vertex<WeightType> >(res_store)));
+	return fm::vector::create(res_store);
+}
+
+}
+
+namespace fg
+{
+
+fm::vector::ptr compute_sssp(FG_graph::ptr fg,
+		const std::vector<vertex_id_t> &sources,
+		const fm::scalar_type *weight_type, edge_type traverse_e)
+{
+	if (sources.empty()) {
+		BOOST_LOG_TRIVIAL(error) << "SSSP requires at least one source vertex";
+		return fm::vector::ptr();
+	}
+	for (size_t i = 0; i < sources.size(); i++) {
+		if (sources[i] >= fg->get_num_vertices()) {
+			BOOST_LOG_TRIVIAL(error) << boost::format(
+					"source vertex %1% doesn't exist") % sources[i];
+			return fm::vector::ptr();
+		}
+	}
+
+	const graph_header &header = fg->get_graph_header();
+	use_edge_weights = weight_type != NULL;
+	if (use_edge_weights && (!header.has_edge_data()
+				|| (size_t) header.get_edge_data_size()
+				!= weight_type->get_size())) {
+		BOOST_LOG_TRIVIAL(error)
+			<< "The edge data in the graph doesn't match the weight type";
+		return fm::vector::ptr();
+	}
+	traverse_edge = traverse_e;
+
+	if (weight_type == NULL || *weight_type == fm::get_scalar_type<int>())
+		return run_sssp<int>(fg, sources);
+	else if (*weight_type == fm::get_scalar_type<long>())
+		return run_sssp<long>(fg, sources);
+	else if (*weight_type == fm::get_scalar_type<size_t>())
+		return run_sssp<size_t>(fg, sources);
+	else if (*weight_type == fm::get_scalar_type<float>())
+		return run_sssp<float>(fg, sources);
+	else if (*weight_type == fm::get_scalar_type<double>())
+		return run_sssp<double>(fg, sources);
+	else {
+		BOOST_LOG_TRIVIAL(error) << "SSSP doesn't support the weight type";
+		return fm::vector::ptr();
+	}
+}
+
+fm::vector::ptr compute_sssp(FG_graph::ptr fg, vertex_id_t source,
+		const fm::scalar_type *weight_type, edge_type traverse_e)
+{
+	std::vector<vertex_id_t> sources(1, source);
+	return compute_sssp(fg, sources, weight_type, traverse_e);
+}
+
+}
@@ -712,6 +712,83 @@ void run_bfs(FG_graph::ptr graph, int argc, char* argv[])
 			start_vertex, num_vertices, edge);
 }
 
+void run_sssp(FG_graph::ptr graph, int argc, char* argv[])
+{
+	int opt;
+	int num_opts = 0;
+	edge_type edge = edge_type::OUT_EDGE;
+	std::vector<vertex_id_t> sources;
+	std::string edge_type_str;
+	std::string weight_type_str;
+	std::string write_out;
+
+	while ((opt = getopt(argc, argv, "e:s:W:w:")) != -1) {
+		num_opts++;
+		switch (opt) {
+			case 'e':
+				edge_type_str = optarg;
+				num_opts++;
+				break;
+			case 's':
+				sources.push_back(atol(optarg));
+				num_opts++;
+				break;
+			case 'W':
+				weight_type_str = optarg;
+				num_opts++;
+				break;
+			case 'w':
+				write_out = optarg;
+				num_opts++;
+				break;
+			default:
+				print_usage();
+				abort();
+		}
+	}
+	if (!edge_type_str.empty()) {
+		if (edge_type_str == "IN")
+			edge = edge_type::IN_EDGE;
+		else if (edge_type_str == "OUT")
+			edge = edge_type::OUT_EDGE;
+		else if (edge_type_str == "BOTH")
+			edge = edge_type::BOTH_EDGES;
+		else {
+			fprintf(stderr, "wrong edge type");
+			exit(1);
+		}
+	}
+	if (sources.empty())
+		sources.push_back(0);
+
+	const fm::scalar_type *weight_type = NULL;
+	if (weight_type_str == "I")
+		weight_type = &fm::get_scalar_type<int>();
+	else if (weight_type_str == "L")
+		weight_type = &fm::get_scalar_type<long>();
+	else if (weight_type_str == "F")
+		weight_type = &fm::get_scalar_type<float>();
+	else if (weight_type_str == "D")
+		weight_type = &fm::get_scalar_type<double>();
+	else if (!weight_type_str.empty()) {
+		fprintf(stderr, "unknown weight type\n");
+		return;
+	}
+
+	fm::vector::ptr dists = compute_sssp(graph, sources, weight_type, edge);
+	if (dists == NULL)
+		return;
+	if (!write_out.empty()) {
+		FILE *f = fopen(write_out.c_str(), "w");
+		if (f == NULL) {
+			perror("fopen");
+			return;
+		}
+		dists->export2(f);
+		fclose(f);
+	}
+}
+
 #if 0
 void run_louvain(FG_graph::ptr graph, int argc, char* argv[])
 {
@@ -834,6 +911,7 @@ std::string supported_algs[] = {
 	"betweenness",
 	"overlap",
 	"bfs",
+	"sssp",
 	"louvain",
     "sem_kmeans"
 };
@@ -843,6 +921,8 @@ void print_usage()
 {
 	fprintf(stderr,
 			"test_algs conf_file graph_file index_file algorithm [alg-options]\n");
+	fprintf(stderr,
+			"set delta_file in conf_file to run on the graph with the updates in the file\n");
 	fprintf(stderr, "scan-statistics:\n");
 	fprintf(stderr, "-K topK: topK vertices in topK scan\n");
 	fprintf(stderr, "\n");
@@ -893,6 +973,12 @@ void print_usage()
 	fprintf(stderr, "-e edge type: the type of edge to traverse (IN, OUT, BOTH)\n");
 	fprintf(stderr, "-s vertex id: the vertex where the BFS starts\n");
 	fprintf(stderr, "\n");
+	fprintf(stderr, "sssp\n");
+	fprintf(stderr, "-e edge type: the type of edge to traverse (IN, OUT, BOTH)\n");
+	fprintf(stderr, "-s vertex id: a source vertex (can be specified multiple times)\n");
+	fprintf(stderr, "-W type: the type of edge weights (I, L, F, D). Default: unweighted\n");
+	fprintf(stderr, "-w output: the file name for a vector written to file\n");
+	fprintf(stderr, "\n");
 	fprintf(stderr, "louvain\n");
 	fprintf(stderr, "-l: how many levels in the hierarchy to compute\n");
 	fprintf(stderr, "\n");
@@ -942,6 +1028,17 @@ int main(int argc, char *argv[])
 		exit(-1);
 	}
 
+	std::string delta_file;
+	if (configs && configs->read_option("delta_file", delta_file)) {
+		graph_delta::ptr delta = graph_delta::create(graph->get_graph_header());
+		if (delta == NULL || !delta->load(delta_file)) {
+			fprintf(stderr, "can't load the graph updates from %s\n",
+					delta_file.c_str());
+			exit(-1);
+		}
+		graph->set_delta(delta);
+	}
+
 	if (alg == "cycle_triangle") {
 		run_cycle_triangle(graph, argc, argv);
 	}
@@ -990,6 +1087,9 @@ int main(int argc, char *argv[])
 	else if (alg == "bfs") {
 		run_bfs(graph, argc, argv);
 	}
+	else if (alg == "sssp") {
+		run_sssp(graph, argc, argv);
+	}
 #if 0
 	else if (alg == "louvain") {
 		run_louvain(graph, argc, argv);
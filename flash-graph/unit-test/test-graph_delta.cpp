@@ -0,0 +1,435 @@
+#include <stdio.h>
+#include <unistd.h>
+
+#include <set>
+#include <vector>
+#include <algorithm>
+
+#include "cache.h"
+
+#include "graph_delta.h"
+#include "vertex_index.h"
+#include "in_mem_storage.h"
+#include "utils.h"
+#include "fg_utils.h"
+
+using namespace fg;
+
+typedef std::pair<vertex_id_t, vertex_id_t> edge_t;
+typedef std::set<edge_t> edge_set;
+typedef std::vector<std::vector<vertex_id_t> > adj_lists;
+
+/*
+ * This wraps a vertex in memory, so we can construct a page vertex on it.
+ */
+class test_byte_array: public safs::page_byte_array
+{
+	const std::vector<char> &buf;
+public:
+	test_byte_array(const std::vector<char> &_buf): buf(_buf) {
+	}
+
+	virtual void lock() {
+	}
+
+	virtual void unlock() {
+	}
+
+	virtual size_t get_size() const {
+		return buf.size();
+	}
+
+	virtual page_byte_array *clone() {
+		return NULL;
+	}
+
+	virtual off_t get_offset() const {
+		return 0;
+	}
+
+	virtual off_t get_offset_in_first_page() const {
+		return 0;
+	}
+
+	virtual const char *get_page(int idx) const {
+		return buf.data() + ((size_t) idx) * safs::PAGE_SIZE;
+	}
+};
+
+/*
+ * For a directed graph, the in-neighbors of a vertex are the sources of
+ * the edges to the vertex. An undirected graph stores an edge in both
+ * directions, so we only need the out-neighbors.
+ */
+void get_adj_lists(const edge_set &edges, size_t num_vertices, edge_type type,
+		adj_lists &lists)
+{
+	lists.clear();
+	lists.resize(num_vertices);
+	for (auto it = edges.begin(); it != edges.end(); it++) {
+		if (type == OUT_EDGE && it->first < num_vertices)
+			lists[it->first].push_back(it->second);
+		else if (type == IN_EDGE && it->second < num_vertices)
+			lists[it->second].push_back(it->first);
+	}
+	for (size_t i = 0; i < lists.size(); i++)
+		std::sort(lists[i].begin(), lists[i].end());
+}
+
+void add_edge(edge_set &edges, vertex_id_t src, vertex_id_t dst, bool directed)
+{
+	edges.insert(edge_t(src, dst));
+	if (!directed)
+		edges.insert(edge_t(dst, src));
+}
+
+void remove_edge(edge_set &edges, vertex_id_t src, vertex_id_t dst,
+		bool directed)
+{
+	edges.erase(edge_t(src, dst));
+	if (!directed)
+		edges.erase(edge_t(dst, src));
+}
+
+edge_set create_rand_edges(size_t num_vertices, size_t num_edges, bool directed)
+{
+	edge_set edges;
+	for (size_t i = 0; i < num_edges; i++) {
+		vertex_id_t src = random() % num_vertices;
+		vertex_id_t dst = random() % num_vertices;
+		// We don't have self loops, so an undirected edge is stored twice.
+		if (src != dst)
+			add_edge(edges, src, dst, directed);
+	}
+	return edges;
+}
+
+/*
+ * Apply random updates to the delta and the edges. A deletion deletes
+ * an existing edge most of the time. Inserted edges may have vertices
+ * in [0, max_id).
+ */
+void rand_update(graph_delta &delta, edge_set &edges, size_t num_updates,
+		size_t max_id)
+{
+	for (size_t i = 0; i < num_updates; i++) {
+		vertex_id_t src = random() % max_id;
+		vertex_id_t dst = random() % max_id;
+		if (random() % 2 == 0 && !edges.empty()) {
+			if (random() % 4 != 0) {
+				auto it = edges.lower_bound(edge_t(src, dst));
+				if (it == edges.end())
+					it = edges.begin();
+				src = it->first;
+				dst = it->second;
+			}
+			delta.remove_edge(src, dst);
+			remove_edge(edges, src, dst, delta.is_directed());
+		}
+		else if (src != dst) {
+			delta.add_edge(src, dst);
+			add_edge(edges, src, dst, delta.is_directed());
+		}
+	}
+}
+
+void build_image(const edge_set &edges, size_t num_vertices, bool directed,
+		const std::string &graph_file, const std::string &index_file)
+{
+	adj_lists in_lists;
+	adj_lists out_lists;
+	get_adj_lists(edges, num_vertices, IN_EDGE, in_lists);
+	get_adj_lists(edges, num_vertices, OUT_EDGE, out_lists);
+	utils::mem_serial_graph::ptr g = utils::mem_serial_graph::create(directed, 0);
+	for (size_t id = 0; id < num_vertices; id++) {
+		if (directed) {
+			in_mem_directed_vertex<> v(id, false);
+			for (size_t i = 0; i < in_lists[id].size(); i++)
+				v.add_in_edge(edge<>(in_lists[id][i], id));
+			for (size_t i = 0; i < out_lists[id].size(); i++)
+				v.add_out_edge(edge<>(id, out_lists[id][i]));
+			g->add_vertex(v);
+		}
+		else {
+			in_mem_undirected_vertex<> v(id, false);
+			for (size_t i = 0; i < out_lists[id].size(); i++)
+				v.add_edge(edge<>(id, out_lists[id][i]));
+			g->add_vertex(v);
+		}
+	}
+	g->dump_index(true)->dump(index_file);
+	g->dump_graph(graph_file)->dump(graph_file);
+}
+
+void read_lists(const std::vector<char> &buf, const std::vector<off_t> &offs,
+		adj_lists &lists)
+{
+	lists.resize(offs.size() - 1);
+	for (size_t id = 0; id < lists.size(); id++) {
+		const ext_mem_undirected_vertex *v
+			= (const ext_mem_undirected_vertex *) (buf.data() + offs[id]);
+		assert(v->get_id() == id);
+		assert((size_t) (offs[id + 1] - offs[id]) == v->get_size());
+		lists[id].resize(v->get_num_edges());
+		for (size_t i = 0; i < v->get_num_edges(); i++)
+			lists[id][i] = v->get_neighbor(i);
+	}
+}
+
+/*
+ * Read all adjacency lists in a graph image with its index.
+ */
+graph_header read_image(const std::string &graph_file,
+		const std::string &index_file, adj_lists &in_lists,
+		adj_lists &out_lists)
+{
+	vertex_index::ptr vindex = vertex_index::load(index_file);
+	FILE *f = fopen(graph_file.c_str(), "r");
+	assert(f);
+	fseek(f, 0, SEEK_END);
+	std::vector<char> buf(ftell(f));
+	fseek(f, 0, SEEK_SET);
+	BOOST_VERIFY(fread(buf.data(), buf.size(), 1, f) == 1);
+	fclose(f);
+
+	std::vector<off_t> offs(vindex->get_num_vertices() + 1);
+	if (vindex->get_graph_header().is_directed_graph()) {
+		init_in_offs(vindex, offs);
+		read_lists(buf, offs, in_lists);
+	}
+	init_out_offs(vindex, offs);
+	read_lists(buf, offs, out_lists);
+	return vindex->get_graph_header();
+}
+
+void write_vertex(vertex_id_t id, const std::vector<vertex_id_t> &neighs,
+		std::vector<char> &buf)
+{
+	buf.resize(ext_mem_undirected_vertex::num_edges2vsize(neighs.size(), 0));
+	ext_mem_undirected_vertex *v = new (buf.data()) ext_mem_undirected_vertex(
+			id, neighs.size(), 0);
+	for (size_t i = 0; i < neighs.size(); i++)
+		v->set_neighbor(i, neighs[i]);
+}
+
+void check_edges(const page_vertex &v, edge_type type,
+		const std::vector<vertex_id_t> &expected)
+{
+	assert(v.get_num_edges(type) == expected.size());
+	std::vector<vertex_id_t> neighs(expected.size());
+	v.read_edges(type, neighs.data(), neighs.size());
+	assert(neighs == expected);
+}
+
+/*
+ * Merge the updates in the delta with the vertices in the base graph and
+ * compare them with the adjacency lists of the updated graph. The vertices
+ * that don't exist in the base graph are ignored.
+ */
+void check_page_vertices(const edge_set &base, const edge_set &expected,
+		const graph_delta &delta)
+{
+	size_t num_vertices = delta.get_num_base_vertices();
+	adj_lists base_in, base_out, exp_in, exp_out;
+	get_adj_lists(base, num_vertices, IN_EDGE, base_in);
+	get_adj_lists(base, num_vertices, OUT_EDGE, base_out);
+	get_adj_lists(expected, num_vertices, IN_EDGE, exp_in);
+	get_adj_lists(expected, num_vertices, OUT_EDGE, exp_out);
+	for (size_t id = 0; id < num_vertices; id++) {
+		std::vector<vertex_id_t> &in = exp_in[id];
+		std::vector<vertex_id_t> &out = exp_out[id];
+		in.erase(std::lower_bound(in.begin(), in.end(), num_vertices), in.end());
+		out.erase(std::lower_bound(out.begin(), out.end(), num_vertices),
+				out.end());
+		if (!delta.has_updates(id)) {
+			assert(out == base_out[id]);
+			assert(!delta.is_directed() || in == base_in[id]);
+			continue;
+		}
+
+		std::vector<char> in_buf, out_buf;
+		write_vertex(id, base_in[id], in_buf);
+		write_vertex(id, base_out[id], out_buf);
+		test_byte_array in_arr(in_buf);
+		test_byte_array out_arr(out_buf);
+		if (delta.is_directed()) {
+			page_directed_vertex v(in_arr, out_arr);
+			delta_page_vertex dv(v, delta);
+			check_edges(dv.get(), IN_EDGE, in);
+			check_edges(dv.get(), OUT_EDGE, out);
+		}
+		else {
+			page_undirected_vertex v(out_arr);
+			delta_page_vertex dv(v, delta);
+			check_edges(dv.get(), OUT_EDGE, out);
+		}
+	}
+}
+
+void test_insert(bool directed)
+{
+	printf("test inserting edges to a %s graph\n",
+			directed ? "directed" : "undirected");
+	size_t num_vertices = 1000;
+	edge_set base = create_rand_edges(num_vertices, 5000, directed);
+	graph_header header(directed ? graph_type::DIRECTED : graph_type::UNDIRECTED,
+			num_vertices, base.size(), 0);
+	graph_delta::ptr delta = graph_delta::create(header);
+	edge_set edges = base;
+	for (size_t i = 0; i < 2000; i++) {
+		vertex_id_t src = random() % num_vertices;
+		vertex_id_t dst = random() % num_vertices;
+		// Insert existing edges once in a while.
+		if (i % 10 == 0 && !base.empty()) {
+			auto it = base.lower_bound(edge_t(src, dst));
+			if (it == base.end())
+				it = base.begin();
+			src = it->first;
+			dst = it->second;
+		}
+		if (src == dst)
+			continue;
+		delta->add_edge(src, dst);
+		add_edge(edges, src, dst, directed);
+	}
+	// The edges to the vertices that don't exist in the base graph.
+	delta->add_edge(0, num_vertices + 10);
+	delta->add_edge(num_vertices + 10, 1);
+	delta->finalize();
+	check_page_vertices(base, edges, *delta);
+}
+
+void test_delete(bool directed)
+{
+	printf("test deleting edges from a %s graph\n",
+			directed ? "directed" : "undirected");
+	size_t num_vertices = 1000;
+	edge_set base = create_rand_edges(num_vertices, 5000, directed);
+	graph_header header(directed ? graph_type::DIRECTED : graph_type::UNDIRECTED,
+			num_vertices, base.size(), 0);
+	graph_delta::ptr delta = graph_delta::create(header);
+	edge_set edges = base;
+	for (auto it = base.begin(); it != base.end(); it++) {
+		if (random() % 3 == 0) {
+			delta->remove_edge(it->first, it->second);
+			remove_edge(edges, it->first, it->second, directed);
+		}
+	}
+	// Deleting edges that don't exist doesn't change the graph.
+	for (size_t i = 0; i < 100; i++) {
+		vertex_id_t src = random() % num_vertices;
+		vertex_id_t dst = random() % num_vertices;
+		delta->remove_edge(src, dst);
+		remove_edge(edges, src, dst, directed);
+	}
+	delta->finalize();
+	check_page_vertices(base, edges, *delta);
+}
+
+void test_last_op_wins(bool directed)
+{
+	printf("test the order of updates on a %s graph\n",
+			directed ? "directed" : "undirected");
+	edge_set base;
+	add_edge(base, 0, 1, directed);
+	add_edge(base, 1, 2, directed);
+	add_edge(base, 2, 3, directed);
+	graph_header header(directed ? graph_type::DIRECTED : graph_type::UNDIRECTED,
+			10, base.size(), 0);
+	graph_delta::ptr delta = graph_delta::create(header);
+	edge_set edges = base;
+	// Delete an edge and insert it back.
+	delta->remove_edge(0, 1);
+	delta->add_edge(0, 1);
+	// Insert an edge and delete it.
+	delta->add_edge(0, 5);
+	delta->remove_edge(0, 5);
+	remove_edge(edges, 0, 5, directed);
+	// The last update of a sequence on an edge.
+	delta->remove_edge(2, 3);
+	delta->add_edge(2, 3);
+	delta->remove_edge(2, 3);
+	remove_edge(edges, 2, 3, directed);
+	delta->add_edge(4, 6);
+	delta->remove_edge(4, 6);
+	delta->add_edge(4, 6);
+	add_edge(edges, 4, 6, directed);
+	delta->finalize();
+
+	// There is one update per edge after merging.
+	auto updates = delta->get_updates(0, OUT_EDGE);
+	assert(updates.second - updates.first == 2);
+	assert(updates.first[0].neigh == 1 && updates.first[0].insert);
+	assert(updates.first[1].neigh == 5 && !updates.first[1].insert);
+	updates = delta->get_updates(2, OUT_EDGE);
+	assert(updates.second - updates.first == 1);
+	assert(updates.first[0].neigh == 3 && !updates.first[0].insert);
+	updates = delta->get_updates(6, IN_EDGE);
+	assert(updates.second - updates.first == 1);
+	assert(updates.first[0].neigh == 4 && updates.first[0].insert);
+	assert(!delta->has_updates(7));
+	check_page_vertices(base, edges, *delta);
+
+	// Updates after finalization override the earlier ones.
+	delta->add_edge(0, 5);
+	add_edge(edges, 0, 5, directed);
+	delta->finalize();
+	check_page_vertices(base, edges, *delta);
+}
+
+void test_compact(bool directed)
+{
+	printf("test compacting a %s graph\n", directed ? "directed" : "undirected");
+	size_t num_vertices = 1000;
+	edge_set base = create_rand_edges(num_vertices, 5000, directed);
+	build_image(base, num_vertices, directed, "test-delta-base.adj",
+			"test-delta-base.index");
+
+	adj_lists in_lists, out_lists;
+	graph_header header = read_image("test-delta-base.adj",
+			"test-delta-base.index", in_lists, out_lists);
+	graph_delta::ptr delta = graph_delta::create(header);
+	edge_set edges = base;
+	// The updates add new vertices to the graph.
+	rand_update(*delta, edges, 3000, num_vertices + 100);
+	BOOST_VERIFY(delta->compact("test-delta-base.adj", "test-delta-base.index",
+				"test-delta-new.adj", "test-delta-new.index"));
+	graph_header new_header = read_image("test-delta-new.adj",
+			"test-delta-new.index", in_lists, out_lists);
+
+	// The new image has the vertices of all inserted edges, even if
+	// the edges are deleted later.
+	size_t new_num_vertices = new_header.get_num_vertices();
+	assert(new_num_vertices >= num_vertices);
+	for (auto it = edges.begin(); it != edges.end(); it++)
+		assert(std::max(it->first, it->second) < new_num_vertices);
+	build_image(edges, new_num_vertices, directed, "test-delta-fresh.adj",
+			"test-delta-fresh.index");
+	adj_lists fresh_in_lists, fresh_out_lists;
+	graph_header fresh_header = read_image("test-delta-fresh.adj",
+			"test-delta-fresh.index", fresh_in_lists, fresh_out_lists);
+	assert(new_header.get_graph_type() == fresh_header.get_graph_type());
+	assert(new_header.get_num_vertices() == fresh_header.get_num_vertices());
+	assert(new_header.get_num_edges() == fresh_header.get_num_edges());
+	assert(out_lists == fresh_out_lists);
+	assert(in_lists == fresh_in_lists);
+
+	unlink("test-delta-base.adj");
+	unlink("test-delta-base.index");
+	unlink("test-delta-new.adj");
+	unlink("test-delta-new.index");
+	unlink("test-delta-fresh.adj");
+	unlink("test-delta-fresh.index");
+}
+
+int main()
+{
+	test_insert(true);
+	test_insert(false);
+	test_delete(true);
+	test_delete(false);
+	test_last_op_wins(true);
+	test_last_op_wins(false);
+	test_compact(true);
+	test_compact(false);
+}
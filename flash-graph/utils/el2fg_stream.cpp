@@ -0,0 +1,715 @@
+/*
+ * Copyright 2014 Open Connectome Project (http://openconnecto.me)
+ * Written by Da Zheng (zhengda1936@gmail.com)
+ *
+ * This file is part of FlashGraph.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * This tool converts a very large edge list to the FlashGraph format
+ * in a streaming fashion. Unlike el2fg, it doesn't go through data frames
+ * and doesn't sort the entire edge list. Instead, it works in two passes:
+ *
+ * In the first pass, all threads parse chunks of the input files in parallel
+ * and partition edges by the high bits of the source vertex (and of
+ * the destination vertex for in-edges in a directed graph). Each partition
+ * is kept in a temporary file on disks.
+ *
+ * In the second pass, we load a group of partitions to memory at a time,
+ * construct the adjacency lists of the vertices in each partition with
+ * counting sort in parallel and append them to the adjacency list file
+ * in the order of vertex ID.
+ *
+ * The memory budget bounds the buffers used in both passes. The only data
+ * structure that grows with the size of the graph is the number of edges
+ * of each vertex, which is required to construct the vertex index.
+ */
+
+#include <omp.h>
+#include <unistd.h>
+#include <string.h>
+#include <stdint.h>
+#include <assert.h>
+
+#include <vector>
+#include <string>
+#include <algorithm>
+#include <atomic>
+#include <mutex>
+
+#include "common.h"
+#include "native_file.h"
+
+#include "FG_basic_types.h"
+#include "vertex.h"
+#include "graph_file_header.h"
+#include "vertex_index.h"
+
+namespace
+{
+
+struct edge_t
+{
+	// The vertex whose adjacency list contains the edge.
+	fg::vertex_id_t key;
+	fg::vertex_id_t neigh;
+
+	bool operator<(const edge_t &e) const {
+		if (key != e.key)
+			return key < e.key;
+		else
+			return neigh < e.neigh;
+	}
+};
+
+// The size of the chunk of an input file that a thread parses each time.
+const size_t CHUNK_SIZE = 64UL * 1024 * 1024;
+
+/*
+ * Parse unsigned integers in text. We convert 8 digits at a time with
+ * SWAR (SIMD within a register), which avoids most of the per-character
+ * branches in strtol. The buffer needs to have 8 bytes of padding at the end.
+ */
+
+static inline bool is_8digits(uint64_t v)
+{
+	return (((v & 0xF0F0F0F0F0F0F0F0UL)
+				| (((v + 0x0606060606060606UL) & 0xF0F0F0F0F0F0F0F0UL) >> 4))
+		== 0x3333333333333333UL);
+}
+
+static inline uint32_t parse_8digits(uint64_t v)
+{
+	const uint64_t mask = 0x000000FF000000FFUL;
+	const uint64_t mul1 = 0x000F424000000064UL;	// 100 + (1000000 << 32)
+	const uint64_t mul2 = 0x0000271000000001UL;	// 1 + (10000 << 32)
+	v -= 0x3030303030303030UL;
+	v = (v * 10) + (v >> 8);
+	v = (((v & mask) * mul1) + (((v >> 16) & mask) * mul2)) >> 32;
+	return v;
+}
+
+static inline bool is_digit(char c)
+{
+	return c >= '0' && c <= '9';
+}
+
+/*
+ * Parse an unsigned integer that starts at `p'.
+ * It returns the location after the last digit.
+ */
+static inline const char *parse_uint(const char *p, uint64_t &val)
+{
+	uint64_t v = 0;
+	uint64_t word;
+	memcpy(&word, p, sizeof(word));
+	if (is_8digits(word)) {
+		v = parse_8digits(word);
+		p += 8;
+	}
+	while (is_digit(*p)) {
+		v = v * 10 + (*p - '0');
+		p++;
+	}
+	val = v;
+	return p;
+}
+
+static inline const char *skip_line(const char *p, const char *end)
+{
+	const char *nl = (const char *) memchr(p, '\n', end - p);
+	return nl == NULL ? end : nl + 1;
+}
+
+/*
+ * The temporary file that stores the edges of a partition.
+ */
+class part_file
+{
+	FILE *f;
+	std::string name;
+	size_t num_edges;
+	std::mutex lock;
+public:
+	part_file(const std::string &name) {
+		this->name = name;
+		this->num_edges = 0;
+		f = fopen(name.c_str(), "w+");
+		if (f == NULL) {
+			fprintf(stderr, "can't create %s: %s\n", name.c_str(),
+					strerror(errno));
+			exit(1);
+		}
+	}
+
+	~part_file() {
+		fclose(f);
+		unlink(name.c_str());
+	}
+
+	void append(const std::vector<edge_t> &edges) {
+		std::lock_guard<std::mutex> guard(lock);
+		BOOST_VERIFY(fwrite(edges.data(), sizeof(edges[0]) * edges.size(),
+					1, f) == 1);
+		num_edges += edges.size();
+	}
+
+	size_t get_num_edges() const {
+		return num_edges;
+	}
+
+	void read_all(std::vector<edge_t> &edges) {
+		edges.resize(num_edges);
+		fflush(f);
+		if (num_edges > 0) {
+			BOOST_VERIFY(fseek(f, 0, SEEK_SET) == 0);
+			BOOST_VERIFY(fread(edges.data(), sizeof(edges[0]) * num_edges,
+						1, f) == 1);
+		}
+	}
+};
+
+/*
+ * All partitions of edges in one direction. The number of partitions grows
+ * as we see larger vertex IDs.
+ */
+class part_set
+{
+	std::string prefix;
+	std::vector<part_file *> parts;
+	std::mutex lock;
+public:
+	part_set(const std::string &prefix) {
+		this->prefix = prefix;
+	}
+
+	~part_set() {
+		for (size_t i = 0; i < parts.size(); i++)
+			delete parts[i];
+	}
+
+	part_file *get_part(size_t idx) {
+		std::lock_guard<std::mutex> guard(lock);
+		while (parts.size() <= idx) {
+			std::string name = prefix + "." + itoa(parts.size());
+			parts.push_back(new part_file(name));
+		}
+		return parts[idx];
+	}
+
+	// This should only be called after all edges are partitioned.
+	size_t get_num_parts() const {
+		return parts.size();
+	}
+
+	part_file *get_part_nolock(size_t idx) const {
+		return idx < parts.size() ? parts[idx] : NULL;
+	}
+};
+
+/*
+ * Each thread buffers edges for each partition and flushes them to
+ * the partition files when the buffers reach the memory limit of the thread.
+ */
+class part_buffer
+{
+	part_set &set;
+	int part_bits;
+	size_t max_buf_edges;
+	size_t num_buf_edges;
+	std::vector<std::vector<edge_t> > bufs;
+	std::vector<part_file *> files;
+public:
+	part_buffer(part_set &_set, int part_bits, size_t max_buf_edges): set(_set) {
+		this->part_bits = part_bits;
+		this->max_buf_edges = max_buf_edges;
+		this->num_buf_edges = 0;
+	}
+
+	~part_buffer() {
+		flush();
+	}
+
+	void add(fg::vertex_id_t key, fg::vertex_id_t neigh) {
+		size_t idx = key >> part_bits;
+		if (idx >= bufs.size()) {
+			bufs.resize(idx + 1);
+			files.resize(idx + 1);
+		}
+		edge_t e;
+		e.key = key;
+		e.neigh = neigh;
+		bufs[idx].push_back(e);
+		num_buf_edges++;
+		if (num_buf_edges >= max_buf_edges)
+			flush();
+	}
+
+	void flush() {
+		for (size_t i = 0; i < bufs.size(); i++) {
+			if (bufs[i].empty())
+				continue;
+			if (files[i] == NULL)
+				files[i] = set.get_part(i);
+			files[i]->append(bufs[i]);
+			bufs[i].clear();
+		}
+		num_buf_edges = 0;
+	}
+};
+
+struct conv_options
+{
+	bool directed;
+	bool uniq_edge;
+	bool binary;
+	int part_bits;
+	size_t mem_budget;
+};
+
+struct input_chunk
+{
+	std::string file;
+	off_t off;
+	size_t size;
+};
+
+/*
+ * Read the chunk of a text file. Except the first chunk of a file, we skip
+ * the partial line at the beginning, which belongs to the previous chunk,
+ * and we read past the end of the chunk to complete the last line.
+ */
+static void read_text_chunk(FILE *f, const input_chunk &chunk,
+		std::vector<char> &buf, const char *&start, const char *&end)
+{
+	const size_t extra = 4096;
+	buf.resize(chunk.size + extra + 8);
+	BOOST_VERIFY(fseek(f, chunk.off, SEEK_SET) == 0);
+	size_t size = fread(buf.data(), 1, chunk.size, f);
+	// Complete the last line.
+	while (size > 0 && buf[size - 1] != '\n') {
+		if (buf.size() < size + extra + 8)
+			buf.resize(size + extra + 8);
+		size_t ret = fread(buf.data() + size, 1, extra, f);
+		if (ret == 0)
+			break;
+		const char *nl = (const char *) memchr(buf.data() + size, '\n', ret);
+		if (nl) {
+			size = nl - buf.data() + 1;
+			break;
+		}
+		size += ret;
+	}
+	memset(buf.data() + size, 0, 8);
+	start = buf.data();
+	end = buf.data() + size;
+	if (chunk.off > 0) {
+		// The previous chunk owns the line that crosses the chunk boundary.
+		// We peek at the previous byte to tell if the chunk starts at a new line.
+		char prev = 0;
+		BOOST_VERIFY(fseek(f, chunk.off - 1, SEEK_SET) == 0);
+		BOOST_VERIFY(fread(&prev, 1, 1, f) == 1);
+		if (prev != '\n')
+			start = skip_line(start, end);
+	}
+}
+
+/*
+ * Parse a text chunk. Each line has a source vertex and a destination
+ * vertex separated by white spaces or commas. The remaining fields of
+ * a line are ignored. Lines starting with '#' or '%' are comments.
+ */
+static size_t parse_text_chunk(const char *p, const char *end,
+		std::vector<std::pair<fg::vertex_id_t, fg::vertex_id_t> > &edges)
+{
+	size_t num_skipped = 0;
+	edges.clear();
+	while (p < end) {
+		while (p < end && (*p == ' ' || *p == '\t' || *p == '\r'))
+			p++;
+		if (p >= end)
+			break;
+		if (!is_digit(*p)) {
+			if (*p != '\n' && *p != '#' && *p != '%')
+				num_skipped++;
+			p = skip_line(p, end);
+			continue;
+		}
+		uint64_t src, dst;
+		p = parse_uint(p, src);
+		while (p < end && (*p == ' ' || *p == '\t' || *p == ','))
+			p++;
+		if (p >= end || !is_digit(*p)) {
+			num_skipped++;
+			p = skip_line(p, end);
+			continue;
+		}
+		p = parse_uint(p, dst);
+		p = skip_line(p, end);
+		if (src >= fg::MAX_VERTEX_ID || dst >= fg::MAX_VERTEX_ID) {
+			num_skipped++;
+			continue;
+		}
+		edges.push_back(std::pair<fg::vertex_id_t, fg::vertex_id_t>(src, dst));
+	}
+	return num_skipped;
+}
+
+/*
+ * A binary edge list stores an edge as two vertex_id_t.
+ */
+static void read_binary_chunk(FILE *f, const input_chunk &chunk,
+		std::vector<std::pair<fg::vertex_id_t, fg::vertex_id_t> > &edges)
+{
+	assert(chunk.size % sizeof(edges[0]) == 0);
+	edges.resize(chunk.size / sizeof(edges[0]));
+	BOOST_VERIFY(fseek(f, chunk.off, SEEK_SET) == 0);
+	if (chunk.size > 0)
+		BOOST_VERIFY(fread(edges.data(), chunk.size, 1, f) == 1);
+}
+
+/*
+ * The first pass: parse the edge lists and partition edges.
+ * It returns the max vertex ID.
+ */
+static fg::vertex_id_t partition_edges(const std::vector<std::string> &files,
+		const conv_options &opts, part_set &out_parts, part_set &in_parts)
+{
+	std::vector<input_chunk> chunks;
+	for (size_t i = 0; i < files.size(); i++) {
+		safs::native_file f(files[i]);
+		ssize_t size = f.get_size();
+		if (opts.binary && size % (sizeof(fg::vertex_id_t) * 2) != 0) {
+			fprintf(stderr, "%s isn't a binary edge list\n", files[i].c_str());
+			exit(1);
+		}
+		for (ssize_t off = 0; off < size; off += CHUNK_SIZE) {
+			input_chunk chunk;
+			chunk.file = files[i];
+			chunk.off = off;
+			chunk.size = std::min(CHUNK_SIZE, (size_t) (size - off));
+			chunks.push_back(chunk);
+		}
+	}
+
+	int num_threads = omp_get_max_threads();
+	// Half of the memory budget is used by the partition buffers.
+	// The other half is used for reading and parsing input data.
+	size_t max_buf_edges = std::max(1024UL,
+			opts.mem_budget / 2 / num_threads / sizeof(edge_t)
+			/ (opts.directed ? 2 : 1));
+	std::atomic<size_t> num_edges(0);
+	std::atomic<size_t> num_skipped(0);
+	std::vector<fg::vertex_id_t> max_ids(num_threads);
+#pragma omp parallel
+	{
+		int thread_id = omp_get_thread_num();
+		part_buffer out_buf(out_parts, opts.part_bits, max_buf_edges);
+		part_buffer in_buf(in_parts, opts.part_bits, max_buf_edges);
+		std::vector<char> buf;
+		std::vector<std::pair<fg::vertex_id_t, fg::vertex_id_t> > edges;
+		fg::vertex_id_t max_id = 0;
+#pragma omp for schedule(dynamic, 1)
+		for (size_t i = 0; i < chunks.size(); i++) {
+			FILE *f = fopen(chunks[i].file.c_str(), "r");
+			if (f == NULL) {
+				fprintf(stderr, "can't open %s: %s\n", chunks[i].file.c_str(),
+						strerror(errno));
+				exit(1);
+			}
+			if (opts.binary)
+				read_binary_chunk(f, chunks[i], edges);
+			else {
+				const char *start, *end;
+				read_text_chunk(f, chunks[i], buf, start, end);
+				num_skipped += parse_text_chunk(start, end, edges);
+			}
+			fclose(f);
+
+			for (size_t j = 0; j < edges.size(); j++) {
+				fg::vertex_id_t src = edges[j].first;
+				fg::vertex_id_t dst = edges[j].second;
+				max_id = std::max(max_id, std::max(src, dst));
+				out_buf.add(src, dst);
+				if (opts.directed)
+					in_buf.add(dst, src);
+				else
+					out_buf.add(dst, src);
+			}
+			num_edges += edges.size();
+		}
+		max_ids[thread_id] = max_id;
+	}
+	if (num_skipped > 0)
+		printf("skip %ld invalid lines\n", num_skipped.load());
+	printf("There are %ld edges in the edge lists\n", num_edges.load());
+	if (num_edges == 0)
+		return fg::INVALID_VERTEX_ID;
+	return *std::max_element(max_ids.begin(), max_ids.end());
+}
+
+/*
+ * Construct the adjacency lists of the vertices in a partition.
+ */
+static void build_part(std::vector<edge_t> &edges, fg::vertex_id_t start_vid,
+		size_t num_vertices, bool uniq_edge, std::vector<char> &adj_buf,
+		fg::vsize_t num_edges[])
+{
+	// Counting sort on the vertex whose adjacency list contains the edge.
+	std::vector<size_t> offs(num_vertices + 1);
+	for (size_t i = 0; i < edges.size(); i++)
+		offs[edges[i].key - start_vid + 1]++;
+	for (size_t i = 1; i < offs.size(); i++)
+		offs[i] += offs[i - 1];
+	std::vector<fg::vertex_id_t> neighs(edges.size());
+	std::vector<size_t> locs(offs.begin(), offs.end() - 1);
+	for (size_t i = 0; i < edges.size(); i++)
+		neighs[locs[edges[i].key - start_vid]++] = edges[i].neigh;
+	edges.clear();
+	edges.shrink_to_fit();
+
+	size_t tot_size = 0;
+	for (size_t i = 0; i < num_vertices; i++) {
+		fg::vertex_id_t *begin = neighs.data() + offs[i];
+		fg::vertex_id_t *end = neighs.data() + offs[i + 1];
+		std::sort(begin, end);
+		if (uniq_edge)
+			end = std::unique(begin, end);
+		num_edges[i] = end - begin;
+		tot_size += fg::ext_mem_undirected_vertex::num_edges2vsize(
+				num_edges[i], 0);
+	}
+
+	adj_buf.resize(tot_size);
+	size_t off = 0;
+	for (size_t i = 0; i < num_vertices; i++) {
+		fg::ext_mem_undirected_vertex *v
+			= new (adj_buf.data() + off) fg::ext_mem_undirected_vertex(
+					start_vid + i, num_edges[i], 0);
+		for (size_t j = 0; j < num_edges[i]; j++)
+			v->set_neighbor(j, neighs[offs[i] + j]);
+		off += v->get_size();
+	}
+	assert(off == tot_size);
+}
+
+/*
+ * The second pass: construct adjacency lists partition by partition
+ * and append them to the adjacency list file. We construct a group of
+ * partitions in parallel as long as they fit in the memory budget.
+ * It returns the total number of edges in the adjacency lists.
+ */
+static size_t write_adj_lists(part_set &parts, size_t num_vertices,
+		const conv_options &opts, FILE *adj_f, std::vector<fg::vsize_t> &num_edges)
+{
+	num_edges.resize(num_vertices);
+	size_t part_size = 1UL << opts.part_bits;
+	size_t num_parts = ROUNDUP(num_vertices, part_size) / part_size;
+	int num_threads = omp_get_max_threads();
+	size_t tot_edges = 0;
+	for (size_t start = 0; start < num_parts;) {
+		// Each edge takes the space in the partition, in the counting sort and
+		// in the adjacency lists.
+		size_t group_bytes = 0;
+		size_t end = start;
+		do {
+			part_file *part = parts.get_part_nolock(end);
+			size_t part_edges = part ? part->get_num_edges() : 0;
+			group_bytes += part_edges * (sizeof(edge_t)
+					+ 2 * sizeof(fg::vertex_id_t));
+			end++;
+		} while (end < num_parts && (int) (end - start) < num_threads
+				&& group_bytes < opts.mem_budget);
+		if (group_bytes > opts.mem_budget && end - start > 1)
+			end--;
+		else if (group_bytes > opts.mem_budget)
+			fprintf(stderr,
+					"partition %ld exceeds the memory budget. Use fewer partition bits\n",
+					start);
+
+		std::vector<std::vector<char> > adj_bufs(end - start);
+#pragma omp parallel for schedule(dynamic, 1)
+		for (size_t i = start; i < end; i++) {
+			fg::vertex_id_t start_vid = i * part_size;
+			size_t part_vertices = std::min(part_size, num_vertices - start_vid);
+			std::vector<edge_t> edges;
+			part_file *part = parts.get_part_nolock(i);
+			if (part)
+				part->read_all(edges);
+			build_part(edges, start_vid, part_vertices, opts.uniq_edge,
+					adj_bufs[i - start], num_edges.data() + start_vid);
+		}
+		for (size_t i = 0; i < adj_bufs.size(); i++)
+			BOOST_VERIFY(fwrite(adj_bufs[i].data(), adj_bufs[i].size(), 1,
+						adj_f) == 1);
+		start = end;
+	}
+	for (size_t i = 0; i < num_vertices; i++)
+		tot_edges += num_edges[i];
+	return tot_edges;
+}
+
+}
+
+void print_usage()
+{
+	fprintf(stderr,
+			"convert a large edge list to adjacency lists with bounded memory\n");
+	fprintf(stderr, "el2fg_stream [options] edge_file graph_name\n");
+	fprintf(stderr, "-u: undirected graph\n");
+	fprintf(stderr, "-U: unique edges\n");
+	fprintf(stderr, "-b: the edge list is binary (pairs of 32-bit vertex IDs)\n");
+	fprintf(stderr, "-m size: the memory budget (default: 4G)\n");
+	fprintf(stderr, "-p bits: a partition has 2^bits vertices (default: 20)\n");
+	fprintf(stderr, "-T num: the number of threads\n");
+	fprintf(stderr, "-w dir: the directory for temporary files\n");
+}
+
+int main(int argc, char *argv[])
+{
+	conv_options opts;
+	opts.directed = true;
+	opts.uniq_edge = false;
+	opts.binary = false;
+	opts.part_bits = 20;
+	opts.mem_budget = 4UL * 1024 * 1024 * 1024;
+	std::string work_dir = ".";
+	int opt;
+	int num_opts = 0;
+	while ((opt = getopt(argc, argv, "uUbm:p:T:w:")) != -1) {
+		num_opts++;
+		switch (opt) {
+			case 'u':
+				opts.directed = false;
+				break;
+			case 'U':
+				opts.uniq_edge = true;
+				break;
+			case 'b':
+				opts.binary = true;
+				break;
+			case 'm':
+				opts.mem_budget = str2size(optarg);
+				num_opts++;
+				break;
+			case 'p':
+				opts.part_bits = atoi(optarg);
+				num_opts++;
+				break;
+			case 'T':
+				omp_set_num_threads(atoi(optarg));
+				num_opts++;
+				break;
+			case 'w':
+				work_dir = optarg;
+				num_opts++;
+				break;
+			default:
+				print_usage();
+				exit(1);
+		}
+	}
+
+	argv += 1 + num_opts;
+	argc -= 1 + num_opts;
+	if (argc < 2) {
+		print_usage();
+		exit(1);
+	}
+	if (opts.part_bits <= 0 || opts.part_bits >= 32) {
+		fprintf(stderr, "the number of partition bits must be in (0, 32)\n");
+		exit(1);
+	}
+
+	std::string file_name = argv[0];
+	std::string graph_name = argv[1];
+	std::string adj_file = graph_name + ".adj";
+	std::string index_file = graph_name + ".index";
+
+	std::vector<std::string> files;
+	safs::native_file f(file_name);
+	if (f.exist() && !f.is_dir())
+		files.push_back(file_name);
+	else if (f.exist() && f.is_dir()) {
+		safs::native_dir d(file_name);
+		d.read_all_files(files);
+		for (size_t i = 0; i < files.size(); i++)
+			files[i] = file_name + "/" + files[i];
+	}
+	else {
+		fprintf(stderr, "The input file %s doesn't exist\n", file_name.c_str());
+		return -1;
+	}
+	printf("read edges from %ld files with %d threads\n", files.size(),
+			omp_get_max_threads());
+
+	struct timeval start, end;
+	size_t name_start = graph_name.rfind('/');
+	std::string tmp_prefix = work_dir + "/" + (name_start == std::string::npos
+			? graph_name : graph_name.substr(name_start + 1))
+		+ "." + itoa(getpid());
+	part_set out_parts(tmp_prefix + ".out");
+	part_set in_parts(tmp_prefix + ".in");
+	gettimeofday(&start, NULL);
+	fg::vertex_id_t max_id = partition_edges(files, opts, out_parts, in_parts);
+	gettimeofday(&end, NULL);
+	printf("It takes %.3f seconds to parse and partition the edge lists\n",
+			time_diff(start, end));
+	if (max_id == fg::INVALID_VERTEX_ID) {
+		fprintf(stderr, "there aren't edges in the edge lists\n");
+		return -1;
+	}
+	size_t num_vertices = ((size_t) max_id) + 1;
+	printf("There are %ld vertices\n", num_vertices);
+
+	start = end;
+	FILE *adj_f = fopen(adj_file.c_str(), "w");
+	if (adj_f == NULL) {
+		fprintf(stderr, "can't open %s: %s\n", adj_file.c_str(), strerror(errno));
+		return -1;
+	}
+	// We don't know the number of edges yet. The header is rewritten
+	// at the end.
+	fg::graph_header header;
+	BOOST_VERIFY(fwrite(&header, sizeof(header), 1, adj_f) == 1);
+	std::vector<fg::vsize_t> num_in_edges;
+	std::vector<fg::vsize_t> num_out_edges;
+	if (opts.directed)
+		write_adj_lists(in_parts, num_vertices, opts, adj_f, num_in_edges);
+	size_t num_edges = write_adj_lists(out_parts, num_vertices, opts, adj_f,
+			num_out_edges);
+	gettimeofday(&end, NULL);
+	printf("It takes %.3f seconds to construct the adjacency lists\n",
+			time_diff(start, end));
+
+	if (!opts.directed)
+		num_edges /= 2;
+	printf("There are %ld edges in the graph\n", num_edges);
+	header = fg::graph_header(opts.directed ? fg::graph_type::DIRECTED
+			: fg::graph_type::UNDIRECTED, num_vertices, num_edges, 0);
+	BOOST_VERIFY(fseek(adj_f, 0, SEEK_SET) == 0);
+	BOOST_VERIFY(fwrite(&header, sizeof(header), 1, adj_f) == 1);
+	fclose(adj_f);
+
+	fg::vertex_index::ptr vindex;
+	if (opts.directed)
+		vindex = fg::cdirected_vertex_index::construct(num_vertices,
+				num_in_edges.data(), num_out_edges.data(), header);
+	else
+		vindex = fg::cundirected_vertex_index::construct(num_vertices,
+				num_out_edges.data(), header);
+	vindex->dump(index_file);
+	return 0;
+}
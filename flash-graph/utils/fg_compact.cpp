@@ -0,0 +1,70 @@
+/*
+ * Copyright 2014 Open Connectome Project (http://openconnecto.me)
+ * Written by Da Zheng (zhengda1936@gmail.com)
+ *
+ * This file is part of FlashGraph.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * This tool applies the updates in a graph delta file to a graph image
+ * and writes a new graph image.
+ */
+
+#include <stdio.h>
+
+#include <string>
+
+#include "common.h"
+
+#include "vertex_index.h"
+#include "graph_delta.h"
+
+void print_usage()
+{
+	fprintf(stderr, "apply graph updates to a graph image\n");
+	fprintf(stderr,
+			"fg_compact graph_file index_file delta_file new_graph_name\n");
+	fprintf(stderr, "Each line in delta_file is \"+ src dst\" or \"- src dst\"\n");
+}
+
+int main(int argc, char *argv[])
+{
+	if (argc < 5) {
+		print_usage();
+		exit(1);
+	}
+
+	std::string graph_file = argv[1];
+	std::string index_file = argv[2];
+	std::string delta_file = argv[3];
+	std::string graph_name = argv[4];
+	std::string adj_file = graph_name + ".adj";
+	std::string new_index_file = graph_name + ".index";
+
+	struct timeval start, end;
+	gettimeofday(&start, NULL);
+	fg::vertex_index::ptr vindex = fg::vertex_index::load(index_file);
+	fg::graph_delta::ptr delta = fg::graph_delta::create(
+			vindex->get_graph_header());
+	if (delta == NULL || !delta->load(delta_file))
+		return -1;
+	printf("There are %ld updates\n", delta->get_num_updates());
+	if (!delta->compact(graph_file, index_file, adj_file, new_index_file))
+		return -1;
+	gettimeofday(&end, NULL);
+	printf("It takes %.3f seconds to compact the graph\n",
+			time_diff(start, end));
+	return 0;
+}
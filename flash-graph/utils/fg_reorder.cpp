@@ -0,0 +1,591 @@
+/*
+ * Copyright 2014 Open Connectome Project (http://openconnecto.me)
+ * Written by Da Zheng (zhengda1936@gmail.com)
+ *
+ * This file is part of FlashGraph.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * This tool relabels the vertices in a FlashGraph graph image to improve
+ * the locality of accessing adjacency lists. FlashGraph reads adjacency lists
+ * from SSDs in pages, so placing the vertices that are accessed together
+ * in the same pages reduces the amount of data read from SSDs and increases
+ * the cache hit rate in SAFS.
+ *
+ * The tool writes a new adjacency list file and a new index file, as well as
+ * the permutation that maps the original vertex IDs to the new vertex IDs.
+ * The permutation file stores a vertex_id_t for each vertex in the original
+ * graph: the i-th entry is the new ID of vertex i.
+ */
+
+#include <assert.h>
+
+#include <vector>
+#include <deque>
+#include <algorithm>
+
+#include "common.h"
+
+#include "FGlib.h"
+#include "in_mem_storage.h"
+#include "vertex_index.h"
+#include "fg_utils.h"
+
+#include "mem_vec_store.h"
+#include "raw_data_array.h"
+#include "matrix_config.h"
+#include "sparse_matrix.h"
+
+using namespace fm;
+
+namespace
+{
+
+/*
+ * The adjacency lists of one direction in a graph, stored in memory.
+ */
+class adj_lists
+{
+	detail::simple_raw_array data;
+	std::vector<off_t> offs;
+public:
+	adj_lists() {
+	}
+
+	bool load(FILE *f, fg::vertex_index::ptr vindex, bool is_out_edge) {
+		offs.resize(vindex->get_num_vertices() + 1);
+		if (is_out_edge)
+			fg::init_out_offs(vindex, offs);
+		else
+			fg::init_in_offs(vindex, offs);
+
+		off_t start = offs.front();
+		size_t size = offs.back() - offs.front();
+		data = detail::simple_raw_array(size, -1);
+		if (fseek(f, start, SEEK_SET) != 0 || (size > 0
+					&& fread(data.get_raw(), size, 1, f) != 1)) {
+			fprintf(stderr, "can't read the adjacency lists: %s\n",
+					strerror(errno));
+			return false;
+		}
+		for (size_t i = 0; i < offs.size(); i++)
+			offs[i] -= start;
+		return true;
+	}
+
+	const fg::ext_mem_undirected_vertex &get_vertex(fg::vertex_id_t id) const {
+		return *(const fg::ext_mem_undirected_vertex *) (data.get_raw()
+				+ offs[id]);
+	}
+
+	size_t get_num_edges(fg::vertex_id_t id) const {
+		return get_vertex(id).get_num_edges();
+	}
+};
+
+/*
+ * The graph whose adjacency lists are all stored in memory.
+ * In an undirected graph, we only have the out-edge lists.
+ */
+class mem_graph
+{
+	fg::vertex_index::ptr vindex;
+	adj_lists in_lists;
+	adj_lists out_lists;
+public:
+	bool load(const std::string &graph_file, fg::vertex_index::ptr vindex) {
+		this->vindex = vindex;
+		FILE *f = fopen(graph_file.c_str(), "r");
+		if (f == NULL) {
+			fprintf(stderr, "can't open %s: %s\n", graph_file.c_str(),
+					strerror(errno));
+			return false;
+		}
+		bool ret = out_lists.load(f, vindex, true);
+		if (ret && is_directed())
+			ret = in_lists.load(f, vindex, false);
+		fclose(f);
+		return ret;
+	}
+
+	const fg::graph_header &get_header() const {
+		return vindex->get_graph_header();
+	}
+
+	bool is_directed() const {
+		return get_header().is_directed_graph();
+	}
+
+	size_t get_num_vertices() const {
+		return vindex->get_num_vertices();
+	}
+
+	const adj_lists &get_in_lists() const {
+		assert(is_directed());
+		return in_lists;
+	}
+
+	const adj_lists &get_out_lists() const {
+		return out_lists;
+	}
+
+	size_t get_degree(fg::vertex_id_t id) const {
+		size_t degree = out_lists.get_num_edges(id);
+		if (is_directed())
+			degree += in_lists.get_num_edges(id);
+		return degree;
+	}
+
+	/*
+	 * Get the neighbors of a vertex regardless of the edge direction.
+	 */
+	void get_neighbors(fg::vertex_id_t id,
+			std::vector<fg::vertex_id_t> &neighs) const {
+		neighs.clear();
+		const fg::ext_mem_undirected_vertex &out_v = out_lists.get_vertex(id);
+		for (size_t i = 0; i < out_v.get_num_edges(); i++)
+			neighs.push_back(out_v.get_neighbor(i));
+		if (is_directed()) {
+			const fg::ext_mem_undirected_vertex &in_v = in_lists.get_vertex(id);
+			for (size_t i = 0; i < in_v.get_num_edges(); i++)
+				neighs.push_back(in_v.get_neighbor(i));
+		}
+	}
+};
+
+/*
+ * All of the functions below compute a new order of vertices.
+ * The returned vector contains the original vertex IDs in the new order.
+ */
+
+struct degree_greater
+{
+	const mem_graph &g;
+
+	degree_greater(const mem_graph &_g): g(_g) {
+	}
+
+	bool operator()(fg::vertex_id_t v1, fg::vertex_id_t v2) const {
+		return g.get_degree(v1) > g.get_degree(v2);
+	}
+};
+
+/*
+ * Sort all vertices in the descending order of their degree.
+ */
+std::vector<fg::vertex_id_t> degree_order(const mem_graph &g)
+{
+	std::vector<fg::vertex_id_t> order(g.get_num_vertices());
+	for (size_t i = 0; i < order.size(); i++)
+		order[i] = i;
+	std::stable_sort(order.begin(), order.end(), degree_greater(g));
+	return order;
+}
+
+/*
+ * Hub sorting: only the vertices whose degree is larger than the average
+ * degree are sorted and placed at the beginning. The remaining vertices
+ * keep their relative order, so we don't destroy the locality that already
+ * exists in the original order.
+ */
+std::vector<fg::vertex_id_t> hub_order(const mem_graph &g)
+{
+	size_t num_vertices = g.get_num_vertices();
+	size_t tot_degree = 0;
+	for (size_t i = 0; i < num_vertices; i++)
+		tot_degree += g.get_degree(i);
+	double avg_degree = ((double) tot_degree) / num_vertices;
+
+	std::vector<fg::vertex_id_t> hubs;
+	std::vector<fg::vertex_id_t> others;
+	for (size_t i = 0; i < num_vertices; i++) {
+		if (g.get_degree(i) > avg_degree)
+			hubs.push_back(i);
+		else
+			others.push_back(i);
+	}
+	std::stable_sort(hubs.begin(), hubs.end(), degree_greater(g));
+	printf("There are %ld hubs\n", hubs.size());
+	hubs.insert(hubs.end(), others.begin(), others.end());
+	return hubs;
+}
+
+/*
+ * Reverse Cuthill-McKee. We run BFS from the vertex with the minimal
+ * degree in each connected component and visit the neighbors of a vertex
+ * in the ascending order of their degree. Edge directions are ignored.
+ */
+std::vector<fg::vertex_id_t> rcm_order(const mem_graph &g)
+{
+	size_t num_vertices = g.get_num_vertices();
+	std::vector<fg::vertex_id_t> order;
+	order.reserve(num_vertices);
+	std::vector<bool> visited(num_vertices);
+
+	// We search for the start vertices in the ascending order of degree.
+	std::vector<fg::vertex_id_t> starts = degree_order(g);
+	std::reverse(starts.begin(), starts.end());
+
+	std::vector<fg::vertex_id_t> neighs;
+	std::vector<std::pair<size_t, fg::vertex_id_t> > unvisited;
+	for (size_t i = 0; i < starts.size(); i++) {
+		if (visited[starts[i]])
+			continue;
+
+		size_t head = order.size();
+		order.push_back(starts[i]);
+		visited[starts[i]] = true;
+		while (head < order.size()) {
+			fg::vertex_id_t id = order[head++];
+			g.get_neighbors(id, neighs);
+			unvisited.clear();
+			for (size_t j = 0; j < neighs.size(); j++) {
+				if (!visited[neighs[j]]) {
+					visited[neighs[j]] = true;
+					unvisited.push_back(std::pair<size_t, fg::vertex_id_t>(
+								g.get_degree(neighs[j]), neighs[j]));
+				}
+			}
+			std::sort(unvisited.begin(), unvisited.end());
+			for (size_t j = 0; j < unvisited.size(); j++)
+				order.push_back(unvisited[j].second);
+		}
+	}
+	assert(order.size() == num_vertices);
+	std::reverse(order.begin(), order.end());
+	return order;
+}
+
+/*
+ * Community-based ordering. We detect communities with label propagation
+ * and place the vertices in the same community together. Communities are
+ * placed in the order that they are reached by BFS from the largest hub,
+ * so that adjacent communities are also placed close to each other.
+ * Inside a community, vertices are ordered by BFS as well.
+ */
+std::vector<fg::vertex_id_t> community_order(const mem_graph &g,
+		int num_iters)
+{
+	size_t num_vertices = g.get_num_vertices();
+	std::vector<fg::vertex_id_t> labels(num_vertices);
+	for (size_t i = 0; i < num_vertices; i++)
+		labels[i] = i;
+
+	// We update labels in place and visit vertices in a random order
+	// to help label propagation converge.
+	std::vector<fg::vertex_id_t> visit_order(num_vertices);
+	for (size_t i = 0; i < num_vertices; i++)
+		visit_order[i] = i;
+	std::random_shuffle(visit_order.begin(), visit_order.end());
+
+	std::vector<fg::vertex_id_t> neighs;
+	std::vector<fg::vertex_id_t> neigh_labels;
+	for (int iter = 0; iter < num_iters; iter++) {
+		size_t num_changes = 0;
+		for (size_t i = 0; i < num_vertices; i++) {
+			fg::vertex_id_t id = visit_order[i];
+			g.get_neighbors(id, neighs);
+			if (neighs.empty())
+				continue;
+
+			neigh_labels.resize(neighs.size());
+			for (size_t j = 0; j < neighs.size(); j++)
+				neigh_labels[j] = labels[neighs[j]];
+			std::sort(neigh_labels.begin(), neigh_labels.end());
+			// Find the most frequent label among the neighbors.
+			// The smallest label wins the tie.
+			fg::vertex_id_t best = neigh_labels[0];
+			size_t best_count = 0;
+			for (size_t j = 0; j < neigh_labels.size();) {
+				size_t k = j;
+				while (k < neigh_labels.size() && neigh_labels[k] == neigh_labels[j])
+					k++;
+				if (k - j > best_count) {
+					best_count = k - j;
+					best = neigh_labels[j];
+				}
+				j = k;
+			}
+			if (best != labels[id]) {
+				labels[id] = best;
+				num_changes++;
+			}
+		}
+		printf("label propagation iteration %d: %ld vertices change labels\n",
+				iter, num_changes);
+		if (num_changes == 0)
+			break;
+	}
+
+	// Group vertices by their communities.
+	std::vector<size_t> comm_offs(num_vertices + 1);
+	for (size_t i = 0; i < num_vertices; i++)
+		comm_offs[labels[i] + 1]++;
+	for (size_t i = 1; i < comm_offs.size(); i++)
+		comm_offs[i] += comm_offs[i - 1];
+	std::vector<fg::vertex_id_t> comm_members(num_vertices);
+	std::vector<size_t> comm_locs(comm_offs.begin(), comm_offs.end() - 1);
+	for (size_t i = 0; i < num_vertices; i++)
+		comm_members[comm_locs[labels[i]]++] = i;
+
+	// Traverse the communities with BFS on the vertices. When we reach
+	// a vertex in a community that hasn't been placed, we place
+	// the entire community with BFS inside the community.
+	std::vector<fg::vertex_id_t> order;
+	order.reserve(num_vertices);
+	std::vector<bool> placed_comm(num_vertices);
+	std::vector<bool> placed(num_vertices);
+	std::deque<fg::vertex_id_t> comm_queue;
+	std::vector<fg::vertex_id_t> starts = degree_order(g);
+	for (size_t i = 0; i < starts.size(); i++) {
+		if (placed_comm[labels[starts[i]]])
+			continue;
+		placed_comm[labels[starts[i]]] = true;
+		comm_queue.push_back(starts[i]);
+		while (!comm_queue.empty()) {
+			fg::vertex_id_t comm_start = comm_queue.front();
+			comm_queue.pop_front();
+			fg::vertex_id_t label = labels[comm_start];
+			size_t head = order.size();
+			order.push_back(comm_start);
+			placed[comm_start] = true;
+			while (head < order.size()) {
+				fg::vertex_id_t id = order[head++];
+				g.get_neighbors(id, neighs);
+				for (size_t j = 0; j < neighs.size(); j++) {
+					fg::vertex_id_t neigh = neighs[j];
+					if (labels[neigh] == label && !placed[neigh]) {
+						placed[neigh] = true;
+						order.push_back(neigh);
+					}
+					else if (labels[neigh] != label
+							&& !placed_comm[labels[neigh]]) {
+						placed_comm[labels[neigh]] = true;
+						comm_queue.push_back(neigh);
+					}
+				}
+			}
+			// The community may not be connected internally.
+			for (size_t j = comm_offs[label]; j < comm_offs[label + 1]; j++) {
+				if (!placed[comm_members[j]]) {
+					placed[comm_members[j]] = true;
+					order.push_back(comm_members[j]);
+				}
+			}
+		}
+	}
+	assert(order.size() == num_vertices);
+	return order;
+}
+
+/*
+ * Rewrite the adjacency lists of one direction in the new vertex order.
+ * The neighbors of a vertex are relabeled and sorted, and the edge data
+ * are moved with the neighbors.
+ */
+size_t write_adj_lists(const adj_lists &lists,
+		const std::vector<fg::vertex_id_t> &order,
+		const std::vector<fg::vertex_id_t> &perm, size_t edge_data_size,
+		char *buf, std::vector<fg::vsize_t> &num_edges)
+{
+	size_t num_vertices = order.size();
+	num_edges.resize(num_vertices);
+	std::vector<off_t> offs(num_vertices + 1);
+	for (size_t i = 0; i < num_vertices; i++) {
+		num_edges[i] = lists.get_num_edges(order[i]);
+		offs[i + 1] = offs[i] + fg::ext_mem_undirected_vertex::num_edges2vsize(
+				num_edges[i], edge_data_size);
+	}
+	if (buf == NULL)
+		return offs.back();
+
+#pragma omp parallel for
+	for (size_t i = 0; i < num_vertices; i++) {
+		const fg::ext_mem_undirected_vertex &old_v
+			= lists.get_vertex(order[i]);
+		fg::ext_mem_undirected_vertex *new_v
+			= new (buf + offs[i]) fg::ext_mem_undirected_vertex(i,
+					old_v.get_num_edges(), edge_data_size);
+		std::vector<std::pair<fg::vertex_id_t, size_t> > neighs(
+				old_v.get_num_edges());
+		for (size_t j = 0; j < neighs.size(); j++)
+			neighs[j] = std::pair<fg::vertex_id_t, size_t>(
+					perm[old_v.get_neighbor(j)], j);
+		std::sort(neighs.begin(), neighs.end());
+		for (size_t j = 0; j < neighs.size(); j++) {
+			new_v->set_neighbor(j, neighs[j].first);
+			if (edge_data_size > 0)
+				memcpy(new_v->get_raw_edge_data(j),
+						old_v.get_raw_edge_data(neighs[j].second),
+						edge_data_size);
+		}
+	}
+	return offs.back();
+}
+
+fg::FG_graph::ptr reorder_graph(const mem_graph &g,
+		const std::vector<fg::vertex_id_t> &order,
+		const std::vector<fg::vertex_id_t> &perm)
+{
+	const fg::graph_header &old_header = g.get_header();
+	size_t edge_data_size = old_header.get_edge_data_size();
+	size_t num_vertices = g.get_num_vertices();
+	std::vector<fg::vsize_t> num_in_edges;
+	std::vector<fg::vsize_t> num_out_edges;
+
+	size_t header_size = fg::graph_header::get_header_size();
+	size_t in_size = 0;
+	if (g.is_directed())
+		in_size = write_adj_lists(g.get_in_lists(), order, perm,
+				edge_data_size, NULL, num_in_edges);
+	size_t out_size = write_adj_lists(g.get_out_lists(), order, perm,
+			edge_data_size, NULL, num_out_edges);
+
+	detail::smp_vec_store::ptr graph_data = detail::smp_vec_store::create(
+			header_size + in_size + out_size, get_scalar_type<char>());
+	char *buf = graph_data->get_raw_arr();
+	memcpy(buf, &old_header, header_size);
+	if (g.is_directed())
+		write_adj_lists(g.get_in_lists(), order, perm, edge_data_size,
+				buf + header_size, num_in_edges);
+	write_adj_lists(g.get_out_lists(), order, perm, edge_data_size,
+			buf + header_size + in_size, num_out_edges);
+
+	fg::vertex_index::ptr vindex;
+	if (g.is_directed())
+		vindex = fg::cdirected_vertex_index::construct(num_vertices,
+				num_in_edges.data(), num_out_edges.data(), old_header);
+	else
+		vindex = fg::cundirected_vertex_index::construct(num_vertices,
+				num_out_edges.data(), old_header);
+	return fg::construct_FG_graph(
+			std::pair<fg::vertex_index::ptr, detail::vec_store::ptr>(vindex,
+				graph_data), "");
+}
+
+}
+
+void print_usage()
+{
+	fprintf(stderr, "relabel the vertices of a graph for locality\n");
+	fprintf(stderr,
+			"fg_reorder [options] conf_file graph_file index_file new_graph_name\n");
+	fprintf(stderr, "-m method: degree, hub, rcm, community (default: rcm)\n");
+	fprintf(stderr, "-i num: the max number of label propagation iterations in community\n");
+}
+
+int main(int argc, char *argv[])
+{
+	std::string method = "rcm";
+	int num_lp_iters = 10;
+	int opt;
+	int num_opts = 0;
+	while ((opt = getopt(argc, argv, "m:i:")) != -1) {
+		num_opts++;
+		switch (opt) {
+			case 'm':
+				method = optarg;
+				num_opts++;
+				break;
+			case 'i':
+				num_lp_iters = atoi(optarg);
+				num_opts++;
+				break;
+			default:
+				print_usage();
+				exit(1);
+		}
+	}
+
+	argv += 1 + num_opts;
+	argc -= 1 + num_opts;
+	if (argc < 4) {
+		print_usage();
+		exit(1);
+	}
+
+	std::string conf_file = argv[0];
+	std::string graph_file = argv[1];
+	std::string index_file = argv[2];
+	std::string graph_name = argv[3];
+	std::string adj_file = graph_name + ".adj";
+	std::string new_index_file = graph_name + ".index";
+	std::string perm_file = graph_name + ".perm";
+
+	config_map::ptr configs = config_map::create(conf_file);
+	init_flash_matrix(configs);
+	{
+		struct timeval start, end;
+		gettimeofday(&start, NULL);
+		fg::vertex_index::ptr vindex = fg::vertex_index::load(index_file);
+		mem_graph g;
+		if (!g.load(graph_file, vindex))
+			return -1;
+		gettimeofday(&end, NULL);
+		printf("It takes %.3f seconds to load the graph\n",
+				time_diff(start, end));
+
+		start = end;
+		std::vector<fg::vertex_id_t> order;
+		if (method == "degree")
+			order = degree_order(g);
+		else if (method == "hub")
+			order = hub_order(g);
+		else if (method == "rcm")
+			order = rcm_order(g);
+		else if (method == "community")
+			order = community_order(g, num_lp_iters);
+		else {
+			fprintf(stderr, "unknown reorder method: %s\n", method.c_str());
+			print_usage();
+			return -1;
+		}
+		gettimeofday(&end, NULL);
+		printf("It takes %.3f seconds to compute the %s order\n",
+				time_diff(start, end), method.c_str());
+
+		// perm maps the original vertex IDs to the new vertex IDs.
+		std::vector<fg::vertex_id_t> perm(order.size());
+		for (size_t i = 0; i < order.size(); i++)
+			perm[order[i]] = i;
+
+		start = end;
+		fg::FG_graph::ptr graph = reorder_graph(g, order, perm);
+		order.clear();
+		gettimeofday(&end, NULL);
+		printf("It takes %.3f seconds to relabel the graph\n",
+				time_diff(start, end));
+		if (graph && graph->get_index_data())
+			graph->get_index_data()->dump(new_index_file);
+		if (graph && graph->get_graph_data())
+			graph->get_graph_data()->dump(adj_file);
+
+		FILE *f = fopen(perm_file.c_str(), "w");
+		if (f == NULL) {
+			fprintf(stderr, "can't open %s: %s\n", perm_file.c_str(),
+					strerror(errno));
+			return -1;
+		}
+		if (fwrite(perm.data(), perm.size() * sizeof(perm[0]), 1, f) != 1) {
+			fprintf(stderr, "can't write the permutation: %s\n",
+					strerror(errno));
+			fclose(f);
+			return -1;
+		}
+		fclose(f);
+	}
+	destroy_flash_matrix();
+	return 0;
+}
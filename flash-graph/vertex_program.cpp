@@ -45,6 +45,7 @@ void vertex_program::init(graph_engine *graph, worker_thread *t)
 {
 	this->t = t;
 	this->graph = graph;
+	this->delta = graph->get_delta();
 	part_id = t->get_worker_id();
 }
 
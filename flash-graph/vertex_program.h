@@ -26,6 +26,7 @@
 #include "vertex.h"
 #include "messaging.h"
 #include "vertex_pointer.h"
+#include "graph_delta.h"
 
 namespace fg
 {
@@ -47,6 +48,8 @@ class vertex_program
 	int part_id;
 	worker_thread *t;
 	graph_engine *graph;
+	// The updates of the graph. It's NULL if the graph doesn't have updates.
+	const graph_delta *delta;
 
 	std::unique_ptr<std::vector<local_vid_t>[]> vid_bufs;
 	std::unique_ptr<vertex_loc_t[]> vertex_locs;
@@ -82,6 +85,7 @@ public:
 		part_id = 0;
 		t = NULL;
 		graph = NULL;
+		delta = NULL;
 	}
     
     /** \brief Destructor */
@@ -167,6 +171,14 @@ public:
 	graph_engine &get_graph() {
 		return *graph;
 	}
+
+    /**
+     * \brief Get the updates merged into the adjacency lists of vertices.
+     *  \return The graph delta. NULL if the graph doesn't have updates.
+     */
+	const graph_delta *get_delta() const {
+		return delta;
+	}
     
     /**
      * \brief Multicast the same message to several other vertices. If the number of vertices
@@ -284,7 +296,13 @@ public:
      * \param vertex The curren `page vertex`.
 	 */
 	virtual void run(compute_vertex &comp_v, const page_vertex &vertex) {
-		((vertex_type &) comp_v).run(*this, vertex);
+		const graph_delta *delta = get_delta();
+		if (delta && delta->has_updates(vertex.get_id())) {
+			delta_page_vertex merged(vertex, *delta);
+			((vertex_type &) comp_v).run(*this, merged.get());
+		}
+		else
+			((vertex_type &) comp_v).run(*this, vertex);
 	}
 
 	/**
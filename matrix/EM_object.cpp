@@ -169,6 +169,8 @@ void portion_callback::add(long key, portion_compute::ptr compute)
 
 int portion_callback::invoke(safs::io_request *reqs[], int num)
 {
+	struct timeval start, end;
+	gettimeofday(&start, NULL);
 	for (int i = 0; i < num; i++) {
 		auto it = computes.find(get_portion_key(*reqs[i]));
 		// Sometimes we want to use the I/O instance synchronously, and
@@ -181,12 +183,16 @@ int portion_callback::invoke(safs::io_request *reqs[], int num)
 		// Otherwise, the user-defined `run' function may try to add new
 		// computes to the vector.
 		computes.erase(it);
+		num_portions++;
+		num_bytes += reqs[i]->get_size();
 
 		for (auto comp_it = tmp.begin(); comp_it != tmp.end(); comp_it++) {
 			portion_compute::ptr compute = *comp_it;
 			compute->run(reqs[i]->get_buf(), reqs[i]->get_size());
 		}
 	}
+	gettimeofday(&end, NULL);
+	compute_us += time_diff_us(start, end);
 	return 0;
 }
 
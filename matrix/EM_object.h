@@ -128,9 +128,20 @@ public:
 class portion_callback: public safs::callback
 {
 	std::unordered_map<long, std::vector<portion_compute::ptr> > computes;
+	// The time spent in the computation on the portions in microseconds.
+	long compute_us;
+	// The number of portions computed and their total size.
+	size_t num_portions;
+	size_t num_bytes;
 public:
 	typedef std::shared_ptr<portion_callback> ptr;
 
+	portion_callback() {
+		compute_us = 0;
+		num_portions = 0;
+		num_bytes = 0;
+	}
+
 	static long get_portion_key(const safs::io_request &req) {
 		return (long) req.get_buf();
 	}
@@ -152,6 +163,16 @@ public:
 	}
 	void add(long key, portion_compute::ptr compute);
 	virtual int invoke(safs::io_request *reqs[], int num);
+
+	long get_compute_us() const {
+		return compute_us;
+	}
+	size_t get_num_portions() const {
+		return num_portions;
+	}
+	size_t get_num_bytes() const {
+		return num_bytes;
+	}
 };
 
 class sync_read_compute: public portion_compute
@@ -189,12 +189,10 @@ NUMA_vec_store::ptr NUMA_vec_store::create(size_t length, const scalar_type &typ
 
 NUMA_vec_store::ptr NUMA_vec_store::cast(vec_store::ptr vec)
 {
-	if (!vec->is_in_mem()
-			|| std::static_pointer_cast<mem_vec_store>(vec)->get_num_nodes() < 0) {
+	NUMA_vec_store::ptr ret = std::dynamic_pointer_cast<NUMA_vec_store>(vec);
+	if (ret == NULL)
 		BOOST_LOG_TRIVIAL(error) << "The vector isn't a NUMA vector";
-		return NUMA_vec_store::ptr();
-	}
-	return std::static_pointer_cast<NUMA_vec_store>(vec);
+	return ret;
 }
 
 NUMA_vec_store::NUMA_vec_store(const NUMA_vec_store &vec): mem_vec_store(
@@ -0,0 +1,126 @@
+#ifndef __FM_BIT_PACKING_H__
+#define __FM_BIT_PACKING_H__
+
+/*
+ * Copyright 2017 Open Connectome Project (http://openconnecto.me)
+ * Written by Da Zheng (zhengda1936@gmail.com)
+ *
+ * This file is part of FlashMatrix.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * These are the helper functions to pack small integers into 64-bit words.
+ * They are shared by the columnar file format and the encoded vectors.
+ */
+
+#include <stdint.h>
+#include <string.h>
+
+#include <limits>
+
+namespace fm
+{
+
+namespace detail
+{
+
+static inline int get_num_bits(uint64_t v)
+{
+	return v == 0 ? 0 : 64 - __builtin_clzl(v);
+}
+
+/*
+ * The number of bytes to store `num' bit-packed values.
+ * The values are packed into 64-bit words.
+ */
+static inline size_t get_packed_size(size_t num, int width)
+{
+	return (num * width + 63) / 64 * 8;
+}
+
+static inline void pack_bits(const uint64_t *vals, size_t num, int width,
+		uint64_t *out)
+{
+	memset(out, 0, get_packed_size(num, width));
+	if (width == 0)
+		return;
+	for (size_t i = 0; i < num; i++) {
+		size_t bit = i * width;
+		size_t word = bit / 64;
+		int shift = bit % 64;
+		out[word] |= vals[i] << shift;
+		if (shift + width > 64)
+			out[word + 1] |= vals[i] >> (64 - shift);
+	}
+}
+
+static inline uint64_t unpack_bits(const uint64_t *in, size_t i, int width,
+		uint64_t mask)
+{
+	// There isn't any data if all values are 0.
+	if (width == 0)
+		return 0;
+	size_t bit = i * width;
+	size_t word = bit / 64;
+	int shift = bit % 64;
+	uint64_t v = in[word] >> shift;
+	if (shift + width > 64)
+		v |= in[word + 1] << (64 - shift);
+	return v & mask;
+}
+
+static inline uint64_t get_mask(int width)
+{
+	return width == 64 ? std::numeric_limits<uint64_t>::max()
+		: (1UL << width) - 1;
+}
+
+/*
+ * The unsigned integer type with the specified number of bytes.
+ */
+template<int size>
+struct bits_type
+{
+};
+
+template<>
+struct bits_type<1>
+{
+	typedef uint8_t type;
+};
+
+template<>
+struct bits_type<2>
+{
+	typedef uint16_t type;
+};
+
+template<>
+struct bits_type<4>
+{
+	typedef uint32_t type;
+};
+
+template<>
+struct bits_type<8>
+{
+	typedef uint64_t type;
+};
+
+}
+
+}
+
+#endif
@@ -65,6 +65,9 @@ class basic_uops_impl: public basic_uops
 		static std::string get_name() {
 			return "-";
 		}
+		static simd::op_kind get_simd_op() {
+			return simd::NEG;
+		}
 		OutType operator()(const InType &e) const {
 			return -e;
 		}
@@ -74,6 +77,9 @@ class basic_uops_impl: public basic_uops
 		static std::string get_name() {
 			return "sqrt";
 		}
+		static simd::op_kind get_simd_op() {
+			return simd::SQRT;
+		}
 		double operator()(const InType &e) const {
 			return std::sqrt(e);
 		}
@@ -83,6 +89,9 @@ class basic_uops_impl: public basic_uops
 		static std::string get_name() {
 			return "abs";
 		}
+		static simd::op_kind get_simd_op() {
+			return simd::ABS;
+		}
 		OutType operator()(const InType &e) const {
 			return (OutType) std::abs(e);
 		}
@@ -217,6 +226,9 @@ struct multiply
 	static std::string get_name() {
 		return "*";
 	}
+	static simd::op_kind get_simd_op() {
+		return simd::MUL;
+	}
 	static ResType1 get_agg_init() {
 		return 1;
 	}
@@ -231,6 +243,12 @@ struct multiply<double, double, double>
 	static std::string get_name() {
 		return "*";
 	}
+	// The vectorized kernel multiplies in double directly. The product
+	// is rounded once, so it may differ from the product below in the last
+	// bit when the long double product is rounded twice.
+	static simd::op_kind get_simd_op() {
+		return simd::MUL;
+	}
 	static double get_agg_init() {
 		return 1;
 	}
@@ -312,6 +330,9 @@ struct min
 	static std::string get_name() {
 		return "min";
 	}
+	static simd::op_kind get_simd_op() {
+		return simd::MIN;
+	}
 	static ResType get_agg_init() {
 		return std::numeric_limits<ResType>::max();
 	}
@@ -326,6 +347,9 @@ struct min<double, double, double>
 	static std::string get_name() {
 		return "min";
 	}
+	static simd::op_kind get_simd_op() {
+		return simd::MIN_NAN;
+	}
 	static double get_agg_init() {
 		return std::numeric_limits<double>::max();
 	}
@@ -345,6 +369,9 @@ struct max
 	static std::string get_name() {
 		return "max";
 	}
+	static simd::op_kind get_simd_op() {
+		return simd::MAX;
+	}
 	static ResType get_agg_init() {
 		return std::numeric_limits<ResType>::min();
 	}
@@ -359,6 +386,9 @@ struct max<double, double, double>
 	static std::string get_name() {
 		return "max";
 	}
+	static simd::op_kind get_simd_op() {
+		return simd::MAX_NAN;
+	}
 	static double get_agg_init() {
 		// We need to define the minimum float-point differently.
 		return -std::numeric_limits<double>::max();
@@ -379,6 +409,9 @@ struct max<float, float, float>
 	static std::string get_name() {
 		return "max";
 	}
+	static simd::op_kind get_simd_op() {
+		return simd::MAX_NAN;
+	}
 	static float get_agg_init() {
 		// We need to define the minimum float-point differently.
 		return -std::numeric_limits<float>::max();
@@ -403,6 +436,9 @@ class basic_ops_impl: public basic_ops
 		static std::string get_name() {
 			return "+";
 		}
+		static simd::op_kind get_simd_op() {
+			return simd::ADD;
+		}
 		static ResType get_agg_init() {
 			return 0;
 		}
@@ -415,6 +451,9 @@ class basic_ops_impl: public basic_ops
 		static std::string get_name() {
 			return "-";
 		}
+		static simd::op_kind get_simd_op() {
+			return simd::SUB;
+		}
 		static ResType get_agg_init() {
 			// This operation isn't used in aggregation, so we
 			// don't care this agg init.
@@ -431,6 +470,9 @@ class basic_ops_impl: public basic_ops
 		static std::string get_name() {
 			return "/";
 		}
+		static simd::op_kind get_simd_op() {
+			return simd::DIV;
+		}
 		static ResType get_agg_init() {
 			// This operation isn't used in aggregation, so we
 			// don't care this agg init.
@@ -446,6 +488,9 @@ class basic_ops_impl: public basic_ops
 		static std::string get_name() {
 			return "/";
 		}
+		static simd::op_kind get_simd_op() {
+			return simd::DIV;
+		}
 		static float get_agg_init() {
 			// This operation isn't used in aggregation, so we
 			// don't care this agg init.
@@ -488,6 +533,9 @@ class basic_ops_impl: public basic_ops
 		static std::string get_name() {
 			return "==";
 		}
+		static simd::op_kind get_simd_op() {
+			return simd::EQ;
+		}
 		static bool get_agg_init() {
 			// This operation isn't used in aggregation, so we
 			// don't care this agg init.
@@ -502,6 +550,9 @@ class basic_ops_impl: public basic_ops
 		static std::string get_name() {
 			return "!=";
 		}
+		static simd::op_kind get_simd_op() {
+			return simd::NEQ;
+		}
 		static bool get_agg_init() {
 			// This operation isn't used in aggregation, so we
 			// don't care this agg init.
@@ -516,6 +567,9 @@ class basic_ops_impl: public basic_ops
 		static std::string get_name() {
 			return ">";
 		}
+		static simd::op_kind get_simd_op() {
+			return simd::GT;
+		}
 		static bool get_agg_init() {
 			// This operation isn't used in aggregation, so we
 			// don't care this agg init.
@@ -530,6 +584,9 @@ class basic_ops_impl: public basic_ops
 		static std::string get_name() {
 			return ">=";
 		}
+		static simd::op_kind get_simd_op() {
+			return simd::GE;
+		}
 		static bool get_agg_init() {
 			// This operation isn't used in aggregation, so we
 			// don't care this agg init.
@@ -544,6 +601,9 @@ class basic_ops_impl: public basic_ops
 		static std::string get_name() {
 			return "<";
 		}
+		static simd::op_kind get_simd_op() {
+			return simd::LT;
+		}
 		static bool get_agg_init() {
 			// This operation isn't used in aggregation, so we
 			// don't care this agg init.
@@ -558,6 +618,9 @@ class basic_ops_impl: public basic_ops
 		static std::string get_name() {
 			return "<=";
 		}
+		static simd::op_kind get_simd_op() {
+			return simd::LE;
+		}
 		static bool get_agg_init() {
 			// This operation isn't used in aggregation, so we
 			// don't care this agg init.
@@ -21,6 +21,7 @@
  */
 
 #include "bulk_operate.h"
+#include "simd_kernels.h"
 
 namespace fm
 {
@@ -43,6 +44,10 @@ public:
 			void *output_arr1) const {
 		const InType *in_arr = (const InType *) in_arr1;
 		OutType *output_arr = (OutType *) output_arr1;
+		simd::op_kind kind = simd::op_kind_trait<OpType>::value();
+		if (kind != simd::NONE
+				&& simd::run_uop(kind, num_eles, in_arr, output_arr))
+			return;
 		for (size_t i = 0; i < num_eles; i++)
 			output_arr[i] = op(in_arr[i]);
 	}
@@ -137,6 +142,10 @@ public:
 		const LeftType *left_arr = (const LeftType *) left_arr1;
 		const RightType *right_arr = (const RightType *) right_arr1;
 		ResType *output_arr = (ResType *) output_arr1;
+		simd::op_kind kind = simd::op_kind_trait<OpType>::value();
+		if (kind != simd::NONE && simd::run_AA(kind, num_eles, left_arr,
+					right_arr, output_arr))
+			return;
 		if (num_eles < BULK_LEN)
 			runAA_short(num_eles, left_arr, right_arr, output_arr);
 		else {
@@ -153,6 +162,10 @@ public:
 		const LeftType *left_arr = (const LeftType *) left_arr1;
 		ResType *output_arr = (ResType *) output_arr1;
 		RightType entry = *(const RightType *) right;
+		simd::op_kind kind = simd::op_kind_trait<OpType>::value();
+		if (kind != simd::NONE && simd::run_AE(kind, num_eles, left_arr,
+					entry, output_arr))
+			return;
 		if (num_eles < BULK_LEN)
 			runAE_short(num_eles, left_arr, entry, output_arr);
 		else {
@@ -169,6 +182,10 @@ public:
 		LeftType entry = *(const LeftType *) left;
 		const RightType *right_arr = (const RightType *) right_arr1;
 		ResType *output_arr = (ResType *) output_arr1;
+		simd::op_kind kind = simd::op_kind_trait<OpType>::value();
+		if (kind != simd::NONE && simd::run_EA(kind, num_eles, entry,
+					right_arr, output_arr))
+			return;
 		if (num_eles < BULK_LEN)
 			runEA_short(num_eles, entry, right_arr, output_arr);
 		else {
@@ -184,6 +201,13 @@ public:
 			void *output) const {
 		const LeftType *left_arr = (const LeftType *) left_arr1;
 		ResType res = OpType::get_agg_init();
+		simd::op_kind kind = simd::op_kind_trait<OpType>::value();
+		const ResType init = res;
+		if (kind != simd::NONE
+				&& simd::run_agg(kind, num_eles, left_arr, init, res)) {
+			*(ResType *) output = res;
+			return;
+		}
 		if (num_eles < BULK_LEN)
 			*(ResType *) output = runAgg_short(num_eles, left_arr, res);
 		else {
@@ -200,6 +224,10 @@ public:
 		const LeftType *left_arr = (const LeftType *) left_arr1;
 		const RightType *prev = (const RightType *) prev1;
 		ResType *output_arr = (ResType *) output_arr1;
+		simd::op_kind kind = simd::op_kind_trait<OpType>::value();
+		if (kind != simd::NONE
+				&& simd::run_cum(kind, num_eles, left_arr, prev, output_arr))
+			return;
 		if (prev1)
 			output_arr[0] = op(left_arr[0], *prev);
 		else
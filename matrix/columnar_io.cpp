@@ -0,0 +1,905 @@
+/*
+ * Copyright 2017 Open Connectome Project (http://openconnecto.me)
+ * Written by Da Zheng (zhengda1936@gmail.com)
+ *
+ * This file is part of FlashMatrix.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#if defined(_OPENMP)
+#include <omp.h>
+#endif
+#include <fcntl.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+
+#include <unordered_map>
+#include <type_traits>
+
+#include <boost/format.hpp>
+
+#include "log.h"
+#include "common.h"
+
+#include "columnar_io.h"
+#include "data_frame.h"
+#include "dense_matrix.h"
+#include "mem_vec_store.h"
+#include "encoded_vec_store.h"
+#include "local_vec_store.h"
+#include "mem_matrix_store.h"
+#include "bit_packing.h"
+
+namespace fm
+{
+
+namespace
+{
+
+using namespace detail;
+
+static const char MAGIC[8] = {'F', 'M', 'C', 'O', 'L', 'U', 'M', 'N'};
+static const uint32_t CURR_VERSION = 1;
+static const size_t HEADER_SIZE = 16;
+// The max number of distinct values in a dictionary.
+static const size_t MAX_DICT_SIZE = 1 << 16;
+
+struct file_footer
+{
+	uint64_t meta_off;
+	uint64_t meta_size;
+	char magic[8];
+};
+
+static inline size_t roundup8(size_t size)
+{
+	return (size + 7) & (~7UL);
+}
+
+template<class T>
+static inline bool is_nan(T v)
+{
+	return v != v;
+}
+
+/*
+ * This encodes and decodes the values of a chunk.
+ */
+class col_codec
+{
+public:
+	virtual ~col_codec() {
+	}
+	/*
+	 * Encode the values. It sets the encoding and the statistics of
+	 * the chunk and stores the encoded data in `out'.
+	 */
+	virtual void encode(const char *vals, size_t num,
+			columnar_file::chunk_info &info, std::vector<uint64_t> &out) const = 0;
+	virtual bool decode(const uint64_t *in, size_t in_size, size_t num,
+			col_encoding enc, char *out) const = 0;
+};
+
+/*
+ * The codec only stores values as they are.
+ */
+template<class T>
+class raw_col_codec: public col_codec
+{
+protected:
+	void get_stats(const T *vals, size_t num,
+			columnar_file::chunk_info &info) const;
+public:
+	virtual void encode(const char *vals, size_t num,
+			columnar_file::chunk_info &info, std::vector<uint64_t> &out) const {
+		get_stats(reinterpret_cast<const T *>(vals), num, info);
+		info.enc = (uint32_t) col_encoding::RAW;
+		out.resize(roundup8(num * sizeof(T)) / 8);
+		memcpy(out.data(), vals, num * sizeof(T));
+	}
+
+	virtual bool decode(const uint64_t *in, size_t in_size, size_t num,
+			col_encoding enc, char *out) const {
+		if (enc != col_encoding::RAW || in_size < num * sizeof(T))
+			return false;
+		memcpy(out, in, num * sizeof(T));
+		return true;
+	}
+};
+
+template<class T>
+void raw_col_codec<T>::get_stats(const T *vals, size_t num,
+		columnar_file::chunk_info &info) const
+{
+	memset(info.min, 0, sizeof(info.min));
+	memset(info.max, 0, sizeof(info.max));
+	if (num == 0)
+		return;
+
+	T min = vals[0];
+	T max = vals[0];
+	size_t i = 0;
+	// Skip NaN at the beginning.
+	for (; i < num && is_nan(vals[i]); i++);
+	if (i < num) {
+		min = vals[i];
+		max = vals[i];
+	}
+	for (; i < num; i++) {
+		if (vals[i] < min)
+			min = vals[i];
+		if (vals[i] > max)
+			max = vals[i];
+	}
+	memcpy(info.min, &min, sizeof(T));
+	memcpy(info.max, &max, sizeof(T));
+}
+
+/*
+ * This codec picks the encoding that requires the least space.
+ *
+ * FOR data: the bit width and the min value, each in 8 bytes,
+ *   followed by the bit-packed differences with the min value.
+ * DICT data: the dictionary size and the bit width, each in 4 bytes,
+ *   followed by the dictionary and the bit-packed indexes. The dictionary
+ *   is padded to 8 bytes.
+ */
+template<class T>
+class packed_col_codec: public raw_col_codec<T>
+{
+	// We use the bits of a value to compare and hash values. This way,
+	// NaN can be stored in the dictionary.
+	typedef typename bits_type<sizeof(T)>::type bits_t;
+
+	static bits_t get_bits(T v) {
+		bits_t bits;
+		memcpy(&bits, &v, sizeof(v));
+		return bits;
+	}
+
+	void encode_for(const T *vals, size_t num, T min, int width,
+			std::vector<uint64_t> &out) const;
+	void encode_dict(const T *vals, size_t num,
+			const std::unordered_map<bits_t, uint32_t> &dict,
+			const std::vector<T> &dict_vals, std::vector<uint64_t> &out) const;
+public:
+	virtual void encode(const char *vals, size_t num,
+			columnar_file::chunk_info &info, std::vector<uint64_t> &out) const;
+	virtual bool decode(const uint64_t *in, size_t in_size, size_t num,
+			col_encoding enc, char *out) const;
+};
+
+template<class T>
+void packed_col_codec<T>::encode(const char *buf, size_t num,
+		columnar_file::chunk_info &info, std::vector<uint64_t> &out) const
+{
+	const T *vals = reinterpret_cast<const T *>(buf);
+	this->get_stats(vals, num, info);
+	size_t raw_size = roundup8(num * sizeof(T));
+
+	// Frame-of-reference only works for integers.
+	size_t for_size = std::numeric_limits<size_t>::max();
+	T min = 0;
+	int for_width = 0;
+	if (std::is_integral<T>::value) {
+		T max;
+		memcpy(&min, info.min, sizeof(T));
+		memcpy(&max, info.max, sizeof(T));
+		// The difference is computed with unsigned integers, so it doesn't
+		// overflow.
+		for_width = get_num_bits((bits_t) ((bits_t) max - (bits_t) min));
+		for_size = 16 + get_packed_size(num, for_width);
+	}
+
+	std::unordered_map<bits_t, uint32_t> dict;
+	std::vector<T> dict_vals;
+	size_t dict_size = std::numeric_limits<size_t>::max();
+	// If the values are packed into less than 8 bits, a dictionary can't
+	// help.
+	if (for_width > 8 || !std::is_integral<T>::value) {
+		for (size_t i = 0; i < num && dict_vals.size() <= MAX_DICT_SIZE; i++) {
+			auto ret = dict.insert(std::pair<bits_t, uint32_t>(
+						get_bits(vals[i]), dict_vals.size()));
+			if (ret.second)
+				dict_vals.push_back(vals[i]);
+		}
+		if (dict_vals.size() <= MAX_DICT_SIZE && !dict_vals.empty())
+			dict_size = 8 + roundup8(dict_vals.size() * sizeof(T))
+				+ get_packed_size(num, get_num_bits(dict_vals.size() - 1));
+	}
+
+	if (for_size < raw_size && for_size <= dict_size) {
+		info.enc = (uint32_t) col_encoding::FOR;
+		encode_for(vals, num, min, for_width, out);
+	}
+	else if (dict_size < raw_size) {
+		info.enc = (uint32_t) col_encoding::DICT;
+		encode_dict(vals, num, dict, dict_vals, out);
+	}
+	else {
+		info.enc = (uint32_t) col_encoding::RAW;
+		out.resize(raw_size / 8);
+		memcpy(out.data(), vals, num * sizeof(T));
+	}
+}
+
+template<class T>
+void packed_col_codec<T>::encode_for(const T *vals, size_t num, T min,
+		int width, std::vector<uint64_t> &out) const
+{
+	out.resize(2 + get_packed_size(num, width) / 8);
+	out[0] = width;
+	out[1] = (bits_t) min;
+	std::vector<uint64_t> diffs(num);
+	for (size_t i = 0; i < num; i++)
+		diffs[i] = (bits_t) ((bits_t) vals[i] - (bits_t) min);
+	pack_bits(diffs.data(), num, width, out.data() + 2);
+}
+
+template<class T>
+void packed_col_codec<T>::encode_dict(const T *vals, size_t num,
+		const std::unordered_map<bits_t, uint32_t> &dict,
+		const std::vector<T> &dict_vals, std::vector<uint64_t> &out) const
+{
+	int width = get_num_bits(dict_vals.size() - 1);
+	size_t dict_words = roundup8(dict_vals.size() * sizeof(T)) / 8;
+	out.resize(1 + dict_words + get_packed_size(num, width) / 8);
+	out[0] = dict_vals.size() | (((uint64_t) width) << 32);
+	out[dict_words] = 0;
+	T *dict_arr = reinterpret_cast<T *>(out.data() + 1);
+	for (size_t i = 0; i < dict_vals.size(); i++)
+		dict_arr[i] = dict_vals[i];
+	std::vector<uint64_t> idxs(num);
+	for (size_t i = 0; i < num; i++) {
+		auto it = dict.find(get_bits(vals[i]));
+		assert(it != dict.end());
+		idxs[i] = it->second;
+	}
+	pack_bits(idxs.data(), num, width, out.data() + 1 + dict_words);
+}
+
+template<class T>
+bool packed_col_codec<T>::decode(const uint64_t *in, size_t in_size,
+		size_t num, col_encoding enc, char *buf) const
+{
+	T *out = reinterpret_cast<T *>(buf);
+	if (enc == col_encoding::RAW)
+		return raw_col_codec<T>::decode(in, in_size, num, enc, buf);
+	else if (enc == col_encoding::FOR && std::is_integral<T>::value) {
+		if (in_size < 16)
+			return false;
+		int width = in[0];
+		bits_t min = in[1];
+		if (width > (int) sizeof(T) * 8
+				|| in_size < 16 + get_packed_size(num, width))
+			return false;
+		uint64_t mask = get_mask(width);
+		for (size_t i = 0; i < num; i++)
+			out[i] = (T) (bits_t) (min + unpack_bits(in + 2, i, width, mask));
+		return true;
+	}
+	else if (enc == col_encoding::DICT) {
+		if (in_size < 8)
+			return false;
+		size_t num_dict = in[0] & 0xFFFFFFFFUL;
+		int width = in[0] >> 32;
+		size_t dict_words = roundup8(num_dict * sizeof(T)) / 8;
+		if (width > 32 || in_size < (1 + dict_words) * 8
+				+ get_packed_size(num, width))
+			return false;
+		const T *dict = reinterpret_cast<const T *>(in + 1);
+		const uint64_t *idxs = in + 1 + dict_words;
+		uint64_t mask = get_mask(width);
+		for (size_t i = 0; i < num; i++) {
+			uint64_t idx = unpack_bits(idxs, i, width, mask);
+			if (idx >= num_dict)
+				return false;
+			out[i] = dict[idx];
+		}
+		return true;
+	}
+	else
+		return false;
+}
+
+template<class T>
+const col_codec &get_packed_codec()
+{
+	static packed_col_codec<T> codec;
+	return codec;
+}
+
+const col_codec &get_col_codec(prim_type type)
+{
+	switch(type) {
+		case P_BOOL:
+			return get_packed_codec<bool>();
+		case P_CHAR:
+			return get_packed_codec<char>();
+		case P_SHORT:
+			return get_packed_codec<short>();
+		case P_USHORT:
+			return get_packed_codec<unsigned short>();
+		case P_INTEGER:
+			return get_packed_codec<int>();
+		case P_UINT:
+			return get_packed_codec<unsigned int>();
+		case P_LONG:
+			return get_packed_codec<long>();
+		case P_ULONG:
+			return get_packed_codec<unsigned long>();
+		case P_FLOAT:
+			return get_packed_codec<float>();
+		case P_DOUBLE:
+			return get_packed_codec<double>();
+		case P_LDOUBLE:
+			{
+				static raw_col_codec<long double> codec;
+				return codec;
+			}
+		default:
+			throw invalid_arg_exception("invalid prim type");
+	}
+}
+
+template<class T>
+void append_val(std::vector<char> &buf, T val)
+{
+	const char *p = reinterpret_cast<const char *>(&val);
+	buf.insert(buf.end(), p, p + sizeof(val));
+}
+
+/*
+ * This parses the metadata in the file.
+ */
+class meta_reader
+{
+	const char *curr;
+	const char *end;
+	bool valid;
+public:
+	meta_reader(const char *buf, size_t size) {
+		curr = buf;
+		end = buf + size;
+		valid = true;
+	}
+
+	bool is_valid() const {
+		return valid;
+	}
+
+	template<class T>
+	T get() {
+		T val;
+		memset(&val, 0, sizeof(val));
+		if (curr + sizeof(T) > end)
+			valid = false;
+		else {
+			memcpy(&val, curr, sizeof(T));
+			curr += sizeof(T);
+		}
+		return val;
+	}
+
+	bool get(char *buf, size_t size) {
+		if (curr + size > end)
+			valid = false;
+		else {
+			memcpy(buf, curr, size);
+			curr += size;
+		}
+		return valid;
+	}
+};
+
+class columnar_writer
+{
+	struct col_info
+	{
+		std::string name;
+		prim_type type;
+		std::vector<columnar_file::chunk_info> chunks;
+	};
+
+	FILE *f;
+	std::string file_name;
+	size_t num_rows;
+	size_t group_size;
+	off_t curr_off;
+	std::vector<col_info> cols;
+
+	bool write(const void *buf, size_t size);
+public:
+	columnar_writer(const std::string &file_name, size_t num_rows,
+			size_t group_size) {
+		this->f = NULL;
+		this->file_name = file_name;
+		this->num_rows = num_rows;
+		this->group_size = group_size;
+		this->curr_off = 0;
+	}
+
+	~columnar_writer() {
+		if (f)
+			fclose(f);
+	}
+
+	bool open();
+
+	size_t get_num_groups() const {
+		return (num_rows + group_size - 1) / group_size;
+	}
+
+	size_t get_group_rows(off_t group_idx) const {
+		return std::min(group_size, num_rows - group_idx * group_size);
+	}
+
+	/*
+	 * Add a column to the file. Its row groups are written with
+	 * write_groups() afterwards.
+	 */
+	void add_col(const std::string &name, const scalar_type &type);
+	/*
+	 * Encode and write some row groups of a column. The data of the row
+	 * groups are given in the same order as they are in the column.
+	 * The row groups of different columns can be written in any order.
+	 */
+	bool write_groups(off_t col_idx, const std::vector<const char *> &groups,
+			off_t first_group);
+	bool close();
+};
+
+bool columnar_writer::write(const void *buf, size_t size)
+{
+	if (fwrite(buf, size, 1, f) != 1 && size > 0) {
+		BOOST_LOG_TRIVIAL(error) << boost::format("can't write to %1%: %2%")
+			% file_name % strerror(errno);
+		return false;
+	}
+	curr_off += size;
+	return true;
+}
+
+bool columnar_writer::open()
+{
+	f = fopen(file_name.c_str(), "w");
+	if (f == NULL) {
+		BOOST_LOG_TRIVIAL(error) << boost::format("can't open %1%: %2%")
+			% file_name % strerror(errno);
+		return false;
+	}
+	char header[HEADER_SIZE];
+	memset(header, 0, sizeof(header));
+	memcpy(header, MAGIC, sizeof(MAGIC));
+	memcpy(header + sizeof(MAGIC), &CURR_VERSION, sizeof(CURR_VERSION));
+	return write(header, sizeof(header));
+}
+
+void columnar_writer::add_col(const std::string &name,
+		const scalar_type &type)
+{
+	col_info col;
+	col.name = name;
+	col.type = type.get_type();
+	col.chunks.resize(get_num_groups());
+	cols.push_back(col);
+}
+
+bool columnar_writer::write_groups(off_t col_idx,
+		const std::vector<const char *> &groups, off_t first_group)
+{
+	col_info &col = cols[col_idx];
+	const col_codec &codec = get_col_codec(col.type);
+	std::vector<std::vector<uint64_t> > encoded(groups.size());
+#pragma omp parallel for
+	for (size_t i = 0; i < groups.size(); i++) {
+		off_t group_idx = first_group + i;
+		codec.encode(groups[i], get_group_rows(group_idx),
+				col.chunks[group_idx], encoded[i]);
+	}
+	for (size_t i = 0; i < groups.size(); i++) {
+		columnar_file::chunk_info &info = col.chunks[first_group + i];
+		info.off = curr_off;
+		info.size = encoded[i].size() * sizeof(uint64_t);
+		info.reserved = 0;
+		if (!write(encoded[i].data(), info.size))
+			return false;
+	}
+	return true;
+}
+
+bool columnar_writer::close()
+{
+	std::vector<char> meta;
+	append_val<uint64_t>(meta, num_rows);
+	append_val<uint64_t>(meta, group_size);
+	append_val<uint64_t>(meta, cols.size());
+	for (size_t i = 0; i < cols.size(); i++) {
+		append_val<uint32_t>(meta, cols[i].name.size());
+		meta.insert(meta.end(), cols[i].name.begin(), cols[i].name.end());
+		append_val<uint32_t>(meta, cols[i].type);
+		for (size_t j = 0; j < cols[i].chunks.size(); j++)
+			append_val(meta, cols[i].chunks[j]);
+	}
+	file_footer footer;
+	footer.meta_off = curr_off;
+	footer.meta_size = meta.size();
+	memcpy(footer.magic, MAGIC, sizeof(MAGIC));
+	bool ret = write(meta.data(), meta.size())
+		&& write(&footer, sizeof(footer));
+	if (fclose(f) != 0 && ret) {
+		BOOST_LOG_TRIVIAL(error) << boost::format("can't write to %1%: %2%")
+			% file_name % strerror(errno);
+		ret = false;
+	}
+	f = NULL;
+	return ret;
+}
+
+}
+
+bool write_columnar(const data_frame &df, const std::string &file_name,
+		size_t group_size)
+{
+	if (group_size == 0) {
+		BOOST_LOG_TRIVIAL(error) << "the row group can't be empty";
+		return false;
+	}
+	size_t num_rows = df.get_num_entries();
+	columnar_writer writer(file_name, num_rows, group_size);
+	if (!writer.open())
+		return false;
+	// We encode the row groups in parallel and fetch the data of a few
+	// row groups each time to keep the memory consumption small.
+	const size_t batch_size = get_num_omp_threads() * 2;
+	for (size_t i = 0; i < df.get_num_vecs(); i++) {
+		detail::vec_store::const_ptr vec = df.get_vec(i);
+		if (vec->get_entry_size() != vec->get_type().get_size()) {
+			BOOST_LOG_TRIVIAL(error) << boost::format(
+					"can't write column %1% with variable-length entries")
+				% df.get_vec_name(i);
+			return false;
+		}
+		writer.add_col(df.get_vec_name(i), vec->get_type());
+		for (size_t group_idx = 0; group_idx < writer.get_num_groups()
+				|| group_idx == 0; group_idx += batch_size) {
+			size_t num_groups = std::min(batch_size,
+					writer.get_num_groups() - group_idx);
+			std::vector<local_vec_store::const_ptr> portions(num_groups);
+			std::vector<const char *> groups(num_groups);
+			for (size_t j = 0; j < num_groups; j++) {
+				portions[j] = vec->get_portion((group_idx + j) * group_size,
+						writer.get_group_rows(group_idx + j));
+				groups[j] = portions[j]->get_raw_arr();
+			}
+			if (!writer.write_groups(i, groups, group_idx))
+				return false;
+		}
+	}
+	return writer.close();
+}
+
+bool write_columnar(const dense_matrix &mat, const std::string &file_name,
+		size_t group_size)
+{
+	if (group_size == 0) {
+		BOOST_LOG_TRIVIAL(error) << "the row group can't be empty";
+		return false;
+	}
+	size_t num_rows = mat.get_num_rows();
+	columnar_writer writer(file_name, num_rows, group_size);
+	if (!writer.open())
+		return false;
+	for (size_t i = 0; i < mat.get_num_cols(); i++)
+		writer.add_col((boost::format("V%1%") % (i + 1)).str(),
+				mat.get_type());
+	// Like the data frame, we only keep a few row groups of the matrix
+	// in memory each time. The rows of a batch are materialized in
+	// the column-major order, so the data of a column is contiguous.
+	const size_t batch_size = get_num_omp_threads() * 2;
+	for (size_t group_idx = 0; group_idx < writer.get_num_groups();
+			group_idx += batch_size) {
+		size_t num_groups = std::min(batch_size,
+				writer.get_num_groups() - group_idx);
+		size_t start_row = group_idx * group_size;
+		size_t end_row = std::min(num_rows,
+				start_row + num_groups * group_size);
+		dense_matrix::ptr batch = mat.get_rows(start_row, end_row);
+		if (batch == NULL)
+			return false;
+		batch = batch->conv_store(true, -1)->conv2(matrix_layout_t::L_COL);
+		batch->materialize_self();
+		detail::mem_col_matrix_store::const_ptr store
+			= detail::mem_col_matrix_store::cast(batch->get_raw_store());
+		for (size_t i = 0; i < mat.get_num_cols(); i++) {
+			std::vector<const char *> groups(num_groups);
+			for (size_t j = 0; j < num_groups; j++)
+				groups[j] = store->get(j * group_size, i);
+			if (!writer.write_groups(i, groups, group_idx))
+				return false;
+		}
+	}
+	return writer.close();
+}
+
+columnar_file::ptr columnar_file::open(const std::string &file_name)
+{
+	int fd = ::open(file_name.c_str(), O_RDONLY);
+	if (fd < 0) {
+		BOOST_LOG_TRIVIAL(error) << boost::format("can't open %1%: %2%")
+			% file_name % strerror(errno);
+		return ptr();
+	}
+	ptr f(new columnar_file(fd, file_name));
+	if (!f->read_metadata())
+		return ptr();
+	return f;
+}
+
+columnar_file::~columnar_file()
+{
+	close(fd);
+}
+
+bool columnar_file::read_metadata()
+{
+	off_t file_size = lseek(fd, 0, SEEK_END);
+	char header[HEADER_SIZE];
+	file_footer footer;
+	if (file_size < (off_t) (HEADER_SIZE + sizeof(footer))
+			|| pread(fd, header, sizeof(header), 0) != (ssize_t) sizeof(header)
+			|| pread(fd, &footer, sizeof(footer), file_size - sizeof(footer))
+			!= (ssize_t) sizeof(footer)
+			|| memcmp(header, MAGIC, sizeof(MAGIC)) != 0
+			|| memcmp(footer.magic, MAGIC, sizeof(MAGIC)) != 0) {
+		BOOST_LOG_TRIVIAL(error) << boost::format(
+				"%1% isn't a columnar file") % file_name;
+		return false;
+	}
+	uint32_t version;
+	memcpy(&version, header + sizeof(MAGIC), sizeof(version));
+	if (version != CURR_VERSION) {
+		BOOST_LOG_TRIVIAL(error) << boost::format(
+				"%1% has an unsupported version %2%") % file_name % version;
+		return false;
+	}
+	if (footer.meta_off + footer.meta_size + sizeof(footer)
+			!= (uint64_t) file_size) {
+		BOOST_LOG_TRIVIAL(error) << boost::format(
+				"%1% has corrupted metadata") % file_name;
+		return false;
+	}
+
+	std::vector<char> meta(footer.meta_size);
+	if (pread(fd, meta.data(), meta.size(), footer.meta_off)
+			!= (ssize_t) meta.size()) {
+		BOOST_LOG_TRIVIAL(error) << boost::format("can't read %1%: %2%")
+			% file_name % strerror(errno);
+		return false;
+	}
+	meta_reader reader(meta.data(), meta.size());
+	num_rows = reader.get<uint64_t>();
+	group_size = reader.get<uint64_t>();
+	size_t num_cols = reader.get<uint64_t>();
+	bool valid = reader.is_valid() && group_size > 0
+		&& num_cols <= meta.size();
+	// Every column stores the information of all row groups, so the number
+	// of row groups is bounded by the size of the metadata.
+	valid = valid && (num_cols == 0 || get_num_groups()
+			<= meta.size() / sizeof(chunk_info) / num_cols);
+	for (size_t i = 0; i < num_cols && valid; i++) {
+		col_info col;
+		uint32_t name_len = reader.get<uint32_t>();
+		if (name_len > meta.size()) {
+			valid = false;
+			break;
+		}
+		std::vector<char> name(name_len);
+		reader.get(name.data(), name_len);
+		col.name = std::string(name.begin(), name.end());
+		col.type = (prim_type) reader.get<uint32_t>();
+		col.chunks.resize(get_num_groups());
+		for (size_t j = 0; j < col.chunks.size() && reader.is_valid(); j++) {
+			col.chunks[j] = reader.get<chunk_info>();
+			// Chunks are stored in 8-byte words.
+			if (col.chunks[j].off + col.chunks[j].size > footer.meta_off
+					|| col.chunks[j].size % 8 != 0)
+				valid = false;
+		}
+		valid = valid && reader.is_valid() && col.type < prim_type::NUM_TYPES;
+		cols.push_back(col);
+	}
+	if (!valid) {
+		BOOST_LOG_TRIVIAL(error) << boost::format(
+				"%1% has corrupted metadata") % file_name;
+		return false;
+	}
+	return true;
+}
+
+off_t columnar_file::get_col_idx(const std::string &name) const
+{
+	for (size_t i = 0; i < cols.size(); i++)
+		if (cols[i].name == name)
+			return i;
+	return -1;
+}
+
+scalar_variable::ptr columnar_file::get_min(off_t col_idx,
+		off_t group_idx) const
+{
+	scalar_variable::ptr var = get_col_type(col_idx).create_scalar();
+	var->set_raw(cols[col_idx].chunks[group_idx].min, var->get_size());
+	return var;
+}
+
+scalar_variable::ptr columnar_file::get_max(off_t col_idx,
+		off_t group_idx) const
+{
+	scalar_variable::ptr var = get_col_type(col_idx).create_scalar();
+	var->set_raw(cols[col_idx].chunks[group_idx].max, var->get_size());
+	return var;
+}
+
+bool columnar_file::read_col(off_t col_idx, off_t start_row, size_t num,
+		char *out) const
+{
+	if (num == 0)
+		return true;
+	const col_info &col = cols[col_idx];
+	const col_codec &codec = get_col_codec(col.type);
+	size_t entry_size = get_col_type(col_idx).get_size();
+	size_t first_group = start_row / group_size;
+	size_t last_group = (start_row + num - 1) / group_size;
+	bool success = true;
+#pragma omp parallel for reduction(&&:success)
+	for (size_t i = first_group; i <= last_group; i++) {
+		const chunk_info &info = col.chunks[i];
+		std::vector<uint64_t> buf(info.size / 8);
+		if (pread(fd, buf.data(), info.size, info.off) != (ssize_t) info.size) {
+			BOOST_LOG_TRIVIAL(error) << boost::format("can't read %1%: %2%")
+				% file_name % strerror(errno);
+			success = false;
+			continue;
+		}
+		size_t group_start = i * group_size;
+		size_t group_rows = std::min(group_size, num_rows - group_start);
+		// If the row group is in the requested range, we can decode it
+		// to the output directly.
+		if (group_start >= (size_t) start_row
+				&& group_start + group_rows <= start_row + num) {
+			char *dest = out + (group_start - start_row) * entry_size;
+			if (!codec.decode(buf.data(), info.size, group_rows,
+						(col_encoding) info.enc, dest))
+				success = false;
+		}
+		else {
+			std::vector<char> tmp(group_rows * entry_size);
+			if (!codec.decode(buf.data(), info.size, group_rows,
+						(col_encoding) info.enc, tmp.data()))
+				success = false;
+			size_t copy_start = std::max(group_start, (size_t) start_row);
+			size_t copy_end = std::min(group_start + group_rows,
+					start_row + num);
+			memcpy(out + (copy_start - start_row) * entry_size,
+					tmp.data() + (copy_start - group_start) * entry_size,
+					(copy_end - copy_start) * entry_size);
+		}
+	}
+	if (!success)
+		BOOST_LOG_TRIVIAL(error) << boost::format(
+				"fail to decode column %1% in %2%") % col.name % file_name;
+	return success;
+}
+
+bool columnar_file::check_range(off_t start_row, size_t &num) const
+{
+	if (start_row < 0 || (size_t) start_row > num_rows) {
+		BOOST_LOG_TRIVIAL(error) << boost::format(
+				"row %1% is out of range in %2%") % start_row % file_name;
+		return false;
+	}
+	num = std::min(num, num_rows - start_row);
+	return true;
+}
+
+detail::vec_store::ptr columnar_file::read_col(off_t col_idx,
+		off_t start_row, size_t num, bool encode) const
+{
+	if (col_idx < 0 || (size_t) col_idx >= cols.size()) {
+		BOOST_LOG_TRIVIAL(error) << boost::format(
+				"column %1% doesn't exist in %2%") % col_idx % file_name;
+		return detail::vec_store::ptr();
+	}
+	if (!check_range(start_row, num))
+		return detail::vec_store::ptr();
+
+	detail::smp_vec_store::ptr vec = detail::smp_vec_store::create(num,
+			get_col_type(col_idx));
+	if (!read_col(col_idx, start_row, num, vec->get_raw_arr()))
+		return detail::vec_store::ptr();
+	if (encode && num > 0) {
+		detail::encoded_vec_store::ptr encoded
+			= detail::encoded_vec_store::create(*vec);
+		if (encoded)
+			return encoded;
+	}
+	return vec;
+}
+
+data_frame::ptr columnar_file::read_data_frame(
+		const std::vector<std::string> &col_names, off_t start_row,
+		size_t num, bool encode) const
+{
+	std::vector<off_t> col_idxs;
+	for (size_t i = 0; i < col_names.size(); i++) {
+		off_t idx = get_col_idx(col_names[i]);
+		if (idx < 0) {
+			BOOST_LOG_TRIVIAL(error) << boost::format(
+					"column %1% doesn't exist in %2%") % col_names[i] % file_name;
+			return data_frame::ptr();
+		}
+		col_idxs.push_back(idx);
+	}
+	if (col_names.empty())
+		for (size_t i = 0; i < cols.size(); i++)
+			col_idxs.push_back(i);
+
+	data_frame::ptr df = data_frame::create();
+	for (size_t i = 0; i < col_idxs.size(); i++) {
+		detail::vec_store::ptr vec = read_col(col_idxs[i], start_row, num,
+				encode);
+		if (vec == NULL || !df->add_vec(cols[col_idxs[i]].name, vec))
+			return data_frame::ptr();
+	}
+	return df;
+}
+
+dense_matrix::ptr columnar_file::read_matrix(const std::vector<off_t> &idxs,
+		off_t start_row, size_t num) const
+{
+	std::vector<off_t> col_idxs = idxs;
+	if (col_idxs.empty())
+		for (size_t i = 0; i < cols.size(); i++)
+			col_idxs.push_back(i);
+	if (col_idxs.empty()) {
+		BOOST_LOG_TRIVIAL(error) << "can't read a matrix without columns";
+		return dense_matrix::ptr();
+	}
+	for (size_t i = 0; i < col_idxs.size(); i++) {
+		if (col_idxs[i] < 0 || (size_t) col_idxs[i] >= cols.size()) {
+			BOOST_LOG_TRIVIAL(error) << boost::format(
+					"column %1% doesn't exist in %2%") % col_idxs[i] % file_name;
+			return dense_matrix::ptr();
+		}
+		if (cols[col_idxs[i]].type != cols[col_idxs[0]].type) {
+			BOOST_LOG_TRIVIAL(error)
+				<< "all columns of a matrix need to have the same type";
+			return dense_matrix::ptr();
+		}
+	}
+	if (!check_range(start_row, num))
+		return dense_matrix::ptr();
+
+	detail::mem_col_matrix_store::ptr store
+		= detail::mem_col_matrix_store::create(num, col_idxs.size(),
+				get_col_type(col_idxs[0]));
+	for (size_t i = 0; i < col_idxs.size(); i++)
+		if (!read_col(col_idxs[i], start_row, num, store->get_col(i)))
+			return dense_matrix::ptr();
+	return dense_matrix::create(store);
+}
+
+}
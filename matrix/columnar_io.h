@@ -0,0 +1,204 @@
+#ifndef __COLUMNAR_IO_H__
+#define __COLUMNAR_IO_H__
+
+/*
+ * Copyright 2017 Open Connectome Project (http://openconnecto.me)
+ * Written by Da Zheng (zhengda1936@gmail.com)
+ *
+ * This file is part of FlashMatrix.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * This file implements a binary columnar file format for data frames and
+ * dense matrices.
+ *
+ * The rows of a table are split into row groups of the same size, and
+ * each column in a row group is stored as a chunk. All chunks of a column
+ * are stored together, so we only read the columns and the row groups
+ * that are requested. Each chunk keeps the min and max values of
+ * the chunk and is stored in the encoding that requires the least space.
+ *
+ * The file layout:
+ *   header: magic number and version.
+ *   column chunks: ordered by columns and then by row groups. Each chunk
+ *     starts at an 8-byte aligned offset.
+ *   metadata: the number of rows, the size of a row group, the name and
+ *     the type of each column, and the location, the encoding and
+ *     the statistics of each chunk.
+ *   footer: the location of the metadata and the magic number.
+ */
+
+#include <stdint.h>
+
+#include <memory>
+#include <vector>
+#include <string>
+#include <limits>
+
+#include "generic_type.h"
+
+namespace fm
+{
+
+class data_frame;
+class dense_matrix;
+
+namespace detail
+{
+class vec_store;
+}
+
+enum class col_encoding
+{
+	// The values are stored as they are.
+	RAW,
+	// The values are stored as the difference with the min value in
+	// the chunk and are bit-packed. This only applies to integers.
+	FOR,
+	// The distinct values are stored in a dictionary and the indexes to
+	// the dictionary are bit-packed.
+	DICT,
+};
+
+class columnar_file
+{
+public:
+	// The max size of a value, i.e., long double.
+	static const size_t MAX_VAL_SIZE = 16;
+
+	struct chunk_info
+	{
+		uint64_t off;
+		uint64_t size;
+		uint32_t enc;
+		uint32_t reserved;
+		char min[MAX_VAL_SIZE];
+		char max[MAX_VAL_SIZE];
+	};
+private:
+	struct col_info
+	{
+		std::string name;
+		prim_type type;
+		std::vector<chunk_info> chunks;
+	};
+
+	int fd;
+	std::string file_name;
+	size_t num_rows;
+	size_t group_size;
+	std::vector<col_info> cols;
+
+	columnar_file(int fd, const std::string &file_name) {
+		this->fd = fd;
+		this->file_name = file_name;
+		num_rows = 0;
+		group_size = 0;
+	}
+	bool read_metadata();
+	bool check_range(off_t start_row, size_t &num_rows) const;
+	bool read_col(off_t col_idx, off_t start_row, size_t num_rows,
+			char *out) const;
+public:
+	typedef std::shared_ptr<columnar_file> ptr;
+
+	static ptr open(const std::string &file_name);
+
+	~columnar_file();
+
+	size_t get_num_rows() const {
+		return num_rows;
+	}
+
+	size_t get_num_cols() const {
+		return cols.size();
+	}
+
+	/*
+	 * The number of rows in a row group.
+	 */
+	size_t get_group_size() const {
+		return group_size;
+	}
+
+	size_t get_num_groups() const {
+		return num_rows / group_size + (num_rows % group_size != 0);
+	}
+
+	const std::string &get_col_name(off_t idx) const {
+		return cols[idx].name;
+	}
+
+	/*
+	 * Get the index of a column. It returns -1 if the column doesn't exist.
+	 */
+	off_t get_col_idx(const std::string &name) const;
+
+	const scalar_type &get_col_type(off_t idx) const {
+		return get_scalar_type(cols[idx].type);
+	}
+
+	col_encoding get_encoding(off_t col_idx, off_t group_idx) const {
+		return (col_encoding) cols[col_idx].chunks[group_idx].enc;
+	}
+
+	/*
+	 * Get the statistics of a column in a row group. NaN is ignored in
+	 * the statistics.
+	 */
+	scalar_variable::ptr get_min(off_t col_idx, off_t group_idx) const;
+	scalar_variable::ptr get_max(off_t col_idx, off_t group_idx) const;
+
+	/*
+	 * Read a range of rows in a column.
+	 * If `encode' is true, the column is kept encoded in memory
+	 * (see encoded_vec_store) if an encoding saves space. The column is
+	 * decoded first, so reading it still needs memory for the raw values.
+	 */
+	std::shared_ptr<detail::vec_store> read_col(off_t col_idx,
+			off_t start_row = 0,
+			size_t num_rows = std::numeric_limits<size_t>::max(),
+			bool encode = false) const;
+	/*
+	 * Read a range of rows in the specified columns into a data frame.
+	 * If no column is specified, all columns are read.
+	 * If `encode' is true, the columns are kept encoded in memory.
+	 */
+	std::shared_ptr<data_frame> read_data_frame(
+			const std::vector<std::string> &col_names, off_t start_row = 0,
+			size_t num_rows = std::numeric_limits<size_t>::max(),
+			bool encode = false) const;
+	/*
+	 * Read a range of rows in the specified columns into a column-major
+	 * dense matrix. All columns need to have the same type.
+	 * If no column is specified, all columns are read.
+	 */
+	std::shared_ptr<dense_matrix> read_matrix(
+			const std::vector<off_t> &col_idxs, off_t start_row = 0,
+			size_t num_rows = std::numeric_limits<size_t>::max()) const;
+};
+
+/*
+ * Write a data frame or a dense matrix to a file in the columnar format.
+ * The columns of a dense matrix are named "V1", "V2", ...
+ */
+bool write_columnar(const data_frame &df, const std::string &file_name,
+		size_t group_size = 64 * 1024);
+bool write_columnar(const dense_matrix &mat, const std::string &file_name,
+		size_t group_size = 64 * 1024);
+
+}
+
+#endif
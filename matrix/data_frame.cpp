@@ -30,6 +30,7 @@
 #include "vector_vector.h"
 #include "EM_vv_store.h"
 #include "bulk_operate_ext.h"
+#include "encoded_vec_store.h"
 
 namespace fm
 {
@@ -67,6 +68,28 @@ data_frame::const_ptr data_frame::shuffle_vecs(
 	return data_frame::create(sub_vecs);
 }
 
+/*
+ * Append vectors to a column. An encoded column can't be modified, so
+ * it's decoded, appended and encoded again with the same encoding.
+ */
+static bool append_col(detail::vec_store::ptr &col,
+		std::vector<detail::vec_store::const_ptr>::const_iterator begin,
+		std::vector<detail::vec_store::const_ptr>::const_iterator end)
+{
+	detail::encoded_vec_store::ptr encoded
+		= detail::encoded_vec_store::cast(col);
+	if (encoded == NULL)
+		return col->append(begin, end);
+
+	detail::vec_store::ptr decoded = encoded->decode();
+	if (!decoded->append(begin, end))
+		return false;
+	detail::vec_store::ptr tmp = detail::encoded_vec_store::create(*decoded,
+			encoded->get_encoding());
+	col = tmp ? tmp : decoded;
+	return true;
+}
+
 bool data_frame::append(std::vector<data_frame::ptr>::const_iterator begin,
 		std::vector<data_frame::ptr>::const_iterator end)
 {
@@ -101,9 +124,14 @@ bool data_frame::append(std::vector<data_frame::ptr>::const_iterator begin,
 		}
 	}
 
-	for (auto it = vecs.begin(); it != vecs.end(); it++) {
-		detail::vec_store::ptr vec = get_vec(it->first);
-		vec->append(it->second.begin() + 1, it->second.end());
+	for (size_t i = 0; i < named_vecs.size(); i++) {
+		auto it = vecs.find(named_vecs[i].first);
+		assert(it != vecs.end());
+		detail::vec_store::ptr col = named_vecs[i].second;
+		if (!append_col(col, it->second.begin() + 1, it->second.end()))
+			return false;
+		if (col != named_vecs[i].second)
+			set_vec(i, col);
 	}
 	return true;
 }
@@ -119,8 +147,15 @@ bool data_frame::append(data_frame::ptr df)
 		}
 	}
 
-	for (auto it = named_vecs.begin(); it != named_vecs.end(); it++)
-		it->second->append(*df->get_vec(it->first));
+	for (size_t i = 0; i < named_vecs.size(); i++) {
+		std::vector<detail::vec_store::const_ptr> vecs(1,
+				df->get_vec(named_vecs[i].first));
+		detail::vec_store::ptr col = named_vecs[i].second;
+		if (!append_col(col, vecs.begin(), vecs.end()))
+			return false;
+		if (col != named_vecs[i].second)
+			set_vec(i, col);
+	}
 	return true;
 }
 
@@ -138,15 +173,16 @@ data_frame::const_ptr data_frame::sort(const std::string &col_name) const
 	data_frame::ptr ret(new data_frame());
 	if (is_in_mem()) {
 		detail::vec_store::ptr copy_col = sorted_col->deep_copy();
-		detail::smp_vec_store::ptr idxs = detail::smp_vec_store::cast(
+		detail::smp_vec_store::const_ptr idxs = detail::get_smp_vec(
 				copy_col->sort_with_index());
 		for (size_t i = 0; i < get_num_vecs(); i++) {
-			detail::smp_vec_store::const_ptr mem_vec
-				= detail::smp_vec_store::cast(get_vec(i));
-			if (mem_vec == sorted_col) {
+			if (get_vec(i) == sorted_col) {
 				ret->add_vec(col_name, copy_col);
 			}
 			else {
+				// The column may be encoded or in NUMA memory.
+				detail::smp_vec_store::const_ptr mem_vec
+					= detail::get_smp_vec(get_vec(i));
 				detail::mem_vec_store::ptr tmp = mem_vec->get(*idxs);
 				ret->add_vec(get_vec_name(i), tmp);
 			}
@@ -238,7 +274,8 @@ data_frame::ptr merge_data_frame(const std::vector<data_frame::const_ptr> &dfs,
 			}
 			vecs.push_back(dfs[df_idx]->named_vecs[vec_idx].second);
 		}
-		vec->append(vecs.begin(), vecs.end());
+		if (!append_col(vec, vecs.begin(), vecs.end()))
+			return data_frame::ptr();
 		df->add_vec(vec_name, vec);
 	}
 	return df;
@@ -972,9 +1009,9 @@ static void parallel_groupby_async(data_frame::const_ptr sorted_df,
 		off_t sorted_col_idx, const gr_apply_operate<sub_data_frame> &op,
 		vv_index_append::ptr append)
 {
-	detail::mem_vec_store::const_ptr sorted_col
-		= std::dynamic_pointer_cast<const detail::mem_vec_store>(
-				sorted_df->get_vec(sorted_col_idx));
+	// The sorted column may be encoded.
+	detail::mem_vec_store::const_ptr sorted_col = detail::get_smp_vec(
+			sorted_df->get_vec(sorted_col_idx));
 	groupby_task_queue::ptr q = groupby_task_queue::create(0,
 			sorted_col, is_all_vec(*sorted_df), append);
 	append->inc_tot_appends(q->get_num_parts());
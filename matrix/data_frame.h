@@ -33,6 +33,7 @@ namespace fm
 {
 
 class local_vec_store;
+class agg_operate;
 
 typedef std::pair<std::string, detail::vec_store::ptr> named_vec_t;
 typedef std::pair<std::string, detail::vec_store::const_ptr> named_cvec_t;
@@ -44,6 +45,19 @@ class data_frame;
 
 std::shared_ptr<data_frame> merge_data_frame(
 		const std::vector<std::shared_ptr<const data_frame> > &dfs, bool in_mem);
+/*
+ * This joins two data frames on the key columns (inner equi-join).
+ * The key columns need to have the same type.
+ * The returned data frame has the key column, the other columns in
+ * the left data frame and the other columns in the right data frame.
+ * If the two data frames have columns with the same name, ".x" and ".y"
+ * are appended to the names of the left and right columns.
+ * If both data frames are in memory, the result is stored in memory.
+ * Otherwise, the result is stored on disks.
+ */
+std::shared_ptr<data_frame> join_data_frame(const data_frame &left,
+		const data_frame &right, const std::string &left_key,
+		const std::string &right_key);
 
 /**
  * This implements the data frame in R.
@@ -150,6 +164,21 @@ public:
 	 */
 	data_frame::const_ptr sort(const std::string &col_name) const;
 	bool is_sorted(const std::string &col_name) const;
+	/*
+	 * This aggregates columns on the keys in the specified column.
+	 * `ops[i]' aggregates column `val_cols[i]' and all aggregations are
+	 * computed in a single pass over the data. The aggregation operators
+	 * need to have combine operators.
+	 * It uses hash aggregation. When the hashtable doesn't fit in
+	 * `groupby_buf_size', the partial aggregation results are split into
+	 * partitions by the hash values of the keys and written to disks,
+	 * and the partitions are merged afterwards.
+	 * The returned data frame has the key column and a column for each
+	 * aggregation, and the keys aren't in any particular order.
+	 */
+	data_frame::ptr aggregate(const std::string &key_col,
+			const std::vector<std::string> &val_cols,
+			const std::vector<std::shared_ptr<const agg_operate> > &ops) const;
 
 	data_frame::const_ptr shallow_copy() const;
 
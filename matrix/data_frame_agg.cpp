@@ -0,0 +1,507 @@
+/*
+ * Copyright 2017 Open Connectome Project (http://openconnecto.me)
+ * Written by Da Zheng (zhengda1936@gmail.com)
+ *
+ * This file is part of FlashMatrix.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <unordered_set>
+
+#include <boost/format.hpp>
+
+#include "log.h"
+#include "common.h"
+
+#include "matrix_config.h"
+#include "data_frame.h"
+#include "mem_vec_store.h"
+#include "local_vec_store.h"
+#include "bulk_operate.h"
+#include "bulk_operate_ext.h"
+#include "generic_hashtable.h"
+
+/*
+ * This file implements streaming hash aggregation on data frames.
+ *
+ * The rows are read in chunks and the chunks are aggregated by multiple
+ * threads in parallel. Each thread groups the rows in a chunk with a local
+ * hashtable and aggregates each group with the aggregation operator.
+ * The partial results of the chunks are then combined into a global
+ * hashtable with the combine operator.
+ *
+ * When the global hashtable uses more memory than `groupby_buf_size', we
+ * split the partial results in the hashtable into partitions by the hash
+ * values of the keys, append them to the partitions on disks and clear
+ * the hashtable. After all rows are processed, each partition is
+ * aggregated again with the combine operators, which may spill again on
+ * other bits of the hash values.
+ */
+
+namespace fm
+{
+
+namespace
+{
+
+// The number of partitions that the partial results are split into
+// when the hashtable is spilled.
+static const int SPILL_BITS = 4;
+// The hash bits starting from here are used for the partitions.
+// They don't overlap with the bits used by the hashtable.
+static const int SPILL_SHIFT = 44;
+// The max number of times that the data can be spilled. After that,
+// the partition is aggregated in memory regardless of its size.
+static const int MAX_SPILL_LEVELS = 3;
+
+/*
+ * The keys and their aggregation results.
+ */
+struct agg_part
+{
+	detail::smp_vec_store::ptr keys;
+	std::vector<detail::smp_vec_store::ptr> aggs;
+};
+
+class agg_table
+{
+public:
+	typedef std::shared_ptr<agg_table> ptr;
+
+	virtual ~agg_table() {
+	}
+
+	/*
+	 * Aggregate a chunk of rows locally. It doesn't change the table,
+	 * so it can run in parallel.
+	 */
+	virtual agg_part local_agg(const char *keys, size_t num,
+			const std::vector<const char *> &vals) const = 0;
+	/*
+	 * Combine the partial results into the table.
+	 */
+	virtual void merge(const agg_part &part) = 0;
+	/*
+	 * Split all groups in the table into partitions by the hash values of
+	 * the keys and clear the table.
+	 */
+	virtual std::vector<agg_part> split(int shift, size_t num_parts) = 0;
+	virtual size_t get_mem_size() const = 0;
+};
+
+template<class T>
+class hash_agg_table: public agg_table
+{
+	typedef flat_hashtable<T, off_t> table_t;
+	const std::vector<agg_operate::const_ptr> &ops;
+	// This maps a key to the group.
+	std::unique_ptr<table_t> table;
+	// The keys and the aggregation results of the groups.
+	agg_part groups;
+	size_t num_groups;
+
+	void reset() {
+		table = std::unique_ptr<table_t>(new table_t());
+		groups.keys = detail::smp_vec_store::create(0, get_scalar_type<T>());
+		groups.aggs.resize(ops.size());
+		for (size_t i = 0; i < ops.size(); i++)
+			groups.aggs[i] = detail::smp_vec_store::create(0,
+					ops[i]->get_output_type());
+		num_groups = 0;
+	}
+public:
+	hash_agg_table(const std::vector<agg_operate::const_ptr> &_ops): ops(_ops) {
+		reset();
+	}
+
+	virtual agg_part local_agg(const char *keys, size_t num,
+			const std::vector<const char *> &vals) const;
+	virtual void merge(const agg_part &part);
+	virtual std::vector<agg_part> split(int shift, size_t num_parts);
+
+	virtual size_t get_mem_size() const {
+		size_t size = table->get_num_slots() * (1 + sizeof(T) + sizeof(off_t)
+				+ sizeof(bool));
+		size += groups.keys->get_reserved_size() * sizeof(T);
+		for (size_t i = 0; i < groups.aggs.size(); i++)
+			size += groups.aggs[i]->get_reserved_size()
+				* groups.aggs[i]->get_entry_size();
+		return size;
+	}
+};
+
+template<class T>
+agg_part hash_agg_table<T>::local_agg(const char *keys, size_t num,
+		const std::vector<const char *> &vals) const
+{
+	const T *tkeys = (const T *) keys;
+	// Assign a local id to each distinct key in the chunk.
+	table_t local;
+	local.reserve(num);
+	std::vector<off_t> lids(num);
+	std::vector<off_t> first_rows;
+	for (size_t i = 0; i < num; i++) {
+		bool inserted;
+		size_t idx = local.find_or_insert(tkeys[i], get_hash_code(tkeys[i]),
+				inserted);
+		if (inserted) {
+			local.get_val(idx) = first_rows.size();
+			first_rows.push_back(i);
+		}
+		lids[i] = local.get_val(idx);
+	}
+	size_t num_groups = first_rows.size();
+
+	// Put the rows of the same group together.
+	std::vector<size_t> offs(num_groups + 1);
+	for (size_t i = 0; i < num; i++)
+		offs[lids[i] + 1]++;
+	for (size_t i = 0; i < num_groups; i++)
+		offs[i + 1] += offs[i];
+	std::vector<off_t> rows(num);
+	std::vector<size_t> locs(offs.begin(), offs.end() - 1);
+	for (size_t i = 0; i < num; i++)
+		rows[locs[lids[i]]++] = i;
+
+	agg_part ret;
+	ret.keys = detail::smp_vec_store::create(num_groups, get_scalar_type<T>());
+	for (size_t i = 0; i < num_groups; i++)
+		ret.keys->set<T>(i, tkeys[first_rows[i]]);
+	ret.aggs.resize(ops.size());
+	for (size_t k = 0; k < ops.size(); k++) {
+		const agg_operate &op = *ops[k];
+		detail::smp_vec_store::ptr sorted = detail::smp_vec_store::create(0,
+				op.get_input_type());
+		sorted->append_rows(vals[k], rows);
+		ret.aggs[k] = detail::smp_vec_store::create(num_groups,
+				op.get_output_type());
+		for (size_t i = 0; i < num_groups; i++)
+			op.runAgg(offs[i + 1] - offs[i], sorted->get(offs[i]),
+					ret.aggs[k]->get(i));
+	}
+	return ret;
+}
+
+template<class T>
+void hash_agg_table<T>::merge(const agg_part &part)
+{
+	// The keys in the partial results are distinct.
+	size_t num = part.keys->get_length();
+	table->reserve(table->get_num_entries() + num);
+	std::vector<off_t> new_srcs;
+	std::vector<off_t> old_srcs, old_dsts;
+	for (size_t i = 0; i < num; i++) {
+		T key = part.keys->get<T>(i);
+		bool inserted;
+		size_t idx = table->find_or_insert(key, get_hash_code(key), inserted);
+		if (inserted) {
+			table->get_val(idx) = num_groups++;
+			new_srcs.push_back(i);
+		}
+		else {
+			old_srcs.push_back(i);
+			old_dsts.push_back(table->get_val(idx));
+		}
+	}
+
+	// The new groups are added to the end.
+	groups.keys->append_rows(part.keys->get_raw_arr(), new_srcs);
+	for (size_t k = 0; k < ops.size(); k++)
+		groups.aggs[k]->append_rows(part.aggs[k]->get_raw_arr(), new_srcs);
+	assert(groups.keys->get_length() == num_groups);
+
+	// Combine the partial results of the existing groups.
+	if (old_srcs.empty())
+		return;
+	for (size_t k = 0; k < ops.size(); k++) {
+		detail::smp_vec_store &agg = *groups.aggs[k];
+		detail::smp_vec_store::ptr olds = detail::smp_vec_store::create(0,
+				agg.get_type());
+		detail::smp_vec_store::ptr news = detail::smp_vec_store::create(0,
+				agg.get_type());
+		olds->append_rows(agg.get_raw_arr(), old_dsts);
+		news->append_rows(part.aggs[k]->get_raw_arr(), old_srcs);
+		ops[k]->get_combine().runAA(olds->get_length(), olds->get_raw_arr(),
+				news->get_raw_arr(), olds->get_raw_arr());
+		size_t entry_size = agg.get_entry_size();
+		for (size_t i = 0; i < old_dsts.size(); i++)
+			memcpy(agg.get(old_dsts[i]), olds->get(i), entry_size);
+	}
+}
+
+template<class T>
+std::vector<agg_part> hash_agg_table<T>::split(int shift, size_t num_parts)
+{
+	std::vector<agg_part> parts(num_parts);
+	if (num_parts == 1)
+		parts[0] = groups;
+	else {
+		std::vector<std::vector<off_t> > rows(num_parts);
+		for (size_t i = 0; i < num_groups; i++)
+			rows[(get_hash_code(groups.keys->get<T>(i)) >> shift)
+				& (num_parts - 1)].push_back(i);
+#pragma omp parallel for
+		for (size_t p = 0; p < num_parts; p++) {
+			parts[p].keys = detail::smp_vec_store::create(0,
+					get_scalar_type<T>());
+			parts[p].keys->append_rows(groups.keys->get_raw_arr(), rows[p]);
+			parts[p].aggs.resize(ops.size());
+			for (size_t k = 0; k < ops.size(); k++) {
+				parts[p].aggs[k] = detail::smp_vec_store::create(0,
+						ops[k]->get_output_type());
+				parts[p].aggs[k]->append_rows(groups.aggs[k]->get_raw_arr(),
+						rows[p]);
+			}
+		}
+	}
+	reset();
+	return parts;
+}
+
+agg_table::ptr create_agg_table(const scalar_type &key_type,
+		const std::vector<agg_operate::const_ptr> &ops)
+{
+	switch(key_type.get_type()) {
+		case P_BOOL:
+			return agg_table::ptr(new hash_agg_table<bool>(ops));
+		case P_CHAR:
+			return agg_table::ptr(new hash_agg_table<char>(ops));
+		case P_SHORT:
+			return agg_table::ptr(new hash_agg_table<short>(ops));
+		case P_USHORT:
+			return agg_table::ptr(new hash_agg_table<unsigned short>(ops));
+		case P_INTEGER:
+			return agg_table::ptr(new hash_agg_table<int>(ops));
+		case P_UINT:
+			return agg_table::ptr(new hash_agg_table<unsigned int>(ops));
+		case P_LONG:
+			return agg_table::ptr(new hash_agg_table<long>(ops));
+		case P_ULONG:
+			return agg_table::ptr(new hash_agg_table<unsigned long>(ops));
+		case P_FLOAT:
+			return agg_table::ptr(new hash_agg_table<float>(ops));
+		case P_DOUBLE:
+			return agg_table::ptr(new hash_agg_table<double>(ops));
+		case P_LDOUBLE:
+			return agg_table::ptr(new hash_agg_table<long double>(ops));
+		default:
+			BOOST_LOG_TRIVIAL(error) << "unsupported key type";
+			return agg_table::ptr();
+	}
+}
+
+class stream_agg
+{
+	const scalar_type &key_type;
+	std::vector<agg_operate::const_ptr> ops;
+	int level;
+	agg_table::ptr table;
+	// The partial results written to disks. Each partition has the key
+	// vector and a vector for each aggregation.
+	std::vector<std::vector<detail::vec_store::ptr> > spills;
+
+	void spill();
+public:
+	stream_agg(const scalar_type &_key_type,
+			const std::vector<agg_operate::const_ptr> &ops,
+			int level): key_type(_key_type) {
+		this->ops = ops;
+		this->level = level;
+		table = create_agg_table(key_type, this->ops);
+	}
+
+	/*
+	 * Aggregate all rows in the columns. The first column contains the keys
+	 * and `ops[i]' aggregates column i + 1.
+	 */
+	bool run(const std::vector<detail::vec_store::const_ptr> &cols);
+	/*
+	 * Append the final aggregation results to the output vectors.
+	 */
+	bool finish(std::vector<detail::vec_store::ptr> &out);
+};
+
+void stream_agg::spill()
+{
+	const size_t num_parts = 1 << SPILL_BITS;
+	std::vector<agg_part> parts = table->split(
+			SPILL_SHIFT + level * SPILL_BITS, num_parts);
+	if (spills.empty()) {
+		BOOST_LOG_TRIVIAL(info) << boost::format(
+				"spill partial aggregation results at level %1%") % level;
+		spills.resize(num_parts);
+		for (size_t p = 0; p < num_parts; p++) {
+			spills[p].push_back(detail::vec_store::create(0, key_type, -1,
+						false));
+			for (size_t k = 0; k < ops.size(); k++)
+				spills[p].push_back(detail::vec_store::create(0,
+							ops[k]->get_output_type(), -1, false));
+		}
+	}
+	for (size_t p = 0; p < num_parts; p++) {
+		if (parts[p].keys->get_length() == 0)
+			continue;
+		spills[p][0]->append(*parts[p].keys);
+		for (size_t k = 0; k < ops.size(); k++)
+			spills[p][k + 1]->append(*parts[p].aggs[k]);
+	}
+}
+
+bool stream_agg::run(const std::vector<detail::vec_store::const_ptr> &cols)
+{
+	const size_t num_rows = cols[0]->get_length();
+	const size_t chunk_rows = cols[0]->get_portion_size();
+	const size_t num_threads = get_num_omp_threads();
+	for (size_t start = 0; start < num_rows;
+			start += chunk_rows * num_threads) {
+		// Each thread aggregates a chunk.
+		size_t num_chunks = std::min(num_threads,
+				(num_rows - start + chunk_rows - 1) / chunk_rows);
+		std::vector<std::vector<local_vec_store::const_ptr> > chunks(
+				num_chunks);
+		for (size_t i = 0; i < num_chunks; i++) {
+			off_t chunk_start = start + i * chunk_rows;
+			size_t len = std::min(chunk_rows, num_rows - chunk_start);
+			for (size_t j = 0; j < cols.size(); j++) {
+				local_vec_store::const_ptr portion = cols[j]->get_portion(
+						chunk_start, len);
+				if (portion == NULL) {
+					BOOST_LOG_TRIVIAL(error) << boost::format(
+							"can't get rows [%1%, %2%) of a column")
+						% chunk_start % (chunk_start + len);
+					return false;
+				}
+				chunks[i].push_back(portion);
+			}
+		}
+
+		std::vector<agg_part> parts(num_chunks);
+#pragma omp parallel for schedule(dynamic, 1)
+		for (size_t i = 0; i < num_chunks; i++) {
+			std::vector<const char *> vals(ops.size());
+			for (size_t k = 0; k < ops.size(); k++)
+				vals[k] = chunks[i][k + 1]->get_raw_arr();
+			parts[i] = table->local_agg(chunks[i][0]->get_raw_arr(),
+					chunks[i][0]->get_length(), vals);
+		}
+		chunks.clear();
+
+		for (size_t i = 0; i < num_chunks; i++) {
+			table->merge(parts[i]);
+			parts[i] = agg_part();
+			if (level < MAX_SPILL_LEVELS
+					&& table->get_mem_size() > matrix_conf.get_groupby_buf_size())
+				spill();
+		}
+	}
+	return true;
+}
+
+bool stream_agg::finish(std::vector<detail::vec_store::ptr> &out)
+{
+	if (spills.empty()) {
+		agg_part res = table->split(0, 1)[0];
+		if (res.keys->get_length() == 0)
+			return true;
+		out[0]->append(*res.keys);
+		for (size_t k = 0; k < ops.size(); k++)
+			out[k + 1]->append(*res.aggs[k]);
+		return true;
+	}
+
+	spill();
+	// The partial results are merged with the combine operators.
+	std::vector<agg_operate::const_ptr> combine_ops(ops.size());
+	for (size_t k = 0; k < ops.size(); k++)
+		combine_ops[k] = agg_operate::create(ops[k]->get_combine_ptr());
+	for (size_t p = 0; p < spills.size(); p++) {
+		if (spills[p][0]->get_length() == 0)
+			continue;
+		std::vector<detail::vec_store::const_ptr> cols(spills[p].begin(),
+				spills[p].end());
+		// We don't need to keep the partition after it's processed.
+		spills[p].clear();
+		stream_agg sub(key_type, combine_ops, level + 1);
+		if (!sub.run(cols) || !sub.finish(out))
+			return false;
+	}
+	return true;
+}
+
+}
+
+data_frame::ptr data_frame::aggregate(const std::string &key_col,
+		const std::vector<std::string> &val_cols,
+		const std::vector<agg_operate::const_ptr> &ops) const
+{
+	std::vector<detail::vec_store::const_ptr> cols;
+	cols.push_back(get_vec(key_col));
+	if (cols[0] == NULL) {
+		BOOST_LOG_TRIVIAL(error) << boost::format(
+				"The column %1% doesn't exist") % key_col;
+		return data_frame::ptr();
+	}
+	if (val_cols.size() != ops.size()) {
+		BOOST_LOG_TRIVIAL(error)
+			<< "The number of columns and aggregations don't match";
+		return data_frame::ptr();
+	}
+	for (size_t i = 0; i < val_cols.size(); i++) {
+		detail::vec_store::const_ptr col = get_vec(val_cols[i]);
+		if (col == NULL) {
+			BOOST_LOG_TRIVIAL(error) << boost::format(
+					"The column %1% doesn't exist") % val_cols[i];
+			return data_frame::ptr();
+		}
+		if (col->get_type() != ops[i]->get_input_type()) {
+			BOOST_LOG_TRIVIAL(error) << boost::format(
+					"The column %1% doesn't have the input type of the aggregation")
+				% val_cols[i];
+			return data_frame::ptr();
+		}
+		if (!ops[i]->has_combine()) {
+			BOOST_LOG_TRIVIAL(error)
+				<< "The aggregation doesn't have a combine operator";
+			return data_frame::ptr();
+		}
+		cols.push_back(col);
+	}
+
+	bool in_mem = is_in_mem();
+	std::vector<detail::vec_store::ptr> out;
+	out.push_back(detail::vec_store::create(0, cols[0]->get_type(), -1, in_mem));
+	for (size_t i = 0; i < ops.size(); i++)
+		out.push_back(detail::vec_store::create(0, ops[i]->get_output_type(),
+					-1, in_mem));
+	stream_agg agg(cols[0]->get_type(), ops, 0);
+	if (!agg.run(cols) || !agg.finish(out))
+		return data_frame::ptr();
+
+	// A column may be aggregated multiple times, so we need to make
+	// the names of the result columns unique.
+	std::unordered_set<std::string> names;
+	names.insert(key_col);
+	data_frame::ptr ret = data_frame::create();
+	ret->add_vec(key_col, out[0]);
+	for (size_t i = 0; i < val_cols.size(); i++) {
+		std::string name = val_cols[i];
+		if (names.find(name) != names.end())
+			name = (boost::format("%1%.%2%") % name % (i + 1)).str();
+		names.insert(name);
+		ret->add_vec(name, out[i + 1]);
+	}
+	return ret;
+}
+
+}
@@ -0,0 +1,661 @@
+/*
+ * Copyright 2017 Open Connectome Project (http://openconnecto.me)
+ * Written by Da Zheng (zhengda1936@gmail.com)
+ *
+ * This file is part of FlashMatrix.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdint.h>
+
+#include <unordered_set>
+
+#include <boost/format.hpp>
+
+#include "log.h"
+#include "common.h"
+
+#include "matrix_config.h"
+#include "data_frame.h"
+#include "mem_vec_store.h"
+#include "local_vec_store.h"
+#include "bulk_operate.h"
+#include "generic_hashtable.h"
+
+/*
+ * This file implements the equi-join of two data frames.
+ *
+ * In-memory data frames are joined with a radix-partitioned hash join.
+ * Both data frames are partitioned on the high bits of the hash values of
+ * the keys, so the hashtable built for a partition fits in the CPU cache.
+ * Each thread partitions a contiguous range of rows and writes them to
+ * the partitions, and then each pair of partitions is joined by a thread
+ * independently.
+ *
+ * External-memory data frames are joined with grace hash join. Both data
+ * frames are split into partitions on other bits of the hash values and
+ * the partitions are written to SAFS. A pair of partitions that fits in
+ * memory is joined with the in-memory hash join. A pair that doesn't fit,
+ * e.g., because of skewed keys, is split again with a different hash
+ * function. If most of its rows have the same key, splitting doesn't
+ * help, so the pair is joined block by block instead.
+ */
+
+namespace fm
+{
+
+namespace
+{
+
+// The hash bits starting from here are used by the grace hash join.
+static const int GRACE_SHIFT = 32;
+// The max number of times that the grace hash join splits a partition.
+static const int MAX_GRACE_LEVEL = 4;
+// The max number of bits used by the radix partitioning.
+static const int MAX_PART_BITS = 12;
+// We want the hashtable of a partition to have this many rows.
+static const size_t PART_BUILD_SIZE = 16 * 1024;
+
+template<class T>
+struct join_entry
+{
+	T key;
+	off_t idx;
+};
+
+static inline size_t get_radix_part(uint64_t hash, int part_bits)
+{
+	return part_bits == 0 ? 0 : hash >> (64 - part_bits);
+}
+
+/*
+ * Partition the keys on the highest `part_bits' bits of their hash values.
+ * The entries in a partition keep the order in the input array.
+ * Partition i is stored in [part_offs[i], part_offs[i + 1]) of `out'.
+ */
+template<class T>
+void radix_partition(const T *keys, size_t num, int part_bits,
+		std::unique_ptr<join_entry<T>[]> &out, std::vector<size_t> &part_offs)
+{
+	const size_t num_parts = 1UL << part_bits;
+	const size_t num_threads = get_num_omp_threads();
+	const size_t part_len = (num + num_threads - 1) / num_threads;
+	out = std::unique_ptr<join_entry<T>[]>(new join_entry<T>[num]);
+	std::vector<size_t> counts(num_threads * num_parts);
+#pragma omp parallel for
+	for (size_t t = 0; t < num_threads; t++) {
+		size_t start = std::min(num, t * part_len);
+		size_t end = std::min(num, start + part_len);
+		size_t *count = &counts[t * num_parts];
+		for (size_t i = start; i < end; i++)
+			count[get_radix_part(get_hash_code(keys[i]), part_bits)]++;
+	}
+
+	// The entries of a thread in a partition are placed after the ones of
+	// the previous threads.
+	part_offs.resize(num_parts + 1);
+	size_t off = 0;
+	for (size_t p = 0; p < num_parts; p++) {
+		part_offs[p] = off;
+		for (size_t t = 0; t < num_threads; t++) {
+			size_t c = counts[t * num_parts + p];
+			counts[t * num_parts + p] = off;
+			off += c;
+		}
+	}
+	part_offs[num_parts] = off;
+	assert(off == num);
+
+#pragma omp parallel for
+	for (size_t t = 0; t < num_threads; t++) {
+		size_t start = std::min(num, t * part_len);
+		size_t end = std::min(num, start + part_len);
+		size_t *count = &counts[t * num_parts];
+		for (size_t i = start; i < end; i++) {
+			size_t p = get_radix_part(get_hash_code(keys[i]), part_bits);
+			join_entry<T> &e = out[count[p]++];
+			e.key = keys[i];
+			e.idx = i;
+		}
+	}
+}
+
+/*
+ * Join a partition. It outputs the pairs of the matched rows in the probe
+ * side and the build side.
+ */
+template<class T>
+void join_part(const join_entry<T> *build, size_t num_build,
+		const join_entry<T> *probe, size_t num_probe,
+		std::vector<std::pair<off_t, off_t> > &res)
+{
+	if (num_build == 0 || num_probe == 0)
+		return;
+
+	// The low bits of the hash values are used to locate the buckets.
+	size_t num_buckets = 1;
+	while (num_buckets < num_build)
+		num_buckets *= 2;
+	std::vector<off_t> heads(num_buckets, -1);
+	std::vector<off_t> next(num_build);
+	// We insert the rows in the reverse order, so the rows in a bucket are
+	// in the original order.
+	for (off_t i = num_build - 1; i >= 0; i--) {
+		size_t b = get_hash_code(build[i].key) & (num_buckets - 1);
+		next[i] = heads[b];
+		heads[b] = i;
+	}
+	for (size_t i = 0; i < num_probe; i++) {
+		size_t b = get_hash_code(probe[i].key) & (num_buckets - 1);
+		for (off_t j = heads[b]; j >= 0; j = next[j])
+			if (build[j].key == probe[i].key)
+				res.push_back(std::pair<off_t, off_t>(probe[i].idx,
+							build[j].idx));
+	}
+}
+
+template<class T>
+void hash_join(const T *lkeys, size_t lnum, const T *rkeys, size_t rnum,
+		detail::smp_vec_store::ptr &lidxs, detail::smp_vec_store::ptr &ridxs)
+{
+	// We build hashtables on the smaller data frame.
+	bool build_left = lnum < rnum;
+	const T *bkeys = build_left ? lkeys : rkeys;
+	const T *pkeys = build_left ? rkeys : lkeys;
+	size_t num_build = build_left ? lnum : rnum;
+	size_t num_probe = build_left ? rnum : lnum;
+
+	const size_t num_threads = get_num_omp_threads();
+	int part_bits = 0;
+	while (part_bits < MAX_PART_BITS && ((1UL << part_bits) < num_threads * 4
+				|| (num_build >> part_bits) > PART_BUILD_SIZE))
+		part_bits++;
+	const size_t num_parts = 1UL << part_bits;
+	std::unique_ptr<join_entry<T>[]> build_parts;
+	std::unique_ptr<join_entry<T>[]> probe_parts;
+	std::vector<size_t> build_offs;
+	std::vector<size_t> probe_offs;
+	radix_partition(bkeys, num_build, part_bits, build_parts, build_offs);
+	radix_partition(pkeys, num_probe, part_bits, probe_parts, probe_offs);
+
+	std::vector<std::vector<std::pair<off_t, off_t> > > res(num_parts);
+#pragma omp parallel for schedule(dynamic, 1)
+	for (size_t p = 0; p < num_parts; p++)
+		join_part(build_parts.get() + build_offs[p],
+				build_offs[p + 1] - build_offs[p],
+				probe_parts.get() + probe_offs[p],
+				probe_offs[p + 1] - probe_offs[p], res[p]);
+
+	std::vector<size_t> res_offs(num_parts + 1);
+	for (size_t p = 0; p < num_parts; p++)
+		res_offs[p + 1] = res_offs[p] + res[p].size();
+	lidxs = detail::smp_vec_store::create(res_offs[num_parts],
+			get_scalar_type<off_t>());
+	ridxs = detail::smp_vec_store::create(res_offs[num_parts],
+			get_scalar_type<off_t>());
+#pragma omp parallel for
+	for (size_t p = 0; p < num_parts; p++) {
+		for (size_t i = 0; i < res[p].size(); i++) {
+			const std::pair<off_t, off_t> &match = res[p][i];
+			lidxs->set<off_t>(res_offs[p] + i,
+					build_left ? match.second : match.first);
+			ridxs->set<off_t>(res_offs[p] + i,
+					build_left ? match.first : match.second);
+		}
+	}
+}
+
+/*
+ * This contains the operations in the join that depend on the key type.
+ */
+class join_key_ops
+{
+public:
+	/*
+	 * Join two key vectors. It outputs the locations of the matched rows
+	 * in the two vectors.
+	 */
+	virtual void join(const detail::smp_vec_store &left,
+			const detail::smp_vec_store &right, detail::smp_vec_store::ptr &lidxs,
+			detail::smp_vec_store::ptr &ridxs) const = 0;
+	/*
+	 * Get the partitions of the keys in grace hash join. Each level of
+	 * the partitioning uses a different hash function.
+	 */
+	virtual void get_grace_parts(const char *keys, size_t num,
+			size_t num_parts, int level, std::vector<uint32_t> &parts) const = 0;
+};
+
+template<class T>
+class join_key_ops_impl: public join_key_ops
+{
+public:
+	virtual void join(const detail::smp_vec_store &left,
+			const detail::smp_vec_store &right, detail::smp_vec_store::ptr &lidxs,
+			detail::smp_vec_store::ptr &ridxs) const {
+		hash_join((const T *) left.get_raw_arr(), left.get_length(),
+				(const T *) right.get_raw_arr(), right.get_length(), lidxs, ridxs);
+	}
+
+	virtual void get_grace_parts(const char *keys, size_t num,
+			size_t num_parts, int level, std::vector<uint32_t> &parts) const {
+		const T *tkeys = (const T *) keys;
+		parts.resize(num);
+#pragma omp parallel for
+		for (size_t i = 0; i < num; i++) {
+			uint64_t hash = get_hash_code(tkeys[i]);
+			if (level > 0)
+				hash = get_hash_code<uint64_t>(hash ^ level);
+			parts[i] = (hash >> GRACE_SHIFT) & (num_parts - 1);
+		}
+	}
+};
+
+const join_key_ops &get_join_key_ops(prim_type type)
+{
+	switch(type) {
+		case P_BOOL:
+			{
+				static join_key_ops_impl<bool> ops;
+				return ops;
+			}
+		case P_CHAR:
+			{
+				static join_key_ops_impl<char> ops;
+				return ops;
+			}
+		case P_SHORT:
+			{
+				static join_key_ops_impl<short> ops;
+				return ops;
+			}
+		case P_USHORT:
+			{
+				static join_key_ops_impl<unsigned short> ops;
+				return ops;
+			}
+		case P_INTEGER:
+			{
+				static join_key_ops_impl<int> ops;
+				return ops;
+			}
+		case P_UINT:
+			{
+				static join_key_ops_impl<unsigned int> ops;
+				return ops;
+			}
+		case P_LONG:
+			{
+				static join_key_ops_impl<long> ops;
+				return ops;
+			}
+		case P_ULONG:
+			{
+				static join_key_ops_impl<unsigned long> ops;
+				return ops;
+			}
+		case P_FLOAT:
+			{
+				static join_key_ops_impl<float> ops;
+				return ops;
+			}
+		case P_DOUBLE:
+			{
+				static join_key_ops_impl<double> ops;
+				return ops;
+			}
+		case P_LDOUBLE:
+			{
+				static join_key_ops_impl<long double> ops;
+				return ops;
+			}
+		default:
+			throw invalid_arg_exception("invalid prim type");
+	}
+}
+
+std::vector<detail::smp_vec_store::const_ptr> get_smp_vecs(const data_frame &df)
+{
+	std::vector<detail::smp_vec_store::const_ptr> vecs(df.get_num_vecs());
+	for (size_t i = 0; i < vecs.size(); i++)
+		vecs[i] = detail::get_smp_vec(df.get_vec(i));
+	return vecs;
+}
+
+/*
+ * Join the columns in memory. It returns the key column, the other columns
+ * of the left side and the other columns of the right side.
+ */
+std::vector<detail::vec_store::ptr> join_vecs(
+		const std::vector<detail::smp_vec_store::const_ptr> &left, off_t lkey,
+		const std::vector<detail::smp_vec_store::const_ptr> &right, off_t rkey,
+		const join_key_ops &ops)
+{
+	detail::smp_vec_store::ptr lidxs, ridxs;
+	ops.join(*left[lkey], *right[rkey], lidxs, ridxs);
+
+	std::vector<detail::vec_store::ptr> ret;
+	ret.push_back(left[lkey]->get(*lidxs));
+	for (size_t i = 0; i < left.size(); i++)
+		if ((off_t) i != lkey)
+			ret.push_back(left[i]->get(*lidxs));
+	for (size_t i = 0; i < right.size(); i++)
+		if ((off_t) i != rkey)
+			ret.push_back(right[i]->get(*ridxs));
+	return ret;
+}
+
+typedef std::vector<detail::vec_store::const_ptr> df_part_t;
+
+size_t get_row_size(const df_part_t &vecs)
+{
+	size_t size = 0;
+	for (size_t i = 0; i < vecs.size(); i++)
+		size += vecs[i]->get_entry_size();
+	return size;
+}
+
+size_t get_num_bytes(const df_part_t &vecs)
+{
+	return vecs.empty() ? 0 : get_row_size(vecs) * vecs[0]->get_length();
+}
+
+df_part_t get_vecs(const data_frame &df)
+{
+	df_part_t vecs(df.get_num_vecs());
+	for (size_t i = 0; i < vecs.size(); i++)
+		vecs[i] = df.get_vec(i);
+	return vecs;
+}
+
+/*
+ * Split a data frame into partitions on the key column and write
+ * the partitions to disks.
+ */
+bool spill_parts(const df_part_t &vecs, off_t key, const join_key_ops &ops,
+		int level, std::vector<df_part_t> &parts)
+{
+	const size_t num_parts = parts.size();
+	const size_t num_cols = vecs.size();
+	const size_t row_size = get_row_size(vecs);
+	std::vector<std::vector<detail::vec_store::ptr> > em_parts(num_parts);
+	std::vector<std::vector<detail::smp_vec_store::ptr> > bufs(num_parts);
+	for (size_t p = 0; p < num_parts; p++) {
+		em_parts[p].resize(num_cols);
+		bufs[p].resize(num_cols);
+		for (size_t c = 0; c < num_cols; c++) {
+			const scalar_type &type = vecs[c]->get_type();
+			em_parts[p][c] = detail::vec_store::create(0, type, -1, false);
+			bufs[p][c] = detail::smp_vec_store::create(0, type);
+		}
+	}
+
+	// The buffers of all partitions take at most half of the memory for join.
+	size_t buf_rows = std::max(matrix_conf.get_join_buf_size() / 2
+			/ num_parts / row_size, 1024UL);
+	size_t chunk_rows = std::max(matrix_conf.get_stream_io_size() / row_size,
+			1024UL);
+	size_t num_rows = vecs[key]->get_length();
+	for (size_t start = 0; start < num_rows; start += chunk_rows) {
+		size_t len = std::min(chunk_rows, num_rows - start);
+		std::vector<local_vec_store::const_ptr> chunk(num_cols);
+		for (size_t c = 0; c < num_cols; c++) {
+			chunk[c] = vecs[c]->get_portion(start, len);
+			if (chunk[c] == NULL) {
+				BOOST_LOG_TRIVIAL(error) << boost::format(
+						"can't read rows [%1%, %2%) of column %3%")
+					% start % (start + len) % c;
+				return false;
+			}
+		}
+
+		std::vector<uint32_t> part_ids;
+		ops.get_grace_parts(chunk[key]->get_raw_arr(), len, num_parts,
+				level, part_ids);
+		std::vector<std::vector<off_t> > rows(num_parts);
+		for (size_t i = 0; i < len; i++)
+			rows[part_ids[i]].push_back(i);
+#pragma omp parallel for
+		for (size_t p = 0; p < num_parts; p++)
+			for (size_t c = 0; c < num_cols; c++)
+				bufs[p][c]->append_rows(chunk[c]->get_raw_arr(), rows[p]);
+
+		for (size_t p = 0; p < num_parts; p++) {
+			if (bufs[p][0]->get_length() < buf_rows)
+				continue;
+			for (size_t c = 0; c < num_cols; c++) {
+				em_parts[p][c]->append(*bufs[p][c]);
+				bufs[p][c]->resize(0);
+			}
+		}
+	}
+	for (size_t p = 0; p < num_parts; p++) {
+		if (bufs[p][0]->get_length() > 0)
+			for (size_t c = 0; c < num_cols; c++)
+				em_parts[p][c]->append(*bufs[p][c]);
+		parts[p].assign(em_parts[p].begin(), em_parts[p].end());
+	}
+	return true;
+}
+
+/*
+ * Copy a range of rows of a vector to the SMP memory.
+ */
+detail::smp_vec_store::const_ptr get_smp_rows(detail::vec_store::const_ptr vec,
+		off_t start, size_t len)
+{
+	local_vec_store::const_ptr portion = vec->get_portion(start, len);
+	if (portion == NULL)
+		return detail::smp_vec_store::const_ptr();
+	detail::smp_vec_store::ptr ret = detail::smp_vec_store::create(len,
+			vec->get_type());
+	memcpy(ret->get_raw_arr(), portion->get_raw_arr(),
+			len * vec->get_entry_size());
+	return ret;
+}
+
+void append_res(const std::vector<detail::vec_store::ptr> &res,
+		std::vector<detail::vec_store::ptr> &out)
+{
+	if (res[0]->get_length() == 0)
+		return;
+	for (size_t i = 0; i < out.size(); i++)
+		out[i]->append(*res[i]);
+}
+
+/*
+ * Join two partitions block by block. Each pair of blocks fits in memory.
+ * This is used when most rows in the partitions have the same key.
+ */
+bool block_join(const df_part_t &left, const df_part_t &right, off_t lkey,
+		off_t rkey, const join_key_ops &ops,
+		std::vector<detail::vec_store::ptr> &out)
+{
+	size_t lblock = std::max(matrix_conf.get_join_buf_size() / 2
+			/ get_row_size(left), 1024UL);
+	size_t rblock = std::max(matrix_conf.get_join_buf_size() / 2
+			/ get_row_size(right), 1024UL);
+	size_t lnum = left[lkey]->get_length();
+	size_t rnum = right[rkey]->get_length();
+	for (size_t lstart = 0; lstart < lnum; lstart += lblock) {
+		size_t llen = std::min(lblock, lnum - lstart);
+		std::vector<detail::smp_vec_store::const_ptr> lvecs(left.size());
+		for (size_t c = 0; c < lvecs.size(); c++) {
+			lvecs[c] = get_smp_rows(left[c], lstart, llen);
+			if (lvecs[c] == NULL)
+				return false;
+		}
+		for (size_t rstart = 0; rstart < rnum; rstart += rblock) {
+			size_t rlen = std::min(rblock, rnum - rstart);
+			std::vector<detail::smp_vec_store::const_ptr> rvecs(right.size());
+			for (size_t c = 0; c < rvecs.size(); c++) {
+				rvecs[c] = get_smp_rows(right[c], rstart, rlen);
+				if (rvecs[c] == NULL)
+					return false;
+			}
+			append_res(join_vecs(lvecs, lkey, rvecs, rkey, ops), out);
+		}
+	}
+	return true;
+}
+
+/*
+ * Join a pair of partitions and append the result to `out'. If the pair
+ * doesn't fit in memory, it's split into smaller partitions with the hash
+ * function of the next level.
+ */
+bool join_parts(const df_part_t &left, const df_part_t &right, off_t lkey,
+		off_t rkey, const join_key_ops &ops, int level,
+		std::vector<detail::vec_store::ptr> &out)
+{
+	if (left[lkey]->get_length() == 0 || right[rkey]->get_length() == 0)
+		return true;
+
+	size_t tot_size = get_num_bytes(left) + get_num_bytes(right);
+	if (tot_size <= matrix_conf.get_join_buf_size()) {
+		std::vector<detail::smp_vec_store::const_ptr> lvecs(left.size());
+		for (size_t c = 0; c < lvecs.size(); c++)
+			lvecs[c] = detail::get_smp_vec(left[c]);
+		std::vector<detail::smp_vec_store::const_ptr> rvecs(right.size());
+		for (size_t c = 0; c < rvecs.size(); c++)
+			rvecs[c] = detail::get_smp_vec(right[c]);
+		append_res(join_vecs(lvecs, lkey, rvecs, rkey, ops), out);
+		return true;
+	}
+	if (level >= MAX_GRACE_LEVEL)
+		return block_join(left, right, lkey, rkey, ops, out);
+
+	size_t num_parts = 2;
+	while (num_parts * matrix_conf.get_join_buf_size() < tot_size)
+		num_parts *= 2;
+	BOOST_LOG_TRIVIAL(info) << boost::format(
+			"join data frames in %1% partitions at level %2%")
+		% num_parts % level;
+	std::vector<df_part_t> lparts(num_parts);
+	std::vector<df_part_t> rparts(num_parts);
+	if (!spill_parts(left, lkey, ops, level, lparts)
+			|| !spill_parts(right, rkey, ops, level, rparts))
+		return false;
+	for (size_t p = 0; p < num_parts; p++) {
+		bool ret;
+		// If all rows are in the same partition, the rows have the same key
+		// or their keys collide in all hash functions. Splitting them again
+		// doesn't help.
+		if (get_num_bytes(lparts[p]) + get_num_bytes(rparts[p]) == tot_size)
+			ret = block_join(lparts[p], rparts[p], lkey, rkey, ops, out);
+		else
+			ret = join_parts(lparts[p], rparts[p], lkey, rkey, ops, level + 1,
+					out);
+		if (!ret)
+			return false;
+		// We don't need the partitions on disks any more.
+		lparts[p].clear();
+		rparts[p].clear();
+	}
+	return true;
+}
+
+data_frame::ptr grace_join(const data_frame &left, const data_frame &right,
+		off_t lkey, off_t rkey, const std::vector<std::string> &names,
+		const join_key_ops &ops)
+{
+	std::vector<detail::vec_store::ptr> out;
+	out.push_back(detail::vec_store::create(0,
+				left.get_vec_ref(lkey).get_type(), -1, false));
+	for (size_t i = 0; i < left.get_num_vecs(); i++)
+		if ((off_t) i != lkey)
+			out.push_back(detail::vec_store::create(0,
+						left.get_vec_ref(i).get_type(), -1, false));
+	for (size_t i = 0; i < right.get_num_vecs(); i++)
+		if ((off_t) i != rkey)
+			out.push_back(detail::vec_store::create(0,
+						right.get_vec_ref(i).get_type(), -1, false));
+	assert(out.size() == names.size());
+
+	if (!join_parts(get_vecs(left), get_vecs(right), lkey, rkey, ops, 0, out))
+		return data_frame::ptr();
+
+	data_frame::ptr ret = data_frame::create();
+	for (size_t i = 0; i < out.size(); i++)
+		ret->add_vec(names[i], out[i]);
+	return ret;
+}
+
+}
+
+data_frame::ptr join_data_frame(const data_frame &left, const data_frame &right,
+		const std::string &left_key, const std::string &right_key)
+{
+	off_t lkey = -1;
+	off_t rkey = -1;
+	std::unordered_set<std::string> lnames;
+	std::unordered_set<std::string> rnames;
+	for (size_t i = 0; i < left.get_num_vecs(); i++) {
+		if (left.get_vec_name(i) == left_key)
+			lkey = i;
+		else
+			lnames.insert(left.get_vec_name(i));
+	}
+	for (size_t i = 0; i < right.get_num_vecs(); i++) {
+		if (right.get_vec_name(i) == right_key)
+			rkey = i;
+		else
+			rnames.insert(right.get_vec_name(i));
+	}
+	if (lkey < 0 || rkey < 0) {
+		BOOST_LOG_TRIVIAL(error) << boost::format(
+				"The key column %1% doesn't exist")
+			% (lkey < 0 ? left_key : right_key);
+		return data_frame::ptr();
+	}
+	if (left.get_vec_ref(lkey).get_type() != right.get_vec_ref(rkey).get_type()) {
+		BOOST_LOG_TRIVIAL(error)
+			<< "The key columns have different types";
+		return data_frame::ptr();
+	}
+
+	// The key column is named after the left key.
+	std::vector<std::string> names;
+	names.push_back(left_key);
+	for (size_t i = 0; i < left.get_num_vecs(); i++) {
+		if ((off_t) i == lkey)
+			continue;
+		std::string name = left.get_vec_name(i);
+		if (rnames.find(name) != rnames.end())
+			name += ".x";
+		names.push_back(name);
+	}
+	for (size_t i = 0; i < right.get_num_vecs(); i++) {
+		if ((off_t) i == rkey)
+			continue;
+		std::string name = right.get_vec_name(i);
+		if (lnames.find(name) != lnames.end() || name == left_key)
+			name += ".y";
+		names.push_back(name);
+	}
+
+	const join_key_ops &ops = get_join_key_ops(
+			left.get_vec_ref(lkey).get_type().get_type());
+	if (!left.is_in_mem() || !right.is_in_mem())
+		return grace_join(left, right, lkey, rkey, names, ops);
+
+	std::vector<detail::vec_store::ptr> res = join_vecs(get_smp_vecs(left),
+			lkey, get_smp_vecs(right), rkey, ops);
+	data_frame::ptr ret = data_frame::create();
+	for (size_t i = 0; i < res.size(); i++)
+		ret->add_vec(names[i], res[i]);
+	return ret;
+}
+
+}
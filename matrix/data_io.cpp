@@ -20,6 +20,14 @@
 #ifdef USE_GZIP
 #include <zlib.h>
 #endif
+#ifdef USE_ZSTD
+#include <zstd.h>
+#endif
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include <deque>
 
 #include <boost/format.hpp>
 #include <boost/foreach.hpp>
@@ -298,6 +306,586 @@ file_io::ptr gz_file_io::create(const std::string &file)
 
 #endif
 
+/*
+ * Some compressed formats store data in blocks that can be decompressed
+ * independently. The blocks of these files are decompressed in parallel
+ * by the worker threads and the decompressed data is returned in
+ * the order of the blocks.
+ */
+
+static const size_t DECOMP_CHUNK_SIZE = 4 * 1024 * 1024;
+
+static inline uint32_t get_le16(const char *p)
+{
+	const unsigned char *b = (const unsigned char *) p;
+	return b[0] | (((uint32_t) b[1]) << 8);
+}
+
+static inline uint32_t get_le32(const char *p)
+{
+	const unsigned char *b = (const unsigned char *) p;
+	return b[0] | (((uint32_t) b[1]) << 8) | (((uint32_t) b[2]) << 16)
+		| (((uint32_t) b[3]) << 24);
+}
+
+static bool pread_complete(int fd, char *buf, size_t size, off_t off,
+		const std::string &name)
+{
+	while (size > 0) {
+		ssize_t ret = pread(fd, buf, size, off);
+		if (ret <= 0) {
+			BOOST_LOG_TRIVIAL(error) << boost::format("fail to read %1%: %2%")
+				% name % (ret < 0 ? strerror(errno) : "unexpected end of file");
+			return false;
+		}
+		buf += ret;
+		size -= ret;
+		off += ret;
+	}
+	return true;
+}
+
+/*
+ * This decompresses a block in a compressed file.
+ */
+class block_codec
+{
+public:
+	typedef std::shared_ptr<const block_codec> const_ptr;
+
+	virtual ~block_codec() {
+	}
+	/*
+	 * The size of the decompressed data has to be known in advance.
+	 */
+	virtual bool decompress(const char *in, size_t in_size, char *out,
+			size_t out_size) const = 0;
+	virtual std::string get_name() const = 0;
+};
+
+/*
+ * A chunk contains a set of consecutive blocks in a compressed file.
+ * A chunk is the unit of decompression tasks.
+ */
+class decomp_chunk
+{
+public:
+	struct block {
+		off_t in_off;
+		size_t in_size;
+		size_t out_size;
+	};
+private:
+	enum state_t {
+		PENDING,
+		RUNNING,
+		DONE,
+	};
+
+	block_codec::const_ptr codec;
+	std::shared_ptr<char> in_buf;
+	std::vector<block> blocks;
+	std::shared_ptr<char> out_buf;
+	size_t out_size;
+	bool success;
+
+	state_t state;
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+
+	void decompress();
+public:
+	typedef std::shared_ptr<decomp_chunk> ptr;
+
+	decomp_chunk(block_codec::const_ptr codec, std::shared_ptr<char> in_buf,
+			const std::vector<block> &blocks) {
+		this->codec = codec;
+		this->in_buf = in_buf;
+		this->blocks = blocks;
+		out_size = 0;
+		for (size_t i = 0; i < blocks.size(); i++)
+			out_size += blocks[i].out_size;
+		success = false;
+		state = PENDING;
+		pthread_mutex_init(&lock, NULL);
+		pthread_cond_init(&cond, NULL);
+	}
+
+	~decomp_chunk() {
+		pthread_mutex_destroy(&lock);
+		pthread_cond_destroy(&cond);
+	}
+
+	/*
+	 * A chunk is decompressed by a worker thread or by the thread that
+	 * reads the data, whichever gets to it first.
+	 */
+	void try_decompress();
+	/*
+	 * Wait for the chunk to be decompressed. If no thread has started to
+	 * decompress the chunk, the current thread decompresses it.
+	 */
+	bool wait4data();
+
+	const char *get_data() const {
+		return out_buf.get();
+	}
+
+	size_t get_size() const {
+		return out_size;
+	}
+};
+
+void decomp_chunk::decompress()
+{
+	success = true;
+	out_buf = file_io::alloc_io_buf(std::max<size_t>(out_size, 1));
+	size_t out_off = 0;
+	for (size_t i = 0; i < blocks.size() && success; i++) {
+		success = codec->decompress(in_buf.get() + blocks[i].in_off,
+				blocks[i].in_size, out_buf.get() + out_off,
+				blocks[i].out_size);
+		out_off += blocks[i].out_size;
+	}
+	// We don't need the compressed data any more.
+	in_buf = NULL;
+	if (!success)
+		out_buf = NULL;
+}
+
+void decomp_chunk::try_decompress()
+{
+	pthread_mutex_lock(&lock);
+	if (state != PENDING) {
+		pthread_mutex_unlock(&lock);
+		return;
+	}
+	state = RUNNING;
+	pthread_mutex_unlock(&lock);
+
+	decompress();
+
+	pthread_mutex_lock(&lock);
+	state = DONE;
+	pthread_mutex_unlock(&lock);
+	pthread_cond_broadcast(&cond);
+}
+
+bool decomp_chunk::wait4data()
+{
+	try_decompress();
+	pthread_mutex_lock(&lock);
+	while (state != DONE)
+		pthread_cond_wait(&cond, &lock);
+	pthread_mutex_unlock(&lock);
+	return success;
+}
+
+namespace
+{
+
+class decomp_task: public thread_task
+{
+	decomp_chunk::ptr chunk;
+public:
+	decomp_task(decomp_chunk::ptr chunk) {
+		this->chunk = chunk;
+	}
+
+	void run() {
+		chunk->try_decompress();
+	}
+};
+
+}
+
+class block_file_io: public file_io
+{
+	// The chunks that are being decompressed, in the order of the file.
+	std::deque<decomp_chunk::ptr> chunks;
+	// The number of bytes that have been read in the first chunk.
+	size_t chunk_off;
+	bool more_chunks;
+
+	void fill_chunks();
+protected:
+	int fd;
+	size_t file_size;
+	std::string name;
+	block_codec::const_ptr codec;
+
+	block_file_io(int fd, const std::string &name,
+			block_codec::const_ptr codec) {
+		this->fd = fd;
+		this->name = name;
+		this->codec = codec;
+		safs::native_file local_f(name);
+		file_size = local_f.get_size();
+		chunk_off = 0;
+		more_chunks = true;
+	}
+
+	/*
+	 * Read the compressed data of the next chunk in the file.
+	 * It returns NULL if it reaches the end of the file or the file
+	 * is corrupted.
+	 */
+	virtual decomp_chunk::ptr read_chunk() = 0;
+public:
+	~block_file_io() {
+		close(fd);
+	}
+
+	std::shared_ptr<char> read_bytes(size_t wanted_bytes,
+			size_t &read_bytes);
+
+	bool eof() const {
+		return chunks.empty() && !more_chunks;
+	}
+
+	std::string get_name() const {
+		return name;
+	}
+};
+
+void block_file_io::fill_chunks()
+{
+	size_t max_chunks = 1;
+	bool parallel = false;
+	detail::mem_thread_pool::ptr mem_threads;
+	// Only the main thread can issue tasks to the thread pool. When a worker
+	// thread reads the file, the file is decompressed in the worker thread.
+	// This happens when we read many files at the same time, which already
+	// parallelizes decompression.
+	if (detail::mem_thread_pool::get_curr_thread_id() == 0) {
+		mem_threads = detail::mem_thread_pool::get_global_mem_threads();
+		max_chunks = mem_threads->get_num_threads();
+		parallel = max_chunks > 1;
+	}
+	while (more_chunks && chunks.size() < max_chunks) {
+		decomp_chunk::ptr chunk = read_chunk();
+		if (chunk == NULL) {
+			more_chunks = false;
+			break;
+		}
+		chunks.push_back(chunk);
+		if (parallel)
+			mem_threads->process_task(-1, new decomp_task(chunk));
+	}
+}
+
+std::shared_ptr<char> block_file_io::read_bytes(size_t wanted_bytes,
+		size_t &read_bytes)
+{
+	read_bytes = 0;
+	fill_chunks();
+	std::shared_ptr<char> ret_buf = file_io::alloc_io_buf(wanted_bytes);
+	while (read_bytes < wanted_bytes && !chunks.empty()) {
+		decomp_chunk::ptr chunk = chunks.front();
+		if (!chunk->wait4data()) {
+			BOOST_LOG_TRIVIAL(error) << boost::format(
+					"fail to decompress %1% with %2%") % name % codec->get_name();
+			chunks.clear();
+			more_chunks = false;
+			read_bytes = 0;
+			return std::shared_ptr<char>();
+		}
+		size_t num_bytes = std::min(wanted_bytes - read_bytes,
+				chunk->get_size() - chunk_off);
+		memcpy(ret_buf.get() + read_bytes, chunk->get_data() + chunk_off,
+				num_bytes);
+		read_bytes += num_bytes;
+		chunk_off += num_bytes;
+		if (chunk_off == chunk->get_size()) {
+			chunks.pop_front();
+			chunk_off = 0;
+			fill_chunks();
+		}
+	}
+	return ret_buf;
+}
+
+#ifdef USE_GZIP
+
+/*
+ * BGZF is a gzip file that consists of many gzip members. Each member
+ * stores its size in the extra field of the header, so we can split
+ * the file into members without decompressing it.
+ */
+class bgzf_codec: public block_codec
+{
+public:
+	bool decompress(const char *in, size_t in_size, char *out,
+			size_t out_size) const;
+
+	std::string get_name() const {
+		return "BGZF";
+	}
+};
+
+bool bgzf_codec::decompress(const char *in, size_t in_size, char *out,
+		size_t out_size) const
+{
+	z_stream strm;
+	memset(&strm, 0, sizeof(strm));
+	// Decode the gzip header and verify the CRC in the trailer.
+	if (inflateInit2(&strm, 16 + MAX_WBITS) != Z_OK)
+		return false;
+	strm.next_in = (Bytef *) in;
+	strm.avail_in = in_size;
+	strm.next_out = (Bytef *) out;
+	strm.avail_out = out_size;
+	int ret = inflate(&strm, Z_FINISH);
+	bool success = ret == Z_STREAM_END && strm.total_out == out_size;
+	inflateEnd(&strm);
+	return success;
+}
+
+class bgzf_file_io: public block_file_io
+{
+	static const size_t HEADER_SIZE = 18;
+	off_t curr_off;
+
+	bgzf_file_io(int fd, const std::string &name): block_file_io(fd, name,
+			block_codec::const_ptr(new bgzf_codec())) {
+		curr_off = 0;
+	}
+protected:
+	decomp_chunk::ptr read_chunk();
+public:
+	/*
+	 * Get the size of a BGZF block from its header.
+	 * It returns 0 if it isn't a BGZF block.
+	 */
+	static size_t get_block_size(const char *header, size_t size);
+	static bool is_bgzf(const std::string &file);
+	static ptr create(const std::string &file);
+};
+
+size_t bgzf_file_io::get_block_size(const char *header, size_t size)
+{
+	const unsigned char *b = (const unsigned char *) header;
+	if (size < HEADER_SIZE || b[0] != 31 || b[1] != 139 || b[2] != 8
+			|| (b[3] & 4) == 0)
+		return 0;
+	size_t xlen = get_le16(header + 10);
+	if (size < 12 + xlen)
+		return 0;
+	// Search for the subfield "BC" that stores the block size.
+	// A subfield has 4 bytes of header and `slen' bytes of data, and all
+	// subfields have to be inside the extra field.
+	for (size_t off = 12; off + 4 <= 12 + xlen;) {
+		size_t slen = get_le16(header + off + 2);
+		if (off + 4 + slen > 12 + xlen)
+			return 0;
+		if (header[off] == 'B' && header[off + 1] == 'C' && slen == 2) {
+			size_t block_size = get_le16(header + off + 4) + 1;
+			// The block has to contain the header and the 8-byte footer.
+			return block_size >= 12 + xlen + 8 ? block_size : 0;
+		}
+		off += 4 + slen;
+	}
+	return 0;
+}
+
+bool bgzf_file_io::is_bgzf(const std::string &file)
+{
+	int fd = open(file.c_str(), O_RDONLY);
+	if (fd < 0)
+		return false;
+	char header[HEADER_SIZE];
+	ssize_t ret = pread(fd, header, sizeof(header), 0);
+	close(fd);
+	return ret == (ssize_t) sizeof(header)
+		&& get_block_size(header, sizeof(header)) > 0;
+}
+
+file_io::ptr bgzf_file_io::create(const std::string &file)
+{
+	int fd = open(file.c_str(), O_RDONLY);
+	if (fd < 0) {
+		BOOST_LOG_TRIVIAL(error)
+			<< boost::format("fail to open %1%: %2%") % file % strerror(errno);
+		return ptr();
+	}
+	return ptr(new bgzf_file_io(fd, file));
+}
+
+decomp_chunk::ptr bgzf_file_io::read_chunk()
+{
+	if ((size_t) curr_off >= file_size)
+		return decomp_chunk::ptr();
+
+	size_t size = std::min(DECOMP_CHUNK_SIZE, file_size - curr_off);
+	std::shared_ptr<char> buf = file_io::alloc_io_buf(size);
+	if (!pread_complete(fd, buf.get(), size, curr_off, name))
+		return decomp_chunk::ptr();
+
+	// Find all complete blocks in the buffer.
+	std::vector<decomp_chunk::block> blocks;
+	size_t off = 0;
+	while (off < size) {
+		size_t block_size = get_block_size(buf.get() + off, size - off);
+		// The last block in the buffer is incomplete. It'll be read with
+		// the next chunk.
+		if (block_size == 0 || off + block_size > size)
+			break;
+		decomp_chunk::block b;
+		b.in_off = off;
+		b.in_size = block_size;
+		// The decompressed size is stored in the last 4 bytes.
+		b.out_size = get_le32(buf.get() + off + block_size - 4);
+		blocks.push_back(b);
+		off += block_size;
+	}
+	if (blocks.empty()) {
+		BOOST_LOG_TRIVIAL(error) << boost::format(
+				"%1% has a corrupted BGZF block at %2%") % name % curr_off;
+		return decomp_chunk::ptr();
+	}
+	curr_off += off;
+	return decomp_chunk::ptr(new decomp_chunk(codec, buf, blocks));
+}
+
+#endif
+
+#ifdef USE_ZSTD
+
+class zstd_codec: public block_codec
+{
+public:
+	bool decompress(const char *in, size_t in_size, char *out,
+			size_t out_size) const {
+		size_t ret = ZSTD_decompress(out, out_size, in, in_size);
+		return !ZSTD_isError(ret) && ret == out_size;
+	}
+
+	std::string get_name() const {
+		return "zstd";
+	}
+};
+
+/*
+ * A file in the zstd seekable format consists of independent zstd frames.
+ * The seek table at the end of the file stores the compressed and
+ * decompressed size of every frame.
+ */
+class zstd_seekable_file_io: public block_file_io
+{
+	static const uint32_t SEEKABLE_MAGIC = 0x8F92EAB1;
+	static const uint32_t SKIPPABLE_MAGIC = 0x184D2A5E;
+	// The footer has the number of frames, the descriptor and the magic number.
+	static const size_t FOOTER_SIZE = 9;
+
+	struct frame {
+		off_t off;
+		size_t size;
+		size_t orig_size;
+	};
+	std::vector<frame> frames;
+	size_t curr_frame;
+
+	zstd_seekable_file_io(int fd, const std::string &name): block_file_io(fd,
+			name, block_codec::const_ptr(new zstd_codec())) {
+		curr_frame = 0;
+	}
+	bool read_seek_table();
+protected:
+	decomp_chunk::ptr read_chunk();
+public:
+	static ptr create(const std::string &file);
+};
+
+bool zstd_seekable_file_io::read_seek_table()
+{
+	char footer[FOOTER_SIZE];
+	if (file_size < FOOTER_SIZE + 8
+			|| !pread_complete(fd, footer, FOOTER_SIZE,
+				file_size - FOOTER_SIZE, name)
+			|| get_le32(footer + 5) != SEEKABLE_MAGIC) {
+		BOOST_LOG_TRIVIAL(error) << boost::format(
+				"%1% isn't in the zstd seekable format") % name;
+		return false;
+	}
+	size_t num_frames = get_le32(footer);
+	size_t entry_size = (footer[4] & 0x80) ? 12 : 8;
+	size_t table_size = 8 + num_frames * entry_size + FOOTER_SIZE;
+	if (table_size > file_size) {
+		BOOST_LOG_TRIVIAL(error) << boost::format(
+				"%1% has a corrupted seek table") % name;
+		return false;
+	}
+	std::vector<char> table(table_size);
+	if (!pread_complete(fd, table.data(), table_size, file_size - table_size,
+				name))
+		return false;
+	if (get_le32(table.data()) != SKIPPABLE_MAGIC
+			|| get_le32(table.data() + 4) != table_size - 8) {
+		BOOST_LOG_TRIVIAL(error) << boost::format(
+				"%1% has a corrupted seek table") % name;
+		return false;
+	}
+
+	frames.resize(num_frames);
+	off_t off = 0;
+	for (size_t i = 0; i < num_frames; i++) {
+		const char *entry = table.data() + 8 + i * entry_size;
+		frames[i].off = off;
+		frames[i].size = get_le32(entry);
+		frames[i].orig_size = get_le32(entry + 4);
+		off += frames[i].size;
+	}
+	if ((size_t) off != file_size - table_size) {
+		BOOST_LOG_TRIVIAL(error) << boost::format(
+				"the seek table doesn't match the frames in %1%") % name;
+		return false;
+	}
+	return true;
+}
+
+file_io::ptr zstd_seekable_file_io::create(const std::string &file)
+{
+	int fd = open(file.c_str(), O_RDONLY);
+	if (fd < 0) {
+		BOOST_LOG_TRIVIAL(error)
+			<< boost::format("fail to open %1%: %2%") % file % strerror(errno);
+		return ptr();
+	}
+	zstd_seekable_file_io *io = new zstd_seekable_file_io(fd, file);
+	ptr ret(io);
+	if (!io->read_seek_table())
+		return ptr();
+	return ret;
+}
+
+decomp_chunk::ptr zstd_seekable_file_io::read_chunk()
+{
+	if (curr_frame >= frames.size())
+		return decomp_chunk::ptr();
+
+	// A chunk has at least one frame.
+	off_t start = frames[curr_frame].off;
+	size_t size = 0;
+	std::vector<decomp_chunk::block> blocks;
+	do {
+		decomp_chunk::block b;
+		b.in_off = size;
+		b.in_size = frames[curr_frame].size;
+		b.out_size = frames[curr_frame].orig_size;
+		blocks.push_back(b);
+		size += b.in_size;
+		curr_frame++;
+	} while (curr_frame < frames.size()
+			&& size + frames[curr_frame].size <= DECOMP_CHUNK_SIZE);
+
+	std::shared_ptr<char> buf = file_io::alloc_io_buf(std::max<size_t>(size, 1));
+	if (!pread_complete(fd, buf.get(), size, start, name))
+		return decomp_chunk::ptr();
+	return decomp_chunk::ptr(new decomp_chunk(codec, buf, blocks));
+}
+
+#endif
+
 file_io::ptr file_io::create_local(const std::string name)
 {
 	return local_file_io::create(name);
@@ -306,20 +894,42 @@ file_io::ptr file_io::create_local(const std::string name)
 file_io::ptr file_io::create_gz(const std::string name)
 {
 #ifdef USE_GZIP
-	return gz_file_io::create(name);
+	if (bgzf_file_io::is_bgzf(name))
+		return bgzf_file_io::create(name);
+	else
+		return gz_file_io::create(name);
 #else
 	return file_io::ptr();
 #endif
 }
 
+file_io::ptr file_io::create_zstd(const std::string name)
+{
+#ifdef USE_ZSTD
+	return zstd_seekable_file_io::create(name);
+#else
+	return file_io::ptr();
+#endif
+}
+
+static bool has_suffix(const std::string &name, const std::string &suffix)
+{
+	return name.length() >= suffix.length() && name.compare(
+			name.length() - suffix.length(), suffix.length(), suffix) == 0;
+}
+
 text_io::ptr text_io::create(const std::string &file_name)
 {
 	file_io::ptr io;
 #ifdef USE_GZIP
-	size_t loc = file_name.rfind(".gz");
 	// If the file name ends up with ".gz", we consider it as a gzip file.
-	if (loc != std::string::npos && loc + 3 == file_name.length())
-		io = gz_file_io::create(file_name);
+	if (has_suffix(file_name, ".gz"))
+		io = file_io::create_gz(file_name);
+	else
+#endif
+#ifdef USE_ZSTD
+	if (has_suffix(file_name, ".zst"))
+		io = file_io::create_zstd(file_name);
 	else
 #endif
 		io = local_file_io::create(file_name);
@@ -379,6 +989,24 @@ std::shared_ptr<char> local_file_io::read_bytes(
 	return std::shared_ptr<char>(buf, del_off_ptr(addr));
 }
 
+size_t line_parser::parse(const char *buf, size_t size, data_frame &df) const
+{
+	const char *end = buf + size;
+	const char *line = buf;
+	std::vector<std::string> lines;
+	while (line < end) {
+		const char *line_end = (const char *) memchr(line, '\n', end - line);
+		if (line_end == NULL)
+			line_end = end;
+		const char *str_end = line_end;
+		if (str_end > line && *(str_end - 1) == '\r')
+			str_end--;
+		lines.push_back(std::string(line, str_end));
+		line = line_end + 1;
+	}
+	return parse(lines, df);
+}
+
 /*
  * Parse the lines in the character buffer.
  * `size' doesn't include '\0'.
@@ -386,26 +1014,212 @@ std::shared_ptr<char> local_file_io::read_bytes(
 static size_t parse_lines(std::shared_ptr<char> line_buf, size_t size,
 		const line_parser &parser, data_frame &df)
 {
-	char *line_end;
-	char *line = line_buf.get();
-	char *buf_start = line_buf.get();
-	// TODO I need to be careful here. It potentially needs to allocate
-	// a lot of small pieces of memory.
-	std::vector<std::string> lines;
-	while ((line_end = strchr(line, '\n'))) {
-		assert(line_end - buf_start <= (ssize_t) size);
-		*line_end = 0;
-		if (*(line_end - 1) == '\r')
-			*(line_end - 1) = 0;
-		lines.push_back(std::string(line));
-		line = line_end + 1;
+	return parser.parse(line_buf.get(), size, df);
+}
+
+static inline bool is_blank(char c)
+{
+	return c == ' ' || c == '\t' || c == '\r' || c == '\v' || c == '\f';
+}
+
+/*
+ * The numbers that are too long or have exponents too large to be
+ * converted exactly here are converted by strtol and strtod.
+ */
+static const size_t MAX_NUM_STR_LEN = 128;
+
+static long fallback_strtol(const char *start, const char *end, int base)
+{
+	char buf[MAX_NUM_STR_LEN];
+	size_t len = std::min((size_t) (end - start), MAX_NUM_STR_LEN - 1);
+	memcpy(buf, start, len);
+	buf[len] = 0;
+	return strtol(buf, NULL, base);
+}
+
+static double fallback_strtod(const char *start, const char *end)
+{
+	char buf[MAX_NUM_STR_LEN];
+	size_t len = std::min((size_t) (end - start), MAX_NUM_STR_LEN - 1);
+	memcpy(buf, start, len);
+	buf[len] = 0;
+	return strtod(buf, NULL);
+}
+
+static inline int get_digit_val(char c)
+{
+	if (c >= '0' && c <= '9')
+		return c - '0';
+	c |= 0x20;
+	if (c >= 'a' && c <= 'z')
+		return c - 'a' + 10;
+	return 36;
+}
+
+long parse_long(const char *start, const char *end, int base)
+{
+	const char *p = start;
+	while (p < end && isspace(*p))
+		p++;
+	bool neg = false;
+	if (p < end && (*p == '-' || *p == '+')) {
+		neg = *p == '-';
+		p++;
+	}
+	if (base == 16 && end - p > 2 && p[0] == '0' && (p[1] | 0x20) == 'x'
+			&& get_digit_val(p[2]) < 16)
+		p += 2;
+	// The number of digits that can't overflow a long.
+	const int max_digits = base == 16 ? 15 : 18;
+	const char *digit_start = p;
+	unsigned long val = 0;
+	for (; p < end; p++) {
+		int digit = get_digit_val(*p);
+		if (digit >= base)
+			break;
+		val = val * base + digit;
 	}
-	if (line - buf_start < (ssize_t) size)
-		lines.push_back(std::string(line));
-	
-	return parser.parse(lines, df);
+	if (p - digit_start > max_digits || base < 2 || base > 36)
+		return fallback_strtol(start, end, base);
+	return neg ? -(long) val : (long) val;
 }
 
+/*
+ * The float-point number is converted exactly if the significant digits
+ * fit in the 53-bit mantissa of double and the power of 10 is exact in
+ * double (Clinger's fast path). This covers most numbers in text files.
+ */
+double parse_double(const char *start, const char *end)
+{
+	static const double pow10[] = {
+		1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+		1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22,
+	};
+	static const int max_exp = 22;
+	static const int max_digits = 19;
+
+	const char *p = start;
+	while (p < end && isspace(*p))
+		p++;
+	bool neg = false;
+	if (p < end && (*p == '-' || *p == '+')) {
+		neg = *p == '-';
+		p++;
+	}
+
+	uint64_t mantissa = 0;
+	// The number of significant digits in the mantissa.
+	int num_digits = 0;
+	bool has_digits = false;
+	int exp = 0;
+	for (; p < end && *p >= '0' && *p <= '9'; p++) {
+		has_digits = true;
+		if (mantissa == 0 && *p == '0')
+			continue;
+		mantissa = mantissa * 10 + (*p - '0');
+		num_digits++;
+	}
+	// Hex float is handled by strtod.
+	if (p < end && (*p | 0x20) == 'x')
+		return fallback_strtod(start, end);
+	if (p < end && *p == '.') {
+		for (p++; p < end && *p >= '0' && *p <= '9'; p++) {
+			has_digits = true;
+			exp--;
+			if (mantissa == 0 && *p == '0')
+				continue;
+			mantissa = mantissa * 10 + (*p - '0');
+			num_digits++;
+		}
+	}
+	// inf and nan are handled by strtod.
+	if (!has_digits || num_digits > max_digits)
+		return fallback_strtod(start, end);
+	// The exponent is only valid if there are digits after `e'.
+	if (p < end && (*p | 0x20) == 'e') {
+		const char *exp_p = p + 1;
+		bool exp_neg = false;
+		if (exp_p < end && (*exp_p == '-' || *exp_p == '+')) {
+			exp_neg = *exp_p == '-';
+			exp_p++;
+		}
+		if (exp_p < end && *exp_p >= '0' && *exp_p <= '9') {
+			int exp_val = 0;
+			for (; exp_p < end && *exp_p >= '0' && *exp_p <= '9'; exp_p++) {
+				// The exponent is too large anyway.
+				if (exp_val > 100000)
+					return fallback_strtod(start, end);
+				exp_val = exp_val * 10 + (*exp_p - '0');
+			}
+			exp += exp_neg ? -exp_val : exp_val;
+		}
+	}
+	if (mantissa > (1UL << 53) || exp > max_exp || exp < -max_exp)
+		return fallback_strtod(start, end);
+
+	double val = mantissa;
+	if (exp < 0)
+		val /= pow10[-exp];
+	else
+		val *= pow10[exp];
+	return neg ? -val : val;
+}
+
+/*
+ * This finds the delimiters and the newlines in a buffer. With SSE2,
+ * it compares 16 bytes with all delimiters at a time.
+ */
+class sep_finder
+{
+	static const size_t MAX_NUM_SEPS = 4;
+	// The newline is always a separator.
+	char seps[MAX_NUM_SEPS];
+	size_t num_seps;
+	// If there are too many delimiters, it falls back to the scalar loop.
+	std::string all_seps;
+#ifdef __SSE2__
+	__m128i vseps[MAX_NUM_SEPS];
+#endif
+public:
+	sep_finder(const std::string &delim) {
+		all_seps = delim + "\n";
+		num_seps = std::min(all_seps.size(), MAX_NUM_SEPS);
+		for (size_t i = 0; i < num_seps; i++) {
+			seps[i] = all_seps[i];
+#ifdef __SSE2__
+			vseps[i] = _mm_set1_epi8(seps[i]);
+#endif
+		}
+	}
+
+	/*
+	 * Find the first separator in [p, end). It returns `end' if there
+	 * isn't a separator.
+	 */
+	const char *find(const char *p, const char *end) const {
+		if (all_seps.size() > MAX_NUM_SEPS) {
+			for (; p < end && all_seps.find(*p) == std::string::npos; p++);
+			return p;
+		}
+#ifdef __SSE2__
+		for (; end - p >= 16; p += 16) {
+			__m128i v = _mm_loadu_si128((const __m128i *) p);
+			__m128i match = _mm_cmpeq_epi8(v, vseps[0]);
+			for (size_t i = 1; i < num_seps; i++)
+				match = _mm_or_si128(match, _mm_cmpeq_epi8(v, vseps[i]));
+			int mask = _mm_movemask_epi8(match);
+			if (mask)
+				return p + __builtin_ctz(mask);
+		}
+#endif
+		for (; p < end; p++)
+			for (size_t i = 0; i < num_seps; i++)
+				if (*p == seps[i])
+					return p;
+		return end;
+	}
+};
+
 namespace
 {
 
@@ -617,7 +1431,10 @@ data_frame::ptr read_lines(text_io::ptr io, const line_parser &parser,
 	off_t task_id = 0;
 	off_t seq_num = 0;
 	while (!io->eof()) {
-		size_t num_tasks = MAX_PENDING - mem_threads->get_num_pending();
+		// The pending tasks may include the tasks that decompress the file.
+		size_t num_pending = mem_threads->get_num_pending();
+		size_t num_tasks = num_pending < MAX_PENDING
+			? MAX_PENDING - num_pending : 0;
 		for (size_t i = 0; i < num_tasks && !io->eof(); i++) {
 			size_t size = 0;
 			std::shared_ptr<char> lines = io->read_lines(LINE_BLOCK_SIZE, size);
@@ -713,6 +1530,7 @@ class row_parser: public line_parser
 	std::vector<ele_parser::const_ptr> parsers;
 	// If this vector contains elements, it contains how columns are duplicated.
 	std::vector<off_t> dup_col_idxs;
+	sep_finder finder;
 
 	static std::string interpret_delim(const std::string &delim) {
 		std::string new_delim = delim;
@@ -728,13 +1546,15 @@ public:
 	row_parser(const std::string &_delim,
 			const std::vector<ele_parser::const_ptr> &_parsers,
 			const std::vector<off_t> &dup_col_idxs): delim(
-				interpret_delim(_delim)), num_cols(_parsers.size()) {
+				interpret_delim(_delim)), num_cols(_parsers.size()),
+			finder(delim) {
 		this->parsers = _parsers;
 		this->dup_col_idxs = dup_col_idxs;
 		assert(dup_col_idxs.empty() || dup_col_idxs.size() == num_cols);
 	}
 
 	size_t parse(const std::vector<std::string> &lines, data_frame &df) const;
+	size_t parse(const char *buf, size_t size, data_frame &df) const;
 	size_t get_num_cols() const {
 		return num_cols;
 	}
@@ -791,6 +1611,69 @@ size_t row_parser::parse(const std::vector<std::string> &lines,
 	return num_rows;
 }
 
+/*
+ * This parses the lines in the I/O buffer directly. It splits a line with
+ * the same rules as boost::split and converts the fields in place.
+ */
+size_t row_parser::parse(const char *buf, size_t size, data_frame &df) const
+{
+	const char *end = buf + size;
+	size_t max_num_rows = 1;
+	for (const char *p = buf; (p = (const char *) memchr(p, '\n',
+					end - p)); p++)
+		max_num_rows++;
+
+	std::vector<detail::smp_vec_store::ptr> cols(num_cols);
+	for (size_t i = 0; i < cols.size(); i++)
+		cols[i] = detail::smp_vec_store::create(max_num_rows, get_col_type(i));
+	size_t num_rows = 0;
+	const char *p = buf;
+	while (p < end) {
+		// Skip space
+		for (; p < end && is_blank(*p); p++);
+		if (p < end && *p == '#') {
+			const char *line_end = (const char *) memchr(p, '\n', end - p);
+			p = line_end ? line_end + 1 : end;
+			continue;
+		}
+
+		size_t col_idx = 0;
+		while (true) {
+			const char *sep = finder.find(p, end);
+			bool line_end = sep == end || *sep == '\n';
+			if (col_idx < num_cols) {
+				const char *field_end = sep;
+				if (line_end && field_end > p && *(field_end - 1) == '\r')
+					field_end--;
+				// If the value is missing. We make it 0.
+				if (field_end == p)
+					parsers[col_idx]->set_zero(cols[col_idx]->get(num_rows));
+				else
+					parsers[col_idx]->parse(p, field_end,
+							cols[col_idx]->get(num_rows));
+			}
+			col_idx++;
+			p = sep + 1;
+			if (line_end)
+				break;
+		}
+		// If the line doesn't have enough values than expected, we fill
+		// the remaining elements in the row with 0.
+		for (; col_idx < num_cols; col_idx++)
+			parsers[col_idx]->set_zero(cols[col_idx]->get(num_rows));
+		num_rows++;
+	}
+	assert(num_rows <= max_num_rows);
+	for (size_t j = 0; j < num_cols; j++) {
+		cols[j]->resize(num_rows);
+		df.get_vec(j)->append(*cols[j]);
+	}
+	if (!dup_col_idxs.empty())
+		for (size_t j = 0; j < num_cols; j++)
+			df.get_vec(dup_col_idxs[j])->append(*cols[j]);
+	return num_rows;
+}
+
 static std::shared_ptr<char> read_first_chunk(text_io::ptr io)
 {
 	// Read at max 1M
@@ -55,7 +55,16 @@ public:
 	typedef std::shared_ptr<file_io> ptr;
 
 	static ptr create_local(const std::string name);
+	/*
+	 * If the gzip file is in the BGZF format, it's decompressed by
+	 * multiple threads.
+	 */
 	static ptr create_gz(const std::string name);
+	/*
+	 * Only the zstd seekable format is supported. The frames in the file
+	 * are decompressed by multiple threads.
+	 */
+	static ptr create_zstd(const std::string name);
 
 	virtual std::shared_ptr<char> read_bytes(size_t wanted_bytes,
 			size_t &read_bytes) = 0;
@@ -128,6 +137,11 @@ class line_parser
 public:
 	virtual size_t parse(const std::vector<std::string> &lines,
 			data_frame &df) const = 0;
+	/*
+	 * Parse the lines in the buffer. `size' doesn't include '\0'.
+	 * By default, it splits the buffer into lines and parses the lines.
+	 */
+	virtual size_t parse(const char *buf, size_t size, data_frame &df) const;
 	virtual size_t get_num_cols() const = 0;
 	virtual const scalar_type &get_col_type(off_t idx) const = 0;
 	virtual std::string get_col_name(off_t idx) const = 0;
@@ -143,9 +157,24 @@ public:
 
 	virtual void set_zero(void *buf) const = 0;
 	virtual void parse(const std::string &str, void *buf) const = 0;
+	/*
+	 * Parse the string in [start, end). The string isn't null-terminated,
+	 * so it can point to the I/O buffer directly.
+	 */
+	virtual void parse(const char *start, const char *end, void *buf) const {
+		parse(std::string(start, end), buf);
+	}
 	virtual const scalar_type &get_type() const = 0;
 };
 
+/*
+ * These convert the string in [start, end) to a number the same way as
+ * strtol and strtod, but without copying the string. The common cases are
+ * converted directly and the rest falls back to strtol and strtod.
+ */
+long parse_long(const char *start, const char *end, int base);
+double parse_double(const char *start, const char *end);
+
 /*
  * Convert a string of decimal to an integer.
  */
@@ -171,6 +200,10 @@ public:
 		T *val = reinterpret_cast<T *>(buf);
 		val[0] = strtol(str.c_str(), NULL, base);
 	}
+	virtual void parse(const char *start, const char *end, void *buf) const {
+		T *val = reinterpret_cast<T *>(buf);
+		val[0] = parse_long(start, end, base);
+	}
 	virtual const scalar_type &get_type() const {
 		return get_scalar_type<T>();
 	}
@@ -184,6 +217,10 @@ public:
 		T *val = reinterpret_cast<T *>(buf);
 		val[0] = atof(str.c_str());
 	}
+	virtual void parse(const char *start, const char *end, void *buf) const {
+		T *val = reinterpret_cast<T *>(buf);
+		val[0] = parse_double(start, end);
+	}
 
 	virtual void set_zero(void *buf) const {
 		T *val = reinterpret_cast<T *>(buf);
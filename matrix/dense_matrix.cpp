@@ -48,6 +48,9 @@
 #include "generic_hashtable.h"
 #include "local_vec_store.h"
 #include "cum_matrix.h"
+#include "fused_mapply_op.h"
+#include "tall_qr.h"
+#include "mater_planner.h"
 
 namespace fm
 {
@@ -523,6 +526,81 @@ dense_matrix::ptr dense_matrix::multiply(const dense_matrix &mat,
 	}
 }
 
+static dense_matrix::ptr create_small_mat(const std::vector<double> &data,
+		size_t n)
+{
+	detail::mem_matrix_store::ptr store = detail::mem_matrix_store::create(
+			n, n, matrix_layout_t::L_COL, get_scalar_type<double>(), -1);
+	for (size_t j = 0; j < n; j++)
+		for (size_t i = 0; i < n; i++)
+			store->set<double>(i, j, data[j * n + i]);
+	return dense_matrix::create(store);
+}
+
+bool dense_matrix::qr(dense_matrix::ptr &Q, dense_matrix::ptr &R,
+		qr_method method) const
+{
+	if (is_wide()) {
+		BOOST_LOG_TRIVIAL(error) << "QR only works on a tall matrix";
+		return false;
+	}
+	if (!is_floating_point(get_type())) {
+		BOOST_LOG_TRIVIAL(error) << "QR only works on floating-point matrices";
+		return false;
+	}
+
+	size_t ncol = get_num_cols();
+	dense_matrix::ptr X;
+	if (get_type() == get_scalar_type<double>())
+		X = clone();
+	else
+		X = cast_ele_type(get_scalar_type<double>());
+
+	std::vector<double> Rdata;
+	std::vector<double> Rinv;
+	bool use_tsqr = method == QR_TSQR;
+	if (method == QR_CHOL2) {
+		// R1 = chol(t(X) %*% X), Q1 = X %*% R1^-1.
+		std::vector<double> R1 = detail::tall_gram(X->get_raw_store());
+		if (detail::chol_upper(R1, ncol)) {
+			std::vector<double> R1inv = R1;
+			detail::inv_upper(R1inv, ncol);
+			dense_matrix::ptr Q1 = X->multiply(*create_small_mat(R1inv, ncol));
+			// Q1 isn't orthonormal enough if X is ill-conditioned.
+			// We orthonormalize it again without materializing it.
+			std::vector<double> R2 = detail::tall_gram(Q1->get_raw_store());
+			if (detail::chol_upper(R2, ncol)) {
+				Rdata = detail::mul_upper(R2, R1, ncol);
+				detail::inv_upper(R2, ncol);
+				Rinv = detail::mul_upper(R1inv, R2, ncol);
+			}
+			else
+				use_tsqr = true;
+		}
+		else
+			use_tsqr = true;
+		if (use_tsqr)
+			BOOST_LOG_TRIVIAL(warning)
+				<< "the matrix is ill-conditioned for Cholesky-QR2, use TSQR";
+	}
+	if (use_tsqr) {
+		Rdata = detail::tall_tsqr(X->get_raw_store());
+		Rinv = Rdata;
+		if (!detail::inv_upper(Rinv, ncol)) {
+			BOOST_LOG_TRIVIAL(error) << "the matrix doesn't have full rank";
+			return false;
+		}
+	}
+
+	Q = X->multiply(*create_small_mat(Rinv, ncol));
+	R = create_small_mat(Rdata, ncol);
+	if (get_type() != get_scalar_type<double>()) {
+		Q = Q->cast_ele_type(get_type());
+		R = R->cast_ele_type(get_type());
+	}
+	return true;
+}
+
 namespace
 {
 
@@ -567,6 +645,9 @@ bool dense_matrix::materialize_self() const
 	if (!store->is_virtual())
 		return true;
 
+	// Decide how the virtual matrices in the DAG should be materialized.
+	detail::dag_mater_scope scope(
+			std::vector<const detail::matrix_store *>(1, store.get()));
 	detail::matrix_store::const_ptr tmp;
 	try {
 		auto vstore = detail::virtual_matrix_store::cast(store);
@@ -903,6 +984,10 @@ public:
 
 	virtual void run(const std::vector<detail::local_matrix_store::const_ptr> &ins,
 			detail::local_matrix_store &out) const;
+	bulk_operate::const_ptr get_op() const {
+		return op;
+	}
+
 	virtual portion_mapply_op::const_ptr transpose() const {
 		return portion_mapply_op::const_ptr(new mapply2_op(op,
 					get_out_num_cols(), get_out_num_rows()));
@@ -1010,6 +1095,10 @@ public:
 
 	virtual void run(const std::vector<detail::local_matrix_store::const_ptr> &ins,
 			detail::local_matrix_store &out) const;
+	bulk_uoperate::const_ptr get_op() const {
+		return op;
+	}
+
 	virtual portion_mapply_op::const_ptr transpose() const {
 		return portion_mapply_op::const_ptr(new sapply_op(op, get_out_num_cols(),
 					get_out_num_rows()));
@@ -1032,6 +1121,112 @@ void sapply_op::run(const std::vector<detail::local_matrix_store::const_ptr> &in
 	detail::sapply(*ins[0], *op, dim, out);
 }
 
+/*
+ * Get the mapply store that computes the matrix with element-wise operations,
+ * if the operations can be fused with the operations on the matrix.
+ */
+const detail::mapply_matrix_store *get_fusible_store(
+		const detail::matrix_store &store, matrix_layout_t layout)
+{
+	const detail::mapply_matrix_store *mapply_store
+		= dynamic_cast<const detail::mapply_matrix_store *>(&store);
+	// If the matrix has been materialized, we should use the materialized
+	// data instead of computing it again. If the materialized data is
+	// kept, e.g., the materialization planner decides to keep it because
+	// the matrix is used by multiple matrices in the DAG, the matrix can't
+	// be inlined either.
+	if (mapply_store == NULL || mapply_store->has_materialized()
+			|| mapply_store->get_materialize_level()
+			!= materialize_level::MATER_CPU
+			|| mapply_store->get_dag_ref() > 1
+			|| mapply_store->store_layout() != layout)
+		return NULL;
+
+	const detail::portion_mapply_op *op = mapply_store->get_portion_op().get();
+	if (dynamic_cast<const mapply2_op *>(op)
+			|| dynamic_cast<const sapply_op *>(op))
+		return mapply_store;
+	else
+		return NULL;
+}
+
+detail::fused_mapply_op::operand add_fused_operand(
+		detail::fused_mapply_builder &builder,
+		detail::matrix_store::const_ptr store, matrix_layout_t layout)
+{
+	detail::fused_mapply_op::operand arg;
+	if (builder.find(*store, arg))
+		return arg;
+
+	const detail::mapply_matrix_store *mapply_store = get_fusible_store(*store,
+			layout);
+	if (mapply_store == NULL
+			|| builder.get_num_steps() >= detail::fused_mapply_builder::MAX_NUM_STEPS)
+		return builder.add_input(store);
+
+	size_t num_steps = builder.get_num_steps();
+	size_t num_ins = builder.get_inputs().size();
+
+	std::vector<detail::matrix_store::const_ptr> ins
+		= mapply_store->get_input_mats();
+	std::vector<detail::fused_mapply_op::operand> args(ins.size());
+	for (size_t i = 0; i < ins.size(); i++)
+		args[i] = add_fused_operand(builder, ins[i], layout);
+
+	const detail::portion_mapply_op *op = mapply_store->get_portion_op().get();
+	const mapply2_op *bop = dynamic_cast<const mapply2_op *>(op);
+	if (bop)
+		arg = builder.add_step(bop->get_op(), args[0], args[1]);
+	else
+		arg = builder.add_step(
+				dynamic_cast<const sapply_op &>(*op).get_op(), args[0]);
+	// The operation that uses the matrix needs another step. If there are
+	// too many steps, we read the matrix as an input instead.
+	if (builder.get_num_steps() >= detail::fused_mapply_builder::MAX_NUM_STEPS) {
+		builder.truncate(num_steps, num_ins);
+		return builder.add_input(store);
+	}
+	builder.set(*store, arg);
+	return arg;
+}
+
+}
+
+namespace detail
+{
+
+portion_mapply_op::const_ptr fuse_mapply(const mapply_matrix_store &store,
+		std::vector<matrix_store::const_ptr> &ins)
+{
+	if (!matrix_conf.is_fuse_mapply())
+		return portion_mapply_op::const_ptr();
+	const portion_mapply_op *op = store.get_portion_op().get();
+	const mapply2_op *bop = dynamic_cast<const mapply2_op *>(op);
+	const sapply_op *uop = dynamic_cast<const sapply_op *>(op);
+	if (bop == NULL && uop == NULL)
+		return portion_mapply_op::const_ptr();
+
+	matrix_layout_t layout = store.store_layout();
+	const std::vector<matrix_store::const_ptr> &in_mats
+		= store.get_input_mats();
+	bool fusible = false;
+	for (size_t i = 0; i < in_mats.size(); i++)
+		fusible = fusible || get_fusible_store(*in_mats[i], layout);
+	if (!fusible)
+		return portion_mapply_op::const_ptr();
+
+	fused_mapply_builder builder;
+	std::vector<fused_mapply_op::operand> args(in_mats.size());
+	for (size_t i = 0; i < in_mats.size(); i++)
+		args[i] = add_fused_operand(builder, in_mats[i], layout);
+	if (bop)
+		builder.add_step(bop->get_op(), args[0], args[1]);
+	else
+		builder.add_step(uop->get_op(), args[0]);
+	ins = builder.get_inputs();
+	return builder.build(store.get_num_rows(), store.get_num_cols());
+}
+
 }
 
 dense_matrix::ptr dense_matrix::sapply(bulk_uoperate::const_ptr op) const
@@ -3907,22 +4102,9 @@ void groupby_ele_portion_op::run(
 
 generic_hashtable::ptr groupby_ele_portion_op::get_agg() const
 {
-	generic_hashtable::ptr ret;
-	size_t i;
-	// Find a local table.
-	for (i = 0; i < tables.size(); i++) {
-		if (tables[i]) {
-			ret = tables[i];
-			break;
-		}
-	}
-	// We need to move to the next local table.
-	i++;
-	// Merge with other local tables if they exist.
-	for (; i < tables.size(); i++)
-		if (tables[i])
-			ret->merge(*tables[i], *agg_op);
-	return ret;
+	// The local tables are merged in parallel. The tables of the threads
+	// that didn't process any portions are empty.
+	return generic_hashtable::merge(tables, *agg_op);
 }
 
 }
@@ -48,6 +48,21 @@ class factor_col_vector;
 class col_vec;
 class data_frame;
 
+/*
+ * The algorithms for computing the QR factorization of a tall matrix.
+ */
+enum qr_method
+{
+	// TSQR factorizes the portions of the matrix and the R factors
+	// computed from the portions. It reads the matrix once and is
+	// numerically stable for computing R.
+	QR_TSQR,
+	// Cholesky-QR2 computes the Cholesky factorization of the Gram matrix
+	// twice. It reads the matrix twice and mostly runs BLAS. It falls back
+	// to TSQR if the matrix is too ill-conditioned.
+	QR_CHOL2,
+};
+
 /*
  * This class represents a dense matrix and is able to perform computation
  * on the matrix. However, this class can't modify the matrix data. The only
@@ -328,6 +343,14 @@ public:
 			matrix_layout_t out_layout = matrix_layout_t::L_NONE) const;
 	virtual dense_matrix::ptr multiply(const dense_matrix &mat,
 			matrix_layout_t out_layout = matrix_layout_t::L_NONE) const;
+	/*
+	 * Compute the QR factorization of a tall matrix.
+	 * R is a small upper-triangular matrix in memory. Q is a virtual matrix
+	 * computed from this matrix and the inverse of R, so it's only
+	 * materialized when it's used.
+	 */
+	bool qr(dense_matrix::ptr &Q, dense_matrix::ptr &R,
+			qr_method method = QR_TSQR) const;
 	/*
 	 * Compute aggregation on the matrix.
 	 * It can aggregate on rows, on columns or on all elements.
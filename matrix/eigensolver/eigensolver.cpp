@@ -1,3 +1,7 @@
+#include "log.h"
+
+#include "eigensolver.h"
+
 #ifdef ENABLE_TRILINOS
 
 // Include header for block Davidson eigensolver
@@ -79,42 +83,6 @@ namespace fm
 namespace eigen
 {
 
-eigen_options::eigen_options()
-{
-	tol = 1.0e-8;
-	max_restarts = 100;
-	max_iters = 500;
-	this->nev = 1;
-	this->solver = "KrylovSchur";
-	which="LM";
-	in_mem = true;
-}
-
-bool eigen_options::init(int nev, std::string solver)
-{
-	this->nev = nev;
-	this->solver = solver;
-	if (solver == "KrylovSchur") {
-		block_size = 1;
-		// The KrylovSchur solver wants the number of blocks to be at least 3.
-		num_blocks = std::max(nev * 2, 3);
-	}
-	else if (solver == "Davidson") {
-		block_size = nev;
-		num_blocks = 4;
-	}
-	else if (solver == "LOBPCG") {
-		block_size = 4;
-		num_blocks = 10;
-	}
-	else {
-		BOOST_LOG_TRIVIAL(error) << "Unknown solver: " << solver;
-		return false;
-	}
-
-	return true;
-}
-
 eigen_res compute_eigen(spm_function *func, bool sym,
 		struct eigen_options &_opts, bool verbose)
 {
@@ -136,6 +104,9 @@ eigen_res compute_eigen(spm_function *func, bool sym,
 	typedef spm_function OP;
 	typedef Anasazi::MultiVecTraits<double, MV> MVT;
 
+	if (_opts.solver == "native")
+		return compute_eigen_native(func, sym, _opts, verbose);
+
 	RCP<spm_function> A = rcp(func);
 
 	struct eigen_options opts = _opts;
@@ -312,3 +283,67 @@ eigen_res compute_eigen(spm_function *func, bool sym,
 }
 
 #endif
+
+namespace fm
+{
+
+namespace eigen
+{
+
+eigen_options::eigen_options()
+{
+	tol = 1.0e-8;
+	max_restarts = 100;
+	max_iters = 500;
+	this->nev = 1;
+	block_size = 0;
+	this->solver = "KrylovSchur";
+	which="LM";
+	in_mem = true;
+}
+
+bool eigen_options::init(int nev, std::string solver)
+{
+	this->nev = nev;
+	this->solver = solver;
+	if (solver == "KrylovSchur") {
+		block_size = 1;
+		// The KrylovSchur solver wants the number of blocks to be at least 3.
+		num_blocks = std::max(nev * 2, 3);
+	}
+	else if (solver == "Davidson") {
+		block_size = nev;
+		num_blocks = 4;
+	}
+	else if (solver == "LOBPCG") {
+		block_size = 4;
+		num_blocks = 10;
+	}
+	else if (solver == "native") {
+		block_size = nev;
+		num_blocks = 3;
+	}
+	else {
+		BOOST_LOG_TRIVIAL(error) << "Unknown solver: " << solver;
+		return false;
+	}
+
+	return true;
+}
+
+#ifndef ENABLE_TRILINOS
+
+eigen_res compute_eigen(spm_function *func, bool sym,
+		struct eigen_options &opts, bool verbose)
+{
+	if (opts.solver != "native")
+		BOOST_LOG_TRIVIAL(warning) << "Trilinos isn't enabled. "
+			<< "Use the native eigensolver instead of " << opts.solver;
+	return compute_eigen_native(func, sym, opts, verbose);
+}
+
+#endif
+
+}
+
+}
@@ -75,10 +75,41 @@ struct eigen_options
 
 /*
  * `func' will be destroyed by this function.
+ * The native solver is used if the solver is "native" or if FlashMatrix
+ * is compiled without Trilinos.
  */
 eigen_res compute_eigen(spm_function *func, bool sym,
 		struct eigen_options &opts, bool verbose=false);
 
+/*
+ * This computes the eigenpairs of a symmetric matrix with LOBPCG that
+ * runs directly on dense matrices. It doesn't require Trilinos.
+ * `func' will be destroyed by this function.
+ */
+eigen_res compute_eigen_native(spm_function *func, bool sym,
+		struct eigen_options &opts, bool verbose=false);
+
+struct svd_res
+{
+	std::vector<double> vals;
+	fm::dense_matrix::ptr U;
+	fm::dense_matrix::ptr V;
+	size_t num_ops;
+};
+
+/*
+ * This computes the top `nsv' singular values and vectors of a matrix
+ * with randomized SVD. `func' multiplies the matrix and `t_func'
+ * multiplies its transpose. `num_over' is the number of extra columns
+ * used for sampling the range of the matrix and `num_power_iters' is
+ * the number of power iterations, which improve the accuracy when
+ * the singular values decay slowly. PCA can be computed by passing
+ * the operators of the centered matrix.
+ */
+svd_res compute_rsvd(spm_function::const_ptr func,
+		spm_function::const_ptr t_func, size_t nsv, size_t num_over = 10,
+		size_t num_power_iters = 2, bool in_mem = true);
+
 }
 
 }
@@ -0,0 +1,486 @@
+/*
+ * Copyright 2017 Open Connectome Project (http://openconnecto.me)
+ * Written by Da Zheng (zhengda1936@gmail.com)
+ *
+ * This file is part of FlashMatrix.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <math.h>
+
+#include <algorithm>
+
+#include "log.h"
+
+#include "eigensolver.h"
+#include "mem_matrix_store.h"
+#include "col_vec.h"
+#include "matrix_config.h"
+#include "matrix_stats.h"
+
+/*
+ * This file implements the eigensolvers that run directly on dense_matrix
+ * without Trilinos. The tall-and-skinny matrices are kept in memory or
+ * on SSDs, and all operations on them are expressed with dense_matrix
+ * operations. Only the small matrices (whose size depends on the block
+ * size) are computed in memory.
+ */
+
+namespace fm
+{
+
+namespace eigen
+{
+
+namespace
+{
+
+/*
+ * A small column-major matrix in memory.
+ */
+class small_mat
+{
+	size_t nrow;
+	size_t ncol;
+	std::vector<double> data;
+public:
+	small_mat() {
+		nrow = 0;
+		ncol = 0;
+	}
+
+	small_mat(size_t nrow, size_t ncol): data(nrow * ncol) {
+		this->nrow = nrow;
+		this->ncol = ncol;
+	}
+
+	size_t get_num_rows() const {
+		return nrow;
+	}
+
+	size_t get_num_cols() const {
+		return ncol;
+	}
+
+	double &operator()(size_t row, size_t col) {
+		return data[col * nrow + row];
+	}
+
+	double operator()(size_t row, size_t col) const {
+		return data[col * nrow + row];
+	}
+
+	small_mat multiply(const small_mat &m) const {
+		assert(ncol == m.nrow);
+		small_mat ret(nrow, m.ncol);
+		for (size_t j = 0; j < m.ncol; j++)
+			for (size_t k = 0; k < ncol; k++) {
+				double v = m(k, j);
+				for (size_t i = 0; i < nrow; i++)
+					ret(i, j) += (*this)(i, k) * v;
+			}
+		return ret;
+	}
+
+	small_mat transpose() const {
+		small_mat ret(ncol, nrow);
+		for (size_t j = 0; j < ncol; j++)
+			for (size_t i = 0; i < nrow; i++)
+				ret(j, i) = (*this)(i, j);
+		return ret;
+	}
+
+	small_mat get_rows(size_t start, size_t end) const {
+		small_mat ret(end - start, ncol);
+		for (size_t j = 0; j < ncol; j++)
+			for (size_t i = start; i < end; i++)
+				ret(i - start, j) = (*this)(i, j);
+		return ret;
+	}
+
+	small_mat get_cols(const std::vector<size_t> &idxs) const {
+		small_mat ret(nrow, idxs.size());
+		for (size_t j = 0; j < idxs.size(); j++)
+			for (size_t i = 0; i < nrow; i++)
+				ret(i, j) = (*this)(i, idxs[j]);
+		return ret;
+	}
+
+	static small_mat create(const dense_matrix &mat) {
+		dense_matrix::ptr mem_mat = mat.conv_store(true, -1);
+		assert(mem_mat);
+		detail::mem_matrix_store::const_ptr store
+			= detail::mem_matrix_store::cast(mem_mat->get_raw_store());
+		small_mat ret(mat.get_num_rows(), mat.get_num_cols());
+		for (size_t j = 0; j < ret.ncol; j++)
+			for (size_t i = 0; i < ret.nrow; i++)
+				ret(i, j) = store->get<double>(i, j);
+		return ret;
+	}
+
+	dense_matrix::ptr conv2dense() const {
+		detail::mem_matrix_store::ptr store = detail::mem_matrix_store::create(
+				nrow, ncol, matrix_layout_t::L_COL, get_scalar_type<double>(),
+				-1);
+		for (size_t j = 0; j < ncol; j++)
+			for (size_t i = 0; i < nrow; i++)
+				store->set<double>(i, j, (*this)(i, j));
+		return dense_matrix::create(store);
+	}
+};
+
+/*
+ * Compute all eigenpairs of a small symmetric matrix with the cyclic
+ * Jacobi method. The eigenvectors are stored in the columns of `vecs'.
+ */
+void sym_eigen(small_mat a, std::vector<double> &vals, small_mat &vecs)
+{
+	size_t n = a.get_num_rows();
+	assert(n == a.get_num_cols());
+	vecs = small_mat(n, n);
+	for (size_t i = 0; i < n; i++)
+		vecs(i, i) = 1;
+
+	for (size_t sweep = 0; sweep < 100; sweep++) {
+		double off = 0;
+		double diag = 0;
+		for (size_t j = 0; j < n; j++) {
+			diag += a(j, j) * a(j, j);
+			for (size_t i = 0; i < j; i++)
+				off += a(i, j) * a(i, j);
+		}
+		if (off <= 1e-30 * diag || off == 0)
+			break;
+
+		for (size_t p = 0; p < n; p++)
+			for (size_t q = p + 1; q < n; q++) {
+				if (a(p, q) == 0)
+					continue;
+				double theta = (a(q, q) - a(p, p)) / (2 * a(p, q));
+				double t = (theta >= 0 ? 1 : -1)
+					/ (fabs(theta) + sqrt(theta * theta + 1));
+				double c = 1 / sqrt(t * t + 1);
+				double s = t * c;
+				for (size_t k = 0; k < n; k++) {
+					double akp = a(k, p);
+					double akq = a(k, q);
+					a(k, p) = c * akp - s * akq;
+					a(k, q) = s * akp + c * akq;
+				}
+				for (size_t k = 0; k < n; k++) {
+					double apk = a(p, k);
+					double aqk = a(q, k);
+					a(p, k) = c * apk - s * aqk;
+					a(q, k) = s * apk + c * aqk;
+				}
+				for (size_t k = 0; k < n; k++) {
+					double vkp = vecs(k, p);
+					double vkq = vecs(k, q);
+					vecs(k, p) = c * vkp - s * vkq;
+					vecs(k, q) = s * vkp + c * vkq;
+				}
+			}
+	}
+	vals.resize(n);
+	for (size_t i = 0; i < n; i++)
+		vals[i] = a(i, i);
+}
+
+/*
+ * Get the order of the eigenvalues based on the `which' option of
+ * the eigensolver.
+ */
+std::vector<size_t> order_eigen(const std::vector<double> &vals,
+		const std::string &which)
+{
+	std::vector<size_t> idxs(vals.size());
+	for (size_t i = 0; i < idxs.size(); i++)
+		idxs[i] = i;
+	if (which == "LA")
+		std::sort(idxs.begin(), idxs.end(), [&vals](size_t i, size_t j) {
+				return vals[i] > vals[j];});
+	else if (which == "SA")
+		std::sort(idxs.begin(), idxs.end(), [&vals](size_t i, size_t j) {
+				return vals[i] < vals[j];});
+	else if (which == "SM")
+		std::sort(idxs.begin(), idxs.end(), [&vals](size_t i, size_t j) {
+				return fabs(vals[i]) < fabs(vals[j]);});
+	else
+		std::sort(idxs.begin(), idxs.end(), [&vals](size_t i, size_t j) {
+				return fabs(vals[i]) > fabs(vals[j]);});
+	return idxs;
+}
+
+/*
+ * Given the Gram matrix G = S^T * S of a tall matrix S, compute T such
+ * that S * T has orthonormal columns (SVQB). The columns of S that are
+ * linearly dependent on the others are dropped, so T may have fewer
+ * columns than S.
+ */
+small_mat orth_trans(const small_mat &gram)
+{
+	size_t n = gram.get_num_rows();
+	// We scale the Gram matrix first, so the columns of S with very
+	// different norms are treated equally.
+	std::vector<double> scales(n);
+	for (size_t i = 0; i < n; i++)
+		scales[i] = gram(i, i) > 0 ? 1 / sqrt(gram(i, i)) : 0;
+	small_mat scaled(n, n);
+	for (size_t j = 0; j < n; j++)
+		for (size_t i = 0; i < n; i++)
+			scaled(i, j) = gram(i, j) * scales[i] * scales[j];
+
+	std::vector<double> vals;
+	small_mat vecs;
+	sym_eigen(scaled, vals, vecs);
+	double max_val = 0;
+	for (size_t i = 0; i < n; i++)
+		max_val = std::max(max_val, vals[i]);
+	std::vector<size_t> keep;
+	for (size_t i = 0; i < n; i++)
+		if (vals[i] > max_val * 1e-12)
+			keep.push_back(i);
+
+	small_mat ret(n, keep.size());
+	for (size_t j = 0; j < keep.size(); j++) {
+		double s = 1 / sqrt(vals[keep[j]]);
+		for (size_t i = 0; i < n; i++)
+			ret(i, j) = scales[i] * vecs(i, keep[j]) * s;
+	}
+	return ret;
+}
+
+small_mat inner_prod(const dense_matrix &m1, const dense_matrix &m2)
+{
+	dense_matrix::ptr res = m1.transpose()->multiply(m2);
+	return small_mat::create(*res);
+}
+
+/*
+ * Materialize a tall matrix in memory or on SSDs.
+ */
+dense_matrix::ptr mater_tall(dense_matrix::ptr mat, bool in_mem)
+{
+	if (in_mem)
+		return mat->conv_store(true, matrix_conf.get_num_nodes());
+	else
+		return mat->conv_store(false, -1);
+}
+
+dense_matrix::ptr multiply_small(const dense_matrix &tall, const small_mat &m,
+		bool in_mem)
+{
+	return mater_tall(tall.multiply(*m.conv2dense()), in_mem);
+}
+
+dense_matrix::ptr apply_op(const spm_function &op, dense_matrix::ptr x,
+		bool in_mem, size_t &num_ops)
+{
+	num_ops += x->get_num_cols();
+	dense_matrix::ptr res = op.run(x);
+	return mater_tall(res, in_mem);
+}
+
+dense_matrix::ptr orthonormalize(dense_matrix::ptr mat, bool in_mem)
+{
+	return multiply_small(*mat, orth_trans(inner_prod(*mat, *mat)), in_mem);
+}
+
+}
+
+eigen_res compute_eigen_native(spm_function *func, bool sym,
+		struct eigen_options &opts, bool verbose)
+{
+	std::unique_ptr<spm_function> A(func);
+	if (!sym) {
+		BOOST_LOG_TRIVIAL(error)
+			<< "the native eigensolver only works for symmetric matrices";
+		return eigen_res();
+	}
+	size_t n = A->get_num_cols();
+	size_t nev = opts.nev;
+	size_t block_size = std::max<size_t>(std::max(opts.block_size, 0), nev);
+	block_size = std::min(block_size, n);
+	if (nev > block_size) {
+		BOOST_LOG_TRIVIAL(error) << "can't compute more eigenvalues than #rows";
+		return eigen_res();
+	}
+	size_t num_ops = 0;
+
+	// This implements LOBPCG. In each iteration, we run Rayleigh-Ritz on
+	// the subspace spanned by the current approximate eigenvectors X,
+	// the residuals R and the search directions P. We maintain A * X,
+	// A * P, so each iteration only needs one SpMM on the residuals.
+	std::vector<dense_matrix::ptr> S(1);
+	std::vector<dense_matrix::ptr> AS(1);
+	S[0] = mater_tall(dense_matrix::create_randn<double>(0, 1, n, block_size,
+				matrix_layout_t::L_COL), opts.in_mem);
+	AS[0] = apply_op(*A, S[0], opts.in_mem, num_ops);
+
+	dense_matrix::ptr X, AX;
+	std::vector<double> vals;
+	size_t iter;
+	bool converged = false;
+	for (iter = 0; ; iter++) {
+		dense_matrix::ptr Smat = dense_matrix::cbind(S);
+		dense_matrix::ptr ASmat = dense_matrix::cbind(AS);
+		small_mat T = orth_trans(inner_prod(*Smat, *Smat));
+		small_mat H = T.transpose().multiply(inner_prod(*Smat, *ASmat)).multiply(T);
+		// Remove the asymmetry caused by rounding errors.
+		for (size_t j = 0; j < H.get_num_cols(); j++)
+			for (size_t i = 0; i < j; i++) {
+				double v = (H(i, j) + H(j, i)) / 2;
+				H(i, j) = v;
+				H(j, i) = v;
+			}
+		std::vector<double> ritz_vals;
+		small_mat ritz_vecs;
+		sym_eigen(H, ritz_vals, ritz_vecs);
+		std::vector<size_t> order = order_eigen(ritz_vals, opts.which);
+		order.resize(std::min(order.size(), block_size));
+		vals.resize(order.size());
+		for (size_t i = 0; i < order.size(); i++)
+			vals[i] = ritz_vals[order[i]];
+		small_mat Y = T.multiply(ritz_vecs.get_cols(order));
+
+		size_t num_x_cols = S[0]->get_num_cols();
+		X = multiply_small(*Smat, Y, opts.in_mem);
+		AX = multiply_small(*ASmat, Y, opts.in_mem);
+		// The new search directions are the part of the new approximate
+		// eigenvectors that doesn't come from the old ones.
+		dense_matrix::ptr P, AP;
+		if (S.size() > 1) {
+			small_mat Yp = Y.get_rows(num_x_cols, Y.get_num_rows());
+			size_t ncol = Smat->get_num_cols();
+			P = multiply_small(*Smat->get_cols(num_x_cols, ncol), Yp,
+					opts.in_mem);
+			AP = multiply_small(*ASmat->get_cols(num_x_cols, ncol), Yp,
+					opts.in_mem);
+		}
+		Smat = NULL;
+		ASmat = NULL;
+		S.clear();
+		AS.clear();
+
+		// R = A * X - X * diag(vals)
+		detail::mem_matrix_store::ptr val_store = detail::mem_matrix_store::create(
+				vals.size(), 1, matrix_layout_t::L_COL,
+				get_scalar_type<double>(), -1);
+		for (size_t i = 0; i < vals.size(); i++)
+			val_store->set<double>(i, 0, vals[i]);
+		dense_matrix::ptr R = mater_tall(AX->minus(*X->scale_cols(
+						col_vec::create(val_store))), opts.in_mem);
+		small_mat RR = inner_prod(*R, *R);
+		size_t num_conv = 0;
+		for (size_t i = 0; i < std::min(nev, vals.size()); i++)
+			if (sqrt(fabs(RR(i, i))) <= opts.tol * std::max(fabs(vals[i]), 1e-12))
+				num_conv++;
+		if (verbose)
+			BOOST_LOG_TRIVIAL(info) << boost::format(
+					"LOBPCG iteration %1%: %2% eigenpairs converged")
+				% iter % num_conv;
+		if (num_conv == nev) {
+			converged = true;
+			break;
+		}
+		if ((int) iter >= opts.max_iters)
+			break;
+
+		S.push_back(X);
+		AS.push_back(AX);
+		S.push_back(R);
+		AS.push_back(apply_op(*A, R, opts.in_mem, num_ops));
+		if (P) {
+			S.push_back(P);
+			AS.push_back(AP);
+		}
+		// If orth_trans() dropped linearly dependent columns, the block
+		// has fewer vectors than required. We refill it with random
+		// vectors, so the next Rayleigh-Ritz can find all eigenpairs.
+		if (vals.size() < block_size) {
+			dense_matrix::ptr fill = mater_tall(
+					dense_matrix::create_randn<double>(0, 1, n,
+						block_size - vals.size(), matrix_layout_t::L_COL),
+					opts.in_mem);
+			S.push_back(fill);
+			AS.push_back(apply_op(*A, fill, opts.in_mem, num_ops));
+		}
+	}
+	if (!converged)
+		BOOST_LOG_TRIVIAL(error) << "the native LOBPCG did not converge.";
+
+	struct eigen_res res;
+	res.vals.assign(vals.begin(), vals.begin() + std::min(nev, vals.size()));
+	res.vecs = X->get_cols(0, res.vals.size());
+	res.status.num_iters = iter;
+	res.status.num_ops = num_ops;
+	BOOST_LOG_TRIVIAL(info) << "#mem read bytes: "
+		<< detail::matrix_stats.get_read_bytes(true);
+	BOOST_LOG_TRIVIAL(info) << "#EM read bytes: "
+		<< detail::matrix_stats.get_read_bytes(false);
+	return res;
+}
+
+svd_res compute_rsvd(spm_function::const_ptr func,
+		spm_function::const_ptr t_func, size_t nsv, size_t num_over,
+		size_t num_power_iters, bool in_mem)
+{
+	size_t nrow = func->get_num_rows();
+	size_t ncol = func->get_num_cols();
+	size_t l = std::min(nsv + num_over, std::min(nrow, ncol));
+	svd_res res;
+	res.num_ops = 0;
+	if (nsv > l) {
+		BOOST_LOG_TRIVIAL(error) << "too many singular values are requested";
+		return res;
+	}
+
+	// Y = A * Omega. We orthonormalize Y and A^T * Y in every power
+	// iteration to avoid losing the small singular values to rounding.
+	dense_matrix::ptr omega = mater_tall(dense_matrix::create_randn<double>(
+				0, 1, ncol, l, matrix_layout_t::L_COL), in_mem);
+	dense_matrix::ptr Q = apply_op(*func, omega, in_mem, res.num_ops);
+	omega = NULL;
+	for (size_t i = 0; i < num_power_iters; i++) {
+		Q = orthonormalize(Q, in_mem);
+		dense_matrix::ptr Z = orthonormalize(apply_op(*t_func, Q, in_mem,
+					res.num_ops), in_mem);
+		Q = apply_op(*func, Z, in_mem, res.num_ops);
+	}
+	Q = orthonormalize(Q, in_mem);
+
+	// B^T = A^T * Q and B * B^T = U_B * S^2 * U_B^T.
+	dense_matrix::ptr Bt = apply_op(*t_func, Q, in_mem, res.num_ops);
+	std::vector<double> vals;
+	small_mat vecs;
+	sym_eigen(inner_prod(*Bt, *Bt), vals, vecs);
+	std::vector<size_t> order = order_eigen(vals, "LA");
+	order.resize(std::min(nsv, order.size()));
+	small_mat Ub = vecs.get_cols(order);
+	res.vals.resize(order.size());
+	small_mat Ub_scaled = Ub;
+	for (size_t j = 0; j < order.size(); j++) {
+		res.vals[j] = sqrt(std::max(vals[order[j]], 0.0));
+		double s = res.vals[j] > 0 ? 1 / res.vals[j] : 0;
+		for (size_t i = 0; i < Ub.get_num_rows(); i++)
+			Ub_scaled(i, j) *= s;
+	}
+	res.U = multiply_small(*Q, Ub, in_mem);
+	res.V = multiply_small(*Bt, Ub_scaled, in_mem);
+	return res;
+}
+
+}
+
+}
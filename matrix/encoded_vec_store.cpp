@@ -0,0 +1,913 @@
+/*
+ * Copyright 2017 Open Connectome Project (http://openconnecto.me)
+ * Written by Da Zheng (zhengda1936@gmail.com)
+ *
+ * This file is part of FlashMatrix.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <string.h>
+
+#include <algorithm>
+#include <unordered_map>
+#include <type_traits>
+
+#include <boost/format.hpp>
+
+#include "log.h"
+
+#include "encoded_vec_store.h"
+#include "mem_vec_store.h"
+#include "local_vec_store.h"
+#include "bulk_operate_ext.h"
+#include "bit_packing.h"
+
+namespace fm
+{
+
+namespace detail
+{
+
+const size_t encoded_vec_store::BLOCK_SIZE;
+
+namespace
+{
+
+// The max number of distinct values in a dictionary.
+static const size_t MAX_DICT_SIZE = 1 << 16;
+
+/*
+ * Long double doesn't have an integer type of the same size, so we use
+ * a struct to copy and compare its bits.
+ */
+struct bits128
+{
+	uint64_t lo;
+	uint64_t hi;
+
+	bool operator==(const bits128 &b) const {
+		return lo == b.lo && hi == b.hi;
+	}
+	bool operator!=(const bits128 &b) const {
+		return !(*this == b);
+	}
+};
+
+template<int size>
+struct entry_type
+{
+	typedef typename bits_type<size>::type type;
+};
+
+template<>
+struct entry_type<16>
+{
+	typedef bits128 type;
+};
+
+template<class E>
+struct entry_hash
+{
+	size_t operator()(const E &e) const {
+		return std::hash<E>()(e);
+	}
+};
+
+template<>
+struct entry_hash<bits128>
+{
+	size_t operator()(const bits128 &e) const {
+		return std::hash<uint64_t>()(e.lo * 0x9E3779B97F4A7C15UL ^ e.hi);
+	}
+};
+
+static size_t get_num_blocks(size_t length)
+{
+	return (length + encoded_vec_store::BLOCK_SIZE - 1)
+		/ encoded_vec_store::BLOCK_SIZE;
+}
+
+/*
+ * Test if the aggregation returns the same result when a value appears
+ * multiple times, i.e., MIN and MAX.
+ */
+static bool is_idempotent(const agg_operate &op)
+{
+	const basic_ops &ops = op.get_input_type().get_basic_ops();
+	return &op.get_agg() == ops.get_op(basic_ops::op_idx::MIN)
+		|| &op.get_agg() == ops.get_op(basic_ops::op_idx::MAX);
+}
+
+encoded_data::const_ptr create_dict_data(const scalar_type &type,
+		const char *dict, size_t num_dict, int width,
+		std::shared_ptr<const std::vector<uint64_t> > idxs);
+encoded_data::const_ptr create_rle_data(const scalar_type &type,
+		const char *vals, std::shared_ptr<const std::vector<uint64_t> > ends);
+
+/*
+ * The dictionary encoding. The indexes to the dictionary of all values
+ * are bit-packed together. BLOCK_SIZE is a multiple of 64, so each block
+ * starts at a word boundary.
+ */
+template<class E>
+class dict_data: public encoded_data
+{
+	std::vector<E> dict;
+	int width;
+	std::shared_ptr<const std::vector<uint64_t> > idxs;
+public:
+	dict_data(const E *dict, size_t num_dict, int width,
+			std::shared_ptr<const std::vector<uint64_t> > idxs) {
+		this->dict.assign(dict, dict + num_dict);
+		this->width = width;
+		this->idxs = idxs;
+	}
+
+	virtual vec_encoding get_encoding() const {
+		return vec_encoding::DICT;
+	}
+
+	virtual size_t get_num_bytes() const {
+		return dict.size() * sizeof(E) + idxs->size() * sizeof(uint64_t);
+	}
+
+	virtual void decode(off_t start, size_t num, char *buf) const {
+		E *out = reinterpret_cast<E *>(buf);
+		uint64_t mask = get_mask(width);
+		for (size_t i = 0; i < num; i++)
+			out[i] = dict[unpack_bits(idxs->data(), start + i, width, mask)];
+	}
+
+	virtual encoded_data::const_ptr sapply(const bulk_uoperate &op) const {
+		const scalar_type &out_type = op.get_output_type();
+		std::vector<char> out_dict(dict.size() * out_type.get_size());
+		op.runA(dict.size(), dict.data(), out_dict.data());
+		// The new dictionary may have duplicated values, which is fine.
+		return create_dict_data(out_type, out_dict.data(), dict.size(), width,
+				idxs);
+	}
+
+	virtual bool aggregate(const agg_operate &op, char *out) const {
+		if (!is_idempotent(op))
+			return false;
+		// All values in the dictionary appear in the vector.
+		op.runAgg(dict.size(), dict.data(), out);
+		return true;
+	}
+};
+
+/*
+ * The run-length encoding. It keeps the value of each run and the end
+ * of each run (exclusive), so we can find the run of a value with
+ * binary search.
+ */
+template<class E>
+class rle_data: public encoded_data
+{
+	std::vector<E> vals;
+	std::shared_ptr<const std::vector<uint64_t> > ends;
+public:
+	rle_data(const E *vals, std::shared_ptr<const std::vector<uint64_t> > ends) {
+		this->vals.assign(vals, vals + ends->size());
+		this->ends = ends;
+	}
+
+	virtual vec_encoding get_encoding() const {
+		return vec_encoding::RLE;
+	}
+
+	virtual size_t get_num_bytes() const {
+		return vals.size() * sizeof(E) + ends->size() * sizeof(uint64_t);
+	}
+
+	virtual void decode(off_t start, size_t num, char *buf) const {
+		E *out = reinterpret_cast<E *>(buf);
+		size_t run = std::upper_bound(ends->begin(), ends->end(),
+				(uint64_t) start) - ends->begin();
+		uint64_t end = start + num;
+		for (uint64_t i = start; i < end; run++) {
+			assert(run < vals.size());
+			uint64_t run_end = std::min((*ends)[run], end);
+			for (; i < run_end; i++)
+				out[i - start] = vals[run];
+		}
+	}
+
+	virtual encoded_data::const_ptr sapply(const bulk_uoperate &op) const {
+		const scalar_type &out_type = op.get_output_type();
+		std::vector<char> out_vals(vals.size() * out_type.get_size());
+		op.runA(vals.size(), vals.data(), out_vals.data());
+		return create_rle_data(out_type, out_vals.data(), ends);
+	}
+
+	virtual bool aggregate(const agg_operate &op, char *out) const {
+		if (!is_idempotent(op))
+			return false;
+		op.runAgg(vals.size(), vals.data(), out);
+		return true;
+	}
+};
+
+/*
+ * Frame-of-reference encoding. Each block keeps its min value and the
+ * differences with the min value are bit-packed with the width of
+ * the block. We also keep the max value of each block, so MIN and MAX
+ * only need to look at the block statistics.
+ */
+template<class E>
+class for_data: public encoded_data
+{
+	std::vector<E> mins;
+	std::vector<E> maxs;
+	std::vector<uint8_t> widths;
+	// The location of each block in `words'.
+	std::vector<uint64_t> offs;
+	std::vector<uint64_t> words;
+public:
+	for_data(std::vector<E> &mins, std::vector<E> &maxs,
+			std::vector<uint8_t> &widths, std::vector<uint64_t> &offs,
+			std::vector<uint64_t> &words) {
+		this->mins.swap(mins);
+		this->maxs.swap(maxs);
+		this->widths.swap(widths);
+		this->offs.swap(offs);
+		this->words.swap(words);
+	}
+
+	virtual vec_encoding get_encoding() const {
+		return vec_encoding::FOR;
+	}
+
+	virtual size_t get_num_bytes() const {
+		return (mins.size() + maxs.size()) * sizeof(E) + widths.size()
+			+ (offs.size() + words.size()) * sizeof(uint64_t);
+	}
+
+	virtual void decode(off_t start, size_t num, char *buf) const {
+		E *out = reinterpret_cast<E *>(buf);
+		size_t end = start + num;
+		for (size_t i = start; i < end;) {
+			size_t block = i / encoded_vec_store::BLOCK_SIZE;
+			size_t block_start = block * encoded_vec_store::BLOCK_SIZE;
+			size_t block_end = std::min(end,
+					block_start + encoded_vec_store::BLOCK_SIZE);
+			const uint64_t *in = words.data() + offs[block];
+			int width = widths[block];
+			uint64_t mask = get_mask(width);
+			E min = mins[block];
+			// The values are added as unsigned integers, which gives us
+			// the original bits of signed integers.
+			for (; i < block_end; i++)
+				out[i - start] = (E) (min + unpack_bits(in, i - block_start,
+							width, mask));
+		}
+	}
+
+	virtual encoded_data::const_ptr sapply(const bulk_uoperate &op) const {
+		return encoded_data::const_ptr();
+	}
+
+	virtual bool aggregate(const agg_operate &op, char *out) const {
+		const basic_ops &ops = op.get_input_type().get_basic_ops();
+		if (&op.get_agg() == ops.get_op(basic_ops::op_idx::MIN))
+			op.runAgg(mins.size(), mins.data(), out);
+		else if (&op.get_agg() == ops.get_op(basic_ops::op_idx::MAX))
+			op.runAgg(maxs.size(), maxs.data(), out);
+		else
+			return false;
+		return true;
+	}
+};
+
+template<class E>
+encoded_data::const_ptr create_dict_data(const char *dict, size_t num_dict,
+		int width, std::shared_ptr<const std::vector<uint64_t> > idxs)
+{
+	return encoded_data::const_ptr(new dict_data<E>(
+				reinterpret_cast<const E *>(dict), num_dict, width, idxs));
+}
+
+encoded_data::const_ptr create_dict_data(const scalar_type &type,
+		const char *dict, size_t num_dict, int width,
+		std::shared_ptr<const std::vector<uint64_t> > idxs)
+{
+	switch (type.get_size()) {
+		case 1:
+			return create_dict_data<uint8_t>(dict, num_dict, width, idxs);
+		case 2:
+			return create_dict_data<uint16_t>(dict, num_dict, width, idxs);
+		case 4:
+			return create_dict_data<uint32_t>(dict, num_dict, width, idxs);
+		case 8:
+			return create_dict_data<uint64_t>(dict, num_dict, width, idxs);
+		case 16:
+			return create_dict_data<bits128>(dict, num_dict, width, idxs);
+		default:
+			throw invalid_arg_exception("unsupported entry size");
+	}
+}
+
+template<class E>
+encoded_data::const_ptr create_rle_data(const char *vals,
+		std::shared_ptr<const std::vector<uint64_t> > ends)
+{
+	return encoded_data::const_ptr(new rle_data<E>(
+				reinterpret_cast<const E *>(vals), ends));
+}
+
+encoded_data::const_ptr create_rle_data(const scalar_type &type,
+		const char *vals, std::shared_ptr<const std::vector<uint64_t> > ends)
+{
+	switch (type.get_size()) {
+		case 1:
+			return create_rle_data<uint8_t>(vals, ends);
+		case 2:
+			return create_rle_data<uint16_t>(vals, ends);
+		case 4:
+			return create_rle_data<uint32_t>(vals, ends);
+		case 8:
+			return create_rle_data<uint64_t>(vals, ends);
+		case 16:
+			return create_rle_data<bits128>(vals, ends);
+		default:
+			throw invalid_arg_exception("unsupported entry size");
+	}
+}
+
+/*
+ * This computes frame-of-reference encoding. It only applies to integers.
+ */
+template<class T, bool integral>
+class for_encoder
+{
+public:
+	void init(const T *vals, size_t num) {
+	}
+	size_t get_encoded_size() const {
+		return std::numeric_limits<size_t>::max();
+	}
+	encoded_data::const_ptr encode() const {
+		BOOST_LOG_TRIVIAL(error)
+			<< "Frame-of-reference encoding only works for integers";
+		return encoded_data::const_ptr();
+	}
+};
+
+template<class T>
+class for_encoder<T, true>
+{
+	// We compute the differences with unsigned integers, so they don't
+	// overflow.
+	typedef typename bits_type<sizeof(T)>::type E;
+
+	const T *vals;
+	size_t num;
+	// The min and max values of each block.
+	std::vector<E> mins;
+	std::vector<E> maxs;
+
+	int get_block_width(size_t block) const {
+		return get_num_bits((E) (maxs[block] - mins[block]));
+	}
+public:
+	void init(const T *vals, size_t num);
+	size_t get_encoded_size() const;
+	encoded_data::const_ptr encode() const;
+};
+
+template<class T>
+void for_encoder<T, true>::init(const T *vals, size_t num)
+{
+	this->vals = vals;
+	this->num = num;
+	size_t num_blocks = get_num_blocks(num);
+	mins.resize(num_blocks);
+	maxs.resize(num_blocks);
+#pragma omp parallel for
+	for (size_t block = 0; block < num_blocks; block++) {
+		size_t start = block * encoded_vec_store::BLOCK_SIZE;
+		size_t end = std::min(num, start + encoded_vec_store::BLOCK_SIZE);
+		T min = vals[start];
+		T max = vals[start];
+		for (size_t i = start + 1; i < end; i++) {
+			min = std::min(min, vals[i]);
+			max = std::max(max, vals[i]);
+		}
+		memcpy(&mins[block], &min, sizeof(T));
+		memcpy(&maxs[block], &max, sizeof(T));
+	}
+}
+
+template<class T>
+size_t for_encoder<T, true>::get_encoded_size() const
+{
+	size_t size = 0;
+	for (size_t block = 0; block < mins.size(); block++) {
+		size_t start = block * encoded_vec_store::BLOCK_SIZE;
+		size_t len = std::min(num - start, encoded_vec_store::BLOCK_SIZE);
+		// Each block keeps the min and max values, the width and
+		// the location of the block.
+		size += get_packed_size(len, get_block_width(block))
+			+ sizeof(E) * 2 + 1 + sizeof(uint64_t);
+	}
+	return size;
+}
+
+template<class T>
+encoded_data::const_ptr for_encoder<T, true>::encode() const
+{
+	size_t num_blocks = mins.size();
+	std::vector<E> block_mins = mins;
+	std::vector<E> block_maxs = maxs;
+	std::vector<uint8_t> widths(num_blocks);
+	std::vector<uint64_t> offs(num_blocks);
+	size_t num_words = 0;
+	for (size_t block = 0; block < num_blocks; block++) {
+		size_t start = block * encoded_vec_store::BLOCK_SIZE;
+		size_t len = std::min(num - start, encoded_vec_store::BLOCK_SIZE);
+		widths[block] = get_block_width(block);
+		offs[block] = num_words;
+		num_words += get_packed_size(len, widths[block]) / sizeof(uint64_t);
+	}
+
+	const E *bits = reinterpret_cast<const E *>(vals);
+	std::vector<uint64_t> words(num_words);
+#pragma omp parallel
+	{
+		std::vector<uint64_t> buf(encoded_vec_store::BLOCK_SIZE);
+#pragma omp for
+		for (size_t block = 0; block < num_blocks; block++) {
+			size_t start = block * encoded_vec_store::BLOCK_SIZE;
+			size_t len = std::min(num - start, encoded_vec_store::BLOCK_SIZE);
+			E min = mins[block];
+			for (size_t i = 0; i < len; i++)
+				buf[i] = (E) (bits[start + i] - min);
+			pack_bits(buf.data(), len, widths[block], words.data() + offs[block]);
+		}
+	}
+	return encoded_data::const_ptr(new for_data<E>(block_mins, block_maxs,
+				widths, offs, words));
+}
+
+/*
+ * This encodes the values of a vector. The dictionary and the runs are
+ * computed on the bits of the values, so NaN can also be encoded.
+ */
+class vec_encoder
+{
+public:
+	typedef std::shared_ptr<vec_encoder> ptr;
+
+	virtual ~vec_encoder() {
+	}
+	/*
+	 * Collect the information of the values to estimate the size of
+	 * each encoding.
+	 */
+	virtual void init(const char *vals, size_t num) = 0;
+	/*
+	 * The number of bytes required by the encoding. It returns the max
+	 * value of size_t if the encoding can't be used.
+	 */
+	virtual size_t get_encoded_size(vec_encoding enc) const = 0;
+	virtual encoded_data::const_ptr encode(vec_encoding enc) const = 0;
+};
+
+template<class T>
+class vec_encoder_impl: public vec_encoder
+{
+	typedef typename entry_type<sizeof(T)>::type E;
+	typedef std::unordered_map<E, uint32_t, entry_hash<E> > dict_map_t;
+
+	const E *vals;
+	size_t num;
+
+	size_t num_runs;
+	// Indicate whether there are too many distinct values for a dictionary.
+	bool dict_overflow;
+	std::vector<E> dict_vals;
+	dict_map_t dict;
+	for_encoder<T, std::is_integral<T>::value> for_enc;
+
+	void init_dict();
+	int get_dict_width() const {
+		return dict_vals.empty() ? 0 : get_num_bits(dict_vals.size() - 1);
+	}
+
+	encoded_data::const_ptr encode_dict() const;
+	encoded_data::const_ptr encode_rle() const;
+public:
+	virtual void init(const char *vals, size_t num);
+	virtual size_t get_encoded_size(vec_encoding enc) const;
+	virtual encoded_data::const_ptr encode(vec_encoding enc) const;
+};
+
+template<class T>
+void vec_encoder_impl<T>::init(const char *vals, size_t num)
+{
+	this->vals = reinterpret_cast<const E *>(vals);
+	this->num = num;
+
+	size_t num_blocks = get_num_blocks(num);
+	num_runs = 0;
+#pragma omp parallel for reduction(+:num_runs)
+	for (size_t block = 0; block < num_blocks; block++) {
+		size_t start = block * encoded_vec_store::BLOCK_SIZE;
+		size_t end = std::min(num, start + encoded_vec_store::BLOCK_SIZE);
+		for (size_t i = start; i < end; i++)
+			if (i == 0 || this->vals[i] != this->vals[i - 1])
+				num_runs++;
+	}
+	init_dict();
+	for_enc.init(reinterpret_cast<const T *>(vals), num);
+}
+
+template<class T>
+void vec_encoder_impl<T>::init_dict()
+{
+	for (size_t i = 0; i < num; i++) {
+		auto ret = dict.insert(std::pair<E, uint32_t>(vals[i],
+					dict_vals.size()));
+		if (ret.second) {
+			dict_vals.push_back(vals[i]);
+			if (dict_vals.size() > MAX_DICT_SIZE)
+				break;
+		}
+	}
+	dict_overflow = dict_vals.size() > MAX_DICT_SIZE;
+	if (dict_overflow) {
+		dict_vals.clear();
+		dict.clear();
+	}
+}
+
+template<class T>
+size_t vec_encoder_impl<T>::get_encoded_size(vec_encoding enc) const
+{
+	switch (enc) {
+		case vec_encoding::DICT:
+			if (dict_overflow)
+				return std::numeric_limits<size_t>::max();
+			return dict_vals.size() * sizeof(E) + get_packed_size(num,
+					get_dict_width());
+		case vec_encoding::RLE:
+			return num_runs * (sizeof(E) + sizeof(uint64_t));
+		case vec_encoding::FOR:
+			return for_enc.get_encoded_size();
+		default:
+			return std::numeric_limits<size_t>::max();
+	}
+}
+
+template<class T>
+encoded_data::const_ptr vec_encoder_impl<T>::encode(vec_encoding enc) const
+{
+	switch (enc) {
+		case vec_encoding::DICT:
+			return encode_dict();
+		case vec_encoding::RLE:
+			return encode_rle();
+		case vec_encoding::FOR:
+			return for_enc.encode();
+		default:
+			return encoded_data::const_ptr();
+	}
+}
+
+template<class T>
+encoded_data::const_ptr vec_encoder_impl<T>::encode_dict() const
+{
+	if (dict_overflow) {
+		BOOST_LOG_TRIVIAL(error) << boost::format(
+				"There are more than %1% distinct values for dictionary encoding")
+			% MAX_DICT_SIZE;
+		return encoded_data::const_ptr();
+	}
+
+	int width = get_dict_width();
+	std::shared_ptr<std::vector<uint64_t> > idxs(new std::vector<uint64_t>(
+				get_packed_size(num, width) / sizeof(uint64_t)));
+	size_t num_blocks = get_num_blocks(num);
+#pragma omp parallel
+	{
+		std::vector<uint64_t> buf(encoded_vec_store::BLOCK_SIZE);
+#pragma omp for
+		for (size_t block = 0; block < num_blocks; block++) {
+			size_t start = block * encoded_vec_store::BLOCK_SIZE;
+			size_t len = std::min(num - start, encoded_vec_store::BLOCK_SIZE);
+			for (size_t i = 0; i < len; i++) {
+				auto it = dict.find(vals[start + i]);
+				assert(it != dict.end());
+				buf[i] = it->second;
+			}
+			// A block always starts at a word boundary.
+			pack_bits(buf.data(), len, width,
+					idxs->data() + start * width / 64);
+		}
+	}
+	return encoded_data::const_ptr(new dict_data<E>(dict_vals.data(),
+				dict_vals.size(), width, idxs));
+}
+
+template<class T>
+encoded_data::const_ptr vec_encoder_impl<T>::encode_rle() const
+{
+	std::vector<E> run_vals;
+	std::shared_ptr<std::vector<uint64_t> > ends(new std::vector<uint64_t>());
+	run_vals.reserve(num_runs);
+	ends->reserve(num_runs);
+	for (size_t i = 0; i < num; i++) {
+		if (i == 0 || vals[i] != vals[i - 1]) {
+			if (i > 0)
+				ends->push_back(i);
+			run_vals.push_back(vals[i]);
+		}
+	}
+	if (num > 0)
+		ends->push_back(num);
+	return encoded_data::const_ptr(new rle_data<E>(run_vals.data(), ends));
+}
+
+vec_encoder::ptr create_encoder(const scalar_type &type)
+{
+	switch (type.get_type()) {
+		case P_BOOL:
+			return vec_encoder::ptr(new vec_encoder_impl<bool>());
+		case P_CHAR:
+			return vec_encoder::ptr(new vec_encoder_impl<char>());
+		case P_SHORT:
+			return vec_encoder::ptr(new vec_encoder_impl<short>());
+		case P_USHORT:
+			return vec_encoder::ptr(new vec_encoder_impl<unsigned short>());
+		case P_INTEGER:
+			return vec_encoder::ptr(new vec_encoder_impl<int>());
+		case P_UINT:
+			return vec_encoder::ptr(new vec_encoder_impl<unsigned int>());
+		case P_LONG:
+			return vec_encoder::ptr(new vec_encoder_impl<long>());
+		case P_ULONG:
+			return vec_encoder::ptr(new vec_encoder_impl<unsigned long>());
+		case P_FLOAT:
+			return vec_encoder::ptr(new vec_encoder_impl<float>());
+		case P_DOUBLE:
+			return vec_encoder::ptr(new vec_encoder_impl<double>());
+		case P_LDOUBLE:
+			return vec_encoder::ptr(new vec_encoder_impl<long double>());
+		default:
+			throw invalid_arg_exception("unknown type");
+	}
+}
+
+encoded_data::const_ptr encode(const smp_vec_store &vec, vec_encoding enc)
+{
+	vec_encoder::ptr encoder = create_encoder(vec.get_type());
+	encoder->init(vec.get_raw_arr(), vec.get_length());
+	return encoder->encode(enc);
+}
+
+}
+
+encoded_vec_store::ptr encoded_vec_store::create(const vec_store &vec)
+{
+	smp_vec_store::const_ptr smp = get_smp_vec(vec.shallow_copy());
+	vec_encoder::ptr encoder = create_encoder(vec.get_type());
+	encoder->init(smp->get_raw_arr(), smp->get_length());
+
+	size_t raw_size = vec.get_length() * vec.get_type().get_size();
+	size_t min_size = raw_size;
+	vec_encoding encs[] = {vec_encoding::DICT, vec_encoding::RLE,
+		vec_encoding::FOR};
+	vec_encoding best = vec_encoding::DICT;
+	for (size_t i = 0; i < sizeof(encs) / sizeof(encs[0]); i++) {
+		size_t size = encoder->get_encoded_size(encs[i]);
+		if (size < min_size) {
+			min_size = size;
+			best = encs[i];
+		}
+	}
+	if (min_size == raw_size)
+		return ptr();
+
+	encoded_data::const_ptr data = encoder->encode(best);
+	return ptr(new encoded_vec_store(data, vec.get_length(), vec.get_type()));
+}
+
+encoded_vec_store::ptr encoded_vec_store::create(const vec_store &vec,
+		vec_encoding enc)
+{
+	encoded_data::const_ptr data = encode(*get_smp_vec(vec.shallow_copy()),
+			enc);
+	if (data == NULL)
+		return ptr();
+	return ptr(new encoded_vec_store(data, vec.get_length(), vec.get_type()));
+}
+
+size_t encoded_vec_store::copy_to(char *buf, size_t num_eles) const
+{
+	size_t num_copy = std::min(get_length(), num_eles);
+	size_t num_blocks = get_num_blocks(num_copy);
+	size_t entry_size = get_type().get_size();
+#pragma omp parallel for
+	for (size_t block = 0; block < num_blocks; block++) {
+		size_t start = block * BLOCK_SIZE;
+		size_t len = std::min(num_copy - start, BLOCK_SIZE);
+		data->decode(start, len, buf + start * entry_size);
+	}
+	return num_copy;
+}
+
+smp_vec_store::ptr encoded_vec_store::decode() const
+{
+	smp_vec_store::ptr vec = smp_vec_store::create(get_length(), get_type());
+	copy_to(vec->get_raw_arr(), get_length());
+	return vec;
+}
+
+vec_store::ptr encoded_vec_store::sapply(const bulk_uoperate &op) const
+{
+	if (op.get_input_type() != get_type()) {
+		BOOST_LOG_TRIVIAL(error) << "The input type of the operator is wrong";
+		return vec_store::ptr();
+	}
+
+	encoded_data::const_ptr res = data->sapply(op);
+	if (res)
+		return vec_store::ptr(new encoded_vec_store(res, get_length(),
+					op.get_output_type()));
+
+	// We have to apply the operator on the decoded values.
+	smp_vec_store::ptr out = smp_vec_store::create(get_length(),
+			op.get_output_type());
+	size_t num_blocks = get_num_blocks(get_length());
+#pragma omp parallel
+	{
+		std::vector<char> buf(BLOCK_SIZE * get_type().get_size());
+#pragma omp for
+		for (size_t block = 0; block < num_blocks; block++) {
+			size_t start = block * BLOCK_SIZE;
+			size_t len = std::min(get_length() - start, BLOCK_SIZE);
+			data->decode(start, len, buf.data());
+			op.runA(len, buf.data(), out->get(start));
+		}
+	}
+	encoded_vec_store::ptr encoded = create(*out);
+	if (encoded)
+		return encoded;
+	else
+		return out;
+}
+
+scalar_variable::ptr encoded_vec_store::aggregate(const agg_operate &op) const
+{
+	if (op.get_input_type() != get_type()) {
+		BOOST_LOG_TRIVIAL(error)
+			<< "The input type of the aggregation is wrong";
+		return scalar_variable::ptr();
+	}
+	if (get_length() == 0) {
+		BOOST_LOG_TRIVIAL(error) << "Can't aggregate an empty vector";
+		return scalar_variable::ptr();
+	}
+
+	scalar_variable::ptr res = op.get_output_type().create_scalar();
+	if (data->aggregate(op, res->get_raw()))
+		return res;
+
+	// Without a combine operator, we have to aggregate all values at once.
+	if (!op.has_combine()) {
+		smp_vec_store::ptr vec = decode();
+		op.runAgg(vec->get_length(), vec->get_raw_arr(), res->get_raw());
+		return res;
+	}
+
+	size_t num_blocks = get_num_blocks(get_length());
+	size_t out_size = op.get_output_type().get_size();
+	std::vector<char> partial(num_blocks * out_size);
+#pragma omp parallel
+	{
+		std::vector<char> buf(BLOCK_SIZE * get_type().get_size());
+#pragma omp for
+		for (size_t block = 0; block < num_blocks; block++) {
+			size_t start = block * BLOCK_SIZE;
+			size_t len = std::min(get_length() - start, BLOCK_SIZE);
+			data->decode(start, len, buf.data());
+			op.runAgg(len, buf.data(), partial.data() + block * out_size);
+		}
+	}
+	op.runCombine(num_blocks, partial.data(), res->get_raw());
+	return res;
+}
+
+bool encoded_vec_store::reserve(size_t num_eles)
+{
+	BOOST_LOG_TRIVIAL(error) << "Can't reserve space in an encoded vector";
+	return false;
+}
+
+bool encoded_vec_store::resize(size_t new_length)
+{
+	if (new_length == get_length())
+		return true;
+	BOOST_LOG_TRIVIAL(error) << "Can't resize an encoded vector";
+	return false;
+}
+
+bool encoded_vec_store::append(
+		std::vector<vec_store::const_ptr>::const_iterator vec_it,
+		std::vector<vec_store::const_ptr>::const_iterator vec_end)
+{
+	BOOST_LOG_TRIVIAL(error) << "Can't append to an encoded vector";
+	return false;
+}
+
+bool encoded_vec_store::append(const vec_store &vec)
+{
+	BOOST_LOG_TRIVIAL(error) << "Can't append to an encoded vector";
+	return false;
+}
+
+bool encoded_vec_store::set_portion(std::shared_ptr<const local_vec_store> store,
+		off_t loc)
+{
+	BOOST_LOG_TRIVIAL(error) << "Can't modify an encoded vector";
+	return false;
+}
+
+local_vec_store::const_ptr encoded_vec_store::get_portion(off_t loc,
+		size_t size) const
+{
+	if (loc + size > get_length()) {
+		BOOST_LOG_TRIVIAL(error) << "the portion is out of boundary";
+		return local_vec_store::const_ptr();
+	}
+
+	local_vec_store::ptr ret(new local_buf_vec_store(loc, size, get_type(),
+				-1));
+	data->decode(loc, size, ret->get_raw_arr());
+	return ret;
+}
+
+local_vec_store::ptr encoded_vec_store::get_portion(off_t loc, size_t size)
+{
+	const encoded_vec_store *const_this = this;
+	return std::const_pointer_cast<local_vec_store>(
+			const_this->get_portion(loc, size));
+}
+
+void encoded_vec_store::reset_data()
+{
+	BOOST_LOG_TRIVIAL(error) << "Can't modify an encoded vector";
+}
+
+void encoded_vec_store::set_data(const set_vec_operate &op)
+{
+	BOOST_LOG_TRIVIAL(error) << "Can't modify an encoded vector";
+}
+
+/*
+ * The values are sorted in the decoded vector and encoded again with
+ * the same encoding. The encoded data is shared by other vectors, so we
+ * replace it instead of modifying it.
+ */
+vec_store::ptr encoded_vec_store::sort_with_index()
+{
+	smp_vec_store::ptr vec = decode();
+	vec_store::ptr idxs = vec->sort_with_index();
+	data = encode(*vec, get_encoding());
+	assert(data);
+	return idxs;
+}
+
+void encoded_vec_store::sort()
+{
+	smp_vec_store::ptr vec = decode();
+	vec->sort();
+	data = encode(*vec, get_encoding());
+	assert(data);
+}
+
+bool encoded_vec_store::is_sorted() const
+{
+	return decode()->is_sorted();
+}
+
+std::shared_ptr<matrix_store> encoded_vec_store::conv2mat(size_t nrow,
+		size_t ncol, bool byrow)
+{
+	return decode()->conv2mat(nrow, ncol, byrow);
+}
+
+}
+
+}
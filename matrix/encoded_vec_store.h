@@ -0,0 +1,202 @@
+#ifndef __ENCODED_VEC_STORE_H__
+#define __ENCODED_VEC_STORE_H__
+
+/*
+ * Copyright 2017 Open Connectome Project (http://openconnecto.me)
+ * Written by Da Zheng (zhengda1936@gmail.com)
+ *
+ * This file is part of FlashMatrix.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdint.h>
+
+#include <vector>
+
+#include "vec_store.h"
+
+namespace fm
+{
+
+class agg_operate;
+class scalar_variable;
+
+namespace detail
+{
+
+class smp_vec_store;
+
+enum class vec_encoding
+{
+	// The distinct values are stored in a dictionary and the indexes to
+	// the dictionary are bit-packed.
+	DICT,
+	// The consecutive identical values are stored as a run.
+	RLE,
+	// The values in a block are stored as the difference with the min value
+	// in the block and are bit-packed. This only applies to integers.
+	FOR,
+};
+
+/*
+ * The encoded data of a vector. The encoded data is immutable, so it can
+ * be shared by multiple vectors.
+ */
+class encoded_data
+{
+public:
+	typedef std::shared_ptr<const encoded_data> const_ptr;
+
+	virtual ~encoded_data() {
+	}
+	virtual vec_encoding get_encoding() const = 0;
+	virtual size_t get_num_bytes() const = 0;
+	/*
+	 * Decode `num' values starting at `start'.
+	 */
+	virtual void decode(off_t start, size_t num, char *out) const = 0;
+	/*
+	 * Apply the operator on the encoded data directly.
+	 * It returns NULL if it can't be done with the encoding.
+	 */
+	virtual const_ptr sapply(const bulk_uoperate &op) const = 0;
+	/*
+	 * Aggregate the values with the aggregation operator on the encoded data
+	 * directly. It returns false if it can't be done with the encoding.
+	 */
+	virtual bool aggregate(const agg_operate &op, char *out) const = 0;
+};
+
+/*
+ * This is a read-only in-memory vector whose values are encoded.
+ * It's intended for factor columns, low-cardinality integers and columns
+ * with long runs of identical values in a data frame.
+ *
+ * The vector is accessed with get_portion() and copy_to(), which decode
+ * the requested portion. It can't be modified except that it can be sorted,
+ * which encodes the sorted values again. The operations that require
+ * the raw array of an in-memory vector (e.g., mem_vec_store::cast)
+ * need to decode the vector first (e.g., with get_smp_vec()).
+ */
+class encoded_vec_store: public vec_store
+{
+	encoded_data::const_ptr data;
+
+	encoded_vec_store(encoded_data::const_ptr data, size_t length,
+			const scalar_type &type): vec_store(length, type, true) {
+		this->data = data;
+	}
+public:
+	typedef std::shared_ptr<encoded_vec_store> ptr;
+	typedef std::shared_ptr<const encoded_vec_store> const_ptr;
+
+	// The number of values in a block.
+	static const size_t BLOCK_SIZE = 64 * 1024;
+
+	/*
+	 * Encode a vector with the encoding that requires the least space.
+	 * It returns NULL if no encoding saves space.
+	 */
+	static ptr create(const vec_store &vec);
+	/*
+	 * Encode a vector with the specified encoding.
+	 */
+	static ptr create(const vec_store &vec, vec_encoding enc);
+
+	static ptr cast(vec_store::ptr vec) {
+		return std::dynamic_pointer_cast<encoded_vec_store>(vec);
+	}
+	static const_ptr cast(vec_store::const_ptr vec) {
+		return std::dynamic_pointer_cast<const encoded_vec_store>(vec);
+	}
+
+	vec_encoding get_encoding() const {
+		return data->get_encoding();
+	}
+
+	/*
+	 * The number of bytes used by the encoded data.
+	 */
+	virtual size_t get_num_bytes() const {
+		return data->get_num_bytes();
+	}
+
+	virtual size_t copy_to(char *data, size_t num_eles) const;
+	/*
+	 * Decode the entire vector.
+	 */
+	std::shared_ptr<smp_vec_store> decode() const;
+	/*
+	 * Apply the operator on each value. The operator is only applied to
+	 * the dictionary or the values of the runs if possible. Otherwise,
+	 * the vector is decoded and the result is encoded again.
+	 */
+	vec_store::ptr sapply(const bulk_uoperate &op) const;
+	/*
+	 * Aggregate all values. MIN and MAX are computed on the dictionary,
+	 * the values of the runs or the statistics of the blocks. The other
+	 * aggregations decode the vector in portions.
+	 */
+	std::shared_ptr<scalar_variable> aggregate(const agg_operate &op) const;
+
+	virtual bool reserve(size_t num_eles);
+	virtual size_t get_reserved_size() const {
+		return get_length();
+	}
+	virtual bool resize(size_t new_length);
+
+	virtual bool append(std::vector<vec_store::const_ptr>::const_iterator vec_it,
+			std::vector<vec_store::const_ptr>::const_iterator vec_end);
+	virtual bool append(const vec_store &vec);
+
+	virtual vec_store::ptr deep_copy() const {
+		// The encoded data is immutable.
+		return vec_store::ptr(new encoded_vec_store(*this));
+	}
+	virtual vec_store::ptr shallow_copy() {
+		return vec_store::ptr(new encoded_vec_store(*this));
+	}
+	virtual vec_store::const_ptr shallow_copy() const {
+		return vec_store::const_ptr(new encoded_vec_store(*this));
+	}
+
+	virtual bool set_portion(std::shared_ptr<const local_vec_store> store,
+			off_t loc);
+	/*
+	 * The returned portion is a decoded copy of the data. Modifying it
+	 * doesn't change the vector.
+	 */
+	virtual std::shared_ptr<local_vec_store> get_portion(off_t loc,
+			size_t size);
+	virtual std::shared_ptr<const local_vec_store> get_portion(off_t loc,
+			size_t size) const;
+	virtual size_t get_portion_size() const {
+		return BLOCK_SIZE;
+	}
+
+	virtual void reset_data();
+	virtual void set_data(const set_vec_operate &op);
+
+	virtual vec_store::ptr sort_with_index();
+	virtual void sort();
+	virtual bool is_sorted() const;
+	virtual std::shared_ptr<matrix_store> conv2mat(size_t nrow,
+			size_t ncol, bool byrow);
+};
+
+}
+
+}
+
+#endif
@@ -45,9 +45,7 @@ class factor_map_impl: public factor_map
 public:
 	static ptr create(detail::vec_store::const_ptr vec) {
 		assert(vec->get_type() == get_scalar_type<T>());
-		detail::mem_vec_store::const_ptr mem_vec
-			= std::dynamic_pointer_cast<const detail::mem_vec_store>(vec);
-		assert(mem_vec);
+		detail::mem_vec_store::const_ptr mem_vec = detail::get_smp_vec(vec);
 		factor_map_impl<T> *ret = new factor_map_impl<T>();
 		size_t id = 0;
 		for (size_t i = 0; i < vec->get_length(); i++) {
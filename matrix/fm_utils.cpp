@@ -17,6 +17,8 @@
  * limitations under the License.
  */
 
+#include <algorithm>
+
 #include "fm_utils.h"
 
 #include "factor.h"
@@ -29,6 +31,7 @@
 #include "EM_vv_store.h"
 #include "EM_vector.h"
 #include "local_vec_store.h"
+#include "mem_vec_store.h"
 #include "sparse_matrix.h"
 
 namespace fm
@@ -115,18 +118,25 @@ class SpM_apply_operate: public gr_apply_operate<sub_data_frame>
 	block_2d_size block_size;
 	size_t num_cols;
 	size_t attr_size;
+	// Whether to remove self edges.
+	bool rm_selfe;
 public:
-	SpM_apply_operate(const matrix_header &header) {
+	SpM_apply_operate(const matrix_header &header, bool rm_selfe) {
 		this->mheader = header;
 		this->block_size = header.get_2d_block_size();
 		this->num_cols = header.get_num_cols();
 		this->attr_size = header.get_entry_size();
+		this->rm_selfe = rm_selfe;
 	}
 
 	size_t get_attr_size() const {
 		return attr_size;
 	}
 
+	bool is_remove_selfe() const {
+		return rm_selfe;
+	}
+
 	virtual bool ignore_key(const void *key) const {
 		ele_idx_t vid = *(const ele_idx_t *) key;
 		return vid == INVALID_IDX_VAL;
@@ -158,7 +168,8 @@ public:
 class binary_apply_operate: public SpM_apply_operate
 {
 public:
-	binary_apply_operate(const matrix_header &header): SpM_apply_operate(header) {
+	binary_apply_operate(const matrix_header &header,
+			bool rm_selfe): SpM_apply_operate(header, rm_selfe) {
 	}
 	virtual void run_row(const void *key, const sub_data_frame &val,
 			local_vec_store &out) const;
@@ -184,7 +195,8 @@ class attr_apply_operate: public SpM_apply_operate
 		}
 	};
 public:
-	attr_apply_operate(const matrix_header &header): SpM_apply_operate(header) {
+	attr_apply_operate(const matrix_header &header,
+			bool rm_selfe): SpM_apply_operate(header, rm_selfe) {
 		assert(sizeof(T) == header.get_entry_size());
 	}
 	virtual void run_row(const void *key, const sub_data_frame &val,
@@ -458,7 +470,7 @@ void binary_apply_operate::run_row(const void *key, const sub_data_frame &val,
 	for (size_t i = 0; i < vec.get_length(); i++) {
 		if (vec.get<ele_idx_t>(i) == INVALID_IDX_VAL
 				// skip self-edges.
-				|| (remove_selfe && vec.get<ele_idx_t>(i) == vid))
+				|| (is_remove_selfe() && vec.get<ele_idx_t>(i) == vid))
 			continue;
 		edge_buf[edge_idx++] = vec.get<ele_idx_t>(i);
 	}
@@ -509,7 +521,7 @@ void attr_apply_operate<T>::run_row(const void *key, const sub_data_frame &val,
 	for (size_t i = 0; i < vec.get_length(); i++) {
 		if (vec.get<ele_idx_t>(i) == INVALID_IDX_VAL
 				// skip self-edges.
-				|| (remove_selfe && vec.get<ele_idx_t>(i) == vid))
+				|| (is_remove_selfe() && vec.get<ele_idx_t>(i) == vid))
 			continue;
 		edge_buf[edge_idx].first = vec.get<ele_idx_t>(i);
 		edge_buf[edge_idx].second = attr_vec.get<T>(i);
@@ -616,7 +628,7 @@ struct empty_deleter {
 
 std::pair<fm::SpM_2d_index::ptr, vector_vector::ptr> create_2d_matrix(
 		data_frame::const_ptr df, const block_2d_size &block_size, size_t num_rows,
-		size_t num_cols, const fm::scalar_type *entry_type)
+		size_t num_cols, const fm::scalar_type *entry_type, bool rm_selfe)
 {
 	if (df->get_num_vecs() == 1) {
 		BOOST_LOG_TRIVIAL(error)
@@ -673,7 +685,7 @@ std::pair<fm::SpM_2d_index::ptr, vector_vector::ptr> create_2d_matrix(
 	vector_vector::ptr res;
 	if (attr_size == 0) {
 		std::unique_ptr<SpM_apply_operate> op(
-				new binary_apply_operate(mheader));
+				new binary_apply_operate(mheader, rm_selfe));
 		res = groupby_df->groupby("key", *op);
 	}
 	// Instead of giving the real data type, we give a type that indicates
@@ -681,12 +693,12 @@ std::pair<fm::SpM_2d_index::ptr, vector_vector::ptr> create_2d_matrix(
 	// here. Only the data size matters.
 	else if (attr_size == 4) {
 		std::unique_ptr<attr_apply_operate<unit4> > op(
-				new attr_apply_operate<unit4>(mheader));
+				new attr_apply_operate<unit4>(mheader, rm_selfe));
 		res = groupby_df->groupby("key", *op);
 	}
 	else if (attr_size == 8) {
 		std::unique_ptr<attr_apply_operate<unit8> > op(
-				new attr_apply_operate<unit8>(mheader));
+				new attr_apply_operate<unit8>(mheader, rm_selfe));
 		res = groupby_df->groupby("key", *op);
 	}
 	else {
@@ -786,7 +798,7 @@ std::shared_ptr<sparse_matrix> create_2d_matrix(data_frame::ptr df,
 		spm_name = std::string("spm") + gen_rand_name(10) + ".mat";
 
 	auto out_mat = create_2d_matrix(df, block_size, max_vid + 1, max_vid + 1,
-			entry_type);
+			entry_type, remove_selfe);
 	if (!is_sym) {
 		data_frame::ptr reversed_df = data_frame::create();
 		reversed_df->add_vec(df->get_vec_name(1), df->get_vec(1));
@@ -794,7 +806,7 @@ std::shared_ptr<sparse_matrix> create_2d_matrix(data_frame::ptr df,
 		for (size_t i = 2; i < df->get_num_vecs(); i++)
 			reversed_df->add_vec(df->get_vec_name(i), df->get_vec(i));
 		auto in_mat = create_2d_matrix(reversed_df, block_size, max_vid + 1, max_vid + 1,
-				entry_type);
+				entry_type, remove_selfe);
 
 		if (out_mat.second->get_raw_store()->is_in_mem()) {
 			assert(in_mat.second->get_raw_store()->is_in_mem());
@@ -840,4 +852,342 @@ std::shared_ptr<sparse_matrix> create_2d_matrix(data_frame::ptr df,
 	}
 }
 
+
+/*
+ * Create an invalid edge for each id in [0, num). If `from_ids' is true,
+ * the edges start from the ids. Otherwise, the edges end at the ids.
+ */
+static data_frame::ptr create_invalid_edges(data_frame::const_ptr df,
+		bool from_ids, size_t num)
+{
+	detail::vec_store::ptr seq_vec = detail::create_seq_vec_store<ele_idx_t>(
+			0, num - 1, 1);
+	detail::vec_store::ptr rep_vec = detail::create_rep_vec_store<ele_idx_t>(
+			num, INVALID_IDX_VAL);
+	data_frame::ptr new_df = data_frame::create();
+	new_df->add_vec(df->get_vec_name(0), from_ids ? seq_vec : rep_vec);
+	new_df->add_vec(df->get_vec_name(1), from_ids ? rep_vec : seq_vec);
+	if (df->get_num_vecs() > 2) {
+		const scalar_type &type = df->get_vec(2)->get_type();
+		detail::vec_store::ptr attr_extra;
+		if (type == get_scalar_type<int>())
+			attr_extra = detail::create_rep_vec_store<int>(num, 0);
+		else if (type == get_scalar_type<long>())
+			attr_extra = detail::create_rep_vec_store<long>(num, 0);
+		else if (type == get_scalar_type<float>())
+			attr_extra = detail::create_rep_vec_store<float>(num, 0);
+		else if (type == get_scalar_type<double>())
+			attr_extra = detail::create_rep_vec_store<double>(num, 0);
+		else {
+			BOOST_LOG_TRIVIAL(error) << "unknown attribute type";
+			return data_frame::ptr();
+		}
+		new_df->add_vec(df->get_vec_name(2), attr_extra);
+	}
+	return new_df;
+}
+
+std::shared_ptr<sparse_matrix> create_rect_2d_matrix(data_frame::ptr edge_df,
+		const block_2d_size &block_size, size_t num_rows, size_t num_cols,
+		const fm::scalar_type *entry_type, bool is_sym)
+{
+	if (num_rows == 0 || num_cols == 0) {
+		BOOST_LOG_TRIVIAL(error) << "can't create an empty sparse matrix";
+		return sparse_matrix::ptr();
+	}
+
+	if (is_sym && num_rows != num_cols) {
+		BOOST_LOG_TRIVIAL(error) << "A symmetric matrix has to be square";
+		return sparse_matrix::ptr();
+	}
+
+	// Every row of the matrix and its transpose needs an invalid edge,
+	// so that all block rows exist in the matrix. We add them to a copy
+	// of the edge list, so the caller's data frame isn't modified.
+	data_frame::ptr out_invalid = create_invalid_edges(edge_df, true, num_rows);
+	data_frame::ptr in_invalid = create_invalid_edges(edge_df, false, num_cols);
+	if (out_invalid == NULL || in_invalid == NULL)
+		return sparse_matrix::ptr();
+	std::vector<data_frame::const_ptr> dfs(3);
+	dfs[0] = edge_df;
+	dfs[1] = out_invalid;
+	dfs[2] = in_invalid;
+	data_frame::ptr df = merge_data_frame(dfs, edge_df->is_in_mem());
+	if (df == NULL)
+		return sparse_matrix::ptr();
+
+	auto out_mat = create_2d_matrix(df, block_size, num_rows, num_cols,
+			entry_type, false);
+	if (out_mat.second == NULL)
+		return sparse_matrix::ptr();
+	if (!out_mat.second->get_raw_store()->is_in_mem()) {
+		BOOST_LOG_TRIVIAL(error)
+			<< "The rectangular sparse matrix has to be built in memory";
+		return sparse_matrix::ptr();
+	}
+	SpM_2d_storage::ptr out_store = SpM_2d_storage::create(
+			*out_mat.second, out_mat.first);
+	if (is_sym)
+		return sparse_matrix::create(out_mat.first, out_store);
+
+	data_frame::ptr reversed_df = data_frame::create();
+	reversed_df->add_vec(df->get_vec_name(1), df->get_vec(1));
+	reversed_df->add_vec(df->get_vec_name(0), df->get_vec(0));
+	for (size_t i = 2; i < df->get_num_vecs(); i++)
+		reversed_df->add_vec(df->get_vec_name(i), df->get_vec(i));
+	auto in_mat = create_2d_matrix(reversed_df, block_size, num_cols,
+			num_rows, entry_type, false);
+	if (in_mat.second == NULL)
+		return sparse_matrix::ptr();
+	if (!in_mat.second->get_raw_store()->is_in_mem()) {
+		BOOST_LOG_TRIVIAL(error)
+			<< "The rectangular sparse matrix has to be built in memory";
+		return sparse_matrix::ptr();
+	}
+	SpM_2d_storage::ptr in_store = SpM_2d_storage::create(
+			*in_mat.second, in_mat.first);
+	return sparse_matrix::create(out_mat.first, out_store,
+			in_mat.first, in_store);
+}
+
+namespace
+{
+
+/*
+ * Convert the non-zero values to the encoding.
+ */
+template<class T>
+void encode_vals(const T *vals, size_t num, spm_val_encoding val_enc,
+		std::vector<char> &out)
+{
+	if (val_enc == spm_val_encoding::FP16) {
+		out.resize(num * sizeof(fp16_t));
+		fp16_t *enc_vals = (fp16_t *) out.data();
+		for (size_t i = 0; i < num; i++)
+			enc_vals[i] = fp16_t(vals[i]);
+	}
+	else if (val_enc == spm_val_encoding::BF16) {
+		out.resize(num * sizeof(bf16_t));
+		bf16_t *enc_vals = (bf16_t *) out.data();
+		for (size_t i = 0; i < num; i++)
+			enc_vals[i] = bf16_t(vals[i]);
+	}
+	else
+		out.assign((const char *) vals, (const char *) (vals + num));
+}
+
+}
+
+void encode_block_rows(const ele_idx_t *rows, const ele_idx_t *cols,
+		size_t nnz, const char *vals, const block_2d_size &block_size,
+		size_t entry_size, size_t brow_start,
+		std::vector<std::vector<char> > &brow_bufs)
+{
+	size_t num_block_rows = brow_bufs.size();
+	// Group the non-zero entries by block rows.
+	std::vector<size_t> brow_offs(num_block_rows + 1);
+	for (size_t i = 0; i < nnz; i++) {
+		size_t br = (rows[i] >> block_size.get_nrow_log()) - brow_start;
+		assert(br < num_block_rows);
+		brow_offs[br + 1]++;
+	}
+	for (size_t i = 1; i < brow_offs.size(); i++)
+		brow_offs[i] += brow_offs[i - 1];
+	std::vector<size_t> order(nnz);
+	std::vector<size_t> locs(brow_offs.begin(), brow_offs.end() - 1);
+	for (size_t i = 0; i < nnz; i++)
+		order[locs[(rows[i] >> block_size.get_nrow_log()) - brow_start]++] = i;
+
+#pragma omp parallel for
+	for (size_t br = 0; br < num_block_rows; br++) {
+		// Sort the non-zero entries by blocks, rows and columns.
+		size_t ncol_log = block_size.get_ncol_log();
+		std::sort(order.begin() + brow_offs[br],
+				order.begin() + brow_offs[br + 1], [&](size_t a, size_t b) {
+				size_t bcol_a = cols[a] >> ncol_log;
+				size_t bcol_b = cols[b] >> ncol_log;
+				if (bcol_a != bcol_b)
+					return bcol_a < bcol_b;
+				else if (rows[a] != rows[b])
+					return rows[a] < rows[b];
+				else
+					return cols[a] < cols[b];
+				});
+
+		brow_bufs[br].clear();
+		std::vector<std::pair<uint16_t, uint16_t> > nzs;
+		std::vector<char> block_vals;
+		for (size_t start = brow_offs[br]; start < brow_offs[br + 1]; ) {
+			size_t bcol = cols[order[start]] >> ncol_log;
+			size_t end = start;
+			nzs.clear();
+			block_vals.clear();
+			for (; end < brow_offs[br + 1]
+					&& (cols[order[end]] >> ncol_log) == bcol; end++) {
+				size_t idx = order[end];
+				// Remove duplicated entries.
+				if (end > start && rows[idx] == rows[order[end - 1]]
+						&& cols[idx] == cols[order[end - 1]])
+					continue;
+				nzs.emplace_back(rows[idx] & block_size.get_nrow_mask(),
+						cols[idx] & block_size.get_ncol_mask());
+				block_vals.insert(block_vals.end(), vals + idx * entry_size,
+						vals + (idx + 1) * entry_size);
+			}
+			sparse_block_2d::encode(brow_start + br, bcol, nzs,
+					block_vals.data(), entry_size, brow_bufs[br]);
+			start = end;
+		}
+		// Insert an empty block in an empty block row, so the matrix index
+		// can work correctly.
+		if (brow_bufs[br].empty()) {
+			brow_bufs[br].resize(sizeof(sparse_block_2d));
+			new (brow_bufs[br].data()) sparse_block_2d(brow_start + br, 0);
+		}
+	}
+}
+
+namespace
+{
+
+/*
+ * Build a sparse matrix with encoded blocks from the non-zero entries.
+ * `vals' contains the encoded values of the non-zero entries.
+ */
+std::pair<SpM_2d_index::ptr, SpM_2d_storage::ptr> build_encoded_2d(
+		const ele_idx_t *rows, const ele_idx_t *cols, size_t nnz,
+		const std::vector<char> &vals, const matrix_header &mheader)
+{
+	block_2d_size block_size = mheader.get_2d_block_size();
+	size_t num_block_rows = block_size.cal_num_block_rows(
+			mheader.get_num_rows());
+	std::vector<std::vector<char> > brow_bufs(num_block_rows);
+	encode_block_rows(rows, cols, nnz, vals.data(), block_size,
+			mheader.get_entry_size(), 0, brow_bufs);
+
+	// The first block row starts after the matrix header.
+	std::vector<off_t> offs(num_block_rows + 1);
+	offs[0] = sizeof(mheader);
+	for (size_t i = 0; i < num_block_rows; i++)
+		offs[i + 1] = offs[i] + brow_bufs[i].size();
+	std::vector<char> data(offs.back());
+	memcpy(data.data(), &mheader, sizeof(mheader));
+	for (size_t i = 0; i < num_block_rows; i++) {
+		memcpy(data.data() + offs[i], brow_bufs[i].data(), brow_bufs[i].size());
+		std::vector<char>().swap(brow_bufs[i]);
+	}
+
+	SpM_2d_index::ptr idx = SpM_2d_index::create(mheader, offs);
+	if (idx == NULL)
+		return std::pair<SpM_2d_index::ptr, SpM_2d_storage::ptr>();
+	return std::pair<SpM_2d_index::ptr, SpM_2d_storage::ptr>(idx,
+			SpM_2d_storage::create(data.data(), data.size(), idx));
+}
+
+const ele_idx_t *get_idx_arr(data_frame::const_ptr df, size_t col_idx)
+{
+	detail::mem_vec_store::const_ptr vec
+		= std::dynamic_pointer_cast<const detail::mem_vec_store>(
+				df->get_vec(col_idx));
+	if (vec == NULL || vec->get_type() != get_scalar_type<ele_idx_t>())
+		return NULL;
+	return (const ele_idx_t *) vec->get_raw_arr();
+}
+
+}
+
+std::pair<SpM_2d_index::ptr, SpM_2d_storage::ptr> create_encoded_2d(
+		data_frame::ptr df, const block_2d_size &block_size, size_t num_rows,
+		size_t num_cols, spm_val_encoding val_enc, bool transpose)
+{
+	std::pair<SpM_2d_index::ptr, SpM_2d_storage::ptr> err;
+	if (num_rows == 0 || num_cols == 0) {
+		BOOST_LOG_TRIVIAL(error) << "can't create an empty sparse matrix";
+		return err;
+	}
+	const ele_idx_t *rows = get_idx_arr(df, 0);
+	const ele_idx_t *cols = get_idx_arr(df, 1);
+	if (rows == NULL || cols == NULL) {
+		BOOST_LOG_TRIVIAL(error)
+			<< "The edge list has to be stored in memory with the right type";
+		return err;
+	}
+	size_t nnz = df->get_num_entries();
+	for (size_t i = 0; i < nnz; i++) {
+		if (rows[i] >= num_rows || cols[i] >= num_cols) {
+			BOOST_LOG_TRIVIAL(error) << "The edge list has invalid edges";
+			return err;
+		}
+	}
+
+	std::vector<char> vals;
+	prim_type type = prim_type::P_BOOL;
+	size_t entry_size = 0;
+	if (df->get_num_vecs() > 2) {
+		detail::mem_vec_store::const_ptr attr
+			= std::dynamic_pointer_cast<const detail::mem_vec_store>(
+					df->get_vec(2));
+		if (attr == NULL) {
+			BOOST_LOG_TRIVIAL(error) << "The attributes have to be in memory";
+			return err;
+		}
+		const scalar_type &attr_type = attr->get_type();
+		type = attr_type.get_type();
+		if (attr_type == get_scalar_type<float>())
+			encode_vals<float>((const float *) attr->get_raw_arr(), nnz,
+					val_enc, vals);
+		else if (attr_type == get_scalar_type<double>())
+			encode_vals<double>((const double *) attr->get_raw_arr(), nnz,
+					val_enc, vals);
+		else if (val_enc == spm_val_encoding::RAW)
+			vals.assign(attr->get_raw_arr(),
+					attr->get_raw_arr() + nnz * attr_type.get_size());
+		else {
+			BOOST_LOG_TRIVIAL(error)
+				<< "Only floating-point values can be stored in 16 bits";
+			return err;
+		}
+		if (val_enc != spm_val_encoding::RAW)
+			entry_size = get_val_encoding_size(val_enc);
+		else
+			entry_size = attr_type.get_size();
+	}
+	else if (val_enc != spm_val_encoding::RAW) {
+		BOOST_LOG_TRIVIAL(error) << "A binary matrix doesn't have values";
+		return err;
+	}
+
+	if (transpose) {
+		std::swap(rows, cols);
+		std::swap(num_rows, num_cols);
+	}
+	matrix_header mheader(matrix_type::SPARSE, entry_size, num_rows,
+			num_cols, matrix_layout_t::L_ROW_2D, type, block_size);
+	mheader.set_val_encoding(val_enc);
+	return build_encoded_2d(rows, cols, nnz, vals, mheader);
+}
+
+std::shared_ptr<sparse_matrix> create_encoded_2d_matrix(data_frame::ptr df,
+		const block_2d_size &block_size, size_t num_rows, size_t num_cols,
+		spm_val_encoding val_enc, bool is_sym)
+{
+	if (is_sym && num_rows != num_cols) {
+		BOOST_LOG_TRIVIAL(error) << "A symmetric matrix has to be square";
+		return sparse_matrix::ptr();
+	}
+	auto out_mat = create_encoded_2d(df, block_size, num_rows, num_cols,
+			val_enc, false);
+	if (out_mat.second == NULL)
+		return sparse_matrix::ptr();
+	if (is_sym)
+		return sparse_matrix::create(out_mat.first, out_mat.second);
+
+	auto in_mat = create_encoded_2d(df, block_size, num_rows, num_cols,
+			val_enc, true);
+	if (in_mat.second == NULL)
+		return sparse_matrix::ptr();
+	return sparse_matrix::create(out_mat.first, out_mat.second,
+			in_mat.first, in_mat.second);
+}
+
 }
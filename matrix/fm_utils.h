@@ -37,6 +37,47 @@ void set_remove_self_edge(bool v);
 std::shared_ptr<sparse_matrix> create_2d_matrix(data_frame::ptr df,
 		const block_2d_size &block_size, const fm::scalar_type *entry_type,
 		bool is_sym, const std::string &name = "");
+/*
+ * Create a sparse matrix with the given number of rows and columns from
+ * an edge list. Unlike the function above, the matrix doesn't need to be
+ * square, and self edges are kept. If the matrix is symmetric, the edge
+ * list has to contain the edges in both directions. The matrix is stored
+ * in memory. The edge list isn't modified.
+ */
+std::shared_ptr<sparse_matrix> create_rect_2d_matrix(data_frame::ptr df,
+		const block_2d_size &block_size, size_t num_rows, size_t num_cols,
+		const fm::scalar_type *entry_type, bool is_sym = false);
+/*
+ * Create a sparse matrix with encoded blocks from an edge list in memory.
+ * The column indices in a block are stored as variable-length gaps or
+ * bitmaps, and `val_enc' decides how the non-zero values are stored.
+ * Duplicated edges are removed. If the matrix is symmetric, the edge list
+ * has to contain the edges in both directions. The matrix is stored
+ * in memory.
+ */
+std::shared_ptr<sparse_matrix> create_encoded_2d_matrix(data_frame::ptr df,
+		const block_2d_size &block_size, size_t num_rows, size_t num_cols,
+		spm_val_encoding val_enc, bool is_sym = false);
+/*
+ * This builds the image of a sparse matrix with encoded blocks and its index
+ * from an edge list in memory. If `transpose' is true, it builds the image
+ * of the transpose of the matrix. The image and the index are kept in memory,
+ * and can be written to the Linux filesystem or SAFS with dump/safs_dump.
+ */
+std::pair<SpM_2d_index::ptr, SpM_2d_storage::ptr> create_encoded_2d(
+		data_frame::ptr df, const block_2d_size &block_size, size_t num_rows,
+		size_t num_cols, spm_val_encoding val_enc, bool transpose = false);
+/*
+ * This encodes the non-zero entries that fall in `brow_bufs.size()' block
+ * rows starting from `brow_start'. Each block row is stored in its own
+ * buffer in the 2D format and all block rows can be written after
+ * the matrix header one after another. `vals' contains `entry_size' bytes
+ * for each non-zero entry. Duplicated entries are removed.
+ */
+void encode_block_rows(const ele_idx_t *rows, const ele_idx_t *cols,
+		size_t nnz, const char *vals, const block_2d_size &block_size,
+		size_t entry_size, size_t brow_start,
+		std::vector<std::vector<char> > &brow_bufs);
 
 }
 
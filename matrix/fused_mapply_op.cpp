@@ -0,0 +1,365 @@
+/*
+ * Copyright 2017 Open Connectome Project (http://openconnecto.me)
+ * Written by Da Zheng (zhengda1936@gmail.com)
+ *
+ * This file is part of FlashMatrix.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "fused_mapply_op.h"
+#include "local_matrix_store.h"
+#include "local_mem_buffer.h"
+
+namespace fm
+{
+
+namespace detail
+{
+
+// The intermediate results of a chunk should fit in L1 cache.
+static const size_t FUSE_CACHE_SIZE = 1024 * 32;
+// The chunk length is a multiple of this, so the bulk operations can
+// process a chunk in blocks of a fixed size.
+static const size_t MIN_CHUNK_LEN = 128;
+
+fused_mapply_op::fused_mapply_op(const std::vector<step> &steps,
+		size_t num_ins, size_t out_num_rows,
+		size_t out_num_cols): portion_mapply_op(out_num_rows, out_num_cols,
+			steps.back().get_output_type())
+{
+	this->steps = steps;
+	this->num_ins = num_ins;
+	init();
+}
+
+static inline size_t get_num_args(const fused_mapply_op::step &s)
+{
+	return s.op ? 2 : 1;
+}
+
+static inline const scalar_type &get_arg_type(const fused_mapply_op::step &s,
+		size_t arg_idx)
+{
+	if (s.uop)
+		return s.uop->get_input_type();
+	else if (arg_idx == 0)
+		return s.op->get_left_type();
+	else
+		return s.op->get_right_type();
+}
+
+void fused_mapply_op::init()
+{
+	in_entry_sizes.resize(num_ins);
+	max_entry_size = 0;
+	// The last step that uses the result of a step.
+	std::vector<size_t> last_use(steps.size(), 0);
+	for (size_t i = 0; i < steps.size(); i++) {
+		for (size_t j = 0; j < get_num_args(steps[i]); j++) {
+			const operand &arg = steps[i].args[j];
+			if (arg.is_input)
+				in_entry_sizes[arg.idx] = get_arg_type(steps[i], j).get_size();
+			else
+				last_use[arg.idx] = i;
+		}
+		max_entry_size = std::max(max_entry_size,
+				steps[i].get_output_type().get_size());
+	}
+
+	// Assign buffers to steps. The result of a step is kept in a buffer
+	// until the last step that uses it, so a buffer is reused by steps
+	// whose results aren't used at the same time. The last step writes
+	// to the output directly.
+	buf_idxs.resize(steps.size());
+	num_bufs = 0;
+	std::vector<size_t> free_bufs;
+	for (size_t i = 0; i < steps.size(); i++) {
+		if (i < steps.size() - 1) {
+			if (free_bufs.empty())
+				buf_idxs[i] = num_bufs++;
+			else {
+				buf_idxs[i] = free_bufs.back();
+				free_bufs.pop_back();
+			}
+		}
+		// We release the buffers of the operands after we allocate the buffer
+		// for the result, because an operation may not run in place when
+		// the input and output types have different sizes.
+		for (size_t j = 0; j < get_num_args(steps[i]); j++) {
+			const operand &arg = steps[i].args[j];
+			// An operand may be used twice in the same step.
+			if (!arg.is_input && last_use[arg.idx] == i
+					&& (j == 0 || steps[i].args[0].is_input
+						|| steps[i].args[0].idx != arg.idx))
+				free_bufs.push_back(buf_idxs[arg.idx]);
+		}
+	}
+}
+
+void fused_mapply_op::run_arrs(const std::vector<const char *> &in_arrs,
+		char *out_arr, size_t num_eles, const std::vector<char *> &bufs,
+		size_t chunk_len) const
+{
+	size_t out_entry_size = get_output_type().get_size();
+	const char *args[2];
+	for (size_t off = 0; off < num_eles; off += chunk_len) {
+		size_t len = std::min(chunk_len, num_eles - off);
+		for (size_t i = 0; i < steps.size(); i++) {
+			const step &s = steps[i];
+			for (size_t j = 0; j < get_num_args(s); j++) {
+				if (s.args[j].is_input)
+					args[j] = in_arrs[s.args[j].idx]
+						+ off * in_entry_sizes[s.args[j].idx];
+				else
+					args[j] = bufs[buf_idxs[s.args[j].idx]];
+			}
+			char *res;
+			if (i == steps.size() - 1)
+				res = out_arr + off * out_entry_size;
+			else
+				res = bufs[buf_idxs[i]];
+			if (s.op)
+				s.op->runAA(len, args[0], args[1], res);
+			else
+				s.uop->runA(len, args[0], res);
+		}
+	}
+}
+
+void fused_mapply_op::_run(const std::vector<local_matrix_store::const_ptr> &ins,
+		local_matrix_store &out) const
+{
+	size_t ncol = out.get_num_cols();
+	size_t nrow = out.get_num_rows();
+	size_t chunk_len = FUSE_CACHE_SIZE / (num_bufs + num_ins + 1)
+		/ max_entry_size;
+	chunk_len = std::max<size_t>(ROUND(chunk_len, MIN_CHUNK_LEN), MIN_CHUNK_LEN);
+	std::shared_ptr<char> mem;
+	std::vector<char *> bufs(num_bufs);
+	if (num_bufs > 0) {
+		mem = local_mem_buffer::alloc(num_bufs * chunk_len * max_entry_size);
+		for (size_t i = 0; i < num_bufs; i++)
+			bufs[i] = mem.get() + i * chunk_len * max_entry_size;
+	}
+
+	bool all_contig = out.get_raw_arr() != NULL;
+	for (size_t i = 0; i < ins.size() && all_contig; i++)
+		all_contig = ins[i]->get_raw_arr() != NULL;
+
+	std::vector<const char *> in_arrs(ins.size());
+	// If all stores have data stored contiguously.
+	if (all_contig) {
+		for (size_t i = 0; i < ins.size(); i++)
+			in_arrs[i] = ins[i]->get_raw_arr();
+		run_arrs(in_arrs, out.get_raw_arr(), nrow * ncol, bufs, chunk_len);
+	}
+	else if (out.store_layout() == matrix_layout_t::L_ROW) {
+		local_row_matrix_store &row_out = (local_row_matrix_store &) out;
+		for (size_t row_idx = 0; row_idx < nrow; row_idx++) {
+			for (size_t i = 0; i < ins.size(); i++)
+				in_arrs[i] = static_cast<const local_row_matrix_store &>(
+						*ins[i]).get_row(row_idx);
+			run_arrs(in_arrs, row_out.get_row(row_idx), ncol, bufs, chunk_len);
+		}
+	}
+	else {
+		local_col_matrix_store &col_out = (local_col_matrix_store &) out;
+		for (size_t col_idx = 0; col_idx < ncol; col_idx++) {
+			for (size_t i = 0; i < ins.size(); i++)
+				in_arrs[i] = static_cast<const local_col_matrix_store &>(
+						*ins[i]).get_col(col_idx);
+			run_arrs(in_arrs, col_out.get_col(col_idx), nrow, bufs, chunk_len);
+		}
+	}
+	for (size_t i = 0; i < ins.size(); i++)
+		ins[i]->complete();
+}
+
+void fused_mapply_op::run(const std::vector<local_matrix_store::const_ptr> &ins,
+		local_matrix_store &out) const
+{
+	assert(ins.size() == num_ins);
+	bool is_virt = false;
+	bool is_whole = true;
+	for (size_t i = 0; i < ins.size(); i++) {
+		assert(ins[i]->store_layout() == out.store_layout());
+		assert(ins[i]->get_global_start_row() == out.get_global_start_row());
+		assert(ins[i]->get_global_start_col() == out.get_global_start_col());
+		is_virt = is_virt || ins[i]->is_virtual();
+		is_whole = is_whole && ins[i]->is_whole();
+	}
+	part_dim_t dim = is_wide() ? part_dim_t::PART_DIM2 : part_dim_t::PART_DIM1;
+	size_t part_len = get_part_dim_len(*ins[0], dim);
+	size_t long_dim = dim == part_dim_t::PART_DIM2
+		? out.get_num_cols() : out.get_num_rows();
+	// If some of the inputs are virtual, we materialize them part by part
+	// as mapply2 does, so that their parts stay in the CPU cache.
+	if (!is_virt || !is_whole || long_dim <= part_len) {
+		_run(ins, out);
+		return;
+	}
+
+	std::vector<local_matrix_store::exposed_area> orig_ins(ins.size());
+	for (size_t i = 0; i < ins.size(); i++)
+		orig_ins[i] = ins[i]->get_exposed_area();
+	local_matrix_store::exposed_area orig_out = out.get_exposed_area();
+	bool success = true;
+	for (size_t idx = 0; idx < long_dim; idx += part_len) {
+		size_t llen = std::min(long_dim - idx, part_len);
+		for (size_t i = 0; i < ins.size() && success; i++) {
+			local_matrix_store &mutable_in
+				= const_cast<local_matrix_store &>(*ins[i]);
+			if (dim == part_dim_t::PART_DIM2)
+				success = mutable_in.resize(orig_ins[i].local_start_row,
+						orig_ins[i].local_start_col + idx, ins[i]->get_num_rows(),
+						llen);
+			else
+				success = mutable_in.resize(orig_ins[i].local_start_row + idx,
+						orig_ins[i].local_start_col, llen, ins[i]->get_num_cols());
+		}
+		if (success) {
+			if (dim == part_dim_t::PART_DIM2)
+				success = out.resize(orig_out.local_start_row,
+						orig_out.local_start_col + idx, out.get_num_rows(), llen);
+			else
+				success = out.resize(orig_out.local_start_row + idx,
+						orig_out.local_start_col, llen, out.get_num_cols());
+		}
+		if (!success) {
+			assert(idx == 0);
+			break;
+		}
+		_run(ins, out);
+	}
+	for (size_t i = 0; i < ins.size(); i++)
+		const_cast<local_matrix_store &>(*ins[i]).restore_size(orig_ins[i]);
+	out.restore_size(orig_out);
+	if (!success)
+		_run(ins, out);
+}
+
+portion_mapply_op::const_ptr fused_mapply_op::transpose() const
+{
+	return portion_mapply_op::const_ptr(new fused_mapply_op(steps, num_ins,
+				get_out_num_cols(), get_out_num_rows()));
+}
+
+std::string fused_mapply_op::to_string(
+		const std::vector<matrix_store::const_ptr> &mats,
+		const operand &arg) const
+{
+	if (arg.is_input)
+		return mats[arg.idx]->get_name();
+
+	const step &s = steps[arg.idx];
+	if (s.op)
+		return s.op->get_name() + std::string("(")
+			+ to_string(mats, s.args[0]) + ", " + to_string(mats, s.args[1])
+			+ ")";
+	else
+		return s.uop->get_name() + std::string("(")
+			+ to_string(mats, s.args[0]) + ")";
+}
+
+std::string fused_mapply_op::to_string(
+		const std::vector<matrix_store::const_ptr> &mats) const
+{
+	assert(mats.size() == num_ins);
+	operand last;
+	last.is_input = false;
+	last.idx = steps.size() - 1;
+	return to_string(mats, last);
+}
+
+bool fused_mapply_builder::find(const matrix_store &store,
+		fused_mapply_op::operand &arg) const
+{
+	auto it = added.find(&store);
+	if (it == added.end())
+		return false;
+	arg = it->second;
+	return true;
+}
+
+fused_mapply_op::operand fused_mapply_builder::add_input(
+		matrix_store::const_ptr store)
+{
+	fused_mapply_op::operand arg;
+	if (find(*store, arg))
+		return arg;
+
+	arg.is_input = true;
+	arg.idx = ins.size();
+	ins.push_back(store);
+	set(*store, arg);
+	return arg;
+}
+
+fused_mapply_op::operand fused_mapply_builder::add_step(
+		bulk_operate::const_ptr op, fused_mapply_op::operand arg1,
+		fused_mapply_op::operand arg2)
+{
+	fused_mapply_op::step s;
+	s.op = op;
+	s.args[0] = arg1;
+	s.args[1] = arg2;
+	steps.push_back(s);
+
+	fused_mapply_op::operand ret;
+	ret.is_input = false;
+	ret.idx = steps.size() - 1;
+	return ret;
+}
+
+fused_mapply_op::operand fused_mapply_builder::add_step(
+		bulk_uoperate::const_ptr op, fused_mapply_op::operand arg)
+{
+	fused_mapply_op::step s;
+	s.uop = op;
+	s.args[0] = arg;
+	s.args[1] = arg;
+	steps.push_back(s);
+
+	fused_mapply_op::operand ret;
+	ret.is_input = false;
+	ret.idx = steps.size() - 1;
+	return ret;
+}
+
+void fused_mapply_builder::truncate(size_t num_steps, size_t num_ins)
+{
+	assert(num_steps <= steps.size() && num_ins <= ins.size());
+	steps.resize(num_steps);
+	ins.resize(num_ins);
+	for (auto it = added.begin(); it != added.end();) {
+		const fused_mapply_op::operand &arg = it->second;
+		if ((arg.is_input && arg.idx >= num_ins)
+				|| (!arg.is_input && arg.idx >= num_steps))
+			it = added.erase(it);
+		else
+			it++;
+	}
+}
+
+portion_mapply_op::const_ptr fused_mapply_builder::build(size_t out_num_rows,
+		size_t out_num_cols) const
+{
+	assert(!steps.empty());
+	return portion_mapply_op::const_ptr(new fused_mapply_op(steps, ins.size(),
+				out_num_rows, out_num_cols));
+}
+
+}
+
+}
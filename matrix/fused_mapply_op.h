@@ -0,0 +1,179 @@
+#ifndef __FM_FUSED_MAPPLY_OP_H__
+#define __FM_FUSED_MAPPLY_OP_H__
+
+/*
+ * Copyright 2017 Open Connectome Project (http://openconnecto.me)
+ * Written by Da Zheng (zhengda1936@gmail.com)
+ *
+ * This file is part of FlashMatrix.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <vector>
+#include <unordered_map>
+
+#include "bulk_operate.h"
+#include "materialize.h"
+
+namespace fm
+{
+
+namespace detail
+{
+
+class mapply_matrix_store;
+
+/*
+ * This portion operation runs a chain of element-wise operations
+ * (mapply2 and sapply) in a single pass over the input portions.
+ * Instead of materializing every intermediate matrix in a portion buffer,
+ * it streams small chunks of the input portions through all operations,
+ * so that the intermediate results stay in the CPU cache.
+ *
+ * All input matrices and the output matrix have the same shape and
+ * the same data layout.
+ */
+class fused_mapply_op: public portion_mapply_op
+{
+public:
+	/*
+	 * An operand of an operation is either an input matrix
+	 * or the result of a previous operation.
+	 */
+	struct operand
+	{
+		bool is_input;
+		size_t idx;
+	};
+
+	struct step
+	{
+		// Only one of them is valid.
+		bulk_operate::const_ptr op;
+		bulk_uoperate::const_ptr uop;
+		operand args[2];
+
+		const scalar_type &get_output_type() const {
+			if (op)
+				return op->get_output_type();
+			else
+				return uop->get_output_type();
+		}
+	};
+private:
+	// The last step computes the output.
+	std::vector<step> steps;
+	size_t num_ins;
+	// The entry size of the input matrices.
+	std::vector<size_t> in_entry_sizes;
+	// The buffer used by each step. Steps whose results aren't used
+	// at the same time share a buffer.
+	std::vector<size_t> buf_idxs;
+	size_t num_bufs;
+	size_t max_entry_size;
+
+	void init();
+	void run_arrs(const std::vector<const char *> &in_arrs, char *out_arr,
+			size_t num_eles, const std::vector<char *> &bufs,
+			size_t chunk_len) const;
+	void _run(const std::vector<std::shared_ptr<const local_matrix_store> > &ins,
+			local_matrix_store &out) const;
+	std::string to_string(const std::vector<matrix_store::const_ptr> &mats,
+			const operand &arg) const;
+public:
+	fused_mapply_op(const std::vector<step> &steps, size_t num_ins,
+			size_t out_num_rows, size_t out_num_cols);
+
+	const std::vector<step> &get_steps() const {
+		return steps;
+	}
+	size_t get_num_inputs() const {
+		return num_ins;
+	}
+
+	virtual void run(
+			const std::vector<std::shared_ptr<const local_matrix_store> > &ins,
+			local_matrix_store &out) const;
+	virtual portion_mapply_op::const_ptr transpose() const;
+	virtual std::string to_string(
+			const std::vector<matrix_store::const_ptr> &mats) const;
+};
+
+/*
+ * This builds a fused operation from a DAG of element-wise operations.
+ * If a matrix is added multiple times, it is read or computed only once.
+ */
+class fused_mapply_builder
+{
+	std::vector<matrix_store::const_ptr> ins;
+	std::vector<fused_mapply_op::step> steps;
+	// The operands of the matrices that have been added.
+	std::unordered_map<const matrix_store *, fused_mapply_op::operand> added;
+public:
+	/*
+	 * The maximal number of operations in a fused operation.
+	 */
+	static const size_t MAX_NUM_STEPS = 64;
+
+	/*
+	 * Find the operand of a matrix that has been added.
+	 */
+	bool find(const matrix_store &store, fused_mapply_op::operand &arg) const;
+	/*
+	 * Remember the operand that computes a matrix.
+	 */
+	void set(const matrix_store &store, fused_mapply_op::operand arg) {
+		added[&store] = arg;
+	}
+
+	fused_mapply_op::operand add_input(matrix_store::const_ptr store);
+	fused_mapply_op::operand add_step(bulk_operate::const_ptr op,
+			fused_mapply_op::operand arg1, fused_mapply_op::operand arg2);
+	fused_mapply_op::operand add_step(bulk_uoperate::const_ptr op,
+			fused_mapply_op::operand arg);
+
+	/*
+	 * Remove the inputs and the operations added after there were
+	 * `num_steps' operations and `num_ins' inputs.
+	 */
+	void truncate(size_t num_steps, size_t num_ins);
+
+	size_t get_num_steps() const {
+		return steps.size();
+	}
+	const std::vector<matrix_store::const_ptr> &get_inputs() const {
+		return ins;
+	}
+
+	portion_mapply_op::const_ptr build(size_t out_num_rows,
+			size_t out_num_cols) const;
+};
+
+/*
+ * Fuse the element-wise operation of a mapply matrix with the element-wise
+ * operations that compute its inputs. An input is inlined only if it isn't
+ * materialized, its materialization level is MATER_CPU and it isn't used
+ * by other matrices in the DAG being materialized, so it should be called
+ * after the materialization is planned.
+ * It returns the fused operation and its inputs, or NULL if none of
+ * the inputs can be inlined.
+ */
+portion_mapply_op::const_ptr fuse_mapply(const mapply_matrix_store &store,
+		std::vector<matrix_store::const_ptr> &ins);
+
+}
+
+}
+
+#endif
@@ -20,7 +20,18 @@
  * limitations under the License.
  */
 
-#include<unordered_map>
+#if defined(_OPENMP)
+#include <omp.h>
+#endif
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#include <stdint.h>
+#include <string.h>
+#include <assert.h>
+
+#include <unordered_map>
+#include <functional>
 
 #include "data_frame.h"
 #include "mem_vec_store.h"
@@ -33,9 +44,35 @@ class agg_operate;
 
 class generic_hashtable
 {
+protected:
+	/*
+	 * Merge the hashtables into a new hashtable in parallel.
+	 */
+	virtual std::shared_ptr<generic_hashtable> parallel_merge(
+			const std::vector<std::shared_ptr<generic_hashtable> > &tables,
+			const agg_operate &op) const = 0;
 public:
 	typedef std::shared_ptr<generic_hashtable> ptr;
 
+	/*
+	 * Merge multiple hashtables of the same type into one.
+	 * The keys are split into partitions by their hash values and each
+	 * partition is merged by a thread. The input tables may be empty
+	 * pointers.
+	 */
+	static ptr merge(const std::vector<ptr> &tables, const agg_operate &op) {
+		std::vector<ptr> valid_tables;
+		for (size_t i = 0; i < tables.size(); i++)
+			if (tables[i])
+				valid_tables.push_back(tables[i]);
+		if (valid_tables.empty())
+			return ptr();
+		else if (valid_tables.size() == 1)
+			return valid_tables[0];
+		else
+			return valid_tables[0]->parallel_merge(valid_tables, op);
+	}
+
 	/*
 	 * This method inserts an array of keys and values.
 	 * If a key exists, merge the old value and the new value with
@@ -53,11 +90,201 @@ public:
 	 * Convert the hashtable to a data frame.
 	 */
 	virtual data_frame::ptr conv2df() const = 0;
+	virtual size_t get_num_entries() const = 0;
 };
 
+/*
+ * std::hash of integers is the identity function, so we need to mix
+ * the bits. The 64-bit finalizer of MurmurHash3 is used here.
+ */
+template<class KeyType>
+inline uint64_t get_hash_code(const KeyType &key)
+{
+	uint64_t h = std::hash<KeyType>()(key);
+	h ^= h >> 33;
+	h *= 0xff51afd7ed558ccdUL;
+	h ^= h >> 33;
+	h *= 0xc4ceb9fe1a85ec53UL;
+	h ^= h >> 33;
+	return h;
+}
+
+/*
+ * This is a hashtable with open addressing. It doesn't support deletion.
+ *
+ * Each slot has a control byte. The control byte is EMPTY if the slot is
+ * empty; otherwise, it stores the 7 highest bits of the hash value of
+ * the key in the slot. The slots are divided into groups of 16. We search
+ * for a key a group at a time: we compare the control bytes of a group with
+ * the hash bits with SIMD instructions and only compare the keys in
+ * the slots whose control bytes match. The groups are probed in
+ * the triangular sequence, which visits every group when the number of
+ * groups is a power of two.
+ */
+template<class KeyType, class ValType>
+class flat_hashtable
+{
+	static const size_t GROUP_SIZE = 16;
+	static const uint8_t EMPTY = 0x80;
+
+	std::unique_ptr<uint8_t[]> ctrl;
+	std::unique_ptr<KeyType[]> keys;
+	std::unique_ptr<ValType[]> vals;
+	// This marks the slots whose values are waiting to be combined with
+	// new values.
+	std::unique_ptr<bool[]> pending;
+	size_t num_slots;
+	size_t num_entries;
+
+	static uint32_t match_byte(const uint8_t *group, uint8_t b) {
+#ifdef __SSE2__
+		__m128i ctrls = _mm_loadu_si128((const __m128i *) group);
+		return _mm_movemask_epi8(_mm_cmpeq_epi8(ctrls, _mm_set1_epi8(b)));
+#else
+		uint32_t mask = 0;
+		for (size_t i = 0; i < GROUP_SIZE; i++)
+			mask |= ((uint32_t) (group[i] == b)) << i;
+		return mask;
+#endif
+	}
+
+	static uint8_t get_hash_bits(uint64_t hash) {
+		return hash >> 57;
+	}
+
+	size_t get_max_entries() const {
+		// The max load factor is 7/8.
+		return num_slots - num_slots / 8;
+	}
+
+	void alloc(size_t num_slots) {
+		this->num_slots = num_slots;
+		ctrl = std::unique_ptr<uint8_t[]>(new uint8_t[num_slots]);
+		memset(ctrl.get(), EMPTY, num_slots);
+		keys = std::unique_ptr<KeyType[]>(new KeyType[num_slots]);
+		vals = std::unique_ptr<ValType[]>(new ValType[num_slots]);
+		pending = std::unique_ptr<bool[]>(new bool[num_slots]);
+		memset(pending.get(), 0, num_slots * sizeof(bool));
+	}
+
+	void rehash(size_t new_num_slots);
+public:
+	flat_hashtable() {
+		num_entries = 0;
+		alloc(GROUP_SIZE);
+	}
+
+	size_t get_num_entries() const {
+		return num_entries;
+	}
+
+	size_t get_num_slots() const {
+		return num_slots;
+	}
+
+	/*
+	 * Make sure we can insert `num' entries in total without resizing
+	 * the table, so the locations of the existing keys don't change.
+	 */
+	void reserve(size_t num) {
+		if (num <= get_max_entries())
+			return;
+		size_t new_num_slots = num_slots;
+		while (new_num_slots - new_num_slots / 8 < num)
+			new_num_slots *= 2;
+		rehash(new_num_slots);
+	}
+
+	/*
+	 * Find the slot of the key. If the key doesn't exist, it's inserted
+	 * to an empty slot and its value isn't initialized.
+	 * The caller needs to reserve space for the new key.
+	 */
+	size_t find_or_insert(const KeyType &key, uint64_t hash, bool &inserted) {
+		assert(num_entries < get_max_entries());
+		uint8_t hash_bits = get_hash_bits(hash);
+		size_t group_mask = num_slots / GROUP_SIZE - 1;
+		size_t group_idx = hash & group_mask;
+		for (size_t step = 1; ; step++) {
+			const uint8_t *group = ctrl.get() + group_idx * GROUP_SIZE;
+			uint32_t match = match_byte(group, hash_bits);
+			while (match) {
+				size_t idx = group_idx * GROUP_SIZE + __builtin_ctz(match);
+				if (keys[idx] == key) {
+					inserted = false;
+					return idx;
+				}
+				match &= match - 1;
+			}
+			// The key doesn't exist if there is an empty slot in the group.
+			uint32_t empty = match_byte(group, EMPTY);
+			if (empty) {
+				size_t idx = group_idx * GROUP_SIZE + __builtin_ctz(empty);
+				ctrl[idx] = hash_bits;
+				keys[idx] = key;
+				num_entries++;
+				inserted = true;
+				return idx;
+			}
+			group_idx = (group_idx + step) & group_mask;
+		}
+	}
+
+	bool is_occupied(size_t idx) const {
+		return ctrl[idx] != EMPTY;
+	}
+
+	const KeyType &get_key(size_t idx) const {
+		return keys[idx];
+	}
+
+	ValType &get_val(size_t idx) {
+		return vals[idx];
+	}
+
+	const ValType &get_val(size_t idx) const {
+		return vals[idx];
+	}
+
+	bool is_pending(size_t idx) const {
+		return pending[idx];
+	}
+
+	void set_pending(size_t idx, bool val) {
+		pending[idx] = val;
+	}
+};
+
+template<class KeyType, class ValType>
+void flat_hashtable<KeyType, ValType>::rehash(size_t new_num_slots)
+{
+	std::unique_ptr<uint8_t[]> old_ctrl = std::move(ctrl);
+	std::unique_ptr<KeyType[]> old_keys = std::move(keys);
+	std::unique_ptr<ValType[]> old_vals = std::move(vals);
+	size_t old_num_slots = num_slots;
+	alloc(new_num_slots);
+	num_entries = 0;
+	for (size_t i = 0; i < old_num_slots; i++) {
+		if (old_ctrl[i] == EMPTY)
+			continue;
+		bool inserted;
+		size_t idx = find_or_insert(old_keys[i], get_hash_code(old_keys[i]),
+				inserted);
+		assert(inserted);
+		vals[idx] = old_vals[i];
+	}
+}
+
 template<class KeyType, int ValSize>
 class generic_hashtable_impl: public generic_hashtable
 {
+	// The number of keys inserted before we combine the values of
+	// the existing keys.
+	static const size_t BATCH_SIZE = 1024;
+	// The hash bits below the ones stored in the control bytes are used
+	// to split a table into partitions.
+	static const int PART_SHIFT = 50;
+
 	const scalar_type &real_val_type;
 
 	/*
@@ -67,63 +294,259 @@ class generic_hashtable_impl: public generic_hashtable
 	typedef struct {
 		char data[ValSize];
 	} ValType;
-	std::unordered_map<KeyType, ValType> table;
+	typedef flat_hashtable<KeyType, ValType> table_t;
+	/*
+	 * We store keys in this type in vectors. It has the same layout as
+	 * the key, but it avoids the specialization of std::vector for bool.
+	 */
+	typedef struct {
+		KeyType key;
+	} KeyEntry;
+
+	// A table is split into partitions after it's merged in parallel.
+	// The number of partitions is a power of two.
+	std::vector<std::shared_ptr<table_t> > parts;
+
+	size_t get_part_idx(uint64_t hash) const {
+		return (hash >> PART_SHIFT) & (parts.size() - 1);
+	}
+
+	static void insert_part(table_t &table, size_t num, const KeyType *keys,
+			const ValType *vals, const agg_operate &op);
+	/*
+	 * Get all keys and values in the table, ordered by partitions.
+	 */
+	void get_entries(std::vector<KeyEntry> &keys,
+			std::vector<ValType> &vals) const;
+protected:
+	virtual generic_hashtable::ptr parallel_merge(
+			const std::vector<generic_hashtable::ptr> &tables,
+			const agg_operate &op) const;
 public:
-	generic_hashtable_impl(const scalar_type &type): real_val_type(type) {
-	}
-
-	void insert(size_t num, const void *pkeys, const void *pvals,
-			const agg_operate &op) {
-		const KeyType *keys = (const KeyType *) pkeys;
-		const ValType *vals = (const ValType *) pvals;
-		assert(op.has_combine());
-		for (size_t i = 0; i < num; i++) {
-			auto ret = table.insert(std::pair<KeyType, ValType>(keys[i],
-						vals[i]));
-			// TODO this is going to be slow.
-			if (!ret.second) {
-				ValType tmp_vals[2];
-				tmp_vals[0] = ret.first->second;
-				tmp_vals[1] = vals[i];
-				op.runCombine(2, tmp_vals, &ret.first->second);
-			}
-		}
+	generic_hashtable_impl(const scalar_type &type,
+			size_t num_parts = 1): real_val_type(type) {
+		assert((num_parts & (num_parts - 1)) == 0);
+		parts.resize(num_parts);
+		for (size_t i = 0; i < num_parts; i++)
+			parts[i] = std::shared_ptr<table_t>(new table_t());
 	}
 
+	virtual void insert(size_t num, const void *pkeys, const void *pvals,
+			const agg_operate &op);
+
 	virtual void merge(const generic_hashtable &gtable, const agg_operate &op) {
 		const generic_hashtable_impl<KeyType, ValSize> &gtable1
 			= dynamic_cast<const generic_hashtable_impl<KeyType, ValSize> &>(
 					gtable);
-		assert(op.has_combine());
-		for (auto it = gtable1.table.begin(); it != gtable1.table.end(); it++) {
-			auto ret = table.insert(std::pair<KeyType, ValType>(it->first,
-						it->second));
-			if (!ret.second) {
-				ValType tmp_vals[2];
-				tmp_vals[0] = ret.first->second;
-				tmp_vals[1] = it->second;
-				op.runCombine(2, tmp_vals, &ret.first->second);
+		std::vector<KeyEntry> keys;
+		std::vector<ValType> vals;
+		gtable1.get_entries(keys, vals);
+		insert(keys.size(), (const KeyType *) keys.data(), vals.data(), op);
+	}
+
+	virtual data_frame::ptr conv2df() const;
+
+	virtual size_t get_num_entries() const {
+		size_t num = 0;
+		for (size_t i = 0; i < parts.size(); i++)
+			num += parts[i]->get_num_entries();
+		return num;
+	}
+};
+
+/*
+ * The values of the new keys are stored in the table directly. The values
+ * of the existing keys are combined with the values in the table in
+ * batches. The combine operation is a binary operation, so we can combine
+ * the old and new values of many keys with a single call to runAA.
+ */
+template<class KeyType, int ValSize>
+void generic_hashtable_impl<KeyType, ValSize>::insert_part(table_t &table,
+		size_t num, const KeyType *keys, const ValType *vals,
+		const agg_operate &op)
+{
+	assert(op.has_combine());
+	std::vector<size_t> pending_idxs;
+	std::vector<ValType> old_vals;
+	std::vector<ValType> new_vals;
+	pending_idxs.reserve(BATCH_SIZE);
+	new_vals.reserve(BATCH_SIZE);
+	auto combine = [&]() {
+		old_vals.resize(pending_idxs.size());
+		for (size_t j = 0; j < pending_idxs.size(); j++) {
+			old_vals[j] = table.get_val(pending_idxs[j]);
+			table.set_pending(pending_idxs[j], false);
+		}
+		op.get_combine().runAA(pending_idxs.size(), old_vals.data(),
+				new_vals.data(), old_vals.data());
+		for (size_t j = 0; j < pending_idxs.size(); j++)
+			table.get_val(pending_idxs[j]) = old_vals[j];
+		pending_idxs.clear();
+		new_vals.clear();
+	};
+
+	for (size_t start = 0; start < num; start += BATCH_SIZE) {
+		size_t end = std::min(num, start + BATCH_SIZE);
+		// The table can't be resized when some values are waiting to be
+		// combined.
+		table.reserve(table.get_num_entries() + end - start);
+		for (size_t i = start; i < end; i++) {
+			bool inserted;
+			size_t idx = table.find_or_insert(keys[i], get_hash_code(keys[i]),
+					inserted);
+			if (inserted)
+				table.get_val(idx) = vals[i];
+			else {
+				// If the key appears multiple times in the batch, the values
+				// have to be combined in order.
+				if (table.is_pending(idx))
+					combine();
+				table.set_pending(idx, true);
+				pending_idxs.push_back(idx);
+				new_vals.push_back(vals[i]);
 			}
 		}
+		if (!pending_idxs.empty())
+			combine();
 	}
+}
 
-	virtual data_frame::ptr conv2df() const {
-		detail::smp_vec_store::ptr keys = detail::smp_vec_store::create(table.size(),
-				get_scalar_type<KeyType>());
-		detail::smp_vec_store::ptr vals = detail::smp_vec_store::create(table.size(),
-				real_val_type);
-		size_t vec_idx = 0;
-		for (auto it = table.begin(); it != table.end(); it++) {
-			keys->set<KeyType>(vec_idx, it->first);
-			vals->set<ValType>(vec_idx, it->second);
-			vec_idx++;
+template<class KeyType, int ValSize>
+void generic_hashtable_impl<KeyType, ValSize>::insert(size_t num,
+		const void *pkeys, const void *pvals, const agg_operate &op)
+{
+	const KeyType *keys = (const KeyType *) pkeys;
+	const ValType *vals = (const ValType *) pvals;
+	if (parts.size() == 1) {
+		insert_part(*parts[0], num, keys, vals, op);
+		return;
+	}
+
+	// Distribute the keys to the partitions.
+	std::vector<std::vector<KeyEntry> > part_keys(parts.size());
+	std::vector<std::vector<ValType> > part_vals(parts.size());
+	for (size_t i = 0; i < num; i++) {
+		size_t part_idx = get_part_idx(get_hash_code(keys[i]));
+		part_keys[part_idx].push_back(KeyEntry{keys[i]});
+		part_vals[part_idx].push_back(vals[i]);
+	}
+	for (size_t i = 0; i < parts.size(); i++)
+		insert_part(*parts[i], part_keys[i].size(),
+				(const KeyType *) part_keys[i].data(),
+				part_vals[i].data(), op);
+}
+
+template<class KeyType, int ValSize>
+void generic_hashtable_impl<KeyType, ValSize>::get_entries(
+		std::vector<KeyEntry> &keys, std::vector<ValType> &vals) const
+{
+	keys.resize(get_num_entries());
+	vals.resize(get_num_entries());
+	size_t idx = 0;
+	for (size_t i = 0; i < parts.size(); i++) {
+		const table_t &table = *parts[i];
+		for (size_t j = 0; j < table.get_num_slots(); j++) {
+			if (table.is_occupied(j)) {
+				keys[idx].key = table.get_key(j);
+				vals[idx] = table.get_val(j);
+				idx++;
+			}
 		}
-		data_frame::ptr ret = data_frame::create();
-		ret->add_vec("key", keys);
-		ret->add_vec("val", vals);
-		return ret;
 	}
-};
+	assert(idx == keys.size());
+}
+
+template<class KeyType, int ValSize>
+generic_hashtable::ptr generic_hashtable_impl<KeyType, ValSize>::parallel_merge(
+		const std::vector<generic_hashtable::ptr> &tables,
+		const agg_operate &op) const
+{
+#if defined(_OPENMP)
+	size_t num_threads = omp_get_max_threads();
+#else
+	size_t num_threads = 1;
+#endif
+	// We create more partitions than threads to balance the load.
+	size_t num_parts = 1;
+	while (num_parts < num_threads * 4 && num_parts < 128)
+		num_parts *= 2;
+	std::shared_ptr<generic_hashtable_impl<KeyType, ValSize> > ret(
+			new generic_hashtable_impl<KeyType, ValSize>(real_val_type,
+				num_parts));
+
+	// Scatter the entries in each input table to the partitions.
+	// part_keys[i * num_parts + j] has the keys in partition j from table i.
+	std::vector<std::vector<KeyEntry> > part_keys(tables.size() * num_parts);
+	std::vector<std::vector<ValType> > part_vals(tables.size() * num_parts);
+#pragma omp parallel for
+	for (size_t i = 0; i < tables.size(); i++) {
+		const generic_hashtable_impl<KeyType, ValSize> &table
+			= dynamic_cast<const generic_hashtable_impl<KeyType, ValSize> &>(
+					*tables[i]);
+		for (size_t k = 0; k < table.parts.size(); k++) {
+			const table_t &part = *table.parts[k];
+			for (size_t j = 0; j < part.get_num_slots(); j++) {
+				if (!part.is_occupied(j))
+					continue;
+				size_t part_idx = ret->get_part_idx(
+						get_hash_code(part.get_key(j)));
+				part_keys[i * num_parts + part_idx].push_back(
+						KeyEntry{part.get_key(j)});
+				part_vals[i * num_parts + part_idx].push_back(part.get_val(j));
+			}
+		}
+	}
+
+	// Each partition is merged by a thread.
+#pragma omp parallel for schedule(dynamic, 1)
+	for (size_t j = 0; j < num_parts; j++) {
+		size_t num = 0;
+		for (size_t i = 0; i < tables.size(); i++)
+			num += part_keys[i * num_parts + j].size();
+		table_t &part = *ret->parts[j];
+		part.reserve(num);
+		for (size_t i = 0; i < tables.size(); i++) {
+			std::vector<KeyEntry> &keys = part_keys[i * num_parts + j];
+			std::vector<ValType> &vals = part_vals[i * num_parts + j];
+			insert_part(part, keys.size(), (const KeyType *) keys.data(),
+					vals.data(), op);
+			// Free memory as soon as possible.
+			std::vector<KeyEntry>().swap(keys);
+			std::vector<ValType>().swap(vals);
+		}
+	}
+	return ret;
+}
+
+template<class KeyType, int ValSize>
+data_frame::ptr generic_hashtable_impl<KeyType, ValSize>::conv2df() const
+{
+	size_t num_entries = get_num_entries();
+	detail::smp_vec_store::ptr keys = detail::smp_vec_store::create(num_entries,
+			get_scalar_type<KeyType>());
+	detail::smp_vec_store::ptr vals = detail::smp_vec_store::create(num_entries,
+			real_val_type);
+	std::vector<size_t> offs(parts.size() + 1);
+	for (size_t i = 0; i < parts.size(); i++)
+		offs[i + 1] = offs[i] + parts[i]->get_num_entries();
+#pragma omp parallel for
+	for (size_t i = 0; i < parts.size(); i++) {
+		const table_t &table = *parts[i];
+		size_t vec_idx = offs[i];
+		for (size_t j = 0; j < table.get_num_slots(); j++) {
+			if (table.is_occupied(j)) {
+				keys->set<KeyType>(vec_idx, table.get_key(j));
+				vals->set<ValType>(vec_idx, table.get_val(j));
+				vec_idx++;
+			}
+		}
+		assert(vec_idx == offs[i + 1]);
+	}
+	data_frame::ptr ret = data_frame::create();
+	ret->add_vec("key", keys);
+	ret->add_vec("val", vals);
+	return ret;
+}
 
 }
 
@@ -23,6 +23,8 @@
 #include "local_mem_buffer.h"
 #include "materialize.h"
 #include "EM_dense_matrix.h"
+#include "mater_planner.h"
+#include "fused_mapply_op.h"
 
 namespace fm
 {
@@ -152,7 +154,7 @@ class mapply_store
 {
 	materialize_level mater_level;
 	std::vector<local_matrix_store::const_ptr> ins;
-	const portion_mapply_op &op;
+	portion_mapply_op::const_ptr op;
 	// This is the global matrix store that keeps the materialized result.
 	materialized_mapply_tall_store *global_res;
 	// This stores the materialized result for the whole portion.
@@ -193,9 +195,11 @@ class mapply_store
 	}
 public:
 	mapply_store(const std::vector<local_matrix_store::const_ptr> &ins,
-			const portion_mapply_op &_op, materialized_mapply_tall_store *global_res,
+			portion_mapply_op::const_ptr op,
+			materialized_mapply_tall_store *global_res,
 			local_matrix_store *lstore, materialize_level mater_level,
-			size_t expect_use): op(_op) {
+			size_t expect_use) {
+		this->op = op;
 		this->global_res = global_res;
 		this->mater_level = mater_level;
 		this->lstore = lstore;
@@ -324,7 +328,7 @@ bool mapply_store::resize(off_t local_start_row, off_t local_start_col,
 
 	// The portion operator contains some data. We need to make sure
 	// the resize is allowed in the portion operator.
-	if (!op.is_resizable(local_start_row, local_start_col, local_num_rows,
+	if (!op->is_resizable(local_start_row, local_start_col, local_num_rows,
 				local_num_cols))
 		return false;
 
@@ -491,7 +495,7 @@ void mapply_store::materialize_whole()
 		whole_res->reset_size();
 	}
 	else {
-		op.run(ins, *whole_res);
+		op->run(ins, *whole_res);
 		num_materialized_eles
 			= whole_res->get_num_rows() * whole_res->get_num_cols();
 	}
@@ -553,7 +557,7 @@ void mapply_store::materialize() const
 				new local_buf_row_matrix_store(lstore->get_global_start_row(),
 					lstore->get_global_start_col(), lstore->get_num_rows(),
 					lstore->get_num_cols(), lstore->get_type(), -1));
-	op.run(ins, *part);
+	op->run(ins, *part);
 	// If the materialization level is CPU cache.
 	if (mater_level == materialize_level::MATER_CPU)
 		mutable_this->res_bufs[0] = part;
@@ -674,7 +678,7 @@ public:
 	lmapply_col_matrix_store(materialize_level mater_level,
 			size_t expect_use,
 			const std::vector<local_matrix_store::const_ptr> &ins,
-			const portion_mapply_op &op,
+			portion_mapply_op::const_ptr op,
 			materialized_mapply_tall_store *res,
 			collect_portion_compute::ptr collect_compute,
 			off_t global_start_row, off_t global_start_col,
@@ -747,7 +751,7 @@ public:
 	lmapply_row_matrix_store(materialize_level mater_level,
 			size_t expect_use,
 			const std::vector<local_matrix_store::const_ptr> &ins,
-			const portion_mapply_op &op,
+			portion_mapply_op::const_ptr op,
 			materialized_mapply_tall_store *res,
 			collect_portion_compute::ptr collect_compute,
 			off_t global_start_row, off_t global_start_col,
@@ -970,6 +974,27 @@ mapply_matrix_store::mapply_matrix_store(
 	for (size_t i = 1; i < in_mats.size(); i++)
 		assert(in_mats[0]->get_num_rows() == in_mats[i]->get_num_rows()
 				|| in_mats[0]->get_num_cols() == in_mats[i]->get_num_cols());
+	pthread_spin_init(&fuse_lock, PTHREAD_PROCESS_PRIVATE);
+	fuse_checked = false;
+}
+
+mapply_matrix_store::~mapply_matrix_store()
+{
+	pthread_spin_destroy(&fuse_lock);
+}
+
+void mapply_matrix_store::fuse() const
+{
+	if (fuse_checked)
+		return;
+
+	mapply_matrix_store *mutable_this = const_cast<mapply_matrix_store *>(this);
+	pthread_spin_lock(&mutable_this->fuse_lock);
+	if (!fuse_checked) {
+		mutable_this->fused_op = fuse_mapply(*this, mutable_this->fused_ins);
+		mutable_this->fuse_checked = true;
+	}
+	pthread_spin_unlock(&mutable_this->fuse_lock);
 }
 
 bool mapply_matrix_store::has_materialized() const
@@ -1027,8 +1052,10 @@ void mapply_matrix_store::materialize_self() const
 	if (has_materialized())
 		return;
 
-	matrix_store::const_ptr materialized = __mapply_portion(in_mats, op,
-			layout, is_in_mem(), get_num_nodes(), par_access);
+	dag_mater_scope scope(std::vector<const matrix_store *>(1, this));
+	matrix_store::const_ptr materialized = __mapply_portion(
+			get_compute_inputs(), get_compute_op(), layout, is_in_mem(),
+			get_num_nodes(), par_access);
 	if (materialized == NULL) {
 		BOOST_LOG_TRIVIAL(error) << "fail to materialize self";
 		return;
@@ -1051,9 +1078,10 @@ matrix_store::const_ptr mapply_matrix_store::materialize(bool in_mem,
 		// the materialized data should be stored. If the matrix has been
 		// materialized, we don't need to move the data.
 		return this->res->get_materialize_res(store_layout());
-	else
-		return __mapply_portion(in_mats, op, layout, in_mem, num_nodes,
-				par_access);
+
+	dag_mater_scope scope(std::vector<const matrix_store *>(1, this));
+	return __mapply_portion(get_compute_inputs(), get_compute_op(), layout,
+			in_mem, num_nodes, par_access);
 }
 
 matrix_store::const_ptr mapply_matrix_store::get_rows(
@@ -1165,30 +1193,32 @@ local_matrix_store::const_ptr mapply_matrix_store::get_portion(
 		return res->get_materialize_ref(store_layout()).get_portion(
 				start_row, start_col, num_rows, num_cols);
 
-	std::vector<local_matrix_store::const_ptr> parts(in_mats.size());
+	const std::vector<matrix_store::const_ptr> &ins = get_compute_inputs();
+	std::vector<local_matrix_store::const_ptr> parts(ins.size());
 	if (is_wide()) {
 		assert(start_row == 0);
 		assert(num_rows == get_num_rows());
-		for (size_t i = 0; i < in_mats.size(); i++)
-			parts[i] = in_mats[i]->get_portion(start_row, start_col,
-					in_mats[i]->get_num_rows(), num_cols);
+		for (size_t i = 0; i < ins.size(); i++)
+			parts[i] = ins[i]->get_portion(start_row, start_col,
+					ins[i]->get_num_rows(), num_cols);
 	}
 	else {
 		assert(start_col == 0);
 		assert(num_cols == get_num_cols());
-		for (size_t i = 0; i < in_mats.size(); i++)
-			parts[i] = in_mats[i]->get_portion(start_row, start_col,
-					num_rows, in_mats[i]->get_num_cols());
+		for (size_t i = 0; i < ins.size(); i++)
+			parts[i] = ins[i]->get_portion(start_row, start_col,
+					num_rows, ins[i]->get_num_cols());
 	}
 
 	if (store_layout() == matrix_layout_t::L_ROW)
 		ret = local_matrix_store::const_ptr(new lmapply_row_matrix_store(
-					get_materialize_level(), data_id->get_ref(), parts, *op,
-					res.get(), NULL, start_row, start_col, num_rows, num_cols,
-					get_type(), parts.front()->get_node_id()));
+					get_materialize_level(), data_id->get_ref(), parts,
+					get_compute_op(), res.get(), NULL, start_row, start_col,
+					num_rows, num_cols, get_type(), parts.front()->get_node_id()));
 	else
 		ret = local_matrix_store::const_ptr(new lmapply_col_matrix_store(
-					get_materialize_level(), data_id->get_ref(), parts, *op,
+					get_materialize_level(), data_id->get_ref(), parts,
+					get_compute_op(),
 					res.get(), NULL, start_row, start_col, num_rows, num_cols,
 					get_type(), parts.front()->get_node_id()));
 	if (is_cache_portion())
@@ -1305,13 +1335,14 @@ async_cres_t mapply_matrix_store::get_portion_async(
 		collect_compute = collect_portion_compute::ptr(
 				new collect_portion_compute(orig_compute, NULL, is_wide()));
 
-	std::vector<local_matrix_store::const_ptr> parts(in_mats.size());
+	const std::vector<matrix_store::const_ptr> &ins = get_compute_inputs();
+	std::vector<local_matrix_store::const_ptr> parts(ins.size());
 	if (is_wide()) {
 		assert(start_row == 0);
 		assert(num_rows == get_num_rows());
-		for (size_t i = 0; i < in_mats.size(); i++) {
-			async_cres_t res = in_mats[i]->get_portion_async(start_row, start_col,
-					in_mats[i]->get_num_rows(), num_cols, collect_compute);
+		for (size_t i = 0; i < ins.size(); i++) {
+			async_cres_t res = ins[i]->get_portion_async(start_row, start_col,
+					ins[i]->get_num_rows(), num_cols, collect_compute);
 			parts[i] = res.second;
 			// If the data in the request portion is invalid.
 			if (!res.first && collect_compute)
@@ -1321,9 +1352,9 @@ async_cres_t mapply_matrix_store::get_portion_async(
 	else {
 		assert(start_col == 0);
 		assert(num_cols == get_num_cols());
-		for (size_t i = 0; i < in_mats.size(); i++) {
-			async_cres_t res = in_mats[i]->get_portion_async(start_row, start_col,
-					num_rows, in_mats[i]->get_num_cols(), collect_compute);
+		for (size_t i = 0; i < ins.size(); i++) {
+			async_cres_t res = ins[i]->get_portion_async(start_row, start_col,
+					num_rows, ins[i]->get_num_cols(), collect_compute);
 			parts[i] = res.second;
 			// If the data in the request portion is invalid.
 			if (!res.first && collect_compute)
@@ -1334,13 +1365,13 @@ async_cres_t mapply_matrix_store::get_portion_async(
 	local_matrix_store::ptr ret;
 	if (store_layout() == matrix_layout_t::L_ROW)
 		ret = local_matrix_store::ptr(new lmapply_row_matrix_store(
-					get_materialize_level(), data_id->get_ref(), parts, *op,
-					res.get(), collect_compute, start_row, start_col, num_rows,
+					get_materialize_level(), data_id->get_ref(), parts,
+					get_compute_op(), res.get(), collect_compute, start_row, start_col, num_rows,
 					num_cols, get_type(), parts.front()->get_node_id()));
 	else
 		ret = local_matrix_store::ptr(new lmapply_col_matrix_store(
-					get_materialize_level(), data_id->get_ref(), parts, *op,
-					res.get(), collect_compute, start_row, start_col, num_rows,
+					get_materialize_level(), data_id->get_ref(), parts,
+					get_compute_op(), res.get(), collect_compute, start_row, start_col, num_rows,
 					num_cols, get_type(), parts.front()->get_node_id()));
 	if (collect_compute)
 		collect_compute->set_res_part(ret);
@@ -1468,6 +1499,12 @@ void mapply_matrix_store::inc_dag_ref(size_t id)
 void mapply_matrix_store::reset_dag_ref()
 {
 	data_id->reset_ref();
+	// The inputs may be computed differently in the next materialization.
+	pthread_spin_lock(&fuse_lock);
+	fused_ins.clear();
+	fused_op = NULL;
+	fuse_checked = false;
+	pthread_spin_unlock(&fuse_lock);
 	for (size_t i = 0; i < in_mats.size(); i++)
 		const_cast<matrix_store &>(*in_mats[i]).reset_dag_ref();
 }
@@ -20,6 +20,8 @@
  * limitations under the License.
  */
 
+#include <atomic>
+
 #include "virtual_matrix_store.h"
 #include "mem_matrix_store.h"
 #include "EM_object.h"
@@ -60,6 +62,20 @@ class mapply_matrix_store: public virtual_matrix_store, public EM_object
 	portion_mapply_op::const_ptr op;
 
 	std::shared_ptr<materialized_mapply_tall_store> res;
+
+	/*
+	 * An element-wise operation is fused with the element-wise operations
+	 * that compute its inputs when the matrix is computed, so that
+	 * the materialization planner sees the whole DAG. These are the fused
+	 * operation and its inputs. They're cleared when the DAG references
+	 * are reset.
+	 */
+	pthread_spinlock_t fuse_lock;
+	std::atomic<bool> fuse_checked;
+	std::vector<matrix_store::const_ptr> fused_ins;
+	portion_mapply_op::const_ptr fused_op;
+
+	void fuse() const;
 public:
 	typedef std::shared_ptr<const mapply_matrix_store> const_ptr;
 
@@ -71,6 +87,7 @@ public:
 			portion_mapply_op::const_ptr op,
 			matrix_layout_t layout,
 			data_id_t::ptr data_id = data_id_t::create(mat_counter++));
+	~mapply_matrix_store();
 
 	virtual void inc_dag_ref(size_t data_id);
 	virtual void reset_dag_ref();
@@ -91,6 +108,25 @@ public:
 		return in_mats;
 	}
 
+	portion_mapply_op::const_ptr get_portion_op() const {
+		return op;
+	}
+
+	/*
+	 * Get the operation that computes the matrix and its inputs.
+	 * If the element-wise operation of the matrix is fused with
+	 * the operations of its inputs, they are the fused operation
+	 * and the inputs of the fused operation.
+	 */
+	portion_mapply_op::const_ptr get_compute_op() const {
+		fuse();
+		return fused_op ? fused_op : op;
+	}
+	const std::vector<matrix_store::const_ptr> &get_compute_inputs() const {
+		fuse();
+		return fused_op ? fused_ins : in_mats;
+	}
+
 	virtual bool has_materialized() const;
 	virtual size_t get_data_id() const {
 		return data_id->get_id();
@@ -0,0 +1,299 @@
+/*
+ * Copyright 2017 Open Connectome Project (http://openconnecto.me)
+ * Written by Da Zheng (zhengda1936@gmail.com)
+ *
+ * This file is part of FlashMatrix.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <atomic>
+#include <algorithm>
+
+#include "io_interface.h"
+
+#include "mater_planner.h"
+#include "mapply_matrix_store.h"
+#include "matrix_config.h"
+
+namespace fm
+{
+
+namespace detail
+{
+
+/*
+ * The relative cost of reading a byte from memory and from SSDs,
+ * and computing an element.
+ */
+static const size_t MEM_BYTE_COST = 1;
+static const size_t EM_BYTE_COST = 8;
+static const size_t COMPUTE_ELE_COST = 2;
+/*
+ * We only keep a materialized matrix if recomputing the matrix is
+ * at least this many times more expensive than reading the kept data.
+ */
+static const size_t MIN_KEEP_GAIN = 2;
+
+/*
+ * The number of bytes used by the matrices kept in memory in the process.
+ */
+static std::atomic<size_t> kept_mem_size;
+/*
+ * The number of DAGs being materialized with a plan.
+ */
+static std::atomic<size_t> num_planned_dags;
+
+static bool reserve_kept_mem(size_t num_bytes)
+{
+	size_t curr = kept_mem_size.load();
+	do {
+		if (curr + num_bytes > matrix_conf.get_mater_cache_size())
+			return false;
+	} while (!kept_mem_size.compare_exchange_weak(curr, curr + num_bytes));
+	return true;
+}
+
+size_t mater_planner::get_kept_mem_size()
+{
+	return kept_mem_size.load();
+}
+
+namespace
+{
+
+/*
+ * This releases the memory of a kept matrix from the budget when
+ * the matrix is freed.
+ */
+class kept_mem_deleter
+{
+	matrix_store::ptr buf;
+	size_t num_bytes;
+public:
+	kept_mem_deleter(matrix_store::ptr buf, size_t num_bytes) {
+		this->buf = buf;
+		this->num_bytes = num_bytes;
+	}
+
+	void operator()(matrix_store *store) {
+		buf = NULL;
+		kept_mem_size -= num_bytes;
+	}
+};
+
+}
+
+static size_t get_num_bytes(const matrix_store &store)
+{
+	return store.get_num_rows() * store.get_num_cols() * store.get_entry_size();
+}
+
+/*
+ * Create the buffer to keep the materialized data of a mapply matrix.
+ * The buffer has to be a tall matrix.
+ */
+static matrix_store::ptr create_mater_buf(const matrix_store &store,
+		bool in_mem)
+{
+	size_t num_rows = store.get_num_rows();
+	size_t num_cols = store.get_num_cols();
+	matrix_layout_t layout = store.store_layout();
+	if (num_rows < num_cols) {
+		std::swap(num_rows, num_cols);
+		if (layout == matrix_layout_t::L_ROW)
+			layout = matrix_layout_t::L_COL;
+		else
+			layout = matrix_layout_t::L_ROW;
+	}
+	return matrix_store::create(num_rows, num_cols, layout, store.get_type(),
+			in_mem ? store.get_num_nodes() : -1, in_mem);
+}
+
+void mater_planner::cache_mem(const mapply_matrix_store &store)
+{
+	mapply_matrix_store &mutable_store = const_cast<mapply_matrix_store &>(store);
+	mutable_store.set_materialize_level(materialize_level::MATER_MEM, NULL);
+	mem_cached.push_back(&mutable_store);
+}
+
+void mater_planner::decide(const mapply_matrix_store &store, node_info &info,
+		size_t compute_cost, size_t EM_bytes)
+{
+	size_t num_refs = std::max<size_t>(store.get_dag_ref(), 1);
+	size_t num_maters = store.get_id_ptr()->inc_dag_maters();
+	size_t num_bytes = get_num_bytes(store);
+
+	info.read_cost = compute_cost;
+	info.EM_bytes = EM_bytes;
+	info.level = materialize_level::MATER_CPU;
+	// We don't override the materialization level set by users.
+	if (store.get_materialize_level() != materialize_level::MATER_CPU)
+		return;
+
+	// If the matrix has been materialized in a previous DAG, it's likely
+	// to be materialized again, e.g., in an iterative algorithm. We keep
+	// the materialized data if recomputing it is expensive.
+	if (num_maters > 1) {
+		mapply_matrix_store &mutable_store
+			= const_cast<mapply_matrix_store &>(store);
+		matrix_store::ptr buf;
+		if ((EM_bytes > 0
+					|| compute_cost >= MIN_KEEP_GAIN * num_bytes * MEM_BYTE_COST)
+				&& reserve_kept_mem(num_bytes)) {
+			buf = create_mater_buf(store, true);
+			buf = matrix_store::ptr(buf.get(), kept_mem_deleter(buf, num_bytes));
+		}
+		else if (safs::is_safs_init()
+				&& compute_cost >= MIN_KEEP_GAIN * num_bytes * EM_BYTE_COST)
+			buf = create_mater_buf(store, false);
+		if (buf) {
+			mutable_store.set_materialize_level(materialize_level::MATER_FULL,
+					buf);
+			info.level = materialize_level::MATER_FULL;
+			info.read_cost = compute_cost / num_refs
+				+ num_bytes * (buf->is_in_mem() ? MEM_BYTE_COST : EM_BYTE_COST);
+			info.EM_bytes = buf->is_in_mem() ? 0 : num_bytes;
+			return;
+		}
+	}
+
+	// If the matrix is used by multiple matrices in the DAG, we keep
+	// the materialized portions in memory to avoid recomputing them.
+	if (num_refs > 1) {
+		cache_mem(store);
+		info.level = materialize_level::MATER_MEM;
+		info.read_cost = compute_cost / num_refs + num_bytes * MEM_BYTE_COST;
+		info.EM_bytes = EM_bytes / num_refs;
+	}
+}
+
+size_t mater_planner::plan(const matrix_store &store, size_t &EM_bytes)
+{
+	const mapply_matrix_store *mapply_store
+		= dynamic_cast<const mapply_matrix_store *>(&store);
+	// We only plan for the mapply matrices. The other matrices are treated
+	// as the leaves of the DAG.
+	if (mapply_store == NULL || mapply_store->has_materialized()) {
+		size_t num_bytes = get_num_bytes(store);
+		if (store.is_in_mem()) {
+			EM_bytes = 0;
+			return num_bytes * MEM_BYTE_COST;
+		}
+		else {
+			EM_bytes = num_bytes;
+			return num_bytes * EM_BYTE_COST;
+		}
+	}
+
+	auto it = nodes.find(mapply_store->get_data_id());
+	if (it != nodes.end()) {
+		node_info &info = it->second;
+		// Another matrix that shares the data, e.g., the transpose of
+		// the matrix, should keep the materialized portions in the same way.
+		// We don't keep the entire materialized data for it because the data
+		// is kept in a different buffer.
+		if (std::find(info.stores.begin(), info.stores.end(), mapply_store)
+				== info.stores.end()) {
+			info.stores.push_back(mapply_store);
+			if (info.level == materialize_level::MATER_MEM
+					&& mapply_store->get_materialize_level()
+					== materialize_level::MATER_CPU)
+				cache_mem(*mapply_store);
+		}
+		EM_bytes = info.EM_bytes;
+		return info.read_cost;
+	}
+
+	node_info &info = nodes[mapply_store->get_data_id()];
+	info.stores.push_back(mapply_store);
+	info.level = mapply_store->get_materialize_level();
+	size_t compute_cost
+		= store.get_num_rows() * store.get_num_cols() * COMPUTE_ELE_COST;
+	size_t in_EM_bytes = 0;
+	std::vector<matrix_store::const_ptr> ins = mapply_store->get_input_mats();
+	for (size_t i = 0; i < ins.size(); i++) {
+		size_t tmp = 0;
+		compute_cost += plan(*ins[i], tmp);
+		in_EM_bytes += tmp;
+	}
+	// The root matrices always keep the materialized data.
+	if (root_ids.find(mapply_store->get_data_id()) != root_ids.end()) {
+		info.read_cost = compute_cost;
+		info.EM_bytes = in_EM_bytes;
+	}
+	else
+		decide(*mapply_store, info, compute_cost, in_EM_bytes);
+	EM_bytes = info.EM_bytes;
+	return info.read_cost;
+}
+
+void mater_planner::plan(const std::vector<const matrix_store *> &roots)
+{
+	for (size_t i = 0; i < roots.size(); i++)
+		root_ids.insert(roots[i]->get_data_id());
+	for (size_t i = 0; i < roots.size(); i++) {
+		size_t EM_bytes = 0;
+		plan(*roots[i], EM_bytes);
+	}
+}
+
+void mater_planner::reset()
+{
+	for (size_t i = 0; i < mem_cached.size(); i++)
+		mem_cached[i]->set_materialize_level(materialize_level::MATER_CPU,
+				NULL);
+	mem_cached.clear();
+	nodes.clear();
+	root_ids.clear();
+}
+
+dag_mater_scope::dag_mater_scope(
+		const std::vector<const matrix_store *> &roots)
+{
+	planned = false;
+	// Element-wise operations are fused when the DAG is materialized and
+	// they need the DAG references as well.
+	if (!matrix_conf.is_plan_mater() && !matrix_conf.is_fuse_mapply())
+		return;
+	// The DAG is part of another DAG being materialized, which has been
+	// planned.
+	if (num_planned_dags.fetch_add(1) > 0) {
+		num_planned_dags--;
+		return;
+	}
+
+	this->roots = roots;
+	for (size_t i = 0; i < roots.size(); i++)
+		const_cast<matrix_store &>(*roots[i]).reset_dag_ref();
+	for (size_t i = 0; i < roots.size(); i++)
+		const_cast<matrix_store &>(*roots[i]).inc_dag_ref(INVALID_MAT_ID);
+	if (matrix_conf.is_plan_mater())
+		planner.plan(roots);
+	planned = true;
+}
+
+dag_mater_scope::~dag_mater_scope()
+{
+	if (!planned)
+		return;
+	planner.reset();
+	for (size_t i = 0; i < roots.size(); i++)
+		const_cast<matrix_store &>(*roots[i]).reset_dag_ref();
+	num_planned_dags--;
+}
+
+
+}
+
+}
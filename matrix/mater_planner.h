@@ -0,0 +1,120 @@
+#ifndef __FM_MATER_PLANNER_H__
+#define __FM_MATER_PLANNER_H__
+
+/*
+ * Copyright 2017 Open Connectome Project (http://openconnecto.me)
+ * Written by Da Zheng (zhengda1936@gmail.com)
+ *
+ * This file is part of FlashMatrix.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <vector>
+#include <unordered_map>
+#include <unordered_set>
+
+#include "virtual_matrix_store.h"
+
+namespace fm
+{
+
+namespace detail
+{
+
+class mapply_matrix_store;
+
+/*
+ * This decides how the virtual matrices in a DAG are materialized before
+ * the DAG is materialized. For each mapply matrix in the DAG, it chooses
+ * to recompute the matrix whenever it's needed, to keep the materialized
+ * portions in memory during the materialization, or to keep the entire
+ * materialized matrix in memory or on SSDs, so that it can be reused
+ * in the following materializations.
+ *
+ * The decision is based on a simple cost model that counts the number of
+ * bytes read from memory and SSDs (the same quantities as in matrix_stats)
+ * and the number of elements computed.
+ *
+ * It only changes the materialization level of the matrices whose level
+ * hasn't been set by users. It requires the DAG references to be counted
+ * with inc_dag_ref().
+ *
+ * The matrices kept in memory share a budget of mater_cache_size bytes
+ * in the process. A matrix is charged when its buffer is created and
+ * released when the buffer is freed.
+ */
+class mater_planner
+{
+	struct node_info
+	{
+		// All matrix stores that share the same data.
+		std::vector<const mapply_matrix_store *> stores;
+		// The cost for a reference of the matrix to get its data.
+		size_t read_cost;
+		// The number of bytes read from SSDs for a reference of the matrix.
+		size_t EM_bytes;
+		// The materialization level chosen for the matrix.
+		materialize_level level;
+	};
+	std::unordered_map<size_t, node_info> nodes;
+	// The data ids of the matrices to be materialized.
+	std::unordered_set<size_t> root_ids;
+	// The matrices whose data are kept in memory only during
+	// the materialization.
+	std::vector<mapply_matrix_store *> mem_cached;
+
+	size_t plan(const matrix_store &store, size_t &EM_bytes);
+	void cache_mem(const mapply_matrix_store &store);
+	void decide(const mapply_matrix_store &store, node_info &info,
+			size_t compute_cost, size_t EM_bytes);
+public:
+	/*
+	 * The number of bytes used by the matrices kept in memory.
+	 */
+	static size_t get_kept_mem_size();
+
+	/*
+	 * Plan the materialization of the DAG formed by the root matrices.
+	 */
+	void plan(const std::vector<const matrix_store *> &roots);
+	/*
+	 * Restore the materialization level of the matrices that are cached
+	 * only during the materialization.
+	 */
+	void reset();
+};
+
+/*
+ * All entry points of materialization create this before they materialize
+ * a DAG. It counts the DAG references and plans the materialization of
+ * the DAG when it's created, and it restores the materialization levels
+ * when it's destroyed. Element-wise operations are fused while the DAG
+ * is materialized, after the plan is made. A materialization started during another
+ * materialization isn't planned again.
+ */
+class dag_mater_scope
+{
+	mater_planner planner;
+	std::vector<const matrix_store *> roots;
+	bool planned;
+public:
+	dag_mater_scope(const std::vector<const matrix_store *> &roots);
+	~dag_mater_scope();
+};
+
+}
+
+}
+
+#endif
@@ -33,6 +33,7 @@
 #include "EM_dense_matrix.h"
 #include "mapply_matrix_store.h"
 #include "sink_matrix.h"
+#include "mater_planner.h"
 
 typedef std::vector<size_t> mat_id_set;
 
@@ -81,14 +82,12 @@ class mapply_task: public thread_task
 	const std::vector<matrix_store::ptr> &out_mats;
 	size_t portion_idx;
 	const portion_mapply_op &op;
-	bool one_portion;
 public:
 	mapply_task(const std::vector<matrix_store::const_ptr> &_mats,
 			size_t portion_idx, const portion_mapply_op &_op,
 			const std::vector<matrix_store::ptr> &_out_mats): mats(
 				_mats), out_mats(_out_mats), op(_op) {
 		this->portion_idx = portion_idx;
-		this->one_portion = mats.front()->get_num_portions() == 1;
 	}
 
 	void run();
@@ -100,23 +99,12 @@ void mapply_task::run()
 			mats.size());
 	std::vector<detail::local_matrix_store::ptr> local_out_stores(
 			out_mats.size());
-	int node_id = thread::get_curr_thread()->get_node_id();
-	for (size_t j = 0; j < mats.size(); j++) {
+	// A thread may steal a portion from another NUMA node, so the portion
+	// isn't necessarily in the node of the current thread.
+	for (size_t j = 0; j < mats.size(); j++)
 		local_stores[j] = mats[j]->get_portion(portion_idx);
-#ifdef MATRIX_DEBUG
-		if (local_stores[j] && local_stores[j]->get_node_id() >= 0
-				&& !one_portion)
-			assert(node_id == local_stores[j]->get_node_id());
-#endif
-	}
-	for (size_t j = 0; j < out_mats.size(); j++) {
+	for (size_t j = 0; j < out_mats.size(); j++)
 		local_out_stores[j] = out_mats[j]->get_portion(portion_idx);
-#ifdef MATRIX_DEBUG
-		if (local_out_stores[j] && local_out_stores[j]->get_node_id() >= 0
-				&& !one_portion)
-			assert(node_id == local_out_stores[j]->get_node_id());
-#endif
-	}
 
 	if (local_out_stores.empty())
 		op.run(local_stores);
@@ -138,22 +126,29 @@ public:
 };
 
 /*
- * This dispatches the computation tasks for all threads in a machine,
- * so it is shared by all threads.
+ * This dispatches the computation tasks with work stealing. The portions
+ * are placed on the threads in the NUMA nodes where they are stored and
+ * idle threads steal portions from the nearby threads first.
+ * It is shared by all threads.
  */
-class smp_task_queue: public mem_task_queue
+class ws_task_queue: public mem_task_queue
 {
-	std::atomic<size_t> curr_portion;
-	size_t num_portions;
+	portion_ws_queue::ptr queue;
 public:
-	smp_task_queue(size_t num_portions) {
-		this->num_portions = num_portions;
-		this->curr_portion = 0;
+	ws_task_queue(const mem_thread_pool &pool, matrix_store::const_ptr numa_mat,
+			size_t num_portions) {
+		std::vector<int> portion_nodes(num_portions, -1);
+		if (numa_mat) {
+			assert(numa_mat->get_num_portions() == num_portions);
+			for (size_t i = 0; i < num_portions; i++)
+				portion_nodes[i] = numa_mat->get_portion_node_id(i);
+		}
+		queue = portion_ws_queue::create(pool, portion_nodes);
 	}
 
 	virtual size_t get_portion_idx() {
-		size_t portion_idx = curr_portion.fetch_add(1);
-		if (portion_idx >= num_portions)
+		size_t portion_idx = queue->get_portion_idx();
+		if (portion_idx == portion_ws_queue::INVALID_TASK)
 			return INVALID_TASK;
 		else
 			return portion_idx;
@@ -164,44 +159,6 @@ public:
 	}
 };
 
-/*
- * This dispatches the computation tasks for the portions in a specific
- * NUMA node. All threads in a NUMA node share the same task queue.
- */
-class numa_task_queue: public mem_task_queue
-{
-	matrix_store::const_ptr numa_mat;
-	size_t num_portions;
-	std::atomic<size_t> curr_portion;
-	int curr_node_id;
-public:
-	numa_task_queue(matrix_store::const_ptr mat, int node_id) {
-		this->numa_mat = mat;
-		this->num_portions = mat->get_num_portions();
-		this->curr_portion = 0;
-		this->curr_node_id = node_id;
-	}
-
-	virtual size_t get_portion_idx() {
-		while (true) {
-			// TODO this doesn't scale to a large number of NUMA nodes.
-			size_t portion_idx = curr_portion.fetch_add(1);
-			// If we have run out of portions, we need to indicate that
-			// we have processed all tasks.
-			if (portion_idx >= num_portions)
-				return INVALID_TASK;
-			// We only return the portion in the current node.
-			int node_id = numa_mat->get_portion_node_id(portion_idx);
-			if (node_id == curr_node_id)
-				return portion_idx;
-		}
-	}
-
-	virtual int get_node_id() const {
-		return curr_node_id;
-	}
-};
-
 class mem_worker_task: public thread_task
 {
 	std::vector<matrix_store::const_ptr> mats;
@@ -971,35 +928,16 @@ bool __mapply_portion(
 	else if (all_in_mem) {
 		detail::mem_thread_pool::ptr threads
 			= detail::mem_thread_pool::get_global_mem_threads();
-		std::vector<mem_task_queue::ptr> task_queues;
-		// If there aren't NUMA matrices, there will be only one queue.
-		if (numa_mats.empty()) {
-			task_queues.resize(1);
-			task_queues[0] = mem_task_queue::ptr(
-					new smp_task_queue(mats[0]->get_num_portions()));
-		}
-		// Otherwise, each NUMA node has a task queue.
-		else {
-			int num_nodes = numa_mats.front()->get_num_nodes();
-			assert(num_nodes > 0);
-			task_queues.resize(num_nodes);
-			for (int i = 0; i < num_nodes; i++)
-				task_queues[i] = mem_task_queue::ptr(
-						new numa_task_queue(numa_mats.front(), i));
-		}
-		for (size_t i = 0; i < threads->get_num_threads(); i++) {
-			int node_id = i % threads->get_num_nodes();
-			mem_task_queue::ptr queue;
-			if (task_queues.size() == 1)
-				queue = task_queues[0];
-			else {
-				assert((size_t) node_id < task_queues.size());
-				queue = task_queues[node_id];
-				assert(queue->get_node_id() == node_id);
-			}
-			threads->process_task(node_id, new mem_worker_task(mats, *op,
-						out_mats, queue));
-		}
+		// If there are NUMA matrices, the portions are placed on the threads
+		// in the NUMA nodes where the portions are stored.
+		matrix_store::const_ptr numa_mat;
+		if (!numa_mats.empty())
+			numa_mat = numa_mats.front();
+		mem_task_queue::ptr queue(new ws_task_queue(*threads, numa_mat,
+					mats[0]->get_num_portions()));
+		for (size_t i = 0; i < threads->get_num_threads(); i++)
+			threads->process_task(i % threads->get_num_nodes(),
+					new mem_worker_task(mats, *op, out_mats, queue));
 		threads->wait4complete();
 	}
 	else {
@@ -1394,11 +1332,11 @@ bool materialize(std::vector<dense_matrix::ptr> &mats, bool par_access,
 	if (mats.empty())
 		return true;
 
+	// Decide how the virtual matrices in the DAG should be materialized.
+	std::vector<const detail::matrix_store *> roots(mats.size());
 	for (size_t i = 0; i < mats.size(); i++)
-		const_cast<detail::matrix_store &>(mats[i]->get_data()).reset_dag_ref();
-	for (size_t i = 0; i < mats.size(); i++)
-		const_cast<detail::matrix_store &>(mats[i]->get_data()).inc_dag_ref(
-				detail::INVALID_MAT_ID);
+		roots[i] = &mats[i]->get_data();
+	detail::dag_mater_scope scope(roots);
 
 	bool ret = true;
 	try {
@@ -1429,8 +1367,6 @@ bool materialize(std::vector<dense_matrix::ptr> &mats, bool par_access,
 				"fail to materialize multiple matrices: %1%") % e.what();
 		ret = false;
 	}
-	for (size_t i = 0; i < mats.size(); i++)
-		const_cast<detail::matrix_store &>(mats[i]->get_data()).reset_dag_ref();
 	return ret;
 }
 
@@ -27,6 +27,7 @@
 #include "parameters.h"
 
 #include "matrix_config.h"
+#include "simd_kernels.h"
 
 namespace fm
 {
@@ -46,11 +47,18 @@ void matrix_config::print_help()
 	printf("\tsort_buf_size: the buffer size for EM sorting\n");
 	printf("\tgroupby_buf_size: the buffer size for EM groupby on vectors\n");
 	printf("\tvv_groupby_buf_size: the buffer size for EM groupby on vector vectors\n");
+	printf("\tjoin_buf_size: the memory size for joining EM data frames\n");
 	printf("\twrite_io_buf_size: the I/O buffer size for writing merge results\n");
 	printf("\tstream_io_size: the I/O size used for streaming\n");
 	printf("\tkeep_mem_buf: indicate whether to keep memory buffer for I/O in dense matrix operation\n");
 	printf("\tblock_size: the block size in a dense matrix\n");
 	printf("\tmax_multiply_block_size: the block size for matrix multiplication\n");
+	printf("\tfuse_mapply: fuse chains of element-wise operations\n");
+	printf("\tplan_mater: decide how to materialize virtual matrices in a DAG automatically\n");
+	printf("\tmater_cache_size: the memory size for keeping materialized virtual matrices\n");
+	printf("\tmax_prefetch_tasks: the max number of tasks with I/O in flight in an I/O thread\n");
+	printf("\tmax_prefetch_mem: the max memory size of the portions with I/O in flight in an I/O thread\n");
+	printf("\tsimd: the widest SIMD instructions used by the operators (avx512, avx2, none)\n");
 }
 
 void matrix_config::print()
@@ -68,11 +76,18 @@ void matrix_config::print()
 	BOOST_LOG_TRIVIAL(info) << "\tsort_buf_size: " << sort_buf_size;
 	BOOST_LOG_TRIVIAL(info) << "\tgroupby_buf_size: " << groupby_buf_size;
 	BOOST_LOG_TRIVIAL(info) << "\tvv_groupby_buf_size: " << vv_groupby_buf_size;
+	BOOST_LOG_TRIVIAL(info) << "\tjoin_buf_size: " << join_buf_size;
 	BOOST_LOG_TRIVIAL(info) << "\twrite_io_buf_size: " << write_io_buf_size;
 	BOOST_LOG_TRIVIAL(info) << "\tstream_io_size: " << stream_io_size;
 	BOOST_LOG_TRIVIAL(info) << "\tkeep_mem_buf: " << keep_mem_buf;
 	BOOST_LOG_TRIVIAL(info) << "\tblock_size: " << block_size;
 	BOOST_LOG_TRIVIAL(info) << "\tmax_multiply_block_size: " << max_multiply_block_size;
+	BOOST_LOG_TRIVIAL(info) << "\tfuse_mapply: " << fuse_mapply;
+	BOOST_LOG_TRIVIAL(info) << "\tplan_mater: " << plan_mater;
+	BOOST_LOG_TRIVIAL(info) << "\tmater_cache_size: " << mater_cache_size;
+	BOOST_LOG_TRIVIAL(info) << "\tmax_prefetch_tasks: " << max_prefetch_tasks;
+	BOOST_LOG_TRIVIAL(info) << "\tmax_prefetch_mem: " << max_prefetch_mem;
+	BOOST_LOG_TRIVIAL(info) << "\tsimd: " << simd::get_isa_name(simd::get_isa());
 }
 
 void matrix_config::init(config_map::ptr map)
@@ -139,6 +154,11 @@ void matrix_config::init(config_map::ptr map)
 		map->read_option_long("vv_groupby_buf_size", tmp);
 		vv_groupby_buf_size = tmp;
 	}
+	if (map->has_option("join_buf_size")) {
+		long tmp = 0;
+		map->read_option_long("join_buf_size", tmp);
+		join_buf_size = tmp;
+	}
 	if (map->has_option("write_io_buf_size")) {
 		long tmp = 0;
 		map->read_option_long("write_io_buf_size", tmp);
@@ -162,5 +182,30 @@ void matrix_config::init(config_map::ptr map)
 		map->read_option_long("max_multiply_block_size", tmp);
 		max_multiply_block_size = tmp;
 	}
+	if (map->has_option("fuse_mapply"))
+		map->read_option_bool("fuse_mapply", fuse_mapply);
+	if (map->has_option("plan_mater"))
+		map->read_option_bool("plan_mater", plan_mater);
+	if (map->has_option("mater_cache_size")) {
+		long tmp = 0;
+		map->read_option_long("mater_cache_size", tmp);
+		mater_cache_size = tmp;
+	}
+	if (map->has_option("max_prefetch_tasks"))
+		map->read_option_int("max_prefetch_tasks", max_prefetch_tasks);
+	if (map->has_option("max_prefetch_mem")) {
+		long tmp = 0;
+		map->read_option_long("max_prefetch_mem", tmp);
+		max_prefetch_mem = tmp;
+	}
+	if (map->has_option("simd")) {
+		std::string name;
+		simd::isa_level level;
+		map->read_option("simd", name);
+		if (simd::parse_isa(name, level))
+			simd::set_max_isa(level);
+		else
+			BOOST_LOG_TRIVIAL(error) << "unknown SIMD instructions: " << name;
+	}
 }
 }
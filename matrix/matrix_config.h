@@ -60,6 +60,9 @@ class matrix_config
 	// The buffer size used for EM groupby on vector vectors.
 	// The number of vectors.
 	size_t vv_groupby_buf_size;
+	// The memory size used for joining external-memory data frames.
+	// The number of bytes.
+	size_t join_buf_size;
 	// The I/O buffer size for writing merge results in sorting a vector.
 	// The number of bytes.
 	size_t write_io_buf_size;
@@ -73,6 +76,19 @@ class matrix_config
 	size_t block_size;
 	// The block size used for matrix multiply on block matrices.
 	size_t max_multiply_block_size;
+	// Indicate whether we fuse chains of element-wise operations.
+	bool fuse_mapply;
+	// Indicate whether we decide how to materialize the virtual matrices
+	// in a DAG automatically.
+	bool plan_mater;
+	// The memory size used for keeping the materialized virtual matrices
+	// in a DAG. The number of bytes.
+	size_t mater_cache_size;
+	// The max number of tasks whose I/O is in flight in an I/O worker thread.
+	int max_prefetch_tasks;
+	// The max memory size of the portions whose I/O is in flight in an I/O
+	// worker thread. The number of bytes.
+	size_t max_prefetch_mem;
 public:
 	/**
 	 * \brief The default constructor that set all configurations to
@@ -90,11 +106,17 @@ public:
 		sort_buf_size = 128 * 1024 * 1024;
 		groupby_buf_size = 128 * 1024 * 1024;
 		vv_groupby_buf_size = 1024 * 1024;
+		join_buf_size = 1024 * 1024 * 1024;
 		write_io_buf_size = 128 * 1024 * 1024;
 		stream_io_size = 128 * 1024 * 1024;
 		keep_mem_buf = false;
 		block_size = 32;
 		max_multiply_block_size = 512;
+		fuse_mapply = true;
+		plan_mater = true;
+		mater_cache_size = 1024 * 1024 * 1024;
+		max_prefetch_tasks = 16;
+		max_prefetch_mem = 256 * 1024 * 1024;
 	}
 
 	/**
@@ -202,6 +224,10 @@ public:
 		this->vv_groupby_buf_size = vv_groupby_buf_size;
 	}
 
+	void set_join_buf_size(size_t join_buf_size) {
+		this->join_buf_size = join_buf_size;
+	}
+
 	void set_write_io_buf_size(size_t write_io_buf_size) {
 		this->write_io_buf_size = write_io_buf_size;
 	}
@@ -218,6 +244,10 @@ public:
 		return vv_groupby_buf_size;
 	}
 
+	size_t get_join_buf_size() const {
+		return join_buf_size;
+	}
+
 	size_t get_write_io_buf_size() const {
 		return write_io_buf_size;
 	}
@@ -241,6 +271,46 @@ public:
 	void set_max_multiply_block_size(size_t size) {
 		this->max_multiply_block_size = size;
 	}
+
+	bool is_fuse_mapply() const {
+		return fuse_mapply;
+	}
+
+	void set_fuse_mapply(bool fuse) {
+		this->fuse_mapply = fuse;
+	}
+
+	bool is_plan_mater() const {
+		return plan_mater;
+	}
+
+	void set_plan_mater(bool plan) {
+		this->plan_mater = plan;
+	}
+
+	size_t get_mater_cache_size() const {
+		return mater_cache_size;
+	}
+
+	void set_mater_cache_size(size_t size) {
+		this->mater_cache_size = size;
+	}
+
+	int get_max_prefetch_tasks() const {
+		return max_prefetch_tasks;
+	}
+
+	void set_max_prefetch_tasks(int num) {
+		this->max_prefetch_tasks = num;
+	}
+
+	size_t get_max_prefetch_mem() const {
+		return max_prefetch_mem;
+	}
+
+	void set_max_prefetch_mem(size_t size) {
+		this->max_prefetch_mem = size;
+	}
 };
 
 extern matrix_config matrix_conf;
@@ -39,6 +39,19 @@ enum matrix_type
 	SPARSE,
 };
 
+/*
+ * How the non-zero values of a sparse matrix are stored.
+ * The values of a float or double sparse matrix can be stored in
+ * 16-bit floating-point formats to reduce the amount of data read from
+ * SSDs. They are converted to float when they are used.
+ */
+enum class spm_val_encoding
+{
+	RAW,
+	FP16,
+	BF16,
+};
+
 static const size_t block_max_num_rows = ((size_t) std::numeric_limits<int16_t>::max()) + 1;
 static const size_t block_max_num_cols = ((size_t) std::numeric_limits<int16_t>::max()) + 1;
 
@@ -113,6 +126,9 @@ class matrix_header
 			// 2D partitioned.
 			size_t block_2d_height;
 			size_t block_2d_width;
+			// The encoding of the non-zero values in a sparse matrix.
+			// `entry_size' is the size of an encoded value.
+			spm_val_encoding val_enc;
 			// It doesn't include the entry type, which should be determined by
 			// users at runtime.
 		} d;
@@ -181,6 +197,14 @@ public:
 	block_2d_size get_2d_block_size() const {
 		return block_2d_size(u.d.block_2d_height, u.d.block_2d_width);
 	}
+
+	spm_val_encoding get_val_encoding() const {
+		return u.d.val_enc;
+	}
+
+	void set_val_encoding(spm_val_encoding enc) {
+		u.d.val_enc = enc;
+	}
 };
 
 }
@@ -59,9 +59,16 @@ class data_id_t
 	 * matrices.
 	 */
 	std::set<size_t> refs;
+	/*
+	 * The number of times that the matrix is part of a DAG being
+	 * materialized. If a virtual matrix is materialized multiple times,
+	 * it's worth keeping its materialized data.
+	 */
+	size_t num_dag_maters;
 
 	data_id_t(size_t id) {
 		this->id = id;
+		this->num_dag_maters = 0;
 	}
 public:
 	typedef std::shared_ptr<data_id_t> ptr;
@@ -84,6 +91,10 @@ public:
 	size_t get_ref() const {
 		return refs.size();
 	}
+
+	size_t inc_dag_maters() {
+		return ++num_dag_maters;
+	}
 };
 
 class matrix_store
@@ -67,6 +67,19 @@ smp_vec_store::smp_vec_store(const detail::simple_raw_array &data,
 	this->arr = this->data.get_raw();
 }
 
+smp_vec_store::const_ptr get_smp_vec(vec_store::const_ptr vec)
+{
+	smp_vec_store::const_ptr ret
+		= std::dynamic_pointer_cast<const smp_vec_store>(vec);
+	if (ret)
+		return ret;
+
+	smp_vec_store::ptr copy = smp_vec_store::create(vec->get_length(),
+			vec->get_type());
+	vec->copy_to(copy->get_raw_arr(), vec->get_length());
+	return copy;
+}
+
 smp_vec_store::ptr smp_vec_store::create(const detail::simple_raw_array &data,
 			const scalar_type &type)
 {
@@ -150,15 +163,37 @@ bool smp_vec_store::append(std::vector<vec_store::const_ptr>::const_iterator vec
 	for (auto it = vec_it; it != vec_end; it++) {
 		assert(loc + (*it)->get_length() <= this->get_length());
 		assert((*it)->is_in_mem());
-		const mem_vec_store &mem_vec = static_cast<const mem_vec_store &>(**it);
-		bool ret = data.set_sub_arr(loc * get_entry_size(),
-				mem_vec.get_raw_arr(), mem_vec.get_length() * get_entry_size());
-		assert(ret);
+		// An in-memory vector may not have a raw array, e.g., an encoded
+		// vector. It decodes the values into this vector.
+		const mem_vec_store *mem_vec
+			= dynamic_cast<const mem_vec_store *>(it->get());
+		if (mem_vec) {
+			bool ret = data.set_sub_arr(loc * get_entry_size(),
+					mem_vec->get_raw_arr(),
+					mem_vec->get_length() * get_entry_size());
+			assert(ret);
+		}
+		else
+			(*it)->copy_to(get(loc), (*it)->get_length());
 		loc += (*it)->get_length();
 	}
 	return true;
 }
 
+void smp_vec_store::append_rows(const char *arr, const std::vector<off_t> &rows)
+{
+	if (rows.empty())
+		return;
+
+	size_t entry_size = get_entry_size();
+	std::vector<const char *> locs(rows.size());
+	for (size_t i = 0; i < rows.size(); i++)
+		locs[i] = arr + rows[i] * entry_size;
+	size_t old_len = get_length();
+	resize(old_len + rows.size());
+	get_type().get_sg().gather(locs, get(old_len));
+}
+
 bool smp_vec_store::append(const vec_store &vec)
 {
 	if (!vec.is_in_mem()) {
@@ -176,10 +211,12 @@ bool smp_vec_store::append(const vec_store &vec)
 	off_t loc = this->get_length() + get_sub_start();
 	this->resize(vec.get_length() + get_length());
 	assert(loc + vec.get_length() <= this->get_length());
-	const mem_vec_store &mem_vec = static_cast<const mem_vec_store &>(vec);
-	assert(mem_vec.get_raw_arr());
-	return data.set_sub_arr(loc * get_entry_size(), mem_vec.get_raw_arr(),
-			mem_vec.get_length() * get_entry_size());
+	const mem_vec_store *mem_vec = dynamic_cast<const mem_vec_store *>(&vec);
+	if (mem_vec == NULL)
+		return vec.copy_to(get(loc), vec.get_length()) == vec.get_length();
+	assert(mem_vec->get_raw_arr());
+	return data.set_sub_arr(loc * get_entry_size(), mem_vec->get_raw_arr(),
+			mem_vec->get_length() * get_entry_size());
 }
 
 size_t smp_vec_store::get_reserved_size() const
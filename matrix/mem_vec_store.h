@@ -49,13 +49,14 @@ public:
 	typedef std::shared_ptr<mem_vec_store> ptr;
 	typedef std::shared_ptr<const mem_vec_store> const_ptr;
 
+	// Not all in-memory vectors are mem_vec_store, e.g., encoded vectors.
 	static ptr cast(vec_store::ptr store) {
-		assert(store->is_in_mem());
+		assert(std::dynamic_pointer_cast<mem_vec_store>(store));
 		return std::static_pointer_cast<mem_vec_store>(store);
 	}
 
 	static const_ptr cast(vec_store::const_ptr store) {
-		assert(store->is_in_mem());
+		assert(std::dynamic_pointer_cast<const mem_vec_store>(store));
 		return std::static_pointer_cast<const mem_vec_store>(store);
 	}
 
@@ -110,13 +111,12 @@ public:
 			const scalar_type &type);
 
 	static ptr cast(vec_store::ptr store) {
-		assert(store->is_in_mem() && std::static_pointer_cast<mem_vec_store>(
-					store)->get_num_nodes() < 0);
+		assert(std::dynamic_pointer_cast<smp_vec_store>(store));
 		return std::static_pointer_cast<smp_vec_store>(store);
 	}
 
 	static const_ptr cast(vec_store::const_ptr store) {
-		assert(store->is_in_mem());
+		assert(std::dynamic_pointer_cast<const smp_vec_store>(store));
 		return std::static_pointer_cast<const smp_vec_store>(store);
 	}
 
@@ -180,6 +180,10 @@ public:
 	void set_data(const set_vec_operate &op);
 
 	void set(const std::vector<const char *> &locs);
+	/*
+	 * Append the specified rows in an array to the end of the vector.
+	 */
+	void append_rows(const char *arr, const std::vector<off_t> &rows);
 
 	virtual vec_store::ptr sort_with_index();
 	virtual void sort() {
@@ -212,6 +216,12 @@ public:
 	}
 };
 
+/*
+ * Get a vector in the SMP memory. The other vectors (e.g., NUMA vectors,
+ * encoded vectors and external-memory vectors) are copied to the SMP memory.
+ */
+smp_vec_store::const_ptr get_smp_vec(vec_store::const_ptr vec);
+
 }
 
 }
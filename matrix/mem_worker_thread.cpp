@@ -17,6 +17,10 @@
  * limitations under the License.
  */
 
+#include <math.h>
+#include <sys/time.h>
+
+#include <algorithm>
 #include <unordered_map>
 
 #include "io_interface.h"
@@ -164,6 +168,229 @@ void mem_thread_pool::destroy()
 	global_threads = NULL;
 }
 
+const size_t ws_deque::EMPTY;
+const size_t ws_deque::ABORT;
+const size_t portion_ws_queue::INVALID_TASK;
+const size_t portion_ws_queue::CLUSTER_SIZE;
+
+/*
+ * Split the portions into `num_parts' contiguous ranges of the same size.
+ */
+static void split_portions(const std::vector<size_t> &portions,
+		std::vector<std::vector<size_t> > &parts, size_t first_part,
+		size_t num_parts)
+{
+	for (size_t i = 0; i < num_parts; i++) {
+		size_t start = portions.size() * i / num_parts;
+		size_t end = portions.size() * (i + 1) / num_parts;
+		parts[first_part + i].insert(parts[first_part + i].end(),
+				portions.begin() + start, portions.begin() + end);
+	}
+}
+
+portion_ws_queue::portion_ws_queue(const mem_thread_pool &pool,
+		const std::vector<int> &portion_nodes)
+{
+	size_t num_threads = pool.get_num_threads();
+	size_t num_nodes = pool.get_num_nodes();
+	size_t nthreads_per_node = pool.get_num_threads_per_node();
+
+	// Group the portions by the NUMA nodes where they are stored.
+	std::vector<std::vector<size_t> > node_portions(num_nodes);
+	std::vector<size_t> free_portions;
+	for (size_t i = 0; i < portion_nodes.size(); i++) {
+		if (portion_nodes[i] < 0)
+			free_portions.push_back(i);
+		else
+			node_portions[portion_nodes[i] % num_nodes].push_back(i);
+	}
+	// Each thread gets contiguous portions in its own node. The portions
+	// that aren't in any NUMA node are split among all threads.
+	std::vector<std::vector<size_t> > thread_portions(num_threads);
+	for (size_t i = 0; i < num_nodes; i++)
+		split_portions(node_portions[i], thread_portions,
+				i * nthreads_per_node, nthreads_per_node);
+	split_portions(free_portions, thread_portions, 0, num_threads);
+
+	deques.resize(num_threads);
+	for (size_t i = 0; i < num_threads; i++) {
+		deques[i] = std::unique_ptr<ws_deque>(
+				new ws_deque(thread_portions[i].size()));
+		// The owner takes portions from the bottom, so we push them in
+		// the reverse order to process them in the ascending order.
+		for (size_t j = thread_portions[i].size(); j > 0; j--)
+			deques[i]->push(thread_portions[i][j - 1]);
+	}
+
+	// The order of the threads to steal from. We start at a different
+	// thread in each group to reduce contention.
+	victims.resize(num_threads);
+	for (size_t i = 0; i < num_threads; i++) {
+		size_t node_id = pool.get_thread_node_id(i);
+		size_t local_id = i % nthreads_per_node;
+		size_t cluster_start = local_id / CLUSTER_SIZE * CLUSTER_SIZE;
+		size_t cluster_size = std::min(CLUSTER_SIZE,
+				nthreads_per_node - cluster_start);
+		// The threads in the same cluster.
+		for (size_t j = 1; j < cluster_size; j++)
+			victims[i].push_back(node_id * nthreads_per_node + cluster_start
+					+ (local_id - cluster_start + j) % cluster_size);
+		// The other threads in the same node.
+		for (size_t j = 1; j < nthreads_per_node; j++) {
+			size_t victim_local = (local_id + j) % nthreads_per_node;
+			if (victim_local / CLUSTER_SIZE * CLUSTER_SIZE != cluster_start)
+				victims[i].push_back(node_id * nthreads_per_node + victim_local);
+		}
+		// The threads in the other nodes.
+		for (size_t j = 1; j < num_nodes; j++) {
+			size_t victim_node = (node_id + j) % num_nodes;
+			for (size_t k = 0; k < nthreads_per_node; k++)
+				victims[i].push_back(victim_node * nthreads_per_node
+						+ (local_id + k) % nthreads_per_node);
+		}
+	}
+	// A thread outside the pool steals from all threads.
+	victims.push_back(std::vector<int>());
+	for (size_t i = 0; i < num_threads; i++)
+		victims.back().push_back(i);
+}
+
+size_t portion_ws_queue::get_portion_idx()
+{
+	// The pool thread id starts with 0.
+	int thread_id = mem_thread_pool::get_curr_thread_id() - 1;
+	if (thread_id < 0 || (size_t) thread_id >= deques.size())
+		thread_id = deques.size();
+	else {
+		size_t portion_idx = deques[thread_id]->take();
+		if (portion_idx != ws_deque::EMPTY)
+			return portion_idx;
+	}
+
+	// No portions are added after the queue is created, so we are done
+	// if all deques are empty.
+	const std::vector<int> &order = victims[thread_id];
+	while (true) {
+		bool aborted = false;
+		for (size_t i = 0; i < order.size(); i++) {
+			size_t portion_idx = deques[order[i]]->steal();
+			if (portion_idx == ws_deque::ABORT)
+				aborted = true;
+			else if (portion_idx != ws_deque::EMPTY)
+				return portion_idx;
+		}
+		if (!aborted)
+			return INVALID_TASK;
+	}
+}
+
+// A stall shorter than this fraction of the computation time is mostly
+// the overhead of polling I/O.
+static const double MIN_STALL_RATIO = 0.05;
+// The weight of a new measurement in the moving averages.
+static const double AVG_WEIGHT = 0.125;
+// The number of tasks whose I/O is hidden before we reduce the depth.
+static const size_t PROBE_INTERVAL = 32;
+
+static double update_avg(double avg, double val)
+{
+	return avg < 0 ? val : avg * (1 - AVG_WEIGHT) + val * AVG_WEIGHT;
+}
+
+prefetch_depth::prefetch_depth(size_t min_depth, size_t max_depth,
+		size_t init_depth)
+{
+	this->min_depth = std::max<size_t>(min_depth, 1);
+	this->max_depth = std::max(max_depth, this->min_depth);
+	this->depth = std::min(std::max(init_depth, this->min_depth),
+			this->max_depth);
+	this->mem_depth = this->max_depth;
+	this->num_tasks = 0;
+	this->num_hidden = 0;
+	this->compute_time = -1;
+	this->io_latency = -1;
+}
+
+void prefetch_depth::update(double compute, double stall)
+{
+	compute_time = update_avg(compute_time, compute);
+	// The number of tasks issued after the current task. It's smaller than
+	// `depth - 1' when the pipeline is being filled.
+	size_t num_ahead = std::min(num_tasks, get() - 1);
+	num_tasks++;
+	if (stall > compute * MIN_STALL_RATIO) {
+		num_hidden = 0;
+		io_latency = update_avg(io_latency,
+				num_ahead * (compute + stall) + stall);
+	}
+	else if (io_latency > 0) {
+		num_hidden++;
+		// The I/O has been hidden for a while, so we try one task fewer
+		// in flight. If it isn't enough, the next stall corrects
+		// the estimate.
+		if (num_hidden >= PROBE_INTERVAL && num_ahead > 1) {
+			num_hidden = 0;
+			io_latency = std::min(io_latency, (num_ahead - 1) * compute);
+		}
+		else
+			io_latency = update_avg(io_latency,
+					std::min(io_latency, num_ahead * compute));
+	}
+	// We haven't stalled for I/O yet.
+	if (io_latency < 0)
+		return;
+
+	// The computation is negligible, so the worker is I/O-bound.
+	// We need to keep as many I/O in flight as possible.
+	if (compute_time < 1)
+		depth = max_depth;
+	else {
+		// The task being computed also needs a slot.
+		double target = ceil(io_latency / compute_time) + 1;
+		if (target >= max_depth)
+			depth = max_depth;
+		else
+			depth = std::max((size_t) target, min_depth);
+	}
+}
+
+void prefetch_depth::set_mem_limit(size_t max_bytes, size_t task_bytes)
+{
+	if (task_bytes == 0)
+		mem_depth = max_depth;
+	else
+		mem_depth = std::max(max_bytes / task_bytes, min_depth);
+}
+
+/*
+ * The time spent in the computation in the callbacks of the I/O instances.
+ */
+static long get_compute_us(const std::vector<safs::io_interface::ptr> &ios)
+{
+	long ret = 0;
+	for (size_t i = 0; i < ios.size(); i++)
+		ret += static_cast<portion_callback &>(
+				ios[i]->get_callback()).get_compute_us();
+	return ret;
+}
+
+/*
+ * The average size of the portions computed in the callbacks of
+ * the I/O instances. It returns 0 before any portion is computed.
+ */
+static size_t get_portion_bytes(const std::vector<safs::io_interface::ptr> &ios)
+{
+	size_t num_portions = 0;
+	size_t num_bytes = 0;
+	for (size_t i = 0; i < ios.size(); i++) {
+		portion_callback &cb = static_cast<portion_callback &>(
+				ios[i]->get_callback());
+		num_portions += cb.get_num_portions();
+		num_bytes += cb.get_num_bytes();
+	}
+	return num_portions > 0 ? num_bytes / num_portions : 0;
+}
+
 void io_worker_task::run()
 {
 	std::vector<safs::io_interface::ptr> ios;
@@ -175,9 +402,47 @@ void io_worker_task::run()
 	pthread_spin_unlock(&lock);
 	safs::io_select::ptr select = safs::create_io_select(ios);
 
-	// The task runs until there are no tasks left in the queue.
-	while (dispatch->issue_task())
-		safs::wait4ios(select, max_pending_ios);
+	if (max_pending_ios >= 0) {
+		// The task runs until there are no tasks left in the queue.
+		while (dispatch->issue_task())
+			safs::wait4ios(select, max_pending_ios);
+	}
+	else {
+		// We start with the same number of tasks in flight as
+		// the default of the fixed pipeline.
+		prefetch_depth depth(2, matrix_conf.get_max_prefetch_tasks(), 4);
+		// The moving average of the number of I/O requests issued by a task.
+		double reqs_per_task = -1;
+		while (true) {
+			struct timeval start, issued, end;
+			long compute_start = get_compute_us(ios);
+			size_t num_pending = select->num_pending_ios();
+			gettimeofday(&start, NULL);
+			if (!dispatch->issue_task())
+				break;
+			gettimeofday(&issued, NULL);
+			// The tasks whose data is cached don't issue I/O.
+			size_t num_new = select->num_pending_ios();
+			if (num_new > num_pending)
+				reqs_per_task = update_avg(reqs_per_task,
+						num_new - num_pending);
+			// Each request reads a portion into memory.
+			depth.set_mem_limit(matrix_conf.get_max_prefetch_mem(),
+					std::max(reqs_per_task, 1.0) * get_portion_bytes(ios));
+
+			// We wait until there are `depth - 1' tasks in flight, so
+			// there are `depth' tasks in flight after we issue the next task.
+			safs::wait4ios(select, ceil((depth.get() - 1)
+						* std::max(reqs_per_task, 1.0)));
+			gettimeofday(&end, NULL);
+
+			// The tasks may run computation when they are issued.
+			long compute_us = time_diff_us(start, issued)
+				+ get_compute_us(ios) - compute_start;
+			long stall_us = time_diff_us(start, end) - compute_us;
+			depth.update(compute_us, std::max(stall_us, 0L));
+		}
+	}
 	// Test if all I/O instances have processed all requests.
 	size_t num_pending = safs::wait4ios(select, 0);
 	assert(num_pending == 0);
@@ -22,6 +22,8 @@
 
 #include <memory>
 #include <set>
+#include <atomic>
+#include <limits>
 #include <unordered_map>
 
 #include "thread.h"
@@ -95,12 +97,151 @@ public:
 		assert(!threads.empty());
 		return threads.size() * threads.front().size();
 	}
+	size_t get_num_threads_per_node() const {
+		assert(!threads.empty());
+		return threads.front().size();
+	}
+	/*
+	 * Get the NUMA node where a worker thread runs.
+	 */
+	int get_thread_node_id(int pool_thread_id) const {
+		return pool_thread_id / get_num_threads_per_node();
+	}
 
 	void process_task(int node_id, thread_task *task);
 
 	void wait4complete();
 };
 
+#ifndef CACHE_LINE_SIZE
+#define CACHE_LINE_SIZE 32
+#endif
+
+/*
+ * This is a Chase-Lev work-stealing deque of task indexes.
+ * The owner thread takes tasks from the bottom and other threads steal
+ * tasks from the top. The deque doesn't grow, so the capacity has to be
+ * at least the number of tasks pushed to it.
+ */
+class ws_deque
+{
+	// The owner may write a slot while a thief reads it, so the slots
+	// are atomic.
+	std::unique_ptr<std::atomic<size_t>[]> tasks;
+	size_t capacity;
+	// top and bottom are on different cache lines to avoid false sharing.
+	char pad1[CACHE_LINE_SIZE];
+	std::atomic<long> top;
+	char pad2[CACHE_LINE_SIZE];
+	std::atomic<long> bottom;
+	char pad3[CACHE_LINE_SIZE];
+public:
+	static const size_t EMPTY = std::numeric_limits<size_t>::max();
+	// The steal fails because of contention. It's worth retrying.
+	static const size_t ABORT = EMPTY - 1;
+
+	ws_deque(size_t capacity): tasks(new std::atomic<size_t>[capacity]) {
+		this->capacity = capacity;
+		top = 0;
+		bottom = 0;
+	}
+
+	/*
+	 * Only the owner can push tasks.
+	 */
+	void push(size_t task) {
+		long b = bottom.load(std::memory_order_relaxed);
+		assert((size_t) b < capacity);
+		tasks[b].store(task, std::memory_order_relaxed);
+		bottom.store(b + 1, std::memory_order_release);
+	}
+
+	size_t take() {
+		long b = bottom.load(std::memory_order_relaxed) - 1;
+		bottom.store(b, std::memory_order_relaxed);
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+		long t = top.load(std::memory_order_relaxed);
+		if (t > b) {
+			bottom.store(b + 1, std::memory_order_relaxed);
+			return EMPTY;
+		}
+		size_t task = tasks[b].load(std::memory_order_relaxed);
+		// This is the last task. We need to race with the thieves.
+		if (t == b) {
+			if (!top.compare_exchange_strong(t, t + 1,
+						std::memory_order_seq_cst, std::memory_order_relaxed))
+				task = EMPTY;
+			bottom.store(b + 1, std::memory_order_relaxed);
+		}
+		return task;
+	}
+
+	size_t steal() {
+		long t = top.load(std::memory_order_acquire);
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+		long b = bottom.load(std::memory_order_acquire);
+		if (t >= b)
+			return EMPTY;
+		size_t task = tasks[t].load(std::memory_order_relaxed);
+		if (!top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst,
+					std::memory_order_relaxed))
+			return ABORT;
+		return task;
+	}
+};
+
+/*
+ * This distributes the portions of a computation to the worker threads
+ * in a mem_thread_pool with work stealing.
+ *
+ * Each worker thread has a deque. The portions are first placed on
+ * the threads in the NUMA node where the portions are stored. When
+ * a thread runs out of portions, it steals portions from the threads in
+ * the same cluster first, then from the threads in the same NUMA node and
+ * finally from the threads in the other NUMA nodes.
+ */
+class portion_ws_queue
+{
+	// The deque of each worker thread, indexed by the pool thread id.
+	std::vector<std::unique_ptr<ws_deque> > deques;
+	// The threads to steal portions from for each worker thread,
+	// ordered by the distance.
+	std::vector<std::vector<int> > victims;
+
+	portion_ws_queue(const mem_thread_pool &pool,
+			const std::vector<int> &portion_nodes);
+public:
+	typedef std::shared_ptr<portion_ws_queue> ptr;
+
+	static const size_t INVALID_TASK = ws_deque::EMPTY;
+	// The number of adjacent worker threads in a NUMA node that form
+	// a cluster.
+	static const size_t CLUSTER_SIZE = 4;
+
+	/*
+	 * `portion_nodes' has the NUMA node of each portion, or -1 if
+	 * the portion isn't stored in a specific NUMA node.
+	 */
+	static ptr create(const mem_thread_pool &pool,
+			const std::vector<int> &portion_nodes) {
+		return ptr(new portion_ws_queue(pool, portion_nodes));
+	}
+
+	/*
+	 * Get a portion for the current thread. It returns INVALID_TASK
+	 * when all portions have been processed.
+	 */
+	size_t get_portion_idx();
+
+	/*
+	 * Get the threads that a worker thread steals portions from, in
+	 * the order of stealing.
+	 */
+	const std::vector<int> &get_victims(int pool_thread_id) const {
+		return victims[pool_thread_id];
+	}
+};
+
 /*
  * This defines a set of I/O tasks that process an entire data container.
  */
@@ -118,6 +259,62 @@ public:
 	virtual bool issue_task() = 0;
 };
 
+/*
+ * This decides the number of tasks whose I/O is in flight in an I/O worker.
+ * The I/O of the following tasks should overlap with the computation of
+ * the current task, so the I/O of a task has to be issued before
+ * the computation of io_latency / compute_time tasks.
+ *
+ * We don't measure the I/O latency of a task directly. When the worker
+ * stalls for the I/O of a task with `depth' tasks in flight, the task was
+ * issued `depth - 1' tasks earlier, so the I/O latency is about
+ * (depth - 1) * (compute_time + stall_time) + stall_time. When the worker
+ * doesn't stall, the latency is at most (depth - 1) * compute_time. This
+ * bound alone can't tell if a smaller depth works, so after the I/O of many
+ * tasks is hidden, we set the estimate to (depth - 2) * compute_time to try
+ * one task fewer. This corrects an overestimate at the cost of a short
+ * stall once in a while.
+ *
+ * The portions of the tasks in flight are kept in memory, so the depth is
+ * also limited by the memory for them.
+ */
+class prefetch_depth
+{
+	size_t min_depth;
+	size_t max_depth;
+	size_t depth;
+	// The max depth that the memory for the portions allows.
+	size_t mem_depth;
+	// The number of tasks that have been measured.
+	size_t num_tasks;
+	// The number of tasks whose I/O has been hidden since the last stall.
+	size_t num_hidden;
+	// The moving averages of the computation time and the I/O latency
+	// of a task in microseconds. They are negative before the first
+	// measurement.
+	double compute_time;
+	double io_latency;
+public:
+	prefetch_depth(size_t min_depth, size_t max_depth, size_t init_depth);
+
+	size_t get() const {
+		return std::min(depth, mem_depth);
+	}
+
+	/*
+	 * Limit the depth so that the portions of the tasks in flight fit in
+	 * `max_bytes'. `task_bytes' is the size of the portions of a task.
+	 * The depth is never smaller than the min depth.
+	 */
+	void set_mem_limit(size_t max_bytes, size_t task_bytes);
+
+	/*
+	 * Update the depth with the measurement of a task. `compute' is
+	 * the time of the computation and `stall' is the time waiting for I/O.
+	 */
+	void update(double compute, double stall);
+};
+
 class EM_object;
 
 class io_worker_task: public thread_task
@@ -126,9 +323,12 @@ class io_worker_task: public thread_task
 	std::set<EM_object *> EM_objs;
 
 	task_dispatcher::ptr dispatch;
+	// If it's negative, the number of pending I/O requests adapts to
+	// the computation time and the I/O latency of the tasks. It's limited
+	// by max_prefetch_tasks and max_prefetch_mem in matrix_conf.
 	int max_pending_ios;
 public:
-	io_worker_task(task_dispatcher::ptr dispatch, int max_pending_ios = 4) {
+	io_worker_task(task_dispatcher::ptr dispatch, int max_pending_ios = -1) {
 		pthread_spin_init(&lock, PTHREAD_PROCESS_PRIVATE);
 		this->dispatch = dispatch;
 		this->max_pending_ios = max_pending_ios;
@@ -149,10 +349,6 @@ public:
 	virtual void run();
 };
 
-#ifndef CACHE_LINE_SIZE
-#define CACHE_LINE_SIZE 32
-#endif
-
 class global_counter
 {
 	union count_t {
@@ -0,0 +1,321 @@
+#ifndef __FM_RADIX_SORT_H__
+#define __FM_RADIX_SORT_H__
+
+/*
+ * Copyright 2017 Open Connectome Project (http://openconnecto.me)
+ * Written by Da Zheng (zhengda1936@gmail.com)
+ *
+ * This file is part of FlashMatrix.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#if defined(_OPENMP)
+#include <omp.h>
+#endif
+#include <string.h>
+#include <sys/types.h>
+#include <stdint.h>
+#include <assert.h>
+
+#include <memory>
+#include <vector>
+#include <algorithm>
+#include <type_traits>
+
+/*
+ * This file implements radix sort for integer and float-point keys.
+ *
+ * The serial version is an LSD radix sort with 8-bit digits. It skips
+ * the digits that are the same in all keys.
+ *
+ * The parallel version first partitions the data on the most significant
+ * digit that differs among the keys (MSD). All threads compute histograms
+ * on their own parts of the data and scatter the data to the buckets.
+ * The buckets are range partitions of the data, so each thread then sorts
+ * whole buckets with the LSD radix sort independently.
+ *
+ * The scatter isn't NUMA-aware. The buckets are in a single buffer and
+ * the threads are OpenMP threads that aren't bound to NUMA nodes.
+ * A NUMA vector is sorted by sorting each of its chunks on its own node
+ * with the serial version and merging the sorted chunks afterwards.
+ */
+
+namespace fm
+{
+
+namespace radix
+{
+
+/*
+ * Only integers and float-point numbers of up to 8 bytes can be sorted
+ * with radix sort.
+ */
+template<class T>
+struct is_sortable
+{
+	static const bool value = (std::is_integral<T>::value
+			&& !std::is_same<T, bool>::value)
+		|| std::is_same<T, float>::value || std::is_same<T, double>::value;
+};
+
+/*
+ * This maps a value to an unsigned integer with the same order.
+ */
+template<class T, class Enable = void>
+struct key_trait
+{
+};
+
+template<class T>
+struct key_trait<T, typename std::enable_if<std::is_integral<T>::value
+	&& std::is_signed<T>::value>::type>
+{
+	typedef typename std::make_unsigned<T>::type key_t;
+	static key_t get(T v) {
+		// Flip the sign bit.
+		return ((key_t) v) ^ (((key_t) 1) << (sizeof(T) * 8 - 1));
+	}
+};
+
+template<class T>
+struct key_trait<T, typename std::enable_if<std::is_integral<T>::value
+	&& std::is_unsigned<T>::value>::type>
+{
+	typedef T key_t;
+	static key_t get(T v) {
+		return v;
+	}
+};
+
+template<class T>
+struct key_trait<T, typename std::enable_if<std::is_floating_point<T>::value
+	>::type>
+{
+	typedef typename std::conditional<sizeof(T) == 4, uint32_t,
+			uint64_t>::type key_t;
+	static key_t get(T v) {
+		static const int num_bits = sizeof(T) * 8;
+		key_t bits;
+		memcpy(&bits, &v, sizeof(v));
+		// Flip all bits of negative numbers and the sign bit of positive
+		// numbers.
+		key_t mask = -(bits >> (num_bits - 1)) | (((key_t) 1) << (num_bits - 1));
+		return bits ^ mask;
+	}
+};
+
+/*
+ * This gets the key of a value. The order of the keys is reversed if
+ * the data is sorted in the decreasing order.
+ */
+template<class T>
+class key_getter
+{
+	bool decreasing;
+public:
+	typedef typename key_trait<T>::key_t key_t;
+
+	key_getter(bool decreasing) {
+		this->decreasing = decreasing;
+	}
+
+	key_t operator()(T v) const {
+		key_t key = key_trait<T>::get(v);
+		return decreasing ? ~key : key;
+	}
+};
+
+/*
+ * The value and its original location for sorting with index.
+ */
+template<class T>
+struct indexed_entry
+{
+	T val;
+	off_t idx;
+};
+
+template<class T>
+class indexed_key_getter
+{
+	key_getter<T> getter;
+public:
+	typedef typename key_getter<T>::key_t key_t;
+
+	indexed_key_getter(bool decreasing): getter(decreasing) {
+	}
+
+	key_t operator()(const indexed_entry<T> &e) const {
+		return getter(e.val);
+	}
+};
+
+static const int num_digit_bits = 8;
+static const size_t num_buckets = 1 << num_digit_bits;
+
+/*
+ * Sort the elements on the lowest `num_bits' bits of their keys with
+ * LSD radix sort. `buf' has the same size as `data' and the sorted
+ * result is always stored in `data'. The sort is stable.
+ */
+template<class E, class KeyGetter>
+void lsd_sort(E *data, E *buf, size_t num, const KeyGetter &get_key,
+		int num_bits)
+{
+	typedef typename KeyGetter::key_t key_t;
+	const int num_passes = (num_bits + num_digit_bits - 1) / num_digit_bits;
+	if (num <= 1 || num_passes == 0)
+		return;
+
+	// Compute the histograms of all digits in one pass.
+	std::vector<size_t> counts(num_passes * num_buckets);
+	for (size_t i = 0; i < num; i++) {
+		key_t key = get_key(data[i]);
+		for (int p = 0; p < num_passes; p++)
+			counts[p * num_buckets
+				+ ((key >> (p * num_digit_bits)) & (num_buckets - 1))]++;
+	}
+
+	E *from = data;
+	E *to = buf;
+	for (int p = 0; p < num_passes; p++) {
+		size_t *count = &counts[p * num_buckets];
+		int shift = p * num_digit_bits;
+		// If all keys have the same digit, this pass doesn't change
+		// the order of the elements.
+		if (count[(get_key(from[0]) >> shift) & (num_buckets - 1)] == num)
+			continue;
+
+		size_t offs[num_buckets];
+		size_t off = 0;
+		for (size_t b = 0; b < num_buckets; b++) {
+			offs[b] = off;
+			off += count[b];
+		}
+		for (size_t i = 0; i < num; i++) {
+			size_t b = (get_key(from[i]) >> shift) & (num_buckets - 1);
+			to[offs[b]++] = from[i];
+		}
+		std::swap(from, to);
+	}
+	if (from != data)
+		memcpy(data, from, num * sizeof(E));
+}
+
+/*
+ * Get the number of the low bits that differ among the keys.
+ */
+template<class E, class KeyGetter>
+int get_num_diff_bits(const E *data, size_t num, const KeyGetter &get_key)
+{
+	typedef typename KeyGetter::key_t key_t;
+	if (num == 0)
+		return 0;
+	key_t first = get_key(data[0]);
+	key_t diff = 0;
+#pragma omp parallel for reduction(|:diff)
+	for (size_t i = 0; i < num; i++)
+		diff |= get_key(data[i]) ^ first;
+	int num_bits = 0;
+	while (diff) {
+		num_bits++;
+		diff >>= 1;
+	}
+	return num_bits;
+}
+
+template<class E, class KeyGetter>
+void serial_sort(E *data, size_t num, const KeyGetter &get_key)
+{
+	if (num <= 1)
+		return;
+	std::unique_ptr<E[]> buf(new E[num]);
+	lsd_sort(data, buf.get(), num, get_key,
+			sizeof(typename KeyGetter::key_t) * 8);
+}
+
+template<class E, class KeyGetter>
+void parallel_sort(E *data, size_t num, const KeyGetter &get_key)
+{
+#if defined(_OPENMP)
+	const size_t num_threads = omp_get_max_threads();
+#else
+	const size_t num_threads = 1;
+#endif
+	int num_bits = get_num_diff_bits(data, num, get_key);
+	if (num_threads == 1 || num_bits <= num_digit_bits) {
+		std::unique_ptr<E[]> buf(new E[num]);
+		lsd_sort(data, buf.get(), num, get_key, num_bits);
+		return;
+	}
+
+	// The MSD partitions the data on the highest bits that differ.
+	const int shift = num_bits - num_digit_bits;
+	std::unique_ptr<E[]> buf(new E[num]);
+	std::vector<size_t> counts(num_threads * num_buckets);
+	std::vector<size_t> bucket_offs(num_buckets + 1);
+	const size_t part_len = (num + num_threads - 1) / num_threads;
+	// Each part of the data is processed by a thread.
+#pragma omp parallel for
+	for (size_t t = 0; t < num_threads; t++) {
+		size_t start = std::min(num, t * part_len);
+		size_t end = std::min(num, start + part_len);
+		size_t *count = &counts[t * num_buckets];
+		for (size_t i = start; i < end; i++)
+			count[(get_key(data[i]) >> shift) & (num_buckets - 1)]++;
+	}
+
+	// The elements of a part in a bucket are placed after the ones of
+	// the previous parts.
+	size_t off = 0;
+	for (size_t b = 0; b < num_buckets; b++) {
+		bucket_offs[b] = off;
+		for (size_t t = 0; t < num_threads; t++) {
+			size_t c = counts[t * num_buckets + b];
+			counts[t * num_buckets + b] = off;
+			off += c;
+		}
+	}
+	bucket_offs[num_buckets] = off;
+	assert(off == num);
+
+#pragma omp parallel for
+	for (size_t t = 0; t < num_threads; t++) {
+		size_t start = std::min(num, t * part_len);
+		size_t end = std::min(num, start + part_len);
+		size_t *count = &counts[t * num_buckets];
+		for (size_t i = start; i < end; i++) {
+			size_t b = (get_key(data[i]) >> shift) & (num_buckets - 1);
+			buf[count[b]++] = data[i];
+		}
+	}
+
+	// Each bucket is sorted by a thread on the low bits. The sorted result
+	// is in `data'.
+#pragma omp parallel for schedule(dynamic, 1)
+	for (size_t b = 0; b < num_buckets; b++) {
+		size_t start = bucket_offs[b];
+		size_t len = bucket_offs[b + 1] - start;
+		if (len == 0)
+			continue;
+		lsd_sort(buf.get() + start, data + start, len, get_key, shift);
+		memcpy(data + start, buf.get() + start, len * sizeof(E));
+	}
+}
+
+}
+
+}
+
+#endif
@@ -0,0 +1,764 @@
+/*
+ * Copyright 2017 Open Connectome Project (http://openconnecto.me)
+ * Written by Da Zheng (zhengda1936@gmail.com)
+ *
+ * This file is part of FlashMatrix.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * This file implements the vectorized kernels on top of the vector types
+ * vdouble, vfloat, vlong and vint. It is included by simd_kernels.cpp once
+ * for each instruction set, inside a namespace that defines the vector types
+ * and under "#pragma GCC target". Therefore, it doesn't have include guards.
+ *
+ * A vector type defines the element type T, the vector type vec, the mask
+ * type mask, the number of elements in a vector and the vector operations.
+ */
+
+template<class V>
+struct add_op
+{
+	typedef typename V::T T;
+	static typename V::vec vapply(typename V::vec a, typename V::vec b) {
+		return V::add(a, b);
+	}
+	static T apply(T a, T b) {
+		return a + b;
+	}
+};
+
+template<class V>
+struct sub_op
+{
+	typedef typename V::T T;
+	static typename V::vec vapply(typename V::vec a, typename V::vec b) {
+		return V::sub(a, b);
+	}
+	static T apply(T a, T b) {
+		return a - b;
+	}
+};
+
+template<class V>
+struct mul_op
+{
+	typedef typename V::T T;
+	static typename V::vec vapply(typename V::vec a, typename V::vec b) {
+		return V::mul(a, b);
+	}
+	static T apply(T a, T b) {
+		return a * b;
+	}
+};
+
+template<class V>
+struct div_op
+{
+	typedef typename V::T T;
+	static typename V::vec vapply(typename V::vec a, typename V::vec b) {
+		return V::div(a, b);
+	}
+	static T apply(T a, T b) {
+		return a / b;
+	}
+};
+
+template<class V>
+struct min_op
+{
+	typedef typename V::T T;
+	static typename V::vec vapply(typename V::vec a, typename V::vec b) {
+		return V::min(a, b);
+	}
+	static T apply(T a, T b) {
+		return std::min(a, b);
+	}
+};
+
+template<class V>
+struct max_op
+{
+	typedef typename V::T T;
+	static typename V::vec vapply(typename V::vec a, typename V::vec b) {
+		return V::max(a, b);
+	}
+	static T apply(T a, T b) {
+		return std::max(a, b);
+	}
+};
+
+/*
+ * min/max that return the first NaN in the inputs.
+ */
+template<class V>
+struct min_nan_op
+{
+	typedef typename V::T T;
+	static typename V::vec vapply(typename V::vec a, typename V::vec b) {
+		typename V::vec res = V::min(a, b);
+		res = V::blend(res, b, V::isnan(b));
+		return V::blend(res, a, V::isnan(a));
+	}
+	static T apply(T a, T b) {
+		if (std::isnan(a))
+			return a;
+		else if (std::isnan(b))
+			return b;
+		else
+			return std::min(a, b);
+	}
+};
+
+template<class V>
+struct max_nan_op
+{
+	typedef typename V::T T;
+	static typename V::vec vapply(typename V::vec a, typename V::vec b) {
+		typename V::vec res = V::max(a, b);
+		res = V::blend(res, b, V::isnan(b));
+		return V::blend(res, a, V::isnan(a));
+	}
+	static T apply(T a, T b) {
+		if (std::isnan(a))
+			return a;
+		else if (std::isnan(b))
+			return b;
+		else
+			return std::max(a, b);
+	}
+};
+
+/*
+ * Comparison. `P' is the predicate of the vector comparison and
+ * `Scalar' is the scalar comparison.
+ */
+template<class V, int P, class Scalar>
+struct cmp_op
+{
+	typedef typename V::T T;
+	static unsigned vapply(typename V::vec a, typename V::vec b) {
+		return V::template cmp<P>(a, b);
+	}
+	static bool apply(T a, T b) {
+		return Scalar()(a, b);
+	}
+};
+
+template<class V>
+struct neg_op
+{
+	typedef typename V::T T;
+	static typename V::vec vapply(typename V::vec a) {
+		return V::neg(a);
+	}
+	static T apply(T a) {
+		return -a;
+	}
+};
+
+template<class V>
+struct abs_op
+{
+	typedef typename V::T T;
+	static typename V::vec vapply(typename V::vec a) {
+		return V::abs(a);
+	}
+	static T apply(T a) {
+		return std::abs(a);
+	}
+};
+
+template<class V>
+struct sqrt_op
+{
+	typedef typename V::T T;
+	static typename V::vec vapply(typename V::vec a) {
+		return V::sqrt(a);
+	}
+	static T apply(T a) {
+		return std::sqrt(a);
+	}
+};
+
+/*
+ * The operands of binary operators: an array or a scalar.
+ */
+template<class V>
+class arr_operand
+{
+	const typename V::T *arr;
+public:
+	arr_operand(const typename V::T *arr) {
+		this->arr = arr;
+	}
+	typename V::vec vget(size_t idx) const {
+		return V::load(arr + idx);
+	}
+	typename V::T get(size_t idx) const {
+		return arr[idx];
+	}
+};
+
+template<class V>
+class val_operand
+{
+	typename V::T val;
+	typename V::vec vval;
+public:
+	val_operand(typename V::T val) {
+		this->val = val;
+		this->vval = V::set1(val);
+	}
+	typename V::vec vget(size_t idx) const {
+		return vval;
+	}
+	typename V::T get(size_t idx) const {
+		return val;
+	}
+};
+
+template<class V, class Op, class LeftOperand, class RightOperand>
+void binary_kernel(size_t num_eles, const LeftOperand &left,
+		const RightOperand &right, typename V::T *out)
+{
+	size_t i = 0;
+	for (; i + V::width <= num_eles; i += V::width)
+		V::store(out + i, Op::vapply(left.vget(i), right.vget(i)));
+	for (; i < num_eles; i++)
+		out[i] = Op::apply(left.get(i), right.get(i));
+}
+
+template<class V, class Op, class LeftOperand, class RightOperand>
+void cmp_kernel(size_t num_eles, const LeftOperand &left,
+		const RightOperand &right, bool *out)
+{
+	size_t i = 0;
+	for (; i + V::width <= num_eles; i += V::width) {
+		unsigned mask = Op::vapply(left.vget(i), right.vget(i));
+		for (size_t j = 0; j < V::width; j++)
+			out[i + j] = (mask >> j) & 1;
+	}
+	for (; i < num_eles; i++)
+		out[i] = Op::apply(left.get(i), right.get(i));
+}
+
+template<class V, class Op>
+void unary_kernel(size_t num_eles, const typename V::T *in,
+		typename V::T *out)
+{
+	size_t i = 0;
+	for (; i + V::width <= num_eles; i += V::width)
+		V::store(out + i, Op::vapply(V::load(in + i)));
+	for (; i < num_eles; i++)
+		out[i] = Op::apply(in[i]);
+}
+
+/*
+ * We use multiple accumulators to hide the latency of the vector operations.
+ */
+template<class V, class Op>
+typename V::T agg_kernel(size_t num_eles, const typename V::T *in,
+		typename V::T init, typename V::T res)
+{
+	const size_t num_accs = 4;
+	size_t i = 0;
+	if (num_eles >= V::width) {
+		typename V::vec acc0 = V::set1(init);
+		typename V::vec acc1 = acc0;
+		typename V::vec acc2 = acc0;
+		typename V::vec acc3 = acc0;
+		for (; i + V::width * num_accs <= num_eles; i += V::width * num_accs) {
+			acc0 = Op::vapply(V::load(in + i), acc0);
+			acc1 = Op::vapply(V::load(in + i + V::width), acc1);
+			acc2 = Op::vapply(V::load(in + i + V::width * 2), acc2);
+			acc3 = Op::vapply(V::load(in + i + V::width * 3), acc3);
+		}
+		for (; i + V::width <= num_eles; i += V::width)
+			acc0 = Op::vapply(V::load(in + i), acc0);
+		acc0 = Op::vapply(acc1, acc0);
+		acc2 = Op::vapply(acc3, acc2);
+		acc0 = Op::vapply(acc2, acc0);
+		typename V::T tmp[V::width];
+		V::store(tmp, acc0);
+		for (size_t j = 0; j < V::width; j++)
+			res = Op::apply(tmp[j], res);
+	}
+	for (; i < num_eles; i++)
+		res = Op::apply(in[i], res);
+	return res;
+}
+
+/*
+ * The prefix sum. Each vector computes the prefix sum inside the vector
+ * first and adds the last sum of the previous vector.
+ */
+template<class V>
+void prefix_sum_kernel(size_t num_eles, const typename V::T *in,
+		const typename V::T *prev, typename V::T *out)
+{
+	if (num_eles == 0)
+		return;
+
+	size_t i;
+	typename V::T carry;
+	if (prev) {
+		carry = *prev;
+		i = 0;
+	}
+	else {
+		// The first element is copied to the output directly, as the generic
+		// implementation does.
+		out[0] = in[0];
+		carry = in[0];
+		i = 1;
+	}
+	if (i + V::width <= num_eles) {
+		typename V::vec vcarry = V::set1(carry);
+		for (; i + V::width <= num_eles; i += V::width) {
+			typename V::vec sum = V::add(V::scan(V::load(in + i)), vcarry);
+			V::store(out + i, sum);
+			vcarry = V::bcast_last(sum);
+		}
+		carry = out[i - 1];
+	}
+	for (; i < num_eles; i++) {
+		carry = in[i] + carry;
+		out[i] = carry;
+	}
+}
+
+/*
+ * The operators supported by float-point types.
+ */
+template<class V>
+struct fp_kernels
+{
+	typedef typename V::T T;
+
+	template<class LeftOperand, class RightOperand>
+	static bool run(op_kind op, size_t num_eles, const LeftOperand &left,
+			const RightOperand &right, T *out) {
+		switch (op) {
+			case ADD:
+				binary_kernel<V, add_op<V> >(num_eles, left, right, out);
+				return true;
+			case SUB:
+				binary_kernel<V, sub_op<V> >(num_eles, left, right, out);
+				return true;
+			case MUL:
+				binary_kernel<V, mul_op<V> >(num_eles, left, right, out);
+				return true;
+			case DIV:
+				binary_kernel<V, div_op<V> >(num_eles, left, right, out);
+				return true;
+			case MIN:
+				binary_kernel<V, min_op<V> >(num_eles, left, right, out);
+				return true;
+			case MAX:
+				binary_kernel<V, max_op<V> >(num_eles, left, right, out);
+				return true;
+			case MIN_NAN:
+				binary_kernel<V, min_nan_op<V> >(num_eles, left, right, out);
+				return true;
+			case MAX_NAN:
+				binary_kernel<V, max_nan_op<V> >(num_eles, left, right, out);
+				return true;
+			default:
+				return false;
+		}
+	}
+
+	template<class LeftOperand, class RightOperand>
+	static bool run(op_kind op, size_t num_eles, const LeftOperand &left,
+			const RightOperand &right, bool *out) {
+		switch (op) {
+			case EQ:
+				cmp_kernel<V, cmp_op<V, _CMP_EQ_OQ, std::equal_to<T> > >(
+						num_eles, left, right, out);
+				return true;
+			case NEQ:
+				cmp_kernel<V, cmp_op<V, _CMP_NEQ_UQ, std::not_equal_to<T> > >(
+						num_eles, left, right, out);
+				return true;
+			case GT:
+				cmp_kernel<V, cmp_op<V, _CMP_GT_OQ, std::greater<T> > >(
+						num_eles, left, right, out);
+				return true;
+			case GE:
+				cmp_kernel<V, cmp_op<V, _CMP_GE_OQ, std::greater_equal<T> > >(
+						num_eles, left, right, out);
+				return true;
+			case LT:
+				cmp_kernel<V, cmp_op<V, _CMP_LT_OQ, std::less<T> > >(
+						num_eles, left, right, out);
+				return true;
+			case LE:
+				cmp_kernel<V, cmp_op<V, _CMP_LE_OQ, std::less_equal<T> > >(
+						num_eles, left, right, out);
+				return true;
+			default:
+				return false;
+		}
+	}
+
+	static bool agg(op_kind op, size_t num_eles, const T *in, T init, T &res) {
+		switch (op) {
+			case ADD:
+				res = agg_kernel<V, add_op<V> >(num_eles, in, init, res);
+				return true;
+			case MIN:
+				res = agg_kernel<V, min_op<V> >(num_eles, in, init, res);
+				return true;
+			case MAX:
+				res = agg_kernel<V, max_op<V> >(num_eles, in, init, res);
+				return true;
+			case MIN_NAN:
+				res = agg_kernel<V, min_nan_op<V> >(num_eles, in, init, res);
+				return true;
+			case MAX_NAN:
+				res = agg_kernel<V, max_nan_op<V> >(num_eles, in, init, res);
+				return true;
+			default:
+				return false;
+		}
+	}
+
+	static bool uop(op_kind op, size_t num_eles, const T *in, T *out) {
+		switch (op) {
+			case NEG:
+				unary_kernel<V, neg_op<V> >(num_eles, in, out);
+				return true;
+			case ABS:
+				unary_kernel<V, abs_op<V> >(num_eles, in, out);
+				return true;
+			case SQRT:
+				unary_kernel<V, sqrt_op<V> >(num_eles, in, out);
+				return true;
+			default:
+				return false;
+		}
+	}
+};
+
+/*
+ * The operators supported by integer types.
+ */
+template<class V>
+struct int_kernels
+{
+	typedef typename V::T T;
+
+	template<class LeftOperand, class RightOperand>
+	static bool run(op_kind op, size_t num_eles, const LeftOperand &left,
+			const RightOperand &right, T *out) {
+		switch (op) {
+			case ADD:
+				binary_kernel<V, add_op<V> >(num_eles, left, right, out);
+				return true;
+			case SUB:
+				binary_kernel<V, sub_op<V> >(num_eles, left, right, out);
+				return true;
+			case MIN:
+				binary_kernel<V, min_op<V> >(num_eles, left, right, out);
+				return true;
+			case MAX:
+				binary_kernel<V, max_op<V> >(num_eles, left, right, out);
+				return true;
+			default:
+				return false;
+		}
+	}
+
+	static bool agg(op_kind op, size_t num_eles, const T *in, T init, T &res) {
+		switch (op) {
+			case ADD:
+				res = agg_kernel<V, add_op<V> >(num_eles, in, init, res);
+				return true;
+			case MIN:
+				res = agg_kernel<V, min_op<V> >(num_eles, in, init, res);
+				return true;
+			case MAX:
+				res = agg_kernel<V, max_op<V> >(num_eles, in, init, res);
+				return true;
+			default:
+				return false;
+		}
+	}
+};
+
+#define FM_SIMD_BINARY(T, OutT, kernels)									\
+bool run_AA(op_kind op, size_t num_eles, const T *left, const T *right,	\
+		OutT *out)															\
+{																			\
+	return kernels::run(op, num_eles, arr_operand<kernels::V>(left),		\
+			arr_operand<kernels::V>(right), out);							\
+}																			\
+bool run_AE(op_kind op, size_t num_eles, const T *left, const T &right,	\
+		OutT *out)															\
+{																			\
+	return kernels::run(op, num_eles, arr_operand<kernels::V>(left),		\
+			val_operand<kernels::V>(right), out);							\
+}																			\
+bool run_EA(op_kind op, size_t num_eles, const T &left, const T *right,	\
+		OutT *out)															\
+{																			\
+	return kernels::run(op, num_eles, val_operand<kernels::V>(left),		\
+			arr_operand<kernels::V>(right), out);							\
+}
+
+struct double_kernels: public fp_kernels<vdouble>
+{
+	typedef vdouble V;
+};
+struct float_kernels: public fp_kernels<vfloat>
+{
+	typedef vfloat V;
+};
+struct long_kernels: public int_kernels<vlong>
+{
+	typedef vlong V;
+};
+struct int_kernels32: public int_kernels<vint>
+{
+	typedef vint V;
+};
+
+FM_SIMD_BINARY(double, double, double_kernels)
+FM_SIMD_BINARY(float, float, float_kernels)
+FM_SIMD_BINARY(long, long, long_kernels)
+FM_SIMD_BINARY(int, int, int_kernels32)
+FM_SIMD_BINARY(double, bool, double_kernels)
+FM_SIMD_BINARY(float, bool, float_kernels)
+
+#undef FM_SIMD_BINARY
+
+bool run_agg(op_kind op, size_t num_eles, const double *in,
+		const double &init, double &res)
+{
+	return double_kernels::agg(op, num_eles, in, init, res);
+}
+
+bool run_agg(op_kind op, size_t num_eles, const float *in,
+		const float &init, float &res)
+{
+	return float_kernels::agg(op, num_eles, in, init, res);
+}
+
+bool run_agg(op_kind op, size_t num_eles, const long *in,
+		const long &init, long &res)
+{
+	return long_kernels::agg(op, num_eles, in, init, res);
+}
+
+bool run_agg(op_kind op, size_t num_eles, const int *in,
+		const int &init, int &res)
+{
+	return int_kernels32::agg(op, num_eles, in, init, res);
+}
+
+bool run_cum(op_kind op, size_t num_eles, const double *in,
+		const double *prev, double *out)
+{
+	if (op != ADD)
+		return false;
+	prefix_sum_kernel<vdouble>(num_eles, in, prev, out);
+	return true;
+}
+
+bool run_cum(op_kind op, size_t num_eles, const long *in,
+		const long *prev, long *out)
+{
+	if (op != ADD)
+		return false;
+	prefix_sum_kernel<vlong>(num_eles, in, prev, out);
+	return true;
+}
+
+bool run_uop(op_kind op, size_t num_eles, const double *in, double *out)
+{
+	return double_kernels::uop(op, num_eles, in, out);
+}
+
+bool run_uop(op_kind op, size_t num_eles, const float *in, float *out)
+{
+	// sqrt on float outputs double.
+	if (op == SQRT)
+		return false;
+	return float_kernels::uop(op, num_eles, in, out);
+}
+
+/*
+ * The SpMM kernels.
+ */
+
+// The number of non-zero entries to prefetch the input rows ahead.
+static const size_t spmm_prefetch_dist = 8;
+
+template<class T, int WIDTH>
+void prefetch_row(const T *row)
+{
+	for (size_t off = 0; off < WIDTH * sizeof(T); off += 64)
+		__builtin_prefetch(((const char *) row) + off);
+}
+
+/*
+ * The kernels for the rows with at least as many elements as a vector.
+ * A row part keeps the output row in registers. The output row is split
+ * into chunks of at most 8 vectors to avoid running out of registers.
+ */
+template<class V, int WIDTH, bool NARROW = (WIDTH < (int) V::width)>
+struct spmm_kernels
+{
+	typedef typename V::T T;
+	static const int num_vecs = WIDTH / V::width;
+	static const int chunk_vecs = num_vecs < 8 ? num_vecs : 8;
+
+	static void row(size_t num, const uint16_t *cols, const T *vals,
+			const T *in_rows, T *dest_row) {
+		for (int start = 0; start < num_vecs; start += chunk_vecs) {
+			T *dest = dest_row + start * V::width;
+			const T *in = in_rows + start * V::width;
+			typename V::vec acc[chunk_vecs];
+			for (int k = 0; k < chunk_vecs; k++)
+				acc[k] = V::load(dest + k * V::width);
+			for (size_t i = 0; i < num; i++) {
+				if (start == 0 && i + spmm_prefetch_dist < num)
+					prefetch_row<T, WIDTH>(in_rows
+							+ WIDTH * cols[i + spmm_prefetch_dist]);
+				const T *src = in + WIDTH * cols[i];
+				typename V::vec v = V::set1(vals ? vals[i] : 1);
+				for (int k = 0; k < chunk_vecs; k++)
+					acc[k] = V::fmadd(V::load(src + k * V::width), v, acc[k]);
+			}
+			for (int k = 0; k < chunk_vecs; k++)
+				V::store(dest + k * V::width, acc[k]);
+		}
+	}
+
+	static void coo(size_t num, const uint16_t *coos, const T *vals,
+			const T *in_rows, T *out_rows) {
+		for (size_t i = 0; i < num; i++) {
+			if (i + spmm_prefetch_dist < num)
+				prefetch_row<T, WIDTH>(in_rows
+						+ WIDTH * coos[(i + spmm_prefetch_dist) * 2 + 1]);
+			const T *src = in_rows + WIDTH * coos[i * 2 + 1];
+			T *dest = out_rows + WIDTH * (coos[i * 2] & 0x7fff);
+			typename V::vec v = V::set1(vals ? vals[i] : 1);
+			for (int k = 0; k < num_vecs; k++)
+				V::store(dest + k * V::width, V::fmadd(
+							V::load(src + k * V::width), v,
+							V::load(dest + k * V::width)));
+		}
+	}
+};
+
+/*
+ * The kernels for the rows with fewer elements than a vector.
+ * A vector holds the input rows of multiple non-zero entries, which are
+ * loaded with a gather instruction. The elements of the output row are
+ * summed at the end of a row part, so the result of float-point additions
+ * may be slightly different from the generic loop.
+ * A non-zero entry in the COO format has its own output row,
+ * so it uses a scalar loop.
+ */
+template<class V, int WIDTH>
+struct spmm_kernels<V, WIDTH, true>
+{
+	typedef typename V::T T;
+	// The number of non-zero entries in a vector.
+	static const size_t num_nzs = V::width / WIDTH;
+
+	static void row(size_t num, const uint16_t *cols, const T *vals,
+			const T *in_rows, T *dest_row) {
+		typename V::vec acc = V::set1(0);
+		int32_t idxs[V::width];
+		T nz_vals[V::width];
+		size_t i = 0;
+		for (; i + num_nzs <= num; i += num_nzs) {
+			for (size_t j = 0; j < num_nzs
+					&& i + j + spmm_prefetch_dist < num; j++)
+				__builtin_prefetch(in_rows
+						+ WIDTH * cols[i + j + spmm_prefetch_dist]);
+			for (size_t k = 0; k < V::width; k++)
+				idxs[k] = cols[i + k / WIDTH] * WIDTH + k % WIDTH;
+			typename V::vec v;
+			if (vals) {
+				for (size_t k = 0; k < V::width; k++)
+					nz_vals[k] = vals[i + k / WIDTH];
+				v = V::load(nz_vals);
+			}
+			else
+				v = V::set1(1);
+			acc = V::fmadd(V::gather(in_rows, idxs), v, acc);
+		}
+		T res[V::width];
+		V::store(res, acc);
+		for (size_t j = 0; j < num_nzs; j++)
+			for (size_t k = 0; k < WIDTH; k++)
+				dest_row[k] += res[j * WIDTH + k];
+		for (; i < num; i++) {
+			const T *src = in_rows + WIDTH * cols[i];
+			T v = vals ? vals[i] : 1;
+			for (size_t k = 0; k < WIDTH; k++)
+				dest_row[k] += src[k] * v;
+		}
+	}
+
+	static void coo(size_t num, const uint16_t *coos, const T *vals,
+			const T *in_rows, T *out_rows) {
+		for (size_t i = 0; i < num; i++) {
+			if (i + spmm_prefetch_dist < num)
+				__builtin_prefetch(in_rows
+						+ WIDTH * coos[(i + spmm_prefetch_dist) * 2 + 1]);
+			const T *src = in_rows + WIDTH * coos[i * 2 + 1];
+			T *dest = out_rows + WIDTH * (coos[i * 2] & 0x7fff);
+			T v = vals ? vals[i] : 1;
+			for (size_t k = 0; k < WIDTH; k++)
+				dest[k] += src[k] * v;
+		}
+	}
+};
+
+template<class V, int WIDTH>
+void set_spmm_kernel(spmm_kernel<typename V::T> &kernel)
+{
+	kernel.row = spmm_kernels<V, WIDTH>::row;
+	kernel.coo = spmm_kernels<V, WIDTH>::coo;
+}
+
+template<class V>
+bool get_spmm_kernel(size_t width, spmm_kernel<typename V::T> &kernel)
+{
+	switch (width) {
+		case 1: set_spmm_kernel<V, 1>(kernel); return true;
+		case 2: set_spmm_kernel<V, 2>(kernel); return true;
+		case 4: set_spmm_kernel<V, 4>(kernel); return true;
+		case 8: set_spmm_kernel<V, 8>(kernel); return true;
+		case 16: set_spmm_kernel<V, 16>(kernel); return true;
+		case 32: set_spmm_kernel<V, 32>(kernel); return true;
+		case 64: set_spmm_kernel<V, 64>(kernel); return true;
+		default: return false;
+	}
+}
+
+bool get_spmm_kernel(size_t width, spmm_kernel<double> &kernel)
+{
+	return get_spmm_kernel<vdouble>(width, kernel);
+}
+
+bool get_spmm_kernel(size_t width, spmm_kernel<float> &kernel)
+{
+	return get_spmm_kernel<vfloat>(width, kernel);
+}
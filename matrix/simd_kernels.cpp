@@ -0,0 +1,616 @@
+/*
+ * Copyright 2017 Open Connectome Project (http://openconnecto.me)
+ * Written by Da Zheng (zhengda1936@gmail.com)
+ *
+ * This file is part of FlashMatrix.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <immintrin.h>
+
+#include <cmath>
+#include <algorithm>
+#include <functional>
+
+#include "simd_kernels.h"
+
+namespace fm
+{
+
+namespace simd
+{
+
+/*
+ * The kernels for AVX2. All CPUs with AVX2 also support FMA.
+ */
+#pragma GCC push_options
+#pragma GCC target("avx2,fma")
+
+namespace avx2
+{
+
+struct vdouble
+{
+	typedef double T;
+	typedef __m256d vec;
+	typedef __m256d mask;
+	static const size_t width = 4;
+
+	static vec load(const T *p) {
+		return _mm256_loadu_pd(p);
+	}
+	static void store(T *p, vec v) {
+		_mm256_storeu_pd(p, v);
+	}
+	static vec set1(T v) {
+		return _mm256_set1_pd(v);
+	}
+	static vec add(vec a, vec b) {
+		return _mm256_add_pd(a, b);
+	}
+	static vec sub(vec a, vec b) {
+		return _mm256_sub_pd(a, b);
+	}
+	static vec mul(vec a, vec b) {
+		return _mm256_mul_pd(a, b);
+	}
+	static vec div(vec a, vec b) {
+		return _mm256_div_pd(a, b);
+	}
+	// The same as std::min(a, b): (b < a) ? b : a.
+	static vec min(vec a, vec b) {
+		return _mm256_min_pd(b, a);
+	}
+	// The same as std::max(a, b): (a < b) ? b : a.
+	static vec max(vec a, vec b) {
+		return _mm256_max_pd(b, a);
+	}
+	static mask isnan(vec a) {
+		return _mm256_cmp_pd(a, a, _CMP_UNORD_Q);
+	}
+	static vec blend(vec a, vec b, mask m) {
+		return _mm256_blendv_pd(a, b, m);
+	}
+	template<int P>
+	static unsigned cmp(vec a, vec b) {
+		return _mm256_movemask_pd(_mm256_cmp_pd(a, b, P));
+	}
+	static vec neg(vec a) {
+		return _mm256_xor_pd(a, _mm256_set1_pd(-0.0));
+	}
+	static vec abs(vec a) {
+		return _mm256_andnot_pd(_mm256_set1_pd(-0.0), a);
+	}
+	static vec sqrt(vec a) {
+		return _mm256_sqrt_pd(a);
+	}
+	static vec scan(vec x) {
+		vec t = _mm256_permute4x64_pd(x, _MM_SHUFFLE(2, 1, 0, 3));
+		x = _mm256_add_pd(x, _mm256_blend_pd(t, _mm256_setzero_pd(), 0x1));
+		t = _mm256_permute2f128_pd(x, x, 0x08);
+		return _mm256_add_pd(x, t);
+	}
+	static vec bcast_last(vec x) {
+		return _mm256_permute4x64_pd(x, _MM_SHUFFLE(3, 3, 3, 3));
+	}
+	// a * b + c
+	static vec fmadd(vec a, vec b, vec c) {
+		return _mm256_fmadd_pd(a, b, c);
+	}
+	static vec gather(const T *base, const int32_t *idx) {
+		return _mm256_i32gather_pd(base,
+				_mm_loadu_si128((const __m128i *) idx), sizeof(T));
+	}
+};
+
+struct vfloat
+{
+	typedef float T;
+	typedef __m256 vec;
+	typedef __m256 mask;
+	static const size_t width = 8;
+
+	static vec load(const T *p) {
+		return _mm256_loadu_ps(p);
+	}
+	static void store(T *p, vec v) {
+		_mm256_storeu_ps(p, v);
+	}
+	static vec set1(T v) {
+		return _mm256_set1_ps(v);
+	}
+	static vec add(vec a, vec b) {
+		return _mm256_add_ps(a, b);
+	}
+	static vec sub(vec a, vec b) {
+		return _mm256_sub_ps(a, b);
+	}
+	static vec mul(vec a, vec b) {
+		return _mm256_mul_ps(a, b);
+	}
+	static vec div(vec a, vec b) {
+		return _mm256_div_ps(a, b);
+	}
+	static vec min(vec a, vec b) {
+		return _mm256_min_ps(b, a);
+	}
+	static vec max(vec a, vec b) {
+		return _mm256_max_ps(b, a);
+	}
+	static mask isnan(vec a) {
+		return _mm256_cmp_ps(a, a, _CMP_UNORD_Q);
+	}
+	static vec blend(vec a, vec b, mask m) {
+		return _mm256_blendv_ps(a, b, m);
+	}
+	template<int P>
+	static unsigned cmp(vec a, vec b) {
+		return _mm256_movemask_ps(_mm256_cmp_ps(a, b, P));
+	}
+	static vec neg(vec a) {
+		return _mm256_xor_ps(a, _mm256_set1_ps(-0.0f));
+	}
+	static vec abs(vec a) {
+		return _mm256_andnot_ps(_mm256_set1_ps(-0.0f), a);
+	}
+	static vec sqrt(vec a) {
+		return _mm256_sqrt_ps(a);
+	}
+	static vec fmadd(vec a, vec b, vec c) {
+		return _mm256_fmadd_ps(a, b, c);
+	}
+	static vec gather(const T *base, const int32_t *idx) {
+		return _mm256_i32gather_ps(base,
+				_mm256_loadu_si256((const __m256i *) idx), sizeof(T));
+	}
+};
+
+struct vlong
+{
+	typedef long T;
+	typedef __m256i vec;
+	static const size_t width = 4;
+
+	static vec load(const T *p) {
+		return _mm256_loadu_si256((const __m256i *) p);
+	}
+	static void store(T *p, vec v) {
+		_mm256_storeu_si256((__m256i *) p, v);
+	}
+	static vec set1(T v) {
+		return _mm256_set1_epi64x(v);
+	}
+	static vec add(vec a, vec b) {
+		return _mm256_add_epi64(a, b);
+	}
+	static vec sub(vec a, vec b) {
+		return _mm256_sub_epi64(a, b);
+	}
+	// AVX2 doesn't have min/max on 64-bit integers.
+	static vec min(vec a, vec b) {
+		return _mm256_blendv_epi8(a, b, _mm256_cmpgt_epi64(a, b));
+	}
+	static vec max(vec a, vec b) {
+		return _mm256_blendv_epi8(a, b, _mm256_cmpgt_epi64(b, a));
+	}
+	static vec scan(vec x) {
+		vec t = _mm256_permute4x64_epi64(x, _MM_SHUFFLE(2, 1, 0, 3));
+		x = _mm256_add_epi64(x,
+				_mm256_blend_epi32(t, _mm256_setzero_si256(), 0x3));
+		t = _mm256_permute2x128_si256(x, x, 0x08);
+		return _mm256_add_epi64(x, t);
+	}
+	static vec bcast_last(vec x) {
+		return _mm256_permute4x64_epi64(x, _MM_SHUFFLE(3, 3, 3, 3));
+	}
+};
+
+struct vint
+{
+	typedef int T;
+	typedef __m256i vec;
+	static const size_t width = 8;
+
+	static vec load(const T *p) {
+		return _mm256_loadu_si256((const __m256i *) p);
+	}
+	static void store(T *p, vec v) {
+		_mm256_storeu_si256((__m256i *) p, v);
+	}
+	static vec set1(T v) {
+		return _mm256_set1_epi32(v);
+	}
+	static vec add(vec a, vec b) {
+		return _mm256_add_epi32(a, b);
+	}
+	static vec sub(vec a, vec b) {
+		return _mm256_sub_epi32(a, b);
+	}
+	static vec min(vec a, vec b) {
+		return _mm256_min_epi32(a, b);
+	}
+	static vec max(vec a, vec b) {
+		return _mm256_max_epi32(a, b);
+	}
+};
+
+#include "simd_kernel_templates.h"
+
+}
+
+#pragma GCC pop_options
+
+/*
+ * The kernels for AVX-512.
+ */
+#pragma GCC push_options
+#pragma GCC target("avx512f")
+
+namespace avx512
+{
+
+struct vdouble
+{
+	typedef double T;
+	typedef __m512d vec;
+	typedef __mmask8 mask;
+	static const size_t width = 8;
+
+	static vec load(const T *p) {
+		return _mm512_loadu_pd(p);
+	}
+	static void store(T *p, vec v) {
+		_mm512_storeu_pd(p, v);
+	}
+	static vec set1(T v) {
+		return _mm512_set1_pd(v);
+	}
+	static vec add(vec a, vec b) {
+		return _mm512_add_pd(a, b);
+	}
+	static vec sub(vec a, vec b) {
+		return _mm512_sub_pd(a, b);
+	}
+	static vec mul(vec a, vec b) {
+		return _mm512_mul_pd(a, b);
+	}
+	static vec div(vec a, vec b) {
+		return _mm512_div_pd(a, b);
+	}
+	static vec min(vec a, vec b) {
+		return _mm512_min_pd(b, a);
+	}
+	static vec max(vec a, vec b) {
+		return _mm512_max_pd(b, a);
+	}
+	static mask isnan(vec a) {
+		return _mm512_cmp_pd_mask(a, a, _CMP_UNORD_Q);
+	}
+	static vec blend(vec a, vec b, mask m) {
+		return _mm512_mask_blend_pd(m, a, b);
+	}
+	template<int P>
+	static unsigned cmp(vec a, vec b) {
+		return _mm512_cmp_pd_mask(a, b, P);
+	}
+	static vec neg(vec a) {
+		return _mm512_castsi512_pd(_mm512_xor_si512(_mm512_castpd_si512(a),
+					_mm512_set1_epi64(0x8000000000000000L)));
+	}
+	static vec abs(vec a) {
+		return _mm512_abs_pd(a);
+	}
+	static vec sqrt(vec a) {
+		return _mm512_sqrt_pd(a);
+	}
+	static vec scan(vec x) {
+		__m512i zero = _mm512_setzero_si512();
+		__m512i t = _mm512_alignr_epi64(_mm512_castpd_si512(x), zero, 7);
+		x = _mm512_add_pd(x, _mm512_castsi512_pd(t));
+		t = _mm512_alignr_epi64(_mm512_castpd_si512(x), zero, 6);
+		x = _mm512_add_pd(x, _mm512_castsi512_pd(t));
+		t = _mm512_alignr_epi64(_mm512_castpd_si512(x), zero, 4);
+		return _mm512_add_pd(x, _mm512_castsi512_pd(t));
+	}
+	static vec bcast_last(vec x) {
+		return _mm512_permutexvar_pd(_mm512_set1_epi64(7), x);
+	}
+	static vec fmadd(vec a, vec b, vec c) {
+		return _mm512_fmadd_pd(a, b, c);
+	}
+	static vec gather(const T *base, const int32_t *idx) {
+		return _mm512_i32gather_pd(_mm256_loadu_si256((const __m256i *) idx),
+				base, sizeof(T));
+	}
+};
+
+struct vfloat
+{
+	typedef float T;
+	typedef __m512 vec;
+	typedef __mmask16 mask;
+	static const size_t width = 16;
+
+	static vec load(const T *p) {
+		return _mm512_loadu_ps(p);
+	}
+	static void store(T *p, vec v) {
+		_mm512_storeu_ps(p, v);
+	}
+	static vec set1(T v) {
+		return _mm512_set1_ps(v);
+	}
+	static vec add(vec a, vec b) {
+		return _mm512_add_ps(a, b);
+	}
+	static vec sub(vec a, vec b) {
+		return _mm512_sub_ps(a, b);
+	}
+	static vec mul(vec a, vec b) {
+		return _mm512_mul_ps(a, b);
+	}
+	static vec div(vec a, vec b) {
+		return _mm512_div_ps(a, b);
+	}
+	static vec min(vec a, vec b) {
+		return _mm512_min_ps(b, a);
+	}
+	static vec max(vec a, vec b) {
+		return _mm512_max_ps(b, a);
+	}
+	static mask isnan(vec a) {
+		return _mm512_cmp_ps_mask(a, a, _CMP_UNORD_Q);
+	}
+	static vec blend(vec a, vec b, mask m) {
+		return _mm512_mask_blend_ps(m, a, b);
+	}
+	template<int P>
+	static unsigned cmp(vec a, vec b) {
+		return _mm512_cmp_ps_mask(a, b, P);
+	}
+	static vec neg(vec a) {
+		return _mm512_castsi512_ps(_mm512_xor_si512(_mm512_castps_si512(a),
+					_mm512_set1_epi32(0x80000000)));
+	}
+	static vec abs(vec a) {
+		return _mm512_abs_ps(a);
+	}
+	static vec sqrt(vec a) {
+		return _mm512_sqrt_ps(a);
+	}
+	static vec fmadd(vec a, vec b, vec c) {
+		return _mm512_fmadd_ps(a, b, c);
+	}
+	static vec gather(const T *base, const int32_t *idx) {
+		return _mm512_i32gather_ps(_mm512_loadu_si512(idx), base, sizeof(T));
+	}
+};
+
+struct vlong
+{
+	typedef long T;
+	typedef __m512i vec;
+	static const size_t width = 8;
+
+	static vec load(const T *p) {
+		return _mm512_loadu_si512(p);
+	}
+	static void store(T *p, vec v) {
+		_mm512_storeu_si512(p, v);
+	}
+	static vec set1(T v) {
+		return _mm512_set1_epi64(v);
+	}
+	static vec add(vec a, vec b) {
+		return _mm512_add_epi64(a, b);
+	}
+	static vec sub(vec a, vec b) {
+		return _mm512_sub_epi64(a, b);
+	}
+	static vec min(vec a, vec b) {
+		return _mm512_min_epi64(a, b);
+	}
+	static vec max(vec a, vec b) {
+		return _mm512_max_epi64(a, b);
+	}
+	static vec scan(vec x) {
+		vec zero = _mm512_setzero_si512();
+		x = _mm512_add_epi64(x, _mm512_alignr_epi64(x, zero, 7));
+		x = _mm512_add_epi64(x, _mm512_alignr_epi64(x, zero, 6));
+		return _mm512_add_epi64(x, _mm512_alignr_epi64(x, zero, 4));
+	}
+	static vec bcast_last(vec x) {
+		return _mm512_permutexvar_epi64(_mm512_set1_epi64(7), x);
+	}
+};
+
+struct vint
+{
+	typedef int T;
+	typedef __m512i vec;
+	static const size_t width = 16;
+
+	static vec load(const T *p) {
+		return _mm512_loadu_si512(p);
+	}
+	static void store(T *p, vec v) {
+		_mm512_storeu_si512(p, v);
+	}
+	static vec set1(T v) {
+		return _mm512_set1_epi32(v);
+	}
+	static vec add(vec a, vec b) {
+		return _mm512_add_epi32(a, b);
+	}
+	static vec sub(vec a, vec b) {
+		return _mm512_sub_epi32(a, b);
+	}
+	static vec min(vec a, vec b) {
+		return _mm512_min_epi32(a, b);
+	}
+	static vec max(vec a, vec b) {
+		return _mm512_max_epi32(a, b);
+	}
+};
+
+#include "simd_kernel_templates.h"
+
+}
+
+#pragma GCC pop_options
+
+static isa_level detect_isa()
+{
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx512f"))
+		return ISA_AVX512;
+	else if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma"))
+		return ISA_AVX2;
+	else
+		return ISA_NONE;
+}
+
+static isa_level max_isa = ISA_AVX512;
+
+isa_level get_isa()
+{
+	static isa_level cpu_isa = detect_isa();
+	return std::min(cpu_isa, max_isa);
+}
+
+void set_max_isa(isa_level level)
+{
+	max_isa = level;
+}
+
+bool parse_isa(const std::string &name, isa_level &level)
+{
+	if (name == "avx512")
+		level = ISA_AVX512;
+	else if (name == "avx2")
+		level = ISA_AVX2;
+	else if (name == "none")
+		level = ISA_NONE;
+	else
+		return false;
+	return true;
+}
+
+std::string get_isa_name(isa_level level)
+{
+	switch (level) {
+		case ISA_AVX512:
+			return "avx512";
+		case ISA_AVX2:
+			return "avx2";
+		default:
+			return "none";
+	}
+}
+
+#define FM_SIMD_DISPATCH(call)					\
+	switch (get_isa()) {						\
+		case ISA_AVX512:						\
+			return avx512::call;				\
+		case ISA_AVX2:							\
+			return avx2::call;					\
+		default:								\
+			return false;						\
+	}
+
+#define FM_SIMD_BINARY(T, OutT)												\
+bool run_AA(op_kind op, size_t num_eles, const T *left, const T *right,	\
+		OutT *out)															\
+{																			\
+	FM_SIMD_DISPATCH(run_AA(op, num_eles, left, right, out));				\
+}																			\
+bool run_AE(op_kind op, size_t num_eles, const T *left, const T &right,	\
+		OutT *out)															\
+{																			\
+	FM_SIMD_DISPATCH(run_AE(op, num_eles, left, right, out));				\
+}																			\
+bool run_EA(op_kind op, size_t num_eles, const T &left, const T *right,	\
+		OutT *out)															\
+{																			\
+	FM_SIMD_DISPATCH(run_EA(op, num_eles, left, right, out));				\
+}
+
+FM_SIMD_BINARY(double, double)
+FM_SIMD_BINARY(float, float)
+FM_SIMD_BINARY(long, long)
+FM_SIMD_BINARY(int, int)
+FM_SIMD_BINARY(double, bool)
+FM_SIMD_BINARY(float, bool)
+
+#undef FM_SIMD_BINARY
+
+bool run_agg(op_kind op, size_t num_eles, const double *in,
+		const double &init, double &res)
+{
+	FM_SIMD_DISPATCH(run_agg(op, num_eles, in, init, res));
+}
+
+bool run_agg(op_kind op, size_t num_eles, const float *in,
+		const float &init, float &res)
+{
+	FM_SIMD_DISPATCH(run_agg(op, num_eles, in, init, res));
+}
+
+bool run_agg(op_kind op, size_t num_eles, const long *in,
+		const long &init, long &res)
+{
+	FM_SIMD_DISPATCH(run_agg(op, num_eles, in, init, res));
+}
+
+bool run_agg(op_kind op, size_t num_eles, const int *in,
+		const int &init, int &res)
+{
+	FM_SIMD_DISPATCH(run_agg(op, num_eles, in, init, res));
+}
+
+bool run_cum(op_kind op, size_t num_eles, const double *in,
+		const double *prev, double *out)
+{
+	FM_SIMD_DISPATCH(run_cum(op, num_eles, in, prev, out));
+}
+
+bool run_cum(op_kind op, size_t num_eles, const long *in,
+		const long *prev, long *out)
+{
+	FM_SIMD_DISPATCH(run_cum(op, num_eles, in, prev, out));
+}
+
+bool run_uop(op_kind op, size_t num_eles, const double *in, double *out)
+{
+	FM_SIMD_DISPATCH(run_uop(op, num_eles, in, out));
+}
+
+bool run_uop(op_kind op, size_t num_eles, const float *in, float *out)
+{
+	FM_SIMD_DISPATCH(run_uop(op, num_eles, in, out));
+}
+
+bool get_spmm_kernel(size_t width, spmm_kernel<double> &kernel)
+{
+	FM_SIMD_DISPATCH(get_spmm_kernel(width, kernel));
+}
+
+bool get_spmm_kernel(size_t width, spmm_kernel<float> &kernel)
+{
+	FM_SIMD_DISPATCH(get_spmm_kernel(width, kernel));
+}
+
+}
+
+}
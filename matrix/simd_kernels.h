@@ -0,0 +1,277 @@
+#ifndef __FM_SIMD_KERNELS_H__
+#define __FM_SIMD_KERNELS_H__
+
+/*
+ * Copyright 2017 Open Connectome Project (http://openconnecto.me)
+ * Written by Da Zheng (zhengda1936@gmail.com)
+ *
+ * This file is part of FlashMatrix.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdlib.h>
+#include <stdint.h>
+
+#include <string>
+
+/*
+ * This file declares the explicitly vectorized kernels for the basic
+ * operators. The kernels are implemented with AVX2 and AVX-512 and
+ * the implementation is chosen at runtime based on the CPU.
+ *
+ * bulk_operate_impl and bulk_uoperate_impl try a kernel first and fall
+ * back to the generic loops if the operator or the element types don't
+ * have a kernel, or if the CPU doesn't support AVX2.
+ */
+
+namespace fm
+{
+
+namespace simd
+{
+
+/*
+ * The operators that have vectorized kernels. An operator declares
+ * its kernel with a static method get_simd_op().
+ */
+enum op_kind
+{
+	NONE,
+	ADD,
+	SUB,
+	MUL,
+	DIV,
+	// min/max with the semantics of std::min/std::max.
+	MIN,
+	MAX,
+	// min/max that return NaN if any of the inputs is NaN.
+	MIN_NAN,
+	MAX_NAN,
+	EQ,
+	NEQ,
+	GT,
+	GE,
+	LT,
+	LE,
+	NEG,
+	ABS,
+	SQRT,
+};
+
+enum isa_level
+{
+	ISA_NONE,
+	ISA_AVX2,
+	ISA_AVX512,
+};
+
+/*
+ * The instruction set used by the kernels. It's the widest instruction set
+ * supported by the CPU, limited by set_max_isa().
+ */
+isa_level get_isa();
+/*
+ * Limit the instruction set used by the kernels.
+ * ISA_NONE disables the vectorized kernels.
+ */
+void set_max_isa(isa_level level);
+/*
+ * Parse the name of an instruction set: "avx512", "avx2" or "none".
+ */
+bool parse_isa(const std::string &name, isa_level &level);
+std::string get_isa_name(isa_level level);
+
+/*
+ * Get the kernel of an operator. Operators without get_simd_op()
+ * don't have kernels.
+ */
+template<class OpType>
+class op_kind_trait
+{
+	template<class T>
+	static op_kind get(decltype(T::get_simd_op()) *) {
+		return T::get_simd_op();
+	}
+	template<class T>
+	static op_kind get(...) {
+		return NONE;
+	}
+public:
+	static op_kind value() {
+		return get<OpType>(NULL);
+	}
+};
+
+/*
+ * All functions below return false if there isn't a kernel for
+ * the operator and the element types. In this case, the output isn't
+ * modified.
+ */
+
+/*
+ * Element-wise binary operators on two arrays (AA), an array and
+ * a scalar (AE) and a scalar and an array (EA).
+ */
+template<class LeftType, class RightType, class ResType>
+bool run_AA(op_kind op, size_t num_eles, const LeftType *left,
+		const RightType *right, ResType *out)
+{
+	return false;
+}
+template<class LeftType, class RightType, class ResType>
+bool run_AE(op_kind op, size_t num_eles, const LeftType *left,
+		const RightType &right, ResType *out)
+{
+	return false;
+}
+template<class LeftType, class RightType, class ResType>
+bool run_EA(op_kind op, size_t num_eles, const LeftType &left,
+		const RightType *right, ResType *out)
+{
+	return false;
+}
+
+bool run_AA(op_kind op, size_t num_eles, const double *left,
+		const double *right, double *out);
+bool run_AA(op_kind op, size_t num_eles, const float *left,
+		const float *right, float *out);
+bool run_AA(op_kind op, size_t num_eles, const long *left,
+		const long *right, long *out);
+bool run_AA(op_kind op, size_t num_eles, const int *left,
+		const int *right, int *out);
+bool run_AA(op_kind op, size_t num_eles, const double *left,
+		const double *right, bool *out);
+bool run_AA(op_kind op, size_t num_eles, const float *left,
+		const float *right, bool *out);
+
+bool run_AE(op_kind op, size_t num_eles, const double *left,
+		const double &right, double *out);
+bool run_AE(op_kind op, size_t num_eles, const float *left,
+		const float &right, float *out);
+bool run_AE(op_kind op, size_t num_eles, const long *left,
+		const long &right, long *out);
+bool run_AE(op_kind op, size_t num_eles, const int *left,
+		const int &right, int *out);
+bool run_AE(op_kind op, size_t num_eles, const double *left,
+		const double &right, bool *out);
+bool run_AE(op_kind op, size_t num_eles, const float *left,
+		const float &right, bool *out);
+
+bool run_EA(op_kind op, size_t num_eles, const double &left,
+		const double *right, double *out);
+bool run_EA(op_kind op, size_t num_eles, const float &left,
+		const float *right, float *out);
+bool run_EA(op_kind op, size_t num_eles, const long &left,
+		const long *right, long *out);
+bool run_EA(op_kind op, size_t num_eles, const int &left,
+		const int *right, int *out);
+bool run_EA(op_kind op, size_t num_eles, const double &left,
+		const double *right, bool *out);
+bool run_EA(op_kind op, size_t num_eles, const float &left,
+		const float *right, bool *out);
+
+/*
+ * Aggregation. `init' is the initial value of the aggregation operator
+ * and `res' is the aggregation result of the previous elements.
+ * The elements are aggregated in a different order from the generic loop,
+ * so the result of float-point additions may be slightly different.
+ */
+template<class InType, class ResType>
+bool run_agg(op_kind op, size_t num_eles, const InType *in,
+		const ResType &init, ResType &res)
+{
+	return false;
+}
+bool run_agg(op_kind op, size_t num_eles, const double *in,
+		const double &init, double &res);
+bool run_agg(op_kind op, size_t num_eles, const float *in,
+		const float &init, float &res);
+bool run_agg(op_kind op, size_t num_eles, const long *in,
+		const long &init, long &res);
+bool run_agg(op_kind op, size_t num_eles, const int *in,
+		const int &init, int &res);
+
+/*
+ * Cumulative operators. Only the prefix sum has a kernel.
+ * `prev' is the cumulative result before the first element and can be NULL.
+ * The kernel computes the prefix sum inside a vector first and adds
+ * the sum of the previous elements to it, so out[i] isn't computed as
+ * out[i - 1] + in[i] as the generic loop does. The result of float-point
+ * additions may be different in the last bits and the difference grows with
+ * the number of elements. Integer results are the same.
+ */
+template<class InType, class PrevType, class ResType>
+bool run_cum(op_kind op, size_t num_eles, const InType *in,
+		const PrevType *prev, ResType *out)
+{
+	return false;
+}
+bool run_cum(op_kind op, size_t num_eles, const double *in,
+		const double *prev, double *out);
+bool run_cum(op_kind op, size_t num_eles, const long *in,
+		const long *prev, long *out);
+
+/*
+ * Unary operators.
+ */
+template<class InType, class OutType>
+bool run_uop(op_kind op, size_t num_eles, const InType *in, OutType *out)
+{
+	return false;
+}
+bool run_uop(op_kind op, size_t num_eles, const double *in, double *out);
+bool run_uop(op_kind op, size_t num_eles, const float *in, float *out);
+
+/*
+ * The SpMM kernels multiply the non-zero entries in a block of a sparse
+ * matrix with the rows of a dense matrix and add the result to the rows
+ * of the output matrix. All rows have the same width. The column and row
+ * indices are relative to the block. `vals' is NULL if the sparse matrix
+ * doesn't have values. The kernels prefetch the input rows of the non-zero
+ * entries ahead.
+ */
+template<class T>
+struct spmm_kernel
+{
+	/*
+	 * This multiplies a row part with `num' non-zero entries.
+	 */
+	void (*row)(size_t num, const uint16_t *cols, const T *vals,
+			const T *in_rows, T *dest_row);
+	/*
+	 * This multiplies the non-zero entries in the COO format. `coos' stores
+	 * a pair of row index and column index for each non-zero entry.
+	 * The most significant bit of the row index is ignored.
+	 */
+	void (*coo)(size_t num, const uint16_t *coos, const T *vals,
+			const T *in_rows, T *out_rows);
+};
+
+/*
+ * Get the SpMM kernels for the row width. There are kernels for
+ * the row width of 1, 2, 4, 8, 16, 32 and 64.
+ */
+template<class T>
+bool get_spmm_kernel(size_t width, spmm_kernel<T> &kernel)
+{
+	return false;
+}
+bool get_spmm_kernel(size_t width, spmm_kernel<double> &kernel);
+bool get_spmm_kernel(size_t width, spmm_kernel<float> &kernel);
+
+}
+
+}
+
+#endif
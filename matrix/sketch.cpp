@@ -0,0 +1,501 @@
+/*
+ * Copyright 2017 Open Connectome Project (http://openconnecto.me)
+ * Written by Da Zheng (zhengda1936@gmail.com)
+ *
+ * This file is part of FlashMatrix.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <math.h>
+
+#include <algorithm>
+
+#include <boost/format.hpp>
+
+#include "log.h"
+#include "common.h"
+
+#include "sketch.h"
+#include "bulk_operate.h"
+#include "dense_matrix.h"
+#include "data_frame.h"
+#include "local_vec_store.h"
+#include "local_matrix_store.h"
+#include "materialize.h"
+#include "mem_worker_thread.h"
+#include "generic_hashtable.h"
+
+namespace fm
+{
+
+/*
+ * Get the values in an array as double-precision floating-points.
+ */
+static const double *get_doubles(const char *arr, size_t num,
+		const scalar_type &type, std::vector<double> &buf)
+{
+	if (type == get_scalar_type<double>())
+		return (const double *) arr;
+	buf.resize(num);
+	type.get_type_cast(get_scalar_type<double>()).runA(num, arr, buf.data());
+	return buf.data();
+}
+
+quantile_sketch::quantile_sketch(size_t k)
+{
+	this->k = k;
+	count = 0;
+	min = std::numeric_limits<double>::infinity();
+	max = -std::numeric_limits<double>::infinity();
+	rand_state = 0x9E3779B97F4A7C15UL;
+	num_retained = 0;
+	max_retained = 0;
+	add_level();
+}
+
+quantile_sketch::ptr quantile_sketch::create(size_t k)
+{
+	if (k < 8) {
+		BOOST_LOG_TRIVIAL(error) << "k of a quantile sketch needs to be at least 8";
+		return ptr();
+	}
+	return ptr(new quantile_sketch(k));
+}
+
+/*
+ * The compactors at lower levels have smaller capacities. The capacity
+ * decreases by 2/3 at each level from the top level.
+ */
+size_t quantile_sketch::get_capacity(size_t level) const
+{
+	size_t height = compactors.size() - 1 - level;
+	return std::max(2.0, ceil(k * pow(2.0 / 3, height)));
+}
+
+void quantile_sketch::add_level()
+{
+	compactors.push_back(std::vector<double>());
+	max_retained = 0;
+	for (size_t i = 0; i < compactors.size(); i++)
+		max_retained += get_capacity(i);
+}
+
+bool quantile_sketch::rand_bit()
+{
+	// xorshift64
+	rand_state ^= rand_state << 13;
+	rand_state ^= rand_state >> 7;
+	rand_state ^= rand_state << 17;
+	return rand_state & 1;
+}
+
+void quantile_sketch::compress()
+{
+	while (num_retained >= max_retained) {
+		// Compact the lowest compactor that is full.
+		for (size_t i = 0; i < compactors.size(); i++) {
+			if (compactors[i].size() < get_capacity(i))
+				continue;
+			if (i + 1 == compactors.size())
+				add_level();
+
+			std::vector<double> &comp = compactors[i];
+			std::sort(comp.begin(), comp.end());
+			// If there are an odd number of values, the largest one stays.
+			size_t num = comp.size() - comp.size() % 2;
+			for (size_t j = rand_bit(); j < num; j += 2)
+				compactors[i + 1].push_back(comp[j]);
+			comp.erase(comp.begin(), comp.begin() + num);
+			num_retained -= num / 2;
+			break;
+		}
+	}
+}
+
+void quantile_sketch::add(const char *arr, size_t num, const scalar_type &type)
+{
+	std::vector<double> buf;
+	const double *vals = get_doubles(arr, num, type, buf);
+	for (size_t i = 0; i < num; i++) {
+		double val = vals[i];
+		if (std::isnan(val))
+			continue;
+		count++;
+		min = std::min(min, val);
+		max = std::max(max, val);
+		compactors[0].push_back(val);
+		num_retained++;
+		if (num_retained >= max_retained)
+			compress();
+	}
+}
+
+bool quantile_sketch::merge(const sketch &s)
+{
+	const quantile_sketch *qs = dynamic_cast<const quantile_sketch *>(&s);
+	if (qs == NULL || qs->k != k) {
+		BOOST_LOG_TRIVIAL(error)
+			<< "can't merge a sketch of a different kind or with different k";
+		return false;
+	}
+
+	while (compactors.size() < qs->compactors.size())
+		add_level();
+	for (size_t i = 0; i < qs->compactors.size(); i++)
+		compactors[i].insert(compactors[i].end(), qs->compactors[i].begin(),
+				qs->compactors[i].end());
+	count += qs->count;
+	min = std::min(min, qs->min);
+	max = std::max(max, qs->max);
+	num_retained += qs->num_retained;
+	compress();
+	return true;
+}
+
+double quantile_sketch::get_quantile(double q) const
+{
+	if (count == 0)
+		return std::numeric_limits<double>::quiet_NaN();
+	if (q <= 0)
+		return min;
+	if (q >= 1)
+		return max;
+
+	// A value in level i represents 2^i values.
+	std::vector<std::pair<double, size_t> > vals;
+	size_t tot_weight = 0;
+	for (size_t i = 0; i < compactors.size(); i++) {
+		for (size_t j = 0; j < compactors[i].size(); j++)
+			vals.push_back(std::pair<double, size_t>(compactors[i][j], 1UL << i));
+		tot_weight += compactors[i].size() << i;
+	}
+	std::sort(vals.begin(), vals.end());
+	double target = q * tot_weight;
+	size_t weight = 0;
+	for (size_t i = 0; i < vals.size(); i++) {
+		weight += vals[i].second;
+		if (weight >= target)
+			return vals[i].first;
+	}
+	return max;
+}
+
+double quantile_sketch::get_rank(double val) const
+{
+	size_t weight = 0;
+	size_t tot_weight = 0;
+	for (size_t i = 0; i < compactors.size(); i++) {
+		for (size_t j = 0; j < compactors[i].size(); j++)
+			if (compactors[i][j] < val)
+				weight += 1UL << i;
+		tot_weight += compactors[i].size() << i;
+	}
+	return tot_weight == 0 ? 0 : ((double) weight) / tot_weight;
+}
+
+const int distinct_sketch::MIN_PRECISION;
+const int distinct_sketch::MAX_PRECISION;
+
+distinct_sketch::ptr distinct_sketch::create(int precision)
+{
+	if (precision < MIN_PRECISION || precision > MAX_PRECISION) {
+		BOOST_LOG_TRIVIAL(error) << boost::format(
+				"The precision of a distinct sketch needs to be in [%1%, %2%]")
+			% MIN_PRECISION % MAX_PRECISION;
+		return ptr();
+	}
+	return ptr(new distinct_sketch(precision));
+}
+
+void distinct_sketch::add(const char *arr, size_t num, const scalar_type &type)
+{
+	if (type.is_floating_point()) {
+		std::vector<double> buf;
+		const double *vals = get_doubles(arr, num, type, buf);
+		for (size_t i = 0; i < num; i++) {
+			// Adding 0 turns -0 into 0.
+			double val = vals[i] + 0.0;
+			uint64_t bits;
+			memcpy(&bits, &val, sizeof(bits));
+			add_hash(get_hash_code(bits));
+		}
+	}
+	else {
+		// All integers have no more than 8 bytes.
+		size_t entry_size = type.get_size();
+		assert(entry_size <= sizeof(uint64_t));
+		for (size_t i = 0; i < num; i++) {
+			uint64_t val = 0;
+			memcpy(&val, arr + i * entry_size, entry_size);
+			add_hash(get_hash_code(val));
+		}
+	}
+}
+
+bool distinct_sketch::merge(const sketch &s)
+{
+	const distinct_sketch *ds = dynamic_cast<const distinct_sketch *>(&s);
+	if (ds == NULL || ds->precision != precision) {
+		BOOST_LOG_TRIVIAL(error) << "can't merge a sketch of a different kind "
+			<< "or with different precision";
+		return false;
+	}
+	for (size_t i = 0; i < registers.size(); i++)
+		registers[i] = std::max(registers[i], ds->registers[i]);
+	return true;
+}
+
+double distinct_sketch::get_estimate() const
+{
+	double m = registers.size();
+	double alpha;
+	if (registers.size() == 16)
+		alpha = 0.673;
+	else if (registers.size() == 32)
+		alpha = 0.697;
+	else if (registers.size() == 64)
+		alpha = 0.709;
+	else
+		alpha = 0.7213 / (1 + 1.079 / m);
+
+	double sum = 0;
+	size_t num_zeros = 0;
+	for (size_t i = 0; i < registers.size(); i++) {
+		sum += ldexp(1.0, -registers[i]);
+		if (registers[i] == 0)
+			num_zeros++;
+	}
+	double est = alpha * m * m / sum;
+	// Use linear counting for small cardinalities.
+	if (est <= 2.5 * m && num_zeros > 0)
+		est = m * log(m / num_zeros);
+	return est;
+}
+
+histogram_sketch::ptr histogram_sketch::create(double min, double max,
+		size_t num_bins)
+{
+	if (!(min < max) || num_bins == 0) {
+		BOOST_LOG_TRIVIAL(error)
+			<< "A histogram needs a valid range and at least one bin";
+		return ptr();
+	}
+	return ptr(new histogram_sketch(min, max, num_bins));
+}
+
+void histogram_sketch::add(const char *arr, size_t num, const scalar_type &type)
+{
+	std::vector<double> buf;
+	const double *vals = get_doubles(arr, num, type, buf);
+	double scale = counts.size() / (max - min);
+	for (size_t i = 0; i < num; i++) {
+		double val = vals[i];
+		if (std::isnan(val))
+			num_nan++;
+		else if (val < min)
+			num_under++;
+		else if (val >= max)
+			num_over++;
+		else {
+			// Avoid the rounding error near the upper bound.
+			size_t idx = std::min((size_t) ((val - min) * scale),
+					counts.size() - 1);
+			counts[idx]++;
+		}
+	}
+}
+
+bool histogram_sketch::merge(const sketch &s)
+{
+	const histogram_sketch *hs = dynamic_cast<const histogram_sketch *>(&s);
+	if (hs == NULL || hs->min != min || hs->max != max
+			|| hs->counts.size() != counts.size()) {
+		BOOST_LOG_TRIVIAL(error)
+			<< "can't merge a sketch of a different kind or with different bins";
+		return false;
+	}
+	for (size_t i = 0; i < counts.size(); i++)
+		counts[i] += hs->counts[i];
+	num_under += hs->num_under;
+	num_over += hs->num_over;
+	num_nan += hs->num_nan;
+	return true;
+}
+
+namespace
+{
+
+/*
+ * Merge the sketches computed by all threads.
+ */
+std::vector<sketch::ptr> merge_sketches(
+		const std::vector<std::vector<sketch::ptr> > &local_sketches,
+		size_t num_sketches, const sketch &init)
+{
+	std::vector<sketch::ptr> ret(num_sketches);
+	for (size_t i = 0; i < num_sketches; i++) {
+		ret[i] = init.create_empty();
+		for (size_t j = 0; j < local_sketches.size(); j++)
+			if (!local_sketches[j].empty() && local_sketches[j][i])
+				ret[i]->merge(*local_sketches[j][i]);
+	}
+	return ret;
+}
+
+class sketch_portion_op: public detail::portion_mapply_op
+{
+	const sketch &init;
+	// Indicate whether we compute a sketch on each column.
+	bool per_col;
+	size_t num_sketches;
+	// The sketches computed by each thread.
+	std::vector<std::vector<sketch::ptr> > local_sketches;
+public:
+	sketch_portion_op(const sketch &_init, bool per_col,
+			size_t num_cols): detail::portion_mapply_op(0, 0,
+				get_scalar_type<double>()), init(_init) {
+		this->per_col = per_col;
+		this->num_sketches = per_col ? num_cols : 1;
+		size_t nthreads = detail::mem_thread_pool::get_global_num_threads();
+		local_sketches.resize(nthreads);
+	}
+
+	virtual detail::portion_mapply_op::const_ptr transpose() const {
+		return detail::portion_mapply_op::const_ptr();
+	}
+
+	virtual std::string to_string(
+			const std::vector<detail::matrix_store::const_ptr> &mats) const {
+		return "";
+	}
+
+	virtual void run(
+			const std::vector<detail::local_matrix_store::const_ptr> &ins) const;
+
+	std::vector<sketch::ptr> get_sketches() const {
+		return merge_sketches(local_sketches, num_sketches, init);
+	}
+};
+
+void sketch_portion_op::run(
+		const std::vector<detail::local_matrix_store::const_ptr> &ins) const
+{
+	int thread_id = detail::mem_thread_pool::get_curr_thread_id();
+	sketch_portion_op *mutable_this = const_cast<sketch_portion_op *>(this);
+	std::vector<sketch::ptr> &sketches = mutable_this->local_sketches[thread_id];
+	if (sketches.empty())
+		sketches.resize(num_sketches);
+
+	// We add the values in the matrix portion column by column.
+	detail::local_matrix_store::const_ptr in = ins[0];
+	if (in->store_layout() != matrix_layout_t::L_COL) {
+		detail::local_matrix_store::ptr buf(
+				new detail::local_buf_col_matrix_store(in->get_global_start_row(),
+					in->get_global_start_col(), in->get_num_rows(),
+					in->get_num_cols(), in->get_type(), -1));
+		buf->copy_from(*in);
+		in = buf;
+	}
+	const detail::local_col_matrix_store &col_in
+		= static_cast<const detail::local_col_matrix_store &>(*in);
+	for (size_t i = 0; i < col_in.get_num_cols(); i++) {
+		size_t idx = per_col ? col_in.get_global_start_col() + i : 0;
+		if (sketches[idx] == NULL)
+			sketches[idx] = init.create_empty();
+		sketches[idx]->add(col_in.get_col(i), col_in.get_num_rows(),
+				col_in.get_type());
+	}
+}
+
+std::vector<sketch::ptr> sketch_matrix(const dense_matrix &mat,
+		const sketch &init, bool per_col)
+{
+	std::vector<detail::matrix_store::const_ptr> stores(1);
+	stores[0] = mat.get_raw_store();
+	sketch_portion_op *_portion_op = new sketch_portion_op(init, per_col,
+			mat.get_num_cols());
+	detail::portion_mapply_op::const_ptr portion_op(_portion_op);
+	detail::__mapply_portion(stores, portion_op, matrix_layout_t::L_COL);
+	return _portion_op->get_sketches();
+}
+
+}
+
+std::vector<sketch::ptr> sketch_cols(const dense_matrix &mat,
+		const sketch &init)
+{
+	return sketch_matrix(mat, init, true);
+}
+
+sketch::ptr sketch_all(const dense_matrix &mat, const sketch &init)
+{
+	return sketch_matrix(mat, init, false)[0];
+}
+
+std::vector<sketch::ptr> sketch_cols(const data_frame &df,
+		const std::vector<std::string> &names, const sketch &init)
+{
+	std::vector<detail::vec_store::const_ptr> cols(names.size());
+	for (size_t i = 0; i < names.size(); i++) {
+		cols[i] = df.get_vec(names[i]);
+		if (cols[i] == NULL) {
+			BOOST_LOG_TRIVIAL(error) << boost::format(
+					"The column %1% doesn't exist") % names[i];
+			return std::vector<sketch::ptr>();
+		}
+	}
+	if (cols.empty())
+		return std::vector<sketch::ptr>();
+
+	// Each thread processes a portion of all columns at a time and adds
+	// the values to its own sketches.
+	const size_t num_threads = get_num_omp_threads();
+	const size_t num_rows = cols[0]->get_length();
+	const size_t portion_size = cols[0]->get_portion_size();
+	std::vector<std::vector<sketch::ptr> > local_sketches(num_threads);
+	for (size_t i = 0; i < num_threads; i++)
+		for (size_t j = 0; j < cols.size(); j++)
+			local_sketches[i].push_back(init.create_empty());
+	for (size_t start = 0; start < num_rows;
+			start += portion_size * num_threads) {
+		std::vector<std::vector<local_vec_store::const_ptr> > portions(
+				num_threads);
+		for (size_t i = 0; i < num_threads; i++) {
+			off_t portion_start = start + i * portion_size;
+			if ((size_t) portion_start >= num_rows)
+				break;
+			size_t len = std::min(portion_size, num_rows - portion_start);
+			for (size_t j = 0; j < cols.size(); j++) {
+				local_vec_store::const_ptr portion = cols[j]->get_portion(
+						portion_start, len);
+				if (portion == NULL) {
+					BOOST_LOG_TRIVIAL(error) << boost::format(
+							"can't get rows [%1%, %2%) of column %3%")
+						% portion_start % (portion_start + len) % names[j];
+					return std::vector<sketch::ptr>();
+				}
+				portions[i].push_back(portion);
+			}
+		}
+#pragma omp parallel for
+		for (size_t i = 0; i < num_threads; i++)
+			for (size_t j = 0; j < portions[i].size(); j++)
+				local_sketches[i][j]->add(portions[i][j]->get_raw_arr(),
+						portions[i][j]->get_length(),
+						portions[i][j]->get_type());
+	}
+	return merge_sketches(local_sketches, cols.size(), init);
+}
+
+}
@@ -0,0 +1,255 @@
+#ifndef __FM_SKETCH_H__
+#define __FM_SKETCH_H__
+
+/*
+ * Copyright 2017 Open Connectome Project (http://openconnecto.me)
+ * Written by Da Zheng (zhengda1936@gmail.com)
+ *
+ * This file is part of FlashMatrix.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * This file implements sketches for approximate aggregations.
+ *
+ * A sketch summarizes a stream of values in a small amount of memory and
+ * the sketches of different parts of the data can be merged. As such,
+ * a sketch can be computed on a matrix or a data frame in a single pass:
+ * each thread computes sketches on the portions it processes and
+ * the sketches of all threads are merged at the end.
+ */
+
+#include <stdint.h>
+
+#include <memory>
+#include <vector>
+#include <string>
+
+#include "generic_type.h"
+
+namespace fm
+{
+
+class dense_matrix;
+class data_frame;
+
+class sketch
+{
+public:
+	typedef std::shared_ptr<sketch> ptr;
+	typedef std::shared_ptr<const sketch> const_ptr;
+
+	virtual ~sketch() {
+	}
+
+	/*
+	 * Create an empty sketch with the same parameters.
+	 */
+	virtual sketch::ptr create_empty() const = 0;
+	/*
+	 * Add an array of values of the specified type to the sketch.
+	 */
+	virtual void add(const char *arr, size_t num, const scalar_type &type) = 0;
+	/*
+	 * Merge a sketch of the same kind and with the same parameters.
+	 */
+	virtual bool merge(const sketch &s) = 0;
+	virtual std::string get_name() const = 0;
+};
+
+/*
+ * This estimates the quantiles of the values with the KLL sketch.
+ * The values are stored in compactors of different levels. When
+ * a compactor is full, it's sorted and every other value is promoted to
+ * the next level with twice the weight. The rank error is about 1.7 / k.
+ * NaN is ignored.
+ */
+class quantile_sketch: public sketch
+{
+	size_t k;
+	size_t count;
+	double min;
+	double max;
+	// Decide which half of the values are promoted.
+	uint64_t rand_state;
+	std::vector<std::vector<double> > compactors;
+	// The number of values in all compactors.
+	size_t num_retained;
+	// The total capacity of all compactors.
+	size_t max_retained;
+
+	quantile_sketch(size_t k);
+	size_t get_capacity(size_t level) const;
+	void add_level();
+	void compress();
+	bool rand_bit();
+public:
+	typedef std::shared_ptr<quantile_sketch> ptr;
+
+	static ptr create(size_t k = 200);
+
+	virtual sketch::ptr create_empty() const {
+		return create(k);
+	}
+	virtual void add(const char *arr, size_t num, const scalar_type &type);
+	virtual bool merge(const sketch &s);
+	virtual std::string get_name() const {
+		return "quantile";
+	}
+
+	/*
+	 * The number of values added to the sketch.
+	 */
+	size_t get_count() const {
+		return count;
+	}
+	double get_min() const {
+		return min;
+	}
+	double get_max() const {
+		return max;
+	}
+	/*
+	 * Get the estimated q-quantile, where 0 <= q <= 1.
+	 * It returns NaN if the sketch is empty.
+	 */
+	double get_quantile(double q) const;
+	/*
+	 * Get the estimated fraction of the values that are smaller than `val'.
+	 */
+	double get_rank(double val) const;
+};
+
+/*
+ * This estimates the number of distinct values with HyperLogLog.
+ * It uses 2^precision registers of one byte and the relative error is
+ * about 1.04 / sqrt(2^precision).
+ */
+class distinct_sketch: public sketch
+{
+	int precision;
+	std::vector<uint8_t> registers;
+
+	distinct_sketch(int precision) {
+		this->precision = precision;
+		registers.resize(1UL << precision);
+	}
+	void add_hash(uint64_t hash) {
+		size_t idx = hash >> (64 - precision);
+		// Make sure the number of leading zeros is no more than 64 - precision.
+		uint64_t rest = (hash << precision) | (1UL << (precision - 1));
+		uint8_t rank = __builtin_clzl(rest) + 1;
+		if (registers[idx] < rank)
+			registers[idx] = rank;
+	}
+public:
+	typedef std::shared_ptr<distinct_sketch> ptr;
+
+	static const int MIN_PRECISION = 4;
+	static const int MAX_PRECISION = 18;
+
+	static ptr create(int precision = 14);
+
+	virtual sketch::ptr create_empty() const {
+		return create(precision);
+	}
+	virtual void add(const char *arr, size_t num, const scalar_type &type);
+	virtual bool merge(const sketch &s);
+	virtual std::string get_name() const {
+		return "distinct";
+	}
+
+	double get_estimate() const;
+};
+
+/*
+ * This counts the values in bins of the same width in [min, max).
+ * The values out of the range and NaN are counted separately.
+ */
+class histogram_sketch: public sketch
+{
+	double min;
+	double max;
+	std::vector<size_t> counts;
+	size_t num_under;
+	size_t num_over;
+	size_t num_nan;
+
+	histogram_sketch(double min, double max, size_t num_bins) {
+		this->min = min;
+		this->max = max;
+		counts.resize(num_bins);
+		num_under = 0;
+		num_over = 0;
+		num_nan = 0;
+	}
+public:
+	typedef std::shared_ptr<histogram_sketch> ptr;
+
+	static ptr create(double min, double max, size_t num_bins);
+
+	virtual sketch::ptr create_empty() const {
+		return create(min, max, counts.size());
+	}
+	virtual void add(const char *arr, size_t num, const scalar_type &type);
+	virtual bool merge(const sketch &s);
+	virtual std::string get_name() const {
+		return "histogram";
+	}
+
+	size_t get_num_bins() const {
+		return counts.size();
+	}
+	/*
+	 * Get the range of a bin.
+	 */
+	std::pair<double, double> get_bin_range(size_t idx) const {
+		double width = (max - min) / counts.size();
+		return std::pair<double, double>(min + width * idx,
+				min + width * (idx + 1));
+	}
+	size_t get_count(size_t idx) const {
+		return counts[idx];
+	}
+	size_t get_num_under() const {
+		return num_under;
+	}
+	size_t get_num_over() const {
+		return num_over;
+	}
+	size_t get_num_nan() const {
+		return num_nan;
+	}
+};
+
+/*
+ * Compute a sketch on each column of a matrix in a single pass over
+ * the matrix. The sketches are created from `init'.
+ */
+std::vector<sketch::ptr> sketch_cols(const dense_matrix &mat,
+		const sketch &init);
+/*
+ * Compute a sketch on all elements of a matrix.
+ */
+sketch::ptr sketch_all(const dense_matrix &mat, const sketch &init);
+/*
+ * Compute a sketch on each of the specified columns of a data frame in
+ * a single pass over the data frame.
+ */
+std::vector<sketch::ptr> sketch_cols(const data_frame &df,
+		const std::vector<std::string> &cols, const sketch &init);
+
+}
+
+#endif
@@ -22,12 +22,15 @@
 
 #include <assert.h>
 #include <memory>
+#include <queue>
 #if defined(_OPENMP)
 #include <parallel/algorithm>
 #else
 #include <algorithm>
 #endif
 
+#include "radix_sort.h"
+
 namespace fm
 {
 
@@ -52,6 +55,67 @@ public:
 			std::vector<std::pair<int, off_t> > &merge_index) const = 0;
 };
 
+/*
+ * Integers and float-point values are sorted with radix sort if there are
+ * enough elements. These functions return false if the data isn't sorted.
+ */
+static const size_t min_radix_sort_len = 4096;
+static const size_t min_parallel_radix_sort_len = 1 << 16;
+
+template<class T>
+bool radix_sort(T *data, size_t num, bool decreasing, bool parallel,
+		std::true_type)
+{
+	if (num < min_radix_sort_len)
+		return false;
+	radix::key_getter<T> get_key(decreasing);
+	if (parallel && num >= min_parallel_radix_sort_len)
+		radix::parallel_sort(data, num, get_key);
+	else
+		radix::serial_sort(data, num, get_key);
+	return true;
+}
+
+template<class T>
+bool radix_sort(T *data, size_t num, bool decreasing, bool parallel,
+		std::false_type)
+{
+	return false;
+}
+
+template<class T>
+bool radix_sort_with_index(T *data, off_t *offs, size_t num, bool decreasing,
+		std::true_type)
+{
+	if (num < min_radix_sort_len)
+		return false;
+	std::unique_ptr<radix::indexed_entry<T>[]> entries(
+			new radix::indexed_entry<T>[num]);
+#pragma omp parallel for
+	for (size_t i = 0; i < num; i++) {
+		entries[i].val = data[i];
+		entries[i].idx = i;
+	}
+	radix::indexed_key_getter<T> get_key(decreasing);
+	if (num >= min_parallel_radix_sort_len)
+		radix::parallel_sort(entries.get(), num, get_key);
+	else
+		radix::serial_sort(entries.get(), num, get_key);
+#pragma omp parallel for
+	for (size_t i = 0; i < num; i++) {
+		data[i] = entries[i].val;
+		offs[i] = entries[i].idx;
+	}
+	return true;
+}
+
+template<class T>
+bool radix_sort_with_index(T *data, off_t *offs, size_t num, bool decreasing,
+		std::false_type)
+{
+	return false;
+}
+
 template<class T>
 class type_sorter: public sorter
 {
@@ -100,6 +164,10 @@ void type_sorter<T>::sort_with_index(char *data1, off_t *offs, size_t num,
 		bool decreasing) const
 {
 	T *data = (T *) data1;
+	if (radix_sort_with_index(data, offs, num, decreasing,
+				std::integral_constant<bool, radix::is_sortable<T>::value>()))
+		return;
+
 	struct indexed_entry {
 		T val;
 		off_t idx;
@@ -148,6 +216,9 @@ template<class T>
 void type_sorter<T>::sort(char *data1, size_t num, bool decreasing) const
 {
 	T *data = (T *) data1;
+	if (radix_sort(data, num, decreasing, true,
+				std::integral_constant<bool, radix::is_sortable<T>::value>()))
+		return;
 	T *start = (T *) data;
 	T *end = start + num;
 #if defined(_OPENMP)
@@ -167,6 +238,9 @@ template<class T>
 void type_sorter<T>::serial_sort(char *data1, size_t num, bool decreasing) const
 {
 	T *data = (T *) data1;
+	if (radix_sort(data, num, decreasing, false,
+				std::integral_constant<bool, radix::is_sortable<T>::value>()))
+		return;
 	T *start = (T *) data;
 	T *end = start + num;
 	if (decreasing)
@@ -224,107 +298,168 @@ size_t get_length(const std::pair<const char *, const char *> &arr)
 }
 
 /*
- * Merge multiple arrays and return the merged result as well as how
- * the arrays are merged.
- * Here I assume there are a few number of arrays to merge.
+ * This merges sorted arrays in the way of sample sort. We sample splitters
+ * from the arrays and cut all arrays at the splitters, so the merge result
+ * is partitioned into ranges of values. The ranges don't overlap, so each
+ * range is merged by a thread independently and written to its own location
+ * in the output.
  */
 template<class T>
-void type_sorter<T>::merge_with_index(
-		const std::vector<std::pair<const char *, const char *> > &arrs,
-		char *output, size_t out_num,
-		std::vector<std::pair<int, off_t> > &merge_index) const
+class range_merger
 {
-	struct indexed_entry {
+	// The number of samples in a range.
+	static const size_t num_samples_per_range = 32;
+	// The minimal number of elements in a range.
+	static const size_t min_range_len = 4096;
+
+	const std::vector<std::pair<const T *, const T *> > &arrs;
+	// The locations where the arrays are cut. The i-th range of the j-th
+	// array is [cuts[i][j], cuts[i + 1][j]).
+	std::vector<std::vector<size_t> > cuts;
+	// The location of each range in the output.
+	std::vector<size_t> out_offs;
+
+	struct head {
 		T val;
 		int arr_idx;
-		off_t off_in_arr;
 	};
-	std::unique_ptr<indexed_entry[]> buf(new indexed_entry[out_num]);
-	// Move data from `arrs' to `buf' in parallel.
-#pragma omp parallel
-	{
+	// The priority queue pops the smallest value first. The equal values
+	// are popped in the order of the arrays.
+	struct head_greater {
+		bool operator()(const head &h1, const head &h2) const {
+			if (h1.val == h2.val)
+				return h1.arr_idx > h2.arr_idx;
+			return h1.val > h2.val;
+		}
+	};
+public:
+	range_merger(const std::vector<std::pair<const T *, const T *> > &_arrs,
+			size_t out_num);
+
+	size_t get_num_ranges() const {
+		return out_offs.size();
+	}
+
+	size_t get_range_start(size_t range_idx) const {
+		return out_offs[range_idx];
+	}
+
+	/*
+	 * Merge a range. If `merge_index' isn't NULL, it stores the locations
+	 * of the merged elements in the input arrays.
+	 */
+	void merge(size_t range_idx, T *output,
+			std::pair<int, off_t> *merge_index) const;
+};
+
+template<class T>
+range_merger<T>::range_merger(
+		const std::vector<std::pair<const T *, const T *> > &_arrs,
+		size_t out_num): arrs(_arrs)
+{
 #if defined(_OPENMP)
-		size_t avg_part_len = ceil(((double) out_num) / omp_get_num_threads());
-		size_t thread_id = omp_get_thread_num();
+	size_t num_ranges = omp_get_max_threads() * 4;
 #else
-		size_t avg_part_len = out_num;
-		size_t thread_id = 0;
+	size_t num_ranges = 1;
 #endif
-		size_t start = thread_id * avg_part_len;
-		if (out_num > start) {
-			size_t part_len = std::min(out_num - start, avg_part_len);
-
-			// Find the first array for the current thread.
-			size_t curr_arr_idx = 0;
-			size_t i = 0;
-			while (true) {
-				// If the array is empty, it works fine.
-				size_t num_eles = get_length<T>(arrs[curr_arr_idx]);
-				if (i + num_eles > start)
-					break;
-				i += num_eles;
-				curr_arr_idx++;
-			}
-			assert(start >= i);
-			off_t curr_off_in_arr = start - i;
-			assert(get_length<T>(arrs[curr_arr_idx]) > 0);
-			assert(arrs[curr_arr_idx].first <= arrs[curr_arr_idx].second);
-			for (size_t i = 0; i < part_len; i++) {
-				const T *curr_ptr
-					= ((const T *) arrs[curr_arr_idx].first) + curr_off_in_arr;
-				assert(curr_ptr < (const T *) arrs[curr_arr_idx].second);
-				buf[start + i].val = *curr_ptr;
-				buf[start + i].arr_idx = curr_arr_idx;
-				buf[start + i].off_in_arr = curr_off_in_arr;
-				// If the current pointer points to the last element in the array,
-				// switch to the next array.
-				if (curr_ptr == ((const T *) arrs[curr_arr_idx].second) - 1) {
-					curr_arr_idx++;
-					// We need to skip the empty arrays.
-					while (curr_arr_idx < arrs.size()
-							&& get_length<T>(arrs[curr_arr_idx]) == 0)
-						curr_arr_idx++;
-					if (curr_arr_idx < arrs.size())
-						assert(arrs[curr_arr_idx].first <= arrs[curr_arr_idx].second);
-					curr_off_in_arr = 0;
-					if (i + 1 < part_len)
-						assert(curr_arr_idx < arrs.size());
-				}
-				else
-					curr_off_in_arr++;
-			}
+	num_ranges = std::max(1UL, std::min(num_ranges, out_num / min_range_len));
+
+	// Sample the arrays evenly. Each array gets the number of samples
+	// proportional to its length.
+	std::vector<T> samples;
+	if (num_ranges > 1) {
+		size_t step = std::max(1UL,
+				out_num / (num_ranges * num_samples_per_range));
+		for (size_t i = 0; i < arrs.size(); i++) {
+			size_t len = arrs[i].second - arrs[i].first;
+			for (size_t j = step / 2; j < len; j += step)
+				samples.push_back(arrs[i].first[j]);
 		}
+		std::sort(samples.begin(), samples.end());
+	}
+	if (samples.empty())
+		num_ranges = 1;
+
+	cuts.resize(num_ranges + 1);
+	cuts[0].resize(arrs.size());
+	for (size_t i = 1; i < num_ranges; i++) {
+		const T &splitter = samples[i * samples.size() / num_ranges];
+		cuts[i].resize(arrs.size());
+		for (size_t j = 0; j < arrs.size(); j++)
+			cuts[i][j] = std::lower_bound(arrs[j].first, arrs[j].second,
+					splitter) - arrs[j].first;
+	}
+	cuts[num_ranges].resize(arrs.size());
+	for (size_t j = 0; j < arrs.size(); j++)
+		cuts[num_ranges][j] = arrs[j].second - arrs[j].first;
+
+	out_offs.resize(num_ranges);
+	for (size_t i = 0; i < num_ranges; i++) {
+		out_offs[i] = 0;
+		for (size_t j = 0; j < arrs.size(); j++)
+			out_offs[i] += cuts[i][j];
 	}
+	assert(out_offs.back() <= out_num);
+}
 
-	std::vector<std::pair<indexed_entry *, indexed_entry *> > indexed_arrs(
-			arrs.size());
-	size_t off = 0;
+template<class T>
+void range_merger<T>::merge(size_t range_idx, T *output,
+		std::pair<int, off_t> *merge_index) const
+{
+	const std::vector<size_t> &starts = cuts[range_idx];
+	const std::vector<size_t> &ends = cuts[range_idx + 1];
+	std::vector<size_t> locs(starts);
+	std::priority_queue<head, std::vector<head>, head_greater> queue;
 	for (size_t i = 0; i < arrs.size(); i++) {
-		size_t len = get_length<T>(arrs[i]);
-		indexed_arrs[i] = std::pair<indexed_entry *, indexed_entry *>(
-				&buf[off], &buf[off + len]);
-		off += len;
+		if (locs[i] < ends[i]) {
+			head h;
+			h.val = arrs[i].first[locs[i]];
+			h.arr_idx = i;
+			queue.push(h);
+		}
 	}
-	assert(off == out_num);
 
-#if defined(_OPENMP)
-	struct {
-		bool operator()(const indexed_entry &e1, const indexed_entry &e2) const {
-			return e1.val < e2.val;
+	size_t out_idx = get_range_start(range_idx);
+	while (!queue.empty()) {
+		head h = queue.top();
+		queue.pop();
+		output[out_idx] = h.val;
+		if (merge_index) {
+			merge_index[out_idx].first = h.arr_idx;
+			merge_index[out_idx].second = locs[h.arr_idx];
+		}
+		out_idx++;
+		if (++locs[h.arr_idx] < ends[h.arr_idx]) {
+			h.val = arrs[h.arr_idx].first[locs[h.arr_idx]];
+			queue.push(h);
 		}
-	} entry_less;
-	std::unique_ptr<indexed_entry[]> merge_res(new indexed_entry[out_num]);
-	__gnu_parallel::multiway_merge(indexed_arrs.begin(), indexed_arrs.end(),
-			merge_res.get(), out_num, entry_less);
-	T *t_output = (T *) output;
-	for (size_t i = 0; i < out_num; i++) {
-		t_output[i] = merge_res[i].val;
-		merge_index[i].first = merge_res[i].arr_idx;
-		merge_index[i].second = merge_res[i].off_in_arr;
 	}
-#else
-	assert(0);
-#endif
+}
+
+/*
+ * Merge multiple arrays and return the merged result as well as how
+ * the arrays are merged.
+ */
+template<class T>
+void type_sorter<T>::merge_with_index(
+		const std::vector<std::pair<const char *, const char *> > &arrs,
+		char *output, size_t out_num,
+		std::vector<std::pair<int, off_t> > &merge_index) const
+{
+	std::vector<std::pair<const T *, const T *> > t_arrs(arrs.size());
+	size_t num_eles = 0;
+	for (size_t i = 0; i < arrs.size(); i++) {
+		t_arrs[i] = std::pair<const T *, const T *>((const T *) arrs[i].first,
+				(const T *) arrs[i].second);
+		num_eles += get_length<T>(arrs[i]);
+	}
+	assert(num_eles == out_num);
+	assert(merge_index.size() >= out_num);
+
+	range_merger<T> merger(t_arrs, out_num);
+#pragma omp parallel for schedule(dynamic, 1)
+	for (size_t i = 0; i < merger.get_num_ranges(); i++)
+		merger.merge(i, (T *) output, merge_index.data());
 }
 
 }
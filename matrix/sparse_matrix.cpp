@@ -32,6 +32,9 @@
 #include "sink_matrix.h"
 #include "col_vec.h"
 #include "combined_matrix_store.h"
+#include "spgemm.h"
+#include "spmm_tuner.h"
+#include "fm_utils.h"
 
 namespace fm
 {
@@ -478,6 +481,67 @@ bool sparse_matrix::compute(detail::task_creator::ptr creator,
 namespace detail
 {
 
+static block_exec_order::ptr create_multiply_order(size_t num_block_rows,
+		size_t num_block_cols, bool hilbert)
+{
+	if (num_block_rows != num_block_cols) {
+		BOOST_LOG_TRIVIAL(error) << "hilbert order requires a square.";
+		return block_exec_order::ptr();
+	}
+	double log2_nbr = log2(num_block_rows);
+	if (log2_nbr != floor(log2_nbr)) {
+		BOOST_LOG_TRIVIAL(error)
+			<< "hilbert order requires a dimension of 2^n";
+		return block_exec_order::ptr();
+	}
+	if (hilbert)
+		return block_exec_order::ptr(new hilbert_exec_order(num_block_rows));
+	else
+		return block_exec_order::ptr(new seq_exec_order());
+}
+
+/*
+ * The non-zero values stored in 16-bit floating-point formats are
+ * converted to float in SpMM.
+ */
+template<class SparseType>
+static task_creator::ptr create_enc_multiply_creator(const sparse_matrix &mat,
+		const scalar_type &type, size_t num_in_cols)
+{
+	if (type == get_scalar_type<float>())
+		return spmm_creator<float, SparseType>::create(mat, num_in_cols);
+	else if (type == get_scalar_type<double>())
+		return spmm_creator<double, SparseType>::create(mat, num_in_cols);
+	else {
+		BOOST_LOG_TRIVIAL(error)
+			<< "A sparse matrix with 16-bit floating-point values can only multiply a float or double matrix";
+		return task_creator::ptr();
+	}
+}
+
+static task_creator::ptr create_multiply_creator(const sparse_matrix &mat,
+		const scalar_type &type, size_t num_in_cols)
+{
+	if (mat.get_val_encoding() == spm_val_encoding::FP16)
+		return create_enc_multiply_creator<fp16_t>(mat, type, num_in_cols);
+	else if (mat.get_val_encoding() == spm_val_encoding::BF16)
+		return create_enc_multiply_creator<bf16_t>(mat, type, num_in_cols);
+	else if (type == get_scalar_type<int>())
+		return spmm_creator<int, int>::create(mat, num_in_cols);
+	else if (type == get_scalar_type<long>())
+		return spmm_creator<long, long>::create(mat, num_in_cols);
+	else if (type == get_scalar_type<size_t>())
+		return spmm_creator<size_t, size_t>::create(mat, num_in_cols);
+	else if (type == get_scalar_type<float>())
+		return spmm_creator<float, float>::create(mat, num_in_cols);
+	else if (type == get_scalar_type<double>())
+		return spmm_creator<double, double>::create(mat, num_in_cols);
+	else {
+		BOOST_LOG_TRIVIAL(error) << "unsupported type";
+		return task_creator::ptr();
+	}
+}
+
 class block_sparse_matrix: public sparse_matrix
 {
 	// If the matrix is stored in the native format and is partitioned
@@ -494,6 +558,7 @@ public:
 				index->get_header().get_2d_block_size()) {
 		this->index = index;
 		factory = mat->create_io_factory();
+		set_val_encoding(index->get_header().get_val_encoding());
 	}
 
 	block_sparse_matrix(SpM_2d_index::ptr index,
@@ -504,6 +569,7 @@ public:
 				index->get_header().get_2d_block_size()) {
 		this->index = index;
 		this->factory = factory;
+		set_val_encoding(index->get_header().get_val_encoding());
 	}
 
 	virtual safs::file_io_factory::shared_ptr get_io_factory() const {
@@ -524,8 +590,11 @@ public:
 		// should fill the entire CPU cache. If the output matrix is written
 		// to disks, the super block should also be large enough so that
 		// each write to disks is large enough to have high I/O throughput.
-		size_t sblock_size = detail::cal_super_block_size(get_block_size(),
-				in.get_entry_size() * in.get_num_cols());
+		return create_sb_io_gen(get_super_block_size(
+					in.get_entry_size() * in.get_num_cols()));
+	}
+
+	matrix_io_generator::ptr create_sb_io_gen(size_t sblock_size) const {
 		return matrix_io_generator::create(index, factory->get_file_id(),
 				sblock_size, 1);
 	}
@@ -542,39 +611,15 @@ public:
 	}
 
 	virtual block_exec_order::ptr get_multiply_order(
-			size_t num_block_rows, size_t num_block_cols) const {
-		if (num_block_rows != num_block_cols) {
-			BOOST_LOG_TRIVIAL(error) << "hilbert order requires a square.";
-			return block_exec_order::ptr();
-		}
-		double log2_nbr = log2(num_block_rows);
-		if (log2_nbr != floor(log2_nbr)) {
-			BOOST_LOG_TRIVIAL(error)
-				<< "hilbert order requires a dimension of 2^n";
-			return block_exec_order::ptr();
-		}
-		if (matrix_conf.use_hilbert_order())
-			return block_exec_order::ptr(new hilbert_exec_order(num_block_rows));
-		else
-			return block_exec_order::ptr(new seq_exec_order());
+			size_t num_block_rows, size_t num_block_cols,
+			size_t row_size) const {
+		return create_multiply_order(num_block_rows, num_block_cols,
+				use_hilbert_order(row_size));
 	}
 
 	virtual detail::task_creator::ptr get_multiply_creator(
 			const scalar_type &type, size_t num_in_cols) const {
-		if (type == get_scalar_type<int>())
-			return detail::spmm_creator<int, int>::create(*this, num_in_cols);
-		else if (type == get_scalar_type<long>())
-			return detail::spmm_creator<long, long>::create(*this, num_in_cols);
-		else if (type == get_scalar_type<size_t>())
-			return detail::spmm_creator<size_t, size_t>::create(*this, num_in_cols);
-		else if (type == get_scalar_type<float>())
-			return detail::spmm_creator<float, float>::create(*this, num_in_cols);
-		else if (type == get_scalar_type<double>())
-			return detail::spmm_creator<double, double>::create(*this, num_in_cols);
-		else {
-			BOOST_LOG_TRIVIAL(error) << "unsupported type";
-			return detail::task_creator::ptr();
-		}
+		return create_multiply_creator(*this, type, num_in_cols);
 	}
 	virtual col_vec::ptr get_diag() const;
 };
@@ -584,8 +629,8 @@ class block_sparse_asym_matrix: public sparse_matrix
 	// If the matrix is stored in the native format and is partitioned
 	// in two dimensions, we need to know the block size.
 	block_2d_size block_size;
-	block_sparse_matrix::ptr mat;
-	block_sparse_matrix::ptr t_mat;
+	std::shared_ptr<block_sparse_matrix> mat;
+	std::shared_ptr<block_sparse_matrix> t_mat;
 public:
 	block_sparse_asym_matrix(SpM_2d_index::ptr index, SpM_2d_storage::ptr mat,
 			SpM_2d_index::ptr t_index, SpM_2d_storage::ptr t_mat): sparse_matrix(
@@ -593,9 +638,11 @@ public:
 				index->get_header().get_num_cols(),
 				&index->get_header().get_data_type(), false), block_size(
 				index->get_header().get_2d_block_size()) {
-		this->mat = block_sparse_matrix::ptr(new block_sparse_matrix(index, mat));
-		this->t_mat = block_sparse_matrix::ptr(new block_sparse_matrix(t_index,
-					t_mat));
+		set_val_encoding(index->get_header().get_val_encoding());
+		this->mat = std::shared_ptr<block_sparse_matrix>(
+				new block_sparse_matrix(index, mat));
+		this->t_mat = std::shared_ptr<block_sparse_matrix>(
+				new block_sparse_matrix(t_index, t_mat));
 	}
 
 	block_sparse_asym_matrix(SpM_2d_index::ptr index,
@@ -606,9 +653,11 @@ public:
 				index->get_header().get_num_cols(),
 				&index->get_header().get_data_type(), false), block_size(
 				index->get_header().get_2d_block_size()) {
-		this->mat = block_sparse_matrix::ptr(new block_sparse_matrix(index, mat_io_fac));
-		this->t_mat = block_sparse_matrix::ptr(new block_sparse_matrix(t_index,
-					t_mat_io_fac));
+		set_val_encoding(index->get_header().get_val_encoding());
+		this->mat = std::shared_ptr<block_sparse_matrix>(
+				new block_sparse_matrix(index, mat_io_fac));
+		this->t_mat = std::shared_ptr<block_sparse_matrix>(
+				new block_sparse_matrix(t_index, t_mat_io_fac));
 	}
 
 	virtual safs::file_io_factory::shared_ptr get_io_factory() const {
@@ -627,7 +676,8 @@ public:
 
 	virtual matrix_io_generator::ptr create_io_gen(
 			const detail::matrix_store &in) const {
-		return mat->create_io_gen(in);
+		return mat->create_sb_io_gen(get_super_block_size(
+					in.get_entry_size() * in.get_num_cols()));
 	}
 
 	virtual const block_2d_size &get_block_size() const {
@@ -640,26 +690,15 @@ public:
 	}
 
 	virtual block_exec_order::ptr get_multiply_order(
-			size_t num_block_rows, size_t num_block_cols) const {
-		return mat->get_multiply_order(num_block_rows, num_block_cols);
+			size_t num_block_rows, size_t num_block_cols,
+			size_t row_size) const {
+		return create_multiply_order(num_block_rows, num_block_cols,
+				use_hilbert_order(row_size));
 	}
 
 	virtual detail::task_creator::ptr get_multiply_creator(
 			const scalar_type &type, size_t num_in_cols) const {
-		if (type == get_scalar_type<int>())
-			return detail::spmm_creator<int, int>::create(*this, num_in_cols);
-		else if (type == get_scalar_type<long>())
-			return detail::spmm_creator<long, long>::create(*this, num_in_cols);
-		else if (type == get_scalar_type<size_t>())
-			return detail::spmm_creator<size_t, size_t>::create(*this, num_in_cols);
-		else if (type == get_scalar_type<float>())
-			return detail::spmm_creator<float, float>::create(*this, num_in_cols);
-		else if (type == get_scalar_type<double>())
-			return detail::spmm_creator<double, double>::create(*this, num_in_cols);
-		else {
-			BOOST_LOG_TRIVIAL(error) << "unsupported type";
-			return detail::task_creator::ptr();
-		}
+		return create_multiply_creator(*this, type, num_in_cols);
 	}
 	virtual col_vec::ptr get_diag() const;
 };
@@ -830,6 +869,77 @@ dense_matrix::ptr sparse_matrix::multiply(dense_matrix::ptr right_mat,
 	}
 }
 
+sparse_matrix::ptr sparse_matrix::multiply(sparse_matrix::ptr right_mat,
+		const std::string &out_name, size_t mem_size) const
+{
+	return detail::spgemm(*this, *right_mat, out_name, mem_size);
+}
+
+sparse_matrix::ptr sparse_matrix::multiply_ele(sparse_matrix::ptr right_mat) const
+{
+	return detail::multiply_ele(*this, *right_mat);
+}
+
+bool sparse_matrix::is_spmm_tuned(size_t row_size) const
+{
+	// SpMM rounds the number of columns of the dense matrix to 2^n when
+	// it splits the dense matrix, so the dense matrices whose row sizes
+	// are rounded to the same 2^n share the tuned parameters.
+	return spmm_conf.sb_size > 0 && row_size > 0
+		&& (size_t) log2(row_size) == (size_t) log2(spmm_conf.row_size);
+}
+
+size_t sparse_matrix::get_super_block_size(size_t row_size) const
+{
+	if (is_spmm_tuned(row_size))
+		return spmm_conf.sb_size;
+	else
+		return detail::cal_super_block_size(get_block_size(), row_size);
+}
+
+bool sparse_matrix::use_hilbert_order(size_t row_size) const
+{
+	if (is_spmm_tuned(row_size))
+		return spmm_conf.hilbert_order;
+	else
+		return matrix_conf.use_hilbert_order();
+}
+
+detail::spmm_params sparse_matrix::tune_spmm(size_t num_in_cols,
+		const scalar_type &type)
+{
+	detail::spmm_params params = detail::tune_spmm(*this,
+			num_in_cols * type.get_size());
+	// The parameters are computed for the recommended block size. We can
+	// only use them if the matrix already has the block size.
+	const block_2d_size &block_size = get_block_size();
+	if (params.block_size.get_num_rows() == block_size.get_num_rows()
+			&& params.block_size.get_num_cols() == block_size.get_num_cols())
+		spmm_conf = params;
+	else
+		spmm_conf = detail::spmm_params();
+	return params;
+}
+
+sparse_matrix::ptr sparse_matrix::reblock(const block_2d_size &block_size) const
+{
+	data_frame::ptr df = detail::conv2el(*this);
+	if (df == NULL)
+		return sparse_matrix::ptr();
+	return create_rect_2d_matrix(df, block_size, get_num_rows(),
+			get_num_cols(), get_entry_size() > 0 ? &get_type() : NULL,
+			is_symmetric());
+}
+
+sparse_matrix::ptr sparse_matrix::compress(spm_val_encoding val_enc) const
+{
+	data_frame::ptr df = detail::conv2el(*this);
+	if (df == NULL)
+		return sparse_matrix::ptr();
+	return create_encoded_2d_matrix(df, get_block_size(), get_num_rows(),
+			get_num_cols(), val_enc, is_symmetric());
+}
+
 static std::atomic<long> init_count;
 
 void init_flash_matrix(config_map::ptr configs)
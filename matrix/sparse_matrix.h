@@ -32,6 +32,7 @@
 #include "local_mem_buffer.h"
 #include "EM_object.h"
 #include "EM_dense_matrix.h"
+#include "simd_kernels.h"
 
 namespace fm
 {
@@ -216,13 +217,61 @@ public:
 	void notify_complete();
 };
 
+/*
+ * This gets the vectorized SpMM kernels for a row width. The kernels only
+ * support float and double. The values of the sparse matrix must have
+ * the same type as the dense matrix if the sparse matrix has values.
+ */
+template<class DenseType, class SparseType>
+class spmm_simd_kernel
+{
+	simd::spmm_kernel<DenseType> kernel;
+	bool has_kernel;
+public:
+	spmm_simd_kernel(size_t row_width) {
+		has_kernel = simd::get_spmm_kernel(row_width, kernel);
+	}
+
+	bool can_run(bool has_val) const {
+		return has_kernel
+			&& (!has_val || std::is_same<DenseType, SparseType>::value);
+	}
+
+	const simd::spmm_kernel<DenseType> &get() const {
+		return kernel;
+	}
+};
+
+/*
+ * This prefetches the input rows of the first non-zero entries in the row
+ * part that starts at `rp', so they are in the CPU cache when the row part
+ * is processed. The row parts end with an empty row part at `rp_end'.
+ */
+template<class DenseType>
+void prefetch_rpart_rows(const uint16_t *rp, const uint16_t *rp_end,
+		const DenseType *in_rows, size_t row_width)
+{
+	static const size_t num_prefetch = 4;
+	if (rp_end == NULL || rp >= rp_end)
+		return;
+	// Skip the row index.
+	const uint16_t *cols = rp + 1;
+	for (size_t i = 0; i < num_prefetch
+			&& cols[i] <= (size_t) std::numeric_limits<int16_t>::max(); i++)
+		__builtin_prefetch(in_rows + row_width * cols[i]);
+}
+
 template<class DenseType, class SparseType, int ROW_WIDTH>
 class row_part_func
 {
 	size_t row_width;
+	const uint16_t *rp_end;
+	spmm_simd_kernel<DenseType, SparseType> simd_kernel;
 public:
-	row_part_func(size_t row_width) {
+	row_part_func(size_t row_width, const char *rp_end): simd_kernel(
+			row_width) {
 		this->row_width = row_width;
+		this->rp_end = (const uint16_t *) rp_end;
 		assert(ROW_WIDTH == row_width);
 	}
 
@@ -233,6 +282,18 @@ public:
 		size_t row_idx = it.get_rel_row_idx();
 		DenseType *dest_row = out_rows + ROW_WIDTH * row_idx;
 		bool has_val = it.get_entry_size() > 0;
+		size_t num = it.get_num_remaining();
+		prefetch_rpart_rows(it.get_curr_col_idxs() + num, rp_end, in_rows,
+				ROW_WIDTH);
+		if (simd_kernel.can_run(has_val)) {
+			const DenseType *vals = NULL;
+			if (has_val)
+				vals = (const DenseType *) it.get_curr_data();
+			simd_kernel.get().row(num, it.get_curr_col_idxs(), vals, in_rows,
+					dest_row);
+			it.skip(num);
+			return it;
+		}
 		while (it.has_next()) {
 			SparseType data = 1;
 			if (has_val)
@@ -250,9 +311,11 @@ template<class DenseType, class SparseType>
 class row_part_func<DenseType, SparseType, 0>
 {
 	size_t row_width;
+	const uint16_t *rp_end;
 public:
-	row_part_func(size_t row_width) {
+	row_part_func(size_t row_width, const char *rp_end) {
 		this->row_width = row_width;
+		this->rp_end = (const uint16_t *) rp_end;
 	}
 
 	rp_edge_iterator operator()(rp_edge_iterator it,
@@ -262,6 +325,8 @@ public:
 		size_t row_idx = it.get_rel_row_idx();
 		DenseType *dest_row = out_rows + row_width * row_idx;
 		bool has_val = it.get_entry_size() > 0;
+		prefetch_rpart_rows(it.get_curr_col_idxs() + it.get_num_remaining(),
+				rp_end, in_rows, row_width);
 		while (it.has_next()) {
 			SparseType data = 1;
 			if (has_val)
@@ -279,8 +344,9 @@ template<class DenseType, class SparseType, int ROW_WIDTH>
 class coo_func
 {
 	size_t row_width;
+	spmm_simd_kernel<DenseType, SparseType> simd_kernel;
 public:
-	coo_func(size_t row_width) {
+	coo_func(size_t row_width): simd_kernel(row_width) {
 		this->row_width = row_width;
 		assert(ROW_WIDTH == row_width);
 	}
@@ -290,6 +356,12 @@ public:
 		const SparseType *coo_vals = (const SparseType *) _coo_vals;
 		const DenseType *in_rows = (const DenseType *) _in_rows;
 		DenseType *out_rows = (DenseType *) _out_rows;
+		if (simd_kernel.can_run(coo_vals != NULL)) {
+			// local_coo_t is a pair of uint16_t.
+			simd_kernel.get().coo(num, (const uint16_t *) coos,
+					(const DenseType *) _coo_vals, in_rows, out_rows);
+			return;
+		}
 		for (size_t i = 0; i < num; i++) {
 			local_coo_t coo = coos[i];
 			SparseType data = 1;
@@ -330,7 +402,42 @@ public:
 	}
 };
 
-template<class RpFuncType, class COOFuncType>
+/*
+ * This decodes an encoded block and multiplies it with the dense matrix.
+ */
+template<class DenseType, class SparseType, int ROW_WIDTH>
+class enc_block_func
+{
+	size_t row_width;
+public:
+	enc_block_func(size_t row_width) {
+		this->row_width = row_width;
+		assert(ROW_WIDTH == 0 || ROW_WIDTH == row_width);
+	}
+
+	void operator()(const sparse_block_2d &block, size_t entry_size,
+			const char *_in_rows, char *_out_rows) {
+		// The row width is a constant if ROW_WIDTH isn't 0.
+		const size_t width = ROW_WIDTH > 0 ? ROW_WIDTH : row_width;
+		const DenseType *in_rows = (const DenseType *) _in_rows;
+		DenseType *out_rows = (DenseType *) _out_rows;
+		const SparseType *vals = NULL;
+		if (entry_size > 0)
+			vals = (const SparseType *) block.get_enc_val_start();
+		auto mul = [&](size_t row_idx, size_t col_idx, size_t nz_idx) {
+			SparseType data = 1;
+			if (vals)
+				data = vals[nz_idx];
+			const DenseType *src_row = in_rows + width * col_idx;
+			DenseType *dest_row = out_rows + width * row_idx;
+			for (size_t j = 0; j < width; j++)
+				dest_row[j] += src_row[j] * data;
+		};
+		block.for_each_encoded(mul);
+	}
+};
+
+template<class RpFuncType, class COOFuncType, class EncFuncType>
 class block_spmm_task_impl: public block_spmm_task
 {
 public:
@@ -357,8 +464,13 @@ public:
 		char *out_rows = get_out_rows(out_row_start, num_out_rows);
 		size_t row_width = get_out_matrix().get_num_cols();
 
+		if (block.is_encoded()) {
+			EncFuncType enc_func(row_width);
+			enc_func(block, get_entry_size(), in_rows, out_rows);
+			return;
+		}
 		if (block.has_rparts()) {
-			RpFuncType rp_func(row_width);
+			RpFuncType rp_func(row_width, block.get_rparts_end_addr());
 			rp_edge_iterator it = block.get_first_edge_iterator(get_entry_size());
 			while (!block.is_rparts_end(it)) {
 				it = rp_func(it, in_rows, out_rows);
@@ -389,9 +501,10 @@ class spmm_creator: public task_creator
 	compute_task::ptr create_block_compute_task(const matrix_io &io) const {
 		typedef row_part_func<DenseType, SparseType, ROW_WIDTH> width_rp_func;
 		typedef coo_func<DenseType, SparseType, ROW_WIDTH> width_coo_func;
-		return compute_task::ptr(
-				new block_spmm_task_impl<width_rp_func,  width_coo_func>(
-					in_row_portions, *output, output_stream, io, mat, order));
+		typedef enc_block_func<DenseType, SparseType, ROW_WIDTH> width_enc_func;
+		return compute_task::ptr(new block_spmm_task_impl<width_rp_func,
+				width_coo_func, width_enc_func>(in_row_portions, *output,
+					output_stream, io, mat, order));
 	}
 public:
 	static task_creator::ptr create(const sparse_matrix &mat,
@@ -430,6 +543,8 @@ public:
 			case 4: return create_block_compute_task<4>(io);
 			case 8: return create_block_compute_task<8>(io);
 			case 16: return create_block_compute_task<16>(io);
+			case 32: return create_block_compute_task<32>(io);
+			case 64: return create_block_compute_task<64>(io);
 			default: return create_block_compute_task<0>(io);
 		}
 	}
@@ -462,6 +577,30 @@ static inline size_t cal_super_block_size(const block_2d_size &block_size,
 	return std::min(size, max_size);
 }
 
+/*
+ * The parameters that decide how SpMM runs on a 2D-partitioned sparse matrix.
+ */
+struct spmm_params
+{
+	// The block size that suits the dense matrix best. The sparse matrix
+	// needs to be re-blocked to use it.
+	block_2d_size block_size;
+	// The super block size (the number of block rows) for `block_size'.
+	// 0 means it isn't tuned.
+	size_t sb_size;
+	// Whether to process the blocks of a super block in the hilbert order.
+	bool hilbert_order;
+	// The number of bytes in a row of the dense matrix the parameters
+	// are tuned for.
+	size_t row_size;
+
+	spmm_params() {
+		sb_size = 0;
+		hilbert_order = false;
+		row_size = 0;
+	}
+};
+
 }
 
 /*
@@ -480,6 +619,16 @@ class sparse_matrix: public detail::EM_object
 	const scalar_type *entry_type;
 	bool symmetric;
 	detail::EM_object::io_set::ptr ios;
+	// The SpMM parameters tuned for the matrix.
+	detail::spmm_params spmm_conf;
+	// The encoding of the non-zero values.
+	spm_val_encoding val_enc;
+
+	/*
+	 * Whether SpMM is tuned for the dense matrix whose row has
+	 * `row_size' bytes.
+	 */
+	bool is_spmm_tuned(size_t row_size) const;
 
 protected:
 	// This constructor is used for the sparse matrix stored
@@ -490,6 +639,7 @@ protected:
 		this->ncols = num_vertices;
 		this->entry_type = entry_type;
 		this->symmetric = symmetric;
+		this->val_enc = spm_val_encoding::RAW;
 	}
 
 	sparse_matrix(size_t nrows, size_t ncols, const scalar_type *entry_type,
@@ -498,6 +648,11 @@ protected:
 		this->nrows = nrows;
 		this->ncols = ncols;
 		this->entry_type = entry_type;
+		this->val_enc = spm_val_encoding::RAW;
+	}
+
+	void set_val_encoding(spm_val_encoding enc) {
+		this->val_enc = enc;
 	}
 
 	void reset_ios() {
@@ -573,11 +728,51 @@ public:
 	 * All blocks are organized in a rectangular area.
 	 */
 	virtual detail::block_exec_order::ptr get_multiply_order(
-			size_t num_block_rows, size_t num_block_cols) const = 0;
+			size_t num_block_rows, size_t num_block_cols,
+			size_t row_size) const = 0;
 
 	virtual detail::task_creator::ptr get_multiply_creator(
 			const scalar_type &type, size_t num_in_cols) const = 0;
 
+	/*
+	 * Get the super block size for the dense matrix whose row has
+	 * `row_size' bytes. It's the tuned size if SpMM is tuned for
+	 * the matrix and the row size. Otherwise, it's estimated from
+	 * the CPU cache size.
+	 */
+	size_t get_super_block_size(size_t row_size) const;
+	/*
+	 * Whether to process the blocks of a super block in the hilbert order
+	 * for the dense matrix whose row has `row_size' bytes.
+	 */
+	bool use_hilbert_order(size_t row_size) const;
+	/*
+	 * Tune SpMM for dense matrices with `num_in_cols' columns of `type'.
+	 * The tuner estimates the distribution of non-zero entries from
+	 * the sizes of the block rows. The parameters are computed for
+	 * the block size in the returned parameters. If it's the current block
+	 * size, the following SpMM on this matrix with dense matrices of
+	 * the same width uses the super block size and the execution order.
+	 * Otherwise, we can re-block the matrix with reblock() and tune it again.
+	 */
+	detail::spmm_params tune_spmm(size_t num_in_cols, const scalar_type &type);
+	void reset_spmm_params() {
+		spmm_conf = detail::spmm_params();
+	}
+	/*
+	 * Store the matrix with a different block size.
+	 * The new matrix is stored in memory.
+	 */
+	sparse_matrix::ptr reblock(const block_2d_size &block_size) const;
+	/*
+	 * Store the matrix with encoded blocks in memory. The column indices
+	 * are stored as variable-length gaps or bitmaps. `val_enc' decides
+	 * how the non-zero values are stored. A float or double matrix can
+	 * store its values in 16-bit floating-point formats.
+	 */
+	sparse_matrix::ptr compress(
+			spm_val_encoding val_enc = spm_val_encoding::RAW) const;
+
 	/*
 	 * This gets a diagonal of a square sparse matrix.
 	 * If the sparse matrix is rectangular, it returns NULL.
@@ -591,13 +786,19 @@ public:
 			return *entry_type;
 	}
 
+	spm_val_encoding get_val_encoding() const {
+		return val_enc;
+	}
+
 	/*
-	 * The size of a non-zero entry.
+	 * The size of a non-zero entry stored in the matrix.
 	 */
 	size_t get_entry_size() const {
 		// Binary matrix doesn't need to store the non-zero entry.
 		if (entry_type == NULL || *entry_type == get_scalar_type<bool>())
 			return 0;
+		else if (val_enc != spm_val_encoding::RAW)
+			return get_val_encoding_size(val_enc);
 		else
 			return entry_type->get_size();
 	}
@@ -643,6 +844,23 @@ public:
 	dense_matrix::ptr multiply(dense_matrix::ptr right_mat,
 			size_t mem_size = std::numeric_limits<size_t>::max()) const;
 
+	/*
+	 * This multiplies the sparse matrix with another sparse matrix.
+	 * The columns of the right matrix are loaded to memory in panels that
+	 * fit in `mem_size' bytes. If `out_name' isn't empty, the output sparse
+	 * matrix is stored in SAFS with the name. Otherwise, it's stored
+	 * in memory.
+	 */
+	sparse_matrix::ptr multiply(sparse_matrix::ptr right_mat,
+			const std::string &out_name = "",
+			size_t mem_size = std::numeric_limits<size_t>::max()) const;
+	/*
+	 * This performs element-wise multiplication between two sparse matrices.
+	 * The right matrix has to fit in memory. The output sparse matrix
+	 * is stored in memory.
+	 */
+	sparse_matrix::ptr multiply_ele(sparse_matrix::ptr right_mat) const;
+
 	bool multiply(detail::vec_store::const_ptr in,
 			detail::vec_store::ptr out) const {
 		return multiply(in->conv2mat(in->get_length(), 1, true),
@@ -667,9 +885,9 @@ spmm_creator<DenseType, SparseType>::spmm_creator(const sparse_matrix &_mat,
 	// block rows and columns.
 	size_t num_cols = num_in_cols;
 	num_cols = 1 << ((size_t) log2(num_cols));
-	size_t sb_size = cal_super_block_size(mat.get_block_size(),
+	size_t sb_size = mat.get_super_block_size(sizeof(DenseType) * num_cols);
+	order = mat.get_multiply_order(sb_size, sb_size,
 			sizeof(DenseType) * num_cols);
-	order = mat.get_multiply_order(sb_size, sb_size);
 }
 
 template<class DenseType, class SparseType>
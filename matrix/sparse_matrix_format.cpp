@@ -33,8 +33,180 @@ namespace fm
 
 static const size_t MAT_CHUNK_SIZE_LOG = 30;
 
+fp16_t::fp16_t(float f)
+{
+	uint32_t bits;
+	memcpy(&bits, &f, sizeof(bits));
+	uint16_t sign = (bits >> 16) & 0x8000;
+	int exp = ((bits >> 23) & 0xff) - 127 + 15;
+	uint32_t mant = bits & 0x7fffff;
+	// NaN and infinity.
+	if (((bits >> 23) & 0xff) == 0xff)
+		v = sign | 0x7c00 | (mant ? 0x200 : 0);
+	// Overflow.
+	else if (exp >= 0x1f)
+		v = sign | 0x7c00;
+	// Subnormal numbers or zero.
+	else if (exp <= 0) {
+		if (exp < -10)
+			v = sign;
+		else {
+			mant |= 0x800000;
+			int shift = 14 - exp;
+			uint32_t half = mant >> shift;
+			uint32_t rem = mant & ((1U << shift) - 1);
+			uint32_t mid = 1U << (shift - 1);
+			// Round to the nearest even.
+			if (rem > mid || (rem == mid && (half & 1)))
+				half++;
+			v = sign | half;
+		}
+	}
+	else {
+		uint32_t half = (exp << 10) | (mant >> 13);
+		uint32_t rem = mant & 0x1fff;
+		// Round to the nearest even. The carry can go to the exponent.
+		if (rem > 0x1000 || (rem == 0x1000 && (half & 1)))
+			half++;
+		v = sign | half;
+	}
+}
+
+fp16_t::operator float() const
+{
+	uint32_t sign = ((uint32_t) (v & 0x8000)) << 16;
+	uint32_t exp = (v >> 10) & 0x1f;
+	uint32_t mant = v & 0x3ff;
+	uint32_t bits;
+	if (exp == 0x1f)
+		bits = sign | 0x7f800000 | (mant << 13);
+	else if (exp > 0)
+		bits = sign | ((exp - 15 + 127) << 23) | (mant << 13);
+	else if (mant == 0)
+		bits = sign;
+	// Normalize a subnormal number.
+	else {
+		exp = 127 - 15 + 1;
+		while ((mant & 0x400) == 0) {
+			mant <<= 1;
+			exp--;
+		}
+		bits = sign | (exp << 23) | ((mant & 0x3ff) << 13);
+	}
+	float f;
+	memcpy(&f, &bits, sizeof(f));
+	return f;
+}
+
+namespace enc
+{
+
+static size_t get_varint_size(size_t v)
+{
+	if (v < (1 << 7))
+		return 1;
+	else if (v < (1 << 14))
+		return 2;
+	else
+		return 3;
+}
+
+static void encode_varint(size_t v, std::vector<char> &buf)
+{
+	assert(v < (1 << 22));
+	if (v < (1 << 7))
+		buf.push_back(v);
+	else if (v < (1 << 14)) {
+		buf.push_back((v & 0x7f) | 0x80);
+		buf.push_back(v >> 7);
+	}
+	else {
+		buf.push_back((v & 0x7f) | 0x80);
+		buf.push_back(((v >> 7) & 0x7f) | 0x80);
+		buf.push_back(v >> 14);
+	}
+}
+
+}
+
+void sparse_block_2d::encode(uint32_t block_row_idx, uint32_t block_col_idx,
+		const std::vector<std::pair<uint16_t, uint16_t> > &nzs,
+		const char *vals, size_t entry_size, std::vector<char> &buf)
+{
+	assert(!nzs.empty());
+	size_t block_off = buf.size();
+	buf.resize(block_off + sizeof(sparse_block_2d) + sizeof(uint32_t));
+	size_t idx_start = buf.size();
+
+	size_t nrow = 0;
+	size_t next_row = 0;
+	for (size_t start = 0; start < nzs.size(); ) {
+		size_t row = nzs[start].first;
+		size_t end = start;
+		while (end < nzs.size() && nzs[end].first == row)
+			end++;
+
+		// Calculate the size of the row stored as gaps.
+		size_t gap_size = enc::get_varint_size(end - start - 1)
+			+ enc::get_varint_size(nzs[start].second);
+		for (size_t i = start + 1; i < end; i++)
+			gap_size += enc::get_varint_size(
+					nzs[i].second - nzs[i - 1].second - 1);
+		// Calculate the size of the row stored as a bitmap.
+		size_t first_word = nzs[start].second / 64;
+		size_t num_words = nzs[end - 1].second / 64 - first_word + 1;
+		size_t bitmap_size = enc::get_varint_size(first_word)
+			+ enc::get_varint_size(num_words) + num_words * sizeof(uint64_t);
+
+		bool use_bitmap = bitmap_size < gap_size;
+		enc::encode_varint(((row - next_row) << 1) | use_bitmap, buf);
+		if (use_bitmap) {
+			enc::encode_varint(first_word, buf);
+			enc::encode_varint(num_words, buf);
+			std::vector<uint64_t> words(num_words);
+			for (size_t i = start; i < end; i++) {
+				size_t col = nzs[i].second - first_word * 64;
+				words[col / 64] |= 1UL << (col % 64);
+			}
+			const char *p = (const char *) words.data();
+			buf.insert(buf.end(), p, p + num_words * sizeof(uint64_t));
+		}
+		else {
+			enc::encode_varint(end - start - 1, buf);
+			enc::encode_varint(nzs[start].second, buf);
+			for (size_t i = start + 1; i < end; i++)
+				enc::encode_varint(nzs[i].second - nzs[i - 1].second - 1, buf);
+		}
+		nrow++;
+		next_row = row + 1;
+		start = end;
+	}
+	// Align the values.
+	buf.resize(ROUNDUP(buf.size() - block_off, sizeof(uint64_t)) + block_off);
+	uint32_t idx_size = buf.size() - idx_start;
+	if (entry_size > 0)
+		buf.insert(buf.end(), vals, vals + nzs.size() * entry_size);
+
+	sparse_block_2d *block = new (buf.data() + block_off) sparse_block_2d(
+			block_row_idx, block_col_idx | ENC_FLAG, nzs.size(), nrow, 0);
+	memcpy(block->row_parts, &idx_size, sizeof(idx_size));
+	assert(block->get_size(entry_size) == buf.size() - block_off);
+}
+
 void sparse_block_2d::verify(const block_2d_size &block_size) const
 {
+	if (is_encoded()) {
+		size_t num_nz = 0;
+		auto check = [&](size_t row, size_t col, size_t idx) {
+			assert(row < block_size.get_num_rows());
+			assert(col < block_size.get_num_cols());
+			num_nz++;
+		};
+		for_each_encoded(check);
+		assert(num_nz == nnz);
+		return;
+	}
+
 	size_t rel_row_id = 0;
 	size_t num_rows = 0;
 	if (has_rparts()) {
@@ -62,9 +234,16 @@ void sparse_block_2d::verify(const block_2d_size &block_size) const
 std::vector<coo_nz_t> sparse_block_2d::get_non_zeros(
 		const block_2d_size &block_size) const
 {
-	size_t row_begin = block_row_idx * block_size.get_num_rows();
-	size_t col_begin = block_col_idx * block_size.get_num_cols();
+	size_t row_begin = get_block_row_idx() * block_size.get_num_rows();
+	size_t col_begin = get_block_col_idx() * block_size.get_num_cols();
 	std::vector<coo_nz_t> ret;
+	if (is_encoded()) {
+		auto add = [&](size_t row, size_t col, size_t idx) {
+			ret.push_back(coo_nz_t(row_begin + row, col_begin + col));
+		};
+		for_each_encoded(add);
+		return ret;
+	}
 	if (has_rparts()) {
 		rp_edge_iterator it = get_first_edge_iterator();
 		while (!is_rparts_end(it)) {
@@ -333,6 +512,16 @@ SpM_2d_storage::ptr SpM_2d_storage::create(const vector_vector &vv,
 	return ptr(new SpM_2d_storage(data, index, "anonymous"));
 }
 
+SpM_2d_storage::ptr SpM_2d_storage::create(const char *mat_data, size_t size,
+		SpM_2d_index::ptr index)
+{
+	NUMA_mapper mapper(safs::params.get_num_nodes(), MAT_CHUNK_SIZE_LOG);
+	safs::NUMA_buffer::ptr data = safs::NUMA_buffer::create(
+			ROUNDUP(size, PAGE_SIZE), mapper);
+	data->copy_from(mat_data, size, 0);
+	return ptr(new SpM_2d_storage(data, index, "anonymous"));
+}
+
 SpM_2d_storage::ptr SpM_2d_storage::create(const matrix_header &header,
 		const vector_vector &vv, SpM_2d_index::ptr index)
 {
@@ -419,4 +608,40 @@ void SpM_2d_storage::dump(const std::string &mat_file) const
 	data->dump(mat_file);
 }
 
+void SpM_2d_storage::safs_dump(const std::string &mat_file) const
+{
+	safs::safs_file f(safs::get_sys_RAID_conf(), mat_file);
+	bool ret = f.create_file(data->get_length());
+	assert(ret);
+
+	safs::file_io_factory::shared_ptr io_fac = safs::create_io_factory(
+			mat_file, safs::REMOTE_ACCESS);
+	if (io_fac == NULL) {
+		BOOST_LOG_TRIVIAL(error) << boost::format(
+				"can't create io factory for %1%") % mat_file;
+		return;
+	}
+
+	safs::io_interface::ptr io = create_io(io_fac, thread::get_curr_thread());
+	if (io == NULL) {
+		BOOST_LOG_TRIVIAL(error) << boost::format(
+				"can't create io instance for %1%") % mat_file;
+		return;
+	}
+
+	// The data in the NUMA buffer is stored in chunks, so we write
+	// one contiguous piece at a time.
+	const size_t max_write_size = 64 * 1024 * 1024;
+	for (off_t off = 0; (size_t) off < data->get_length(); ) {
+		safs::NUMA_buffer::cdata_info piece = data->get_data(off,
+				std::min(data->get_length() - off, max_write_size));
+		assert(piece.second > 0 && piece.second % PAGE_SIZE == 0);
+		safs::data_loc_t loc(io_fac->get_file_id(), off);
+		safs::io_request req((char *) piece.first, loc, piece.second, WRITE);
+		io->access(&req, 1);
+		io->wait4complete(1);
+		off += piece.second;
+	}
+}
+
 }
@@ -113,6 +113,24 @@ public:
 		rel_col_idx_p++;
 	}
 
+	/*
+	 * The number of the remaining non-zero entries in the row part.
+	 */
+	size_t get_num_remaining() const {
+		const uint16_t *p = rel_col_idx_p;
+		while (*p <= (size_t) std::numeric_limits<int16_t>::max())
+			p++;
+		return p - rel_col_idx_p;
+	}
+
+	const uint16_t *get_curr_col_idxs() const {
+		return rel_col_idx_p;
+	}
+
+	void skip(size_t num) {
+		rel_col_idx_p += num;
+	}
+
 	const char *get_curr_addr() const {
 		return (const char *) rel_col_idx_p;
 	}
@@ -124,6 +142,72 @@ public:
 
 typedef std::pair<size_t, size_t> coo_nz_t;
 
+/*
+ * IEEE 754 half-precision floating-point value.
+ */
+class fp16_t
+{
+	uint16_t v;
+public:
+	fp16_t() {
+		v = 0;
+	}
+	fp16_t(float f);
+	operator float() const;
+};
+
+/*
+ * bfloat16 value, which has the exponent of float and a 7-bit mantissa.
+ */
+class bf16_t
+{
+	uint16_t v;
+public:
+	bf16_t() {
+		v = 0;
+	}
+
+	bf16_t(float f) {
+		uint32_t bits;
+		memcpy(&bits, &f, sizeof(bits));
+		// Keep NaN a NaN.
+		if ((bits & 0x7fffffff) > 0x7f800000)
+			v = (bits >> 16) | 0x40;
+		else
+			// Round to the nearest even.
+			v = (bits + 0x7fff + ((bits >> 16) & 1)) >> 16;
+	}
+
+	operator float() const {
+		uint32_t bits = ((uint32_t) v) << 16;
+		float f;
+		memcpy(&f, &bits, sizeof(f));
+		return f;
+	}
+};
+
+static inline size_t get_val_encoding_size(spm_val_encoding enc)
+{
+	switch (enc) {
+		case spm_val_encoding::FP16: return sizeof(fp16_t);
+		case spm_val_encoding::BF16: return sizeof(bf16_t);
+		default: return 0;
+	}
+}
+
+/*
+ * Read a non-zero value stored with the given encoding.
+ */
+template<class T>
+T read_nz_val(const char *addr, spm_val_encoding enc)
+{
+	switch (enc) {
+		case spm_val_encoding::FP16: return (float) *(const fp16_t *) addr;
+		case spm_val_encoding::BF16: return (float) *(const bf16_t *) addr;
+		default: return *(const T *) addr;
+	}
+}
+
 /*
  * This stores the header of a row part. It doesn't contain any attributes.
  */
@@ -209,10 +293,25 @@ public:
 /*
  * This stores the block of a sparse matrix partitioned in 2D.
  * The block is stored in row major.
+ *
+ * A block can also be encoded to reduce its size. An encoded block has
+ * a 32-bit size of the index region after the block header, followed by
+ * the index region and the non-zero values. The index region stores
+ * the rows with non-zero entries one after another. A row starts with
+ * a varint of the row gap from the previous row, whose lowest bit
+ * indicates how the columns are stored:
+ *	gaps: a varint of the number of non-zero entries minus one, followed
+ *	by a varint of the gap between each column and its previous column,
+ *	bitmap: a varint of the first 64-bit word and a varint of the number
+ *	of words, followed by the words. Dense rows are stored this way.
+ * An encoded block doesn't have row parts or COO entries.
  */
 class sparse_block_2d
 {
+	static const uint32_t ENC_FLAG = 1U << 31;
+
 	uint32_t block_row_idx;
+	// The highest bit indicates whether the block is encoded.
 	uint32_t block_col_idx;
 	// The total number of non-zero entries.
 	uint32_t nnz;
@@ -284,15 +383,22 @@ public:
 	}
 
 	size_t get_block_col_idx() const {
-		return block_col_idx;
+		return block_col_idx & ~ENC_FLAG;
 	}
 
 	bool is_empty() const {
 		return nnz == 0;
 	}
 
+	bool is_encoded() const {
+		return block_col_idx & ENC_FLAG;
+	}
+
 	size_t get_size(size_t entry_size) const {
-		if (entry_size == 0)
+		if (is_encoded())
+			return sizeof(*this) + sizeof(uint32_t) + get_enc_index_size()
+				+ entry_size * nnz;
+		else if (entry_size == 0)
 			return sizeof(*this) + get_rindex_size();
 		else
 			return sizeof(*this) + get_rindex_size() + entry_size * nnz;
@@ -303,7 +409,7 @@ public:
 	 * the row part format.
 	 */
 	bool has_rparts() const {
-		return nnz - num_coo_vals > 0;
+		return !is_encoded() && nnz - num_coo_vals > 0;
 	}
 
 	rp_edge_iterator get_first_edge_iterator() const {
@@ -343,6 +449,13 @@ public:
 			return rp->get_edge_iterator(it.get_curr_data(), entry_size);
 	}
 
+	/*
+	 * The address of the empty row part at the end of the row parts.
+	 */
+	const char *get_rparts_end_addr() const {
+		return (const char *) get_rpart_end();
+	}
+
 	bool is_rparts_end(const rp_edge_iterator &it) const {
 		// If the block doesn't have non-zero entries or there aren't non-zero
 		// entries in the row parts.
@@ -400,8 +513,102 @@ public:
 	}
 
 	void verify(const block_2d_size &block_size) const;
+
+	/*
+	 * The size of the index region in an encoded block.
+	 */
+	size_t get_enc_index_size() const {
+		return *(const uint32_t *) row_parts;
+	}
+
+	const char *get_enc_val_start() const {
+		return row_parts + sizeof(uint32_t) + get_enc_index_size();
+	}
+
+	/*
+	 * Run `func(rel_row_idx, rel_col_idx, nz_idx)' on all non-zero entries
+	 * of an encoded block. `nz_idx' is the location of the non-zero value
+	 * in the value region.
+	 */
+	template<class Func>
+	void for_each_encoded(Func &func) const;
+
+	/*
+	 * Encode a block that has the non-zero entries `nzs' with the relative
+	 * row and column indices. The entries are sorted by rows and then by
+	 * columns. `vals' contains their values, whose size is `entry_size'.
+	 * The encoded block is appended to `buf'.
+	 */
+	static void encode(uint32_t block_row_idx, uint32_t block_col_idx,
+			const std::vector<std::pair<uint16_t, uint16_t> > &nzs,
+			const char *vals, size_t entry_size, std::vector<char> &buf);
 };
 
+namespace enc
+{
+
+/*
+ * The values in an encoded block are smaller than 2^22.
+ */
+static inline const uint8_t *decode_varint(const uint8_t *p, size_t &v)
+{
+	v = p[0] & 0x7f;
+	if (p[0] < 0x80)
+		return p + 1;
+	v |= ((size_t) (p[1] & 0x7f)) << 7;
+	if (p[1] < 0x80)
+		return p + 2;
+	v |= ((size_t) p[2]) << 14;
+	return p + 3;
+}
+
+}
+
+template<class Func>
+void sparse_block_2d::for_each_encoded(Func &func) const
+{
+	assert(is_encoded());
+	const uint8_t *p = (const uint8_t *) (row_parts + sizeof(uint32_t));
+	size_t row_idx = 0;
+	size_t nz_idx = 0;
+	for (size_t i = 0; i < nrow; i++) {
+		size_t h;
+		p = enc::decode_varint(p, h);
+		row_idx += h >> 1;
+		if (h & 1) {
+			size_t first_word, num_words;
+			p = enc::decode_varint(p, first_word);
+			p = enc::decode_varint(p, num_words);
+			for (size_t j = 0; j < num_words; j++) {
+				uint64_t word;
+				memcpy(&word, p, sizeof(word));
+				p += sizeof(word);
+				size_t col_base = (first_word + j) * 64;
+				while (word) {
+					func(row_idx, col_base + __builtin_ctzll(word), nz_idx++);
+					word &= word - 1;
+				}
+			}
+		}
+		else {
+			size_t num_nz, col_idx;
+			p = enc::decode_varint(p, num_nz);
+			num_nz++;
+			p = enc::decode_varint(p, col_idx);
+			func(row_idx, col_idx, nz_idx++);
+			for (size_t j = 1; j < num_nz; j++) {
+				size_t gap;
+				p = enc::decode_varint(p, gap);
+				col_idx += gap + 1;
+				func(row_idx, col_idx, nz_idx++);
+			}
+		}
+		// The next row is at least one row after this one.
+		row_idx++;
+	}
+	assert(nz_idx == nnz);
+}
+
 /*
  * This allows users to iterate the blocks in a block row.
  */
@@ -518,6 +725,8 @@ public:
 	static ptr create(const matrix_header &header, const vector_vector &vv,
 			SpM_2d_index::ptr index);
 	static ptr create(const vector_vector &vv, SpM_2d_index::ptr index);
+	// In this version, the data contains the header.
+	static ptr create(const char *data, size_t size, SpM_2d_index::ptr index);
 
 	static void verify(SpM_2d_index::ptr index, const std::string &mat_file);
 
@@ -527,6 +736,7 @@ public:
 
 	void verify() const;
 	void dump(const std::string &file) const;
+	void safs_dump(const std::string &file) const;
 
 	std::shared_ptr<safs::file_io_factory> create_io_factory() const;
 };
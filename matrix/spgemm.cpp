@@ -0,0 +1,1151 @@
+/*
+ * Copyright 2017 Open Connectome Project (http://openconnecto.me)
+ * Written by Da Zheng (zhengda1936@gmail.com)
+ *
+ * This file is part of FlashMatrix.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <algorithm>
+#include <atomic>
+
+#include "log.h"
+
+#include "spgemm.h"
+#include "sparse_matrix.h"
+#include "fm_utils.h"
+#include "data_frame.h"
+#include "mem_vec_store.h"
+#include "mem_matrix_store.h"
+#include "mem_worker_thread.h"
+#include "matrix_stats.h"
+#include "EM_vector.h"
+#include "local_vec_store.h"
+
+namespace fm
+{
+
+namespace detail
+{
+
+namespace
+{
+
+/*
+ * Run a function on all non-zero entries in a block.
+ * A binary sparse matrix doesn't store non-zero values, so all of its
+ * non-zero values are 1.
+ */
+template<class T, class Func>
+void for_each_nz(const sparse_block_2d &block, const block_2d_size &block_size,
+		size_t entry_size, spm_val_encoding val_enc, Func &func)
+{
+	if (block.is_empty())
+		return;
+
+	size_t row_start = block.get_block_row_idx() * block_size.get_num_rows();
+	size_t col_start = block.get_block_col_idx() * block_size.get_num_cols();
+	if (block.is_encoded()) {
+		const char *vals = block.get_enc_val_start();
+		auto enc_func = [&](size_t row_idx, size_t col_idx, size_t nz_idx) {
+			T val = 1;
+			if (entry_size > 0)
+				val = read_nz_val<T>(vals + nz_idx * entry_size, val_enc);
+			func(row_start + row_idx, col_start + col_idx, val);
+		};
+		block.for_each_encoded(enc_func);
+		return;
+	}
+	if (block.has_rparts()) {
+		rp_edge_iterator it = block.get_first_edge_iterator(entry_size);
+		while (!block.is_rparts_end(it)) {
+			size_t row_idx = row_start + it.get_rel_row_idx();
+			while (it.has_next()) {
+				T val = 1;
+				if (entry_size > 0)
+					val = read_nz_val<T>(it.get_curr_data(), val_enc);
+				size_t col_idx = col_start + it.next();
+				func(row_idx, col_idx, val);
+			}
+			it = block.get_next_edge_iterator(it, entry_size);
+		}
+	}
+	const local_coo_t *coos = block.get_coo_start();
+	const char *coo_vals = NULL;
+	if (entry_size > 0)
+		coo_vals = block.get_coo_val_start(entry_size);
+	for (size_t i = 0; i < block.get_num_coo_vals(); i++)
+		func(row_start + coos[i].get_row_idx(),
+				col_start + coos[i].get_col_idx(),
+				coo_vals ? read_nz_val<T>(coo_vals + i * entry_size, val_enc) : 1);
+}
+
+template<class T>
+struct sparse_nz
+{
+	ele_idx_t row;
+	ele_idx_t col;
+	T val;
+
+	sparse_nz(ele_idx_t row, ele_idx_t col, T val) {
+		this->row = row;
+		this->col = col;
+		this->val = val;
+	}
+};
+
+template<class T>
+struct csr_matrix
+{
+	// The location of the first non-zero entry of each row.
+	// It has one more entry than the number of rows.
+	std::vector<size_t> offs;
+	std::vector<ele_idx_t> cols;
+	std::vector<T> vals;
+
+	size_t get_num_rows() const {
+		return offs.size() - 1;
+	}
+
+	size_t get_nnz() const {
+		return cols.size();
+	}
+
+	/*
+	 * Construct the CSR matrix from the non-zero entries collected
+	 * by each thread. The non-zero entries are freed afterwards.
+	 */
+	void init(size_t num_rows, std::vector<std::vector<sparse_nz<T> > > &nzs);
+	/*
+	 * Sort the non-zero entries in each row by the column index.
+	 */
+	void sort_rows();
+
+	/*
+	 * Find the value of a non-zero entry. The rows have to be sorted.
+	 * It returns NULL if the entry doesn't exist.
+	 */
+	const T *find(ele_idx_t row, ele_idx_t col) const {
+		auto start = cols.begin() + offs[row];
+		auto end = cols.begin() + offs[row + 1];
+		auto it = std::lower_bound(start, end, col);
+		if (it == end || *it != col)
+			return NULL;
+		else
+			return &vals[it - cols.begin()];
+	}
+};
+
+template<class T>
+void csr_matrix<T>::init(size_t num_rows,
+		std::vector<std::vector<sparse_nz<T> > > &nzs)
+{
+	offs.clear();
+	offs.resize(num_rows + 1);
+	for (size_t i = 0; i < nzs.size(); i++)
+		for (size_t j = 0; j < nzs[i].size(); j++)
+			offs[nzs[i][j].row + 1]++;
+	for (size_t i = 1; i < offs.size(); i++)
+		offs[i] += offs[i - 1];
+	cols.resize(offs.back());
+	vals.resize(offs.back());
+	std::vector<size_t> locs(offs.begin(), offs.end() - 1);
+	for (size_t i = 0; i < nzs.size(); i++) {
+		for (size_t j = 0; j < nzs[i].size(); j++) {
+			size_t loc = locs[nzs[i][j].row]++;
+			cols[loc] = nzs[i][j].col;
+			vals[loc] = nzs[i][j].val;
+		}
+		std::vector<sparse_nz<T> >().swap(nzs[i]);
+	}
+}
+
+template<class T>
+void csr_matrix<T>::sort_rows()
+{
+#pragma omp parallel
+	{
+		std::vector<std::pair<ele_idx_t, T> > row;
+#pragma omp for
+		for (size_t i = 0; i < get_num_rows(); i++) {
+			row.clear();
+			for (size_t j = offs[i]; j < offs[i + 1]; j++)
+				row.emplace_back(cols[j], vals[j]);
+			std::sort(row.begin(), row.end(),
+					[](const std::pair<ele_idx_t, T> &a,
+						const std::pair<ele_idx_t, T> &b) {
+					return a.first < b.first;
+					});
+			for (size_t j = 0; j < row.size(); j++) {
+				cols[offs[i] + j] = row[j].first;
+				vals[offs[i] + j] = row[j].second;
+			}
+		}
+	}
+}
+
+/*
+ * This is the hash table that accumulates the values of a row in
+ * the output matrix. It uses open addressing with linear probing and
+ * its capacity is always 2^n. We only clear the slots we have used,
+ * so it can be reused by all rows cheaply.
+ */
+template<class T>
+class row_accumulator
+{
+	std::vector<ele_idx_t> keys;
+	std::vector<T> vals;
+	std::vector<size_t> used;
+	size_t mask;
+public:
+	row_accumulator() {
+		mask = 0;
+	}
+
+	/*
+	 * Make sure the hash table can store `max_nnz' entries and
+	 * the hash table is at most half full.
+	 */
+	void reserve(size_t max_nnz) {
+		size_t cap = 16;
+		while (cap < max_nnz * 2)
+			cap *= 2;
+		if (cap > keys.size()) {
+			keys.clear();
+			keys.resize(cap, INVALID_IDX_VAL);
+			vals.resize(cap);
+			mask = cap - 1;
+		}
+	}
+
+	void add(ele_idx_t col, T val) {
+		size_t loc = (col * 2654435761UL) & mask;
+		while (keys[loc] != col && keys[loc] != INVALID_IDX_VAL)
+			loc = (loc + 1) & mask;
+		if (keys[loc] == INVALID_IDX_VAL) {
+			keys[loc] = col;
+			vals[loc] = val;
+			used.push_back(loc);
+		}
+		else
+			vals[loc] += val;
+	}
+
+	/*
+	 * Move the accumulated entries of a row, sorted by the column index,
+	 * to the output and clear the hash table.
+	 */
+	void flush(ele_idx_t row, std::vector<sparse_nz<T> > &out);
+};
+
+template<class T>
+void row_accumulator<T>::flush(ele_idx_t row, std::vector<sparse_nz<T> > &out)
+{
+	size_t start = out.size();
+	for (size_t i = 0; i < used.size(); i++) {
+		out.emplace_back(row, keys[used[i]], vals[used[i]]);
+		keys[used[i]] = INVALID_IDX_VAL;
+	}
+	used.clear();
+	std::sort(out.begin() + start, out.end(),
+			[](const sparse_nz<T> &a, const sparse_nz<T> &b) {
+			return a.col < b.col;
+			});
+}
+
+/*
+ * This is the base class of the task creators that run a function on
+ * the non-zero entries in the columns [col_start, col_end) of a sparse
+ * matrix. The derived class provides `local_func', the function that runs
+ * in the current thread, with get_local_func().
+ */
+class nz_creator: public task_creator
+{
+	size_t col_start;
+	size_t col_end;
+protected:
+	const sparse_matrix &mat;
+public:
+	nz_creator(const sparse_matrix &_mat, size_t col_start,
+			size_t col_end): mat(_mat) {
+		this->col_start = col_start;
+		this->col_end = col_end;
+	}
+
+	size_t get_col_start() const {
+		return col_start;
+	}
+
+	size_t get_col_end() const {
+		return col_end;
+	}
+
+	virtual bool set_data(matrix_store::const_ptr in,
+			matrix_store::ptr out, const block_2d_size &block_size) {
+		return true;
+	}
+
+	virtual std::vector<EM_object *> get_EM_objs() {
+		return std::vector<EM_object *>();
+	}
+
+	virtual void complete() {
+	}
+};
+
+template<class T, class CreatorType>
+class nz_task: public block_compute_task
+{
+	size_t entry_size;
+	spm_val_encoding val_enc;
+	CreatorType &creator;
+public:
+	nz_task(const matrix_io &io, const sparse_matrix &mat,
+			CreatorType &_creator): block_compute_task(io, mat,
+				block_exec_order::ptr(new seq_exec_order())), creator(_creator) {
+		this->entry_size = mat.get_entry_size();
+		this->val_enc = mat.get_val_encoding();
+	}
+
+	virtual void run_on_block(const sparse_block_2d &block) {
+		size_t col_start = creator.get_col_start();
+		size_t col_end = creator.get_col_end();
+		size_t block_start = block.get_block_col_idx()
+			* block_size.get_num_cols();
+		size_t block_end = block_start + block_size.get_num_cols();
+		if (block_end <= col_start || block_start >= col_end)
+			return;
+
+		typename CreatorType::local_func func = creator.get_local_func();
+		if (block_start >= col_start && block_end <= col_end)
+			for_each_nz<T>(block, block_size, entry_size, val_enc, func);
+		else {
+			// The block is only partially in the range.
+			auto range_func = [&](size_t row, size_t col, T val) {
+				if (col >= col_start && col < col_end)
+					func(row, col, val);
+			};
+			for_each_nz<T>(block, block_size, entry_size, val_enc, range_func);
+		}
+	}
+
+	virtual void notify_complete() {
+	}
+};
+
+/*
+ * The task creator collects the non-zero entries of a sparse matrix.
+ * Each thread stores the non-zero entries it reads separately.
+ */
+template<class T>
+class gather_creator: public nz_creator
+{
+	std::vector<std::vector<sparse_nz<T> > > nzs;
+public:
+	class local_func
+	{
+		std::vector<sparse_nz<T> > &nzs;
+	public:
+		local_func(std::vector<sparse_nz<T> > &_nzs): nzs(_nzs) {
+		}
+
+		void operator()(size_t row, size_t col, T val) {
+			nzs.emplace_back(row, col, val);
+		}
+	};
+
+	gather_creator(const sparse_matrix &mat, size_t col_start = 0,
+			size_t col_end = std::numeric_limits<size_t>::max()): nz_creator(
+				mat, col_start, col_end) {
+		nzs.resize(mem_thread_pool::get_global_num_threads());
+	}
+
+	local_func get_local_func() {
+		return local_func(nzs[mem_thread_pool::get_curr_thread_id()]);
+	}
+
+	std::vector<std::vector<sparse_nz<T> > > &get_nzs() {
+		return nzs;
+	}
+
+	virtual compute_task::ptr create(const matrix_io &io) const {
+		gather_creator<T> *mutable_this = const_cast<gather_creator<T> *>(this);
+		return compute_task::ptr(new nz_task<T, gather_creator<T> >(io, mat,
+					*mutable_this));
+	}
+};
+
+/*
+ * The task creator counts the non-zero entries in each column.
+ */
+template<class T>
+class col_count_creator: public nz_creator
+{
+	std::unique_ptr<std::atomic<size_t>[]> counts;
+public:
+	class local_func
+	{
+		std::atomic<size_t> *counts;
+	public:
+		local_func(std::atomic<size_t> *counts) {
+			this->counts = counts;
+		}
+
+		void operator()(size_t row, size_t col, T val) {
+			counts[col].fetch_add(1, std::memory_order_relaxed);
+		}
+	};
+
+	col_count_creator(const sparse_matrix &mat): nz_creator(mat, 0,
+			mat.get_num_cols()), counts(
+				new std::atomic<size_t>[mat.get_num_cols()]) {
+		for (size_t i = 0; i < mat.get_num_cols(); i++)
+			counts[i] = 0;
+	}
+
+	local_func get_local_func() {
+		return local_func(counts.get());
+	}
+
+	const std::atomic<size_t> *get_counts() const {
+		return counts.get();
+	}
+
+	virtual compute_task::ptr create(const matrix_io &io) const {
+		col_count_creator<T> *mutable_this
+			= const_cast<col_count_creator<T> *>(this);
+		return compute_task::ptr(new nz_task<T, col_count_creator<T> >(io, mat,
+					*mutable_this));
+	}
+};
+
+/*
+ * The task creator estimates the memory needed to multiply the left matrix
+ * with the columns of the right matrix. It runs on the right matrix and
+ * counts the non-zero entries and the multiplications in each range of
+ * 2^`range_log' columns. `left_counts' has the number of non-zero entries
+ * in each column of the left matrix.
+ */
+template<class T>
+class panel_cost_creator: public nz_creator
+{
+	const std::atomic<size_t> *left_counts;
+	size_t range_log;
+	std::vector<std::vector<size_t> > nnzs;
+	std::vector<std::vector<size_t> > muls;
+public:
+	class local_func
+	{
+		const std::atomic<size_t> *left_counts;
+		size_t range_log;
+		std::vector<size_t> &nnzs;
+		std::vector<size_t> &muls;
+	public:
+		local_func(const std::atomic<size_t> *left_counts, size_t range_log,
+				std::vector<size_t> &_nnzs, std::vector<size_t> &_muls): nnzs(
+					_nnzs), muls(_muls) {
+			this->left_counts = left_counts;
+			this->range_log = range_log;
+		}
+
+		void operator()(size_t row, size_t col, T val) {
+			nnzs[col >> range_log]++;
+			muls[col >> range_log] += left_counts[row].load(
+					std::memory_order_relaxed);
+		}
+	};
+
+	panel_cost_creator(const sparse_matrix &right,
+			const std::atomic<size_t> *left_counts, size_t range_log,
+			size_t num_ranges): nz_creator(right, 0, right.get_num_cols()) {
+		this->left_counts = left_counts;
+		this->range_log = range_log;
+		size_t num_threads = mem_thread_pool::get_global_num_threads();
+		nnzs.resize(num_threads);
+		muls.resize(num_threads);
+		for (size_t i = 0; i < num_threads; i++) {
+			nnzs[i].resize(num_ranges);
+			muls[i].resize(num_ranges);
+		}
+	}
+
+	local_func get_local_func() {
+		int thread_id = mem_thread_pool::get_curr_thread_id();
+		return local_func(left_counts, range_log, nnzs[thread_id],
+				muls[thread_id]);
+	}
+
+	/*
+	 * The number of bytes used by the non-zero entries of the right matrix
+	 * in a column range and the output entries they generate.
+	 */
+	size_t get_cost(size_t range_idx) const {
+		size_t nnz = 0;
+		size_t num_muls = 0;
+		for (size_t i = 0; i < nnzs.size(); i++) {
+			nnz += nnzs[i][range_idx];
+			num_muls += muls[i][range_idx];
+		}
+		// The non-zero entries are gathered before we build the CSR matrix.
+		// The number of output entries is bounded by the number of
+		// multiplications.
+		return nnz * (sizeof(sparse_nz<T>) + sizeof(ele_idx_t) + sizeof(T))
+			+ num_muls * sizeof(sparse_nz<T>);
+	}
+
+	virtual compute_task::ptr create(const matrix_io &io) const {
+		panel_cost_creator<T> *mutable_this
+			= const_cast<panel_cost_creator<T> *>(this);
+		return compute_task::ptr(new nz_task<T, panel_cost_creator<T> >(io,
+					mat, *mutable_this));
+	}
+};
+
+/*
+ * The task creator multiplies the block rows of the left matrix with
+ * the right matrix in memory. Each thread has its own hash table and
+ * stores the non-zero entries of the output matrix separately.
+ */
+template<class T>
+class spgemm_creator: public task_creator
+{
+	const sparse_matrix &left;
+	const csr_matrix<T> &right;
+	std::vector<row_accumulator<T> > accs;
+	std::vector<std::vector<sparse_nz<T> > > out_nzs;
+public:
+	spgemm_creator(const sparse_matrix &_left,
+			const csr_matrix<T> &_right): left(_left), right(_right) {
+		accs.resize(mem_thread_pool::get_global_num_threads());
+		out_nzs.resize(mem_thread_pool::get_global_num_threads());
+	}
+
+	const csr_matrix<T> &get_right() const {
+		return right;
+	}
+
+	row_accumulator<T> &get_local_acc() {
+		return accs[mem_thread_pool::get_curr_thread_id()];
+	}
+
+	std::vector<sparse_nz<T> > &get_local_out() {
+		return out_nzs[mem_thread_pool::get_curr_thread_id()];
+	}
+
+	std::vector<std::vector<sparse_nz<T> > > &get_out() {
+		return out_nzs;
+	}
+
+	virtual compute_task::ptr create(const matrix_io &io) const;
+
+	virtual bool set_data(matrix_store::const_ptr in,
+			matrix_store::ptr out, const block_2d_size &block_size) {
+		return true;
+	}
+
+	virtual std::vector<EM_object *> get_EM_objs() {
+		return std::vector<EM_object *>();
+	}
+
+	virtual void complete() {
+	}
+};
+
+/*
+ * A task multiplies the block rows it reads with the right matrix.
+ * The blocks of a block row are ordered by the block column index, so
+ * a row of the left matrix is scattered in many blocks. We collect
+ * the non-zero entries of all rows in the block rows first and compute
+ * the output rows one by one when all blocks have been processed.
+ */
+template<class T>
+class block_spgemm_task: public block_compute_task
+{
+	size_t entry_size;
+	spm_val_encoding val_enc;
+	spgemm_creator<T> &creator;
+	std::vector<sparse_nz<T> > left_nzs;
+public:
+	block_spgemm_task(const matrix_io &io, const sparse_matrix &mat,
+			spgemm_creator<T> &_creator): block_compute_task(io, mat,
+				block_exec_order::ptr(new seq_exec_order())), creator(_creator) {
+		this->entry_size = mat.get_entry_size();
+		this->val_enc = mat.get_val_encoding();
+	}
+
+	virtual void run_on_block(const sparse_block_2d &block) {
+		auto add = [this](size_t row, size_t col, T val) {
+			left_nzs.emplace_back(row, col, val);
+		};
+		for_each_nz<T>(block, block_size, entry_size, val_enc, add);
+	}
+
+	virtual void notify_complete();
+};
+
+template<class T>
+void block_spgemm_task<T>::notify_complete()
+{
+	if (left_nzs.empty())
+		return;
+
+	// Group the non-zero entries by rows.
+	std::stable_sort(left_nzs.begin(), left_nzs.end(),
+			[](const sparse_nz<T> &a, const sparse_nz<T> &b) {
+			return a.row < b.row;
+			});
+	const csr_matrix<T> &right = creator.get_right();
+	row_accumulator<T> &acc = creator.get_local_acc();
+	std::vector<sparse_nz<T> > &out = creator.get_local_out();
+	size_t num_muls = 0;
+	for (size_t start = 0; start < left_nzs.size(); ) {
+		ele_idx_t row = left_nzs[start].row;
+		size_t end = start;
+		// The number of non-zero entries in the output row is bounded
+		// by the number of multiplications.
+		size_t max_nnz = 0;
+		for (; end < left_nzs.size() && left_nzs[end].row == row; end++) {
+			ele_idx_t k = left_nzs[end].col;
+			max_nnz += right.offs[k + 1] - right.offs[k];
+		}
+		if (max_nnz > 0) {
+			acc.reserve(max_nnz);
+			for (size_t i = start; i < end; i++) {
+				ele_idx_t k = left_nzs[i].col;
+				T a = left_nzs[i].val;
+				for (size_t j = right.offs[k]; j < right.offs[k + 1]; j++)
+					acc.add(right.cols[j], a * right.vals[j]);
+			}
+			acc.flush(row, out);
+			num_muls += max_nnz;
+		}
+		start = end;
+	}
+	matrix_stats.inc_multiplies(num_muls);
+	std::vector<sparse_nz<T> >().swap(left_nzs);
+}
+
+template<class T>
+compute_task::ptr spgemm_creator<T>::create(const matrix_io &io) const
+{
+	spgemm_creator<T> *mutable_this = const_cast<spgemm_creator<T> *>(this);
+	return compute_task::ptr(new block_spgemm_task<T>(io, left, *mutable_this));
+}
+
+/*
+ * The task creator multiplies the non-zero entries of the left matrix
+ * with the entries in the same location of the right matrix in memory.
+ */
+template<class T>
+class multiply_ele_creator: public nz_creator
+{
+	const csr_matrix<T> &right;
+	std::vector<std::vector<sparse_nz<T> > > out_nzs;
+public:
+	class local_func
+	{
+		const csr_matrix<T> &right;
+		std::vector<sparse_nz<T> > &out;
+	public:
+		local_func(const csr_matrix<T> &_right,
+				std::vector<sparse_nz<T> > &_out): right(_right), out(_out) {
+		}
+
+		void operator()(size_t row, size_t col, T val) {
+			const T *right_val = right.find(row, col);
+			if (right_val)
+				out.emplace_back(row, col, val * *right_val);
+		}
+	};
+
+	multiply_ele_creator(const sparse_matrix &left,
+			const csr_matrix<T> &_right): nz_creator(left, 0,
+				left.get_num_cols()), right(_right) {
+		out_nzs.resize(mem_thread_pool::get_global_num_threads());
+	}
+
+	local_func get_local_func() {
+		return local_func(right, out_nzs[mem_thread_pool::get_curr_thread_id()]);
+	}
+
+	std::vector<std::vector<sparse_nz<T> > > &get_out() {
+		return out_nzs;
+	}
+
+	virtual compute_task::ptr create(const matrix_io &io) const {
+		multiply_ele_creator<T> *mutable_this
+			= const_cast<multiply_ele_creator<T> *>(this);
+		return compute_task::ptr(new nz_task<T, multiply_ele_creator<T> >(io,
+					mat, *mutable_this));
+	}
+};
+
+/*
+ * The sparse matrix computation decides the super block size with
+ * the width of the dense matrix. For SpGEMM, the width of a row
+ * in the right matrix is its average number of non-zero entries.
+ */
+matrix_store::ptr create_width_mat(size_t width, const scalar_type &type)
+{
+	return mem_matrix_store::create(1, std::max(width, 1UL),
+			matrix_layout_t::L_ROW, type, -1);
+}
+
+/*
+ * Convert the non-zero entries collected by each thread to an edge list.
+ * The non-zero entries are freed afterwards.
+ */
+template<class T>
+data_frame::ptr nz2df(std::vector<std::vector<sparse_nz<T> > > &nzs,
+		bool with_attr)
+{
+	size_t nnz = 0;
+	for (size_t i = 0; i < nzs.size(); i++)
+		nnz += nzs[i].size();
+	smp_vec_store::ptr rows = smp_vec_store::create(nnz,
+			get_scalar_type<ele_idx_t>());
+	smp_vec_store::ptr cols = smp_vec_store::create(nnz,
+			get_scalar_type<ele_idx_t>());
+	smp_vec_store::ptr vals;
+	if (with_attr)
+		vals = smp_vec_store::create(nnz, get_scalar_type<T>());
+	size_t idx = 0;
+	for (size_t i = 0; i < nzs.size(); i++) {
+		for (size_t j = 0; j < nzs[i].size(); j++) {
+			rows->set<ele_idx_t>(idx, nzs[i][j].row);
+			cols->set<ele_idx_t>(idx, nzs[i][j].col);
+			if (vals)
+				vals->set<T>(idx, nzs[i][j].val);
+			idx++;
+		}
+		std::vector<sparse_nz<T> >().swap(nzs[i]);
+	}
+
+	data_frame::ptr df = data_frame::create();
+	df->add_vec("source", rows);
+	df->add_vec("dest", cols);
+	if (vals)
+		df->add_vec("attr", vals);
+	return df;
+}
+
+/*
+ * This writes the block rows of a 2D-partitioned sparse matrix one after
+ * another. The matrix image is kept in memory, or is written to SAFS if
+ * the matrix has a name.
+ */
+class block_row_writer
+{
+	matrix_header header;
+	std::string name;
+	std::vector<off_t> offs;
+	std::vector<char> mem_data;
+	EM_vec_store::ptr em_data;
+
+	bool write(const char *data, size_t size);
+public:
+	block_row_writer(const matrix_header &header, const std::string &name);
+
+	const matrix_header &get_header() const {
+		return header;
+	}
+
+	bool append(std::vector<std::vector<char> > &brows);
+	/*
+	 * This finishes writing the matrix. The index is written to SAFS
+	 * with the matrix image. It returns the index and the I/O factory
+	 * to access the matrix image.
+	 */
+	std::pair<SpM_2d_index::ptr, safs::file_io_factory::shared_ptr> finish();
+};
+
+block_row_writer::block_row_writer(const matrix_header &header,
+		const std::string &name)
+{
+	this->header = header;
+	this->name = name;
+	if (!name.empty())
+		em_data = EM_vec_store::create(0, get_scalar_type<char>());
+	// The first block row starts after the matrix header.
+	offs.push_back(sizeof(header));
+	write((const char *) &header, sizeof(header));
+}
+
+bool block_row_writer::write(const char *data, size_t size)
+{
+	if (em_data == NULL) {
+		mem_data.insert(mem_data.end(), data, data + size);
+		return true;
+	}
+	local_buf_vec_store buf(0, size, get_scalar_type<char>(), -1);
+	memcpy(buf.get_raw_arr(), data, size);
+	return em_data->append(buf);
+}
+
+bool block_row_writer::append(std::vector<std::vector<char> > &brows)
+{
+	size_t tot_size = 0;
+	for (size_t i = 0; i < brows.size(); i++)
+		tot_size += brows[i].size();
+	std::vector<char> buf;
+	buf.reserve(tot_size);
+	for (size_t i = 0; i < brows.size(); i++) {
+		buf.insert(buf.end(), brows[i].begin(), brows[i].end());
+		offs.push_back(offs.back() + brows[i].size());
+		std::vector<char>().swap(brows[i]);
+	}
+	return write(buf.data(), buf.size());
+}
+
+std::pair<SpM_2d_index::ptr, safs::file_io_factory::shared_ptr> block_row_writer::finish()
+{
+	std::pair<SpM_2d_index::ptr, safs::file_io_factory::shared_ptr> ret;
+	block_2d_size block_size = header.get_2d_block_size();
+	if (offs.size() != block_size.cal_num_block_rows(header.get_num_rows()) + 1) {
+		BOOST_LOG_TRIVIAL(error) << "The matrix doesn't have all block rows";
+		return ret;
+	}
+	// The matrix is accessed in pages.
+	size_t size = offs.back();
+	std::vector<char> padding(ROUNDUP(size, PAGE_SIZE) - size);
+	if (!padding.empty() && !write(padding.data(), padding.size()))
+		return ret;
+
+	ret.first = SpM_2d_index::create(header, offs);
+	if (ret.first == NULL)
+		return ret;
+	if (em_data == NULL) {
+		ret.second = SpM_2d_storage::create(mem_data.data(), mem_data.size(),
+				ret.first)->create_io_factory();
+		std::vector<char>().swap(mem_data);
+	}
+	else {
+		if (!em_data->set_persistent(name + ".mat")) {
+			BOOST_LOG_TRIVIAL(error) << "can't write the matrix to SAFS";
+			ret.first = NULL;
+			return ret;
+		}
+		em_data = NULL;
+		ret.first->safs_dump(name + ".mat_idx");
+		ret.second = safs::create_io_factory(name + ".mat",
+				safs::REMOTE_ACCESS);
+	}
+	return ret;
+}
+
+/*
+ * Split the output block rows into panels. A panel is a range of columns
+ * of the right matrix whose non-zero entries and output entries fit in
+ * `mem_size' bytes approximately.
+ */
+template<class T>
+bool plan_panels(const sparse_matrix &left, const sparse_matrix &right,
+		const block_2d_size &out_block_size, size_t mem_size,
+		std::vector<std::pair<size_t, size_t> > &panels)
+{
+	size_t num_brows = out_block_size.cal_num_block_rows(right.get_num_cols());
+	if (mem_size == std::numeric_limits<size_t>::max()) {
+		panels.push_back(std::pair<size_t, size_t>(0, num_brows));
+		return true;
+	}
+
+	const scalar_type &type = get_scalar_type<T>();
+	col_count_creator<T> *counter = new col_count_creator<T>(left);
+	task_creator::ptr counter_ptr(counter);
+	if (!left.compute(counter_ptr, *create_width_mat(1, type)))
+		return false;
+	panel_cost_creator<T> *cost = new panel_cost_creator<T>(right,
+			counter->get_counts(), out_block_size.get_nrow_log(), num_brows);
+	task_creator::ptr cost_ptr(cost);
+	if (!right.compute(cost_ptr, *create_width_mat(1, type)))
+		return false;
+
+	// Each panel has a CSR matrix with all rows of the right matrix.
+	size_t fixed_size = (right.get_num_rows() + 1) * sizeof(size_t);
+	size_t budget = mem_size > fixed_size ? mem_size - fixed_size : 0;
+	size_t start = 0;
+	size_t panel_size = 0;
+	for (size_t i = 0; i < num_brows; i++) {
+		size_t brow_size = cost->get_cost(i);
+		if (i > start && panel_size + brow_size > budget) {
+			panels.push_back(std::pair<size_t, size_t>(start, i));
+			start = i;
+			panel_size = 0;
+		}
+		panel_size += brow_size;
+	}
+	panels.push_back(std::pair<size_t, size_t>(start, num_brows));
+	return true;
+}
+
+/*
+ * This multiplies the left matrix with the right matrix one panel at
+ * a time. The columns of the right matrix in a panel are loaded to memory
+ * in the CSR format and the left matrix is streamed from external memory.
+ * The output of a panel is the block rows of the transpose of the output
+ * matrix in the panel, so we pass them to the writer in order.
+ */
+template<class T>
+bool panel_multiply(const sparse_matrix &left, const sparse_matrix &right,
+		size_t mem_size, block_row_writer &writer)
+{
+	const scalar_type &type = get_scalar_type<T>();
+	block_2d_size block_size = writer.get_header().get_2d_block_size();
+	std::vector<std::pair<size_t, size_t> > panels;
+	if (!plan_panels<T>(left, right, block_size, mem_size, panels))
+		return false;
+
+	for (size_t i = 0; i < panels.size(); i++) {
+		size_t col_start = panels[i].first * block_size.get_num_rows();
+		size_t col_end = std::min(panels[i].second * block_size.get_num_rows(),
+				right.get_num_cols());
+		csr_matrix<T> right_csr;
+		{
+			gather_creator<T> *creator = new gather_creator<T>(right,
+					col_start, col_end);
+			task_creator::ptr creator_ptr(creator);
+			if (!right.compute(creator_ptr, *create_width_mat(1, type)))
+				return false;
+			right_csr.init(right.get_num_rows(), creator->get_nzs());
+		}
+
+		spgemm_creator<T> *creator = new spgemm_creator<T>(left, right_csr);
+		task_creator::ptr creator_ptr(creator);
+		size_t width = right_csr.get_nnz() / right_csr.get_num_rows();
+		if (!left.compute(creator_ptr, *create_width_mat(width, type)))
+			return false;
+
+		// Transpose the output entries of the panel.
+		std::vector<std::vector<sparse_nz<T> > > &out = creator->get_out();
+		size_t nnz = 0;
+		for (size_t j = 0; j < out.size(); j++)
+			nnz += out[j].size();
+		std::vector<ele_idx_t> rows(nnz);
+		std::vector<ele_idx_t> cols(nnz);
+		std::vector<T> vals(nnz);
+		size_t idx = 0;
+		for (size_t j = 0; j < out.size(); j++) {
+			for (size_t k = 0; k < out[j].size(); k++) {
+				rows[idx] = out[j][k].col;
+				cols[idx] = out[j][k].row;
+				vals[idx] = out[j][k].val;
+				idx++;
+			}
+			std::vector<sparse_nz<T> >().swap(out[j]);
+		}
+		std::vector<std::vector<char> > brows(panels[i].second
+				- panels[i].first);
+		encode_block_rows(rows.data(), cols.data(), nnz,
+				(const char *) vals.data(), block_size, sizeof(T),
+				panels[i].first, brows);
+		if (!writer.append(brows))
+			return false;
+	}
+	return true;
+}
+
+template<class T>
+sparse_matrix::ptr spgemm(const sparse_matrix &left, const sparse_matrix &right,
+		const std::string &out_name, size_t mem_size)
+{
+	const scalar_type &type = get_scalar_type<T>();
+	const block_2d_size &block_size = left.get_block_size();
+	// The product of a symmetric matrix and itself is symmetric.
+	bool symmetric = &left == &right && left.is_symmetric();
+
+	// The panels of the right matrix generate the block rows of
+	// the transpose of the output matrix.
+	matrix_header t_header(matrix_type::SPARSE, sizeof(T), right.get_num_cols(),
+			left.get_num_rows(), matrix_layout_t::L_ROW_2D, type.get_type(),
+			block_size);
+	std::string t_name;
+	if (!out_name.empty())
+		t_name = symmetric ? out_name : out_name + "_t";
+	block_row_writer t_writer(t_header, t_name);
+	if (!panel_multiply<T>(left, right, mem_size, t_writer))
+		return sparse_matrix::ptr();
+	auto t_mat = t_writer.finish();
+	if (t_mat.first == NULL)
+		return sparse_matrix::ptr();
+	if (symmetric)
+		return sparse_matrix::create(t_mat.first, t_mat.second);
+
+	// The block rows of the output matrix are generated by the transpose
+	// of the product, i.e., t(right) * t(left).
+	matrix_header header(matrix_type::SPARSE, sizeof(T), left.get_num_rows(),
+			right.get_num_cols(), matrix_layout_t::L_ROW_2D, type.get_type(),
+			block_size);
+	block_row_writer writer(header, out_name);
+	sparse_matrix::ptr t_left = right.transpose();
+	sparse_matrix::ptr t_right = left.transpose();
+	if (!panel_multiply<T>(*t_left, *t_right, mem_size, writer))
+		return sparse_matrix::ptr();
+	auto mat = writer.finish();
+	if (mat.first == NULL)
+		return sparse_matrix::ptr();
+	return sparse_matrix::create(mat.first, mat.second, t_mat.first,
+			t_mat.second);
+}
+
+template<class T>
+sparse_matrix::ptr multiply_ele(const sparse_matrix &left,
+		const sparse_matrix &right)
+{
+	const scalar_type &type = get_scalar_type<T>();
+	csr_matrix<T> right_csr;
+	{
+		gather_creator<T> *creator = new gather_creator<T>(right);
+		task_creator::ptr creator_ptr(creator);
+		if (!right.compute(creator_ptr, *create_width_mat(1, type)))
+			return sparse_matrix::ptr();
+		right_csr.init(right.get_num_rows(), creator->get_nzs());
+		right_csr.sort_rows();
+	}
+
+	multiply_ele_creator<T> *creator = new multiply_ele_creator<T>(left,
+			right_csr);
+	task_creator::ptr creator_ptr(creator);
+	if (!left.compute(creator_ptr, *create_width_mat(1, type)))
+		return sparse_matrix::ptr();
+
+	data_frame::ptr df = nz2df<T>(creator->get_out(), true);
+	return create_rect_2d_matrix(df, left.get_block_size(),
+			left.get_num_rows(), left.get_num_cols(), &type,
+			left.is_symmetric() && right.is_symmetric());
+}
+
+template<class T>
+data_frame::ptr conv2el(const sparse_matrix &mat)
+{
+	gather_creator<T> *creator = new gather_creator<T>(mat);
+	task_creator::ptr creator_ptr(creator);
+	if (!mat.compute(creator_ptr, *create_width_mat(1, get_scalar_type<T>())))
+		return data_frame::ptr();
+	return nz2df<T>(creator->get_nzs(), mat.get_entry_size() > 0);
+}
+
+/*
+ * The type of the output matrix of a binary operation on two sparse matrices.
+ * A binary sparse matrix can work with a sparse matrix of any type.
+ * It returns NULL if the two matrices have different types.
+ */
+const scalar_type *get_output_type(const sparse_matrix &left,
+		const sparse_matrix &right)
+{
+	if (left.get_entry_size() == 0)
+		return &right.get_type();
+	else if (right.get_entry_size() == 0)
+		return &left.get_type();
+	else if (left.get_type() == right.get_type())
+		return &left.get_type();
+	else
+		return NULL;
+}
+
+}
+
+sparse_matrix::ptr spgemm(const sparse_matrix &left, const sparse_matrix &right,
+		const std::string &out_name, size_t mem_size)
+{
+	if (left.get_num_cols() != right.get_num_rows()) {
+		BOOST_LOG_TRIVIAL(error)
+			<< "The matrix sizes don't match in SpGEMM";
+		return sparse_matrix::ptr();
+	}
+	if (right.get_num_rows() == 0) {
+		BOOST_LOG_TRIVIAL(error) << "SpGEMM doesn't work on empty matrices";
+		return sparse_matrix::ptr();
+	}
+	if (!out_name.empty() && !safs::is_safs_init()) {
+		BOOST_LOG_TRIVIAL(error)
+			<< "SAFS has to be initialized to store the output matrix";
+		return sparse_matrix::ptr();
+	}
+
+	const scalar_type *type = get_output_type(left, right);
+	if (type == NULL) {
+		BOOST_LOG_TRIVIAL(error)
+			<< "SpGEMM requires sparse matrices of the same type";
+		return sparse_matrix::ptr();
+	}
+
+	if (*type == get_scalar_type<bool>())
+		return spgemm<long>(left, right, out_name, mem_size);
+	else if (*type == get_scalar_type<int>())
+		return spgemm<int>(left, right, out_name, mem_size);
+	else if (*type == get_scalar_type<long>())
+		return spgemm<long>(left, right, out_name, mem_size);
+	else if (*type == get_scalar_type<float>())
+		return spgemm<float>(left, right, out_name, mem_size);
+	else if (*type == get_scalar_type<double>())
+		return spgemm<double>(left, right, out_name, mem_size);
+	else {
+		BOOST_LOG_TRIVIAL(error) << "SpGEMM doesn't support the type";
+		return sparse_matrix::ptr();
+	}
+}
+
+sparse_matrix::ptr multiply_ele(const sparse_matrix &left,
+		const sparse_matrix &right)
+{
+	if (left.get_num_rows() != right.get_num_rows()
+			|| left.get_num_cols() != right.get_num_cols()) {
+		BOOST_LOG_TRIVIAL(error)
+			<< "The matrix sizes don't match in element-wise multiplication";
+		return sparse_matrix::ptr();
+	}
+
+	const scalar_type *type = get_output_type(left, right);
+	if (type == NULL) {
+		BOOST_LOG_TRIVIAL(error)
+			<< "element-wise multiplication requires sparse matrices of the same type";
+		return sparse_matrix::ptr();
+	}
+
+	if (*type == get_scalar_type<bool>())
+		return multiply_ele<long>(left, right);
+	else if (*type == get_scalar_type<int>())
+		return multiply_ele<int>(left, right);
+	else if (*type == get_scalar_type<long>())
+		return multiply_ele<long>(left, right);
+	else if (*type == get_scalar_type<float>())
+		return multiply_ele<float>(left, right);
+	else if (*type == get_scalar_type<double>())
+		return multiply_ele<double>(left, right);
+	else {
+		BOOST_LOG_TRIVIAL(error)
+			<< "element-wise multiplication doesn't support the type";
+		return sparse_matrix::ptr();
+	}
+}
+
+data_frame::ptr conv2el(const sparse_matrix &mat)
+{
+	if (mat.get_entry_size() == 0 || mat.is_type<int>())
+		return conv2el<int>(mat);
+	else if (mat.is_type<long>())
+		return conv2el<long>(mat);
+	else if (mat.is_type<float>())
+		return conv2el<float>(mat);
+	else if (mat.is_type<double>())
+		return conv2el<double>(mat);
+	else {
+		BOOST_LOG_TRIVIAL(error) << "can't convert the sparse matrix type";
+		return data_frame::ptr();
+	}
+}
+
+}
+
+}
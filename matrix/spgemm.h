@@ -0,0 +1,78 @@
+#ifndef __FM_SPGEMM_H__
+#define __FM_SPGEMM_H__
+
+/*
+ * Copyright 2017 Open Connectome Project (http://openconnecto.me)
+ * Written by Da Zheng (zhengda1936@gmail.com)
+ *
+ * This file is part of FlashMatrix.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <memory>
+#include <string>
+
+namespace fm
+{
+
+class sparse_matrix;
+class data_frame;
+
+namespace detail
+{
+
+/*
+ * Multiply two 2D-partitioned sparse matrices.
+ * The right matrix is split into panels of columns, whose non-zero entries
+ * and output entries fit in `mem_size' bytes approximately. The columns
+ * of a panel are loaded to memory in the CSR format, and the left matrix
+ * is streamed from external memory block row by block row. Each row of
+ * the output matrix is accumulated in a hash table. A panel generates
+ * the block rows of the transpose of the output matrix, and t(right) *
+ * t(left) generates the block rows of the output matrix. The block rows
+ * are written one after another with encoded blocks.
+ * If both matrices are binary, the output matrix stores the number of
+ * paths as long integers. If `out_name' is empty, the output matrix is
+ * stored in memory. Otherwise, it's stored in SAFS in the files
+ * "out_name.mat", "out_name.mat_idx" and "out_name_t.mat(_idx)" for
+ * its transpose.
+ */
+std::shared_ptr<sparse_matrix> spgemm(const sparse_matrix &left,
+		const sparse_matrix &right, const std::string &out_name,
+		size_t mem_size);
+
+/*
+ * Multiply two sparse matrices element-wise. The right matrix is loaded
+ * to memory and the left matrix is streamed from external memory.
+ * The output matrix has at most as many non-zero entries as the right
+ * matrix and is stored in memory. As SpGEMM, a binary matrix can work
+ * with a matrix of any type, and the output of two binary matrices stores
+ * long integers. For example, sum(A * (A %*% A)) / 6 counts the triangles
+ * in an undirected graph A.
+ */
+std::shared_ptr<sparse_matrix> multiply_ele(const sparse_matrix &left,
+		const sparse_matrix &right);
+
+/*
+ * Collect the non-zero entries of a 2D-partitioned sparse matrix in
+ * an edge list with the columns "source", "dest" and "attr".
+ * The edge list of a binary matrix doesn't have "attr".
+ */
+std::shared_ptr<data_frame> conv2el(const sparse_matrix &mat);
+
+}
+
+}
+
+#endif
@@ -0,0 +1,164 @@
+/*
+ * Copyright 2017 Open Connectome Project (http://openconnecto.me)
+ * Written by Da Zheng (zhengda1936@gmail.com)
+ *
+ * This file is part of FlashMatrix.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <numeric>
+
+#include <boost/format.hpp>
+
+#include "log.h"
+
+#include "spmm_tuner.h"
+#include "matrix_config.h"
+#include "mem_worker_thread.h"
+
+namespace fm
+{
+
+namespace detail
+{
+
+namespace
+{
+
+/*
+ * The statistics of the non-zero entries in the block rows.
+ */
+struct nnz_stats
+{
+	size_t num_block_rows;
+	double avg_nnz;
+	double max_nnz;
+	double tot_nnz;
+};
+
+/*
+ * Get the statistics of the block rows of `num_rows' rows each.
+ * We only know the number of non-zero entries in the block rows of
+ * the current block size, so we assume the non-zero entries are evenly
+ * distributed in the rows of a current block row and regroup them.
+ */
+nnz_stats get_nnz_stats(const sparse_matrix &mat, size_t num_rows)
+{
+	size_t cur_num_rows = mat.get_block_size().get_num_rows();
+	size_t num_cur_brows = ceil(((double) mat.get_num_rows()) / cur_num_rows);
+	std::vector<off_t> block_row_idxs(num_cur_brows + 1);
+	std::iota(block_row_idxs.begin(), block_row_idxs.end(), 0);
+	std::vector<off_t> offs;
+	mat.get_block_row_offs(block_row_idxs, offs);
+
+	nnz_stats stats;
+	stats.num_block_rows = ceil(((double) mat.get_num_rows()) / num_rows);
+	std::vector<double> nnzs(stats.num_block_rows);
+	// A non-zero entry takes the space of a column index and its value.
+	// The row indices and the block headers are ignored here.
+	size_t nz_size = sparse_row_part::get_col_entry_size()
+		+ mat.get_entry_size();
+	for (size_t i = 0; i < num_cur_brows; i++) {
+		double nnz = ((double) (offs[i + 1] - offs[i])) / nz_size;
+		size_t start = i * cur_num_rows;
+		size_t end = std::min(start + cur_num_rows, mat.get_num_rows());
+		// Split the non-zero entries among the new block rows that
+		// overlap with the current one.
+		for (size_t row = start; row < end;) {
+			size_t new_idx = row / num_rows;
+			size_t new_end = std::min((new_idx + 1) * num_rows, end);
+			nnzs[new_idx] += nnz * (new_end - row) / (end - start);
+			row = new_end;
+		}
+	}
+	stats.max_nnz = 0;
+	stats.tot_nnz = 0;
+	for (size_t i = 0; i < nnzs.size(); i++) {
+		stats.max_nnz = std::max(stats.max_nnz, nnzs[i]);
+		stats.tot_nnz += nnzs[i];
+	}
+	stats.avg_nnz = stats.tot_nnz / stats.num_block_rows;
+	return stats;
+}
+
+size_t floor_pow2(size_t v)
+{
+	return 1UL << ((size_t) log2(std::max(v, 1UL)));
+}
+
+size_t ceil_pow2(size_t v)
+{
+	size_t p = floor_pow2(v);
+	return p < v ? p * 2 : p;
+}
+
+}
+
+spmm_params tune_spmm(const sparse_matrix &mat, size_t row_size)
+{
+	spmm_params params;
+	params.row_size = row_size;
+	nnz_stats stats = get_nnz_stats(mat, mat.get_block_size().get_num_rows());
+	size_t cache_size = matrix_conf.get_cpu_cache_size();
+	double density = stats.tot_nnz / mat.get_num_rows() / mat.get_num_cols();
+
+	// The rows of the dense matrix involved in a block should stay in
+	// the CPU cache. A block is never larger than the matrix.
+	size_t max_bsize = std::min(block_max_num_cols,
+			ceil_pow2(std::max(mat.get_num_rows(), mat.get_num_cols())));
+	size_t bsize = std::min(floor_pow2(cache_size / row_size), max_bsize);
+	bsize = std::max(bsize, std::min(1024UL, max_bsize));
+	// If the matrix is very sparse, a block has only a few non-zero entries
+	// and the overhead of processing a block dominates. We enlarge the block
+	// as long as the dense rows fit in a larger cache shared by threads.
+	const double min_block_nnz = 64;
+	while (bsize < max_bsize && density * bsize * bsize < min_block_nnz
+			&& bsize * 2 * row_size <= cache_size * 4)
+		bsize *= 2;
+	params.block_size = block_2d_size(bsize, bsize);
+	const block_2d_size &block_size = params.block_size;
+	if (block_size.get_num_rows() != mat.get_block_size().get_num_rows())
+		stats = get_nnz_stats(mat, block_size.get_num_rows());
+
+	// The super block size for the recommended block size. It has to be 2^n,
+	// so that the blocks in a super block can be processed in the hilbert
+	// order.
+	size_t sb_size = floor_pow2(cal_super_block_size(block_size, row_size));
+	// A task processes a super block row. If a few block rows have most
+	// of the non-zero entries, we need more tasks to balance the load.
+	size_t min_num_tasks = mem_thread_pool::get_global_num_threads() * 4;
+	const double skew_ratio = 4;
+	if (stats.max_nnz > stats.avg_nnz * skew_ratio)
+		while (sb_size > 1 && stats.num_block_rows / sb_size < min_num_tasks)
+			sb_size /= 2;
+	params.sb_size = sb_size;
+
+	// The hilbert order helps when a super block has many blocks and
+	// the rows of the dense matrix are reused by the non-zero entries
+	// in multiple blocks. It needs at least one non-zero entry per row
+	// in a block on average.
+	double block_nnz = density * block_size.get_num_rows()
+		* block_size.get_num_cols();
+	params.hilbert_order = sb_size >= 4
+		&& block_nnz >= block_size.get_num_rows();
+
+	BOOST_LOG_TRIVIAL(info) << boost::format(
+			"tune SpMM: %1% nnz, block size: %2%, super block size: %3%, hilbert: %4%")
+		% (size_t) stats.tot_nnz % bsize % sb_size % params.hilbert_order;
+	return params;
+}
+
+}
+
+}
@@ -0,0 +1,50 @@
+#ifndef __FM_SPMM_TUNER_H__
+#define __FM_SPMM_TUNER_H__
+
+/*
+ * Copyright 2017 Open Connectome Project (http://openconnecto.me)
+ * Written by Da Zheng (zhengda1936@gmail.com)
+ *
+ * This file is part of FlashMatrix.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "sparse_matrix.h"
+
+namespace fm
+{
+
+namespace detail
+{
+
+/*
+ * This tunes SpMM on a 2D-partitioned sparse matrix for the dense matrix
+ * whose row has `row_size' bytes. It estimates the number of non-zero
+ * entries in each block row from the block row offsets in the index, so
+ * it doesn't need to read the matrix. It chooses:
+ *	the block size that keeps the rows of the dense matrix involved in
+ *	a block in the CPU cache,
+ *	the super block size for the chosen block size, which is reduced
+ *	when a few block rows have most of the non-zero entries,
+ *	the execution order of the blocks in a super block.
+ * The super block size and the execution order are only valid for
+ * the chosen block size and the dense matrix of the same row size.
+ */
+spmm_params tune_spmm(const sparse_matrix &mat, size_t row_size);
+
+}
+
+}
+
+#endif
@@ -0,0 +1,310 @@
+/*
+ * Copyright 2017 Open Connectome Project (http://openconnecto.me)
+ * Written by Da Zheng (zhengda1936@gmail.com)
+ *
+ * This file is part of FlashMatrix.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <math.h>
+#include <cblas.h>
+
+#include "tall_qr.h"
+#include "local_matrix_store.h"
+#include "mem_worker_thread.h"
+#include "materialize.h"
+#include "matrix_stats.h"
+
+namespace fm
+{
+
+namespace detail
+{
+
+namespace
+{
+
+/*
+ * Compute the Householder QR factorization of a column-major matrix
+ * in place. Only the upper triangle of the result (R) is valid.
+ */
+void householder_qr(double *A, size_t nrow, size_t ncol)
+{
+	for (size_t j = 0; j < ncol && j < nrow; j++) {
+		double *v = A + j * nrow;
+		double norm2 = 0;
+		for (size_t i = j; i < nrow; i++)
+			norm2 += v[i] * v[i];
+		if (norm2 == 0)
+			continue;
+		double alpha = v[j] > 0 ? -sqrt(norm2) : sqrt(norm2);
+		// v = x - alpha * e_j
+		double vnorm2 = norm2 - v[j] * v[j];
+		v[j] -= alpha;
+		vnorm2 += v[j] * v[j];
+		for (size_t k = j + 1; k < ncol; k++) {
+			double *c = A + k * nrow;
+			double dot = 0;
+			for (size_t i = j; i < nrow; i++)
+				dot += v[i] * c[i];
+			double s = 2 * dot / vnorm2;
+			for (size_t i = j; i < nrow; i++)
+				c[i] -= s * v[i];
+		}
+		v[j] = alpha;
+	}
+}
+
+/*
+ * Get a portion as a column-major array of doubles. We copy the portion
+ * if its data isn't stored in contiguous memory in column-major order.
+ */
+const double *get_col_arr(const local_matrix_store &portion,
+		local_matrix_store::ptr &buf)
+{
+	if (portion.store_layout() == matrix_layout_t::L_COL
+			&& portion.get_raw_arr())
+		return (const double *) portion.get_raw_arr();
+	buf = local_matrix_store::ptr(new local_buf_col_matrix_store(0, 0,
+				portion.get_num_rows(), portion.get_num_cols(),
+				portion.get_type(), -1));
+	buf->copy_from(portion);
+	return (const double *) buf->get_raw_arr();
+}
+
+class tsqr_portion_op: public portion_mapply_op
+{
+	size_t ncol;
+	// The R factor computed by each thread.
+	std::vector<std::vector<double> > Rs;
+public:
+	tsqr_portion_op(size_t ncol): portion_mapply_op(0, 0,
+			get_scalar_type<double>()) {
+		this->ncol = ncol;
+		Rs.resize(mem_thread_pool::get_global_num_threads());
+	}
+
+	virtual portion_mapply_op::const_ptr transpose() const {
+		return portion_mapply_op::const_ptr();
+	}
+
+	virtual std::string to_string(
+			const std::vector<matrix_store::const_ptr> &mats) const {
+		return std::string("tsqr(") + mats[0]->get_name() + ")";
+	}
+
+	virtual void run(
+			const std::vector<local_matrix_store::const_ptr> &ins) const;
+
+	std::vector<double> get_R() const;
+};
+
+void tsqr_portion_op::run(
+		const std::vector<local_matrix_store::const_ptr> &ins) const
+{
+	assert(ins.size() == 1);
+	assert(ins[0]->get_num_cols() == ncol);
+	int thread_id = mem_thread_pool::get_curr_thread_id();
+	tsqr_portion_op *mutable_this = const_cast<tsqr_portion_op *>(this);
+	std::vector<double> &R = mutable_this->Rs[thread_id];
+
+	local_matrix_store::ptr buf;
+	const double *arr = get_col_arr(*ins[0], buf);
+	size_t nrow = ins[0]->get_num_rows();
+	// We stack the R factor of the thread on top of the portion and
+	// factorize them together.
+	size_t top = R.empty() ? 0 : ncol;
+	size_t stack_nrow = top + nrow;
+	std::vector<double> stack(stack_nrow * ncol);
+	for (size_t j = 0; j < ncol; j++) {
+		double *col = stack.data() + j * stack_nrow;
+		for (size_t i = 0; i < top; i++)
+			col[i] = i <= j ? R[j * ncol + i] : 0;
+		memcpy(col + top, arr + j * nrow, nrow * sizeof(double));
+	}
+	householder_qr(stack.data(), stack_nrow, ncol);
+	matrix_stats.inc_multiplies(2 * stack_nrow * ncol * ncol);
+
+	R.resize(ncol * ncol);
+	for (size_t j = 0; j < ncol; j++)
+		for (size_t i = 0; i < ncol; i++)
+			R[j * ncol + i] = i <= j && i < stack_nrow
+				? stack[j * stack_nrow + i] : 0;
+}
+
+std::vector<double> tsqr_portion_op::get_R() const
+{
+	// Factorize the R factors of all threads.
+	std::vector<const std::vector<double> *> valid;
+	for (size_t i = 0; i < Rs.size(); i++)
+		if (!Rs[i].empty())
+			valid.push_back(&Rs[i]);
+	size_t stack_nrow = valid.size() * ncol;
+	std::vector<double> stack(stack_nrow * ncol);
+	for (size_t k = 0; k < valid.size(); k++)
+		for (size_t j = 0; j < ncol; j++)
+			memcpy(stack.data() + j * stack_nrow + k * ncol,
+					valid[k]->data() + j * ncol, ncol * sizeof(double));
+	householder_qr(stack.data(), stack_nrow, ncol);
+
+	// We make the diagonal of R non-negative, so the factorization
+	// is unique.
+	std::vector<double> R(ncol * ncol);
+	for (size_t i = 0; i < ncol && i < stack_nrow; i++) {
+		double sign = stack[i * stack_nrow + i] < 0 ? -1 : 1;
+		for (size_t j = i; j < ncol; j++)
+			R[j * ncol + i] = sign * stack[j * stack_nrow + i];
+	}
+	return R;
+}
+
+class gram_portion_op: public portion_mapply_op
+{
+	size_t ncol;
+	// The Gram matrix computed by each thread.
+	std::vector<std::vector<double> > grams;
+public:
+	gram_portion_op(size_t ncol): portion_mapply_op(0, 0,
+			get_scalar_type<double>()) {
+		this->ncol = ncol;
+		grams.resize(mem_thread_pool::get_global_num_threads());
+	}
+
+	virtual portion_mapply_op::const_ptr transpose() const {
+		return portion_mapply_op::const_ptr();
+	}
+
+	virtual std::string to_string(
+			const std::vector<matrix_store::const_ptr> &mats) const {
+		return std::string("gram(") + mats[0]->get_name() + ")";
+	}
+
+	virtual void run(
+			const std::vector<local_matrix_store::const_ptr> &ins) const;
+
+	std::vector<double> get_gram() const;
+};
+
+void gram_portion_op::run(
+		const std::vector<local_matrix_store::const_ptr> &ins) const
+{
+	assert(ins.size() == 1);
+	assert(ins[0]->get_num_cols() == ncol);
+	int thread_id = mem_thread_pool::get_curr_thread_id();
+	gram_portion_op *mutable_this = const_cast<gram_portion_op *>(this);
+	std::vector<double> &gram = mutable_this->grams[thread_id];
+	if (gram.empty())
+		gram.resize(ncol * ncol);
+
+	local_matrix_store::ptr buf;
+	const double *arr = get_col_arr(*ins[0], buf);
+	size_t nrow = ins[0]->get_num_rows();
+	cblas_dsyrk(CblasColMajor, CblasUpper, CblasTrans, ncol, nrow, 1,
+			arr, nrow, 1, gram.data(), ncol);
+	matrix_stats.inc_multiplies(nrow * ncol * ncol / 2);
+}
+
+std::vector<double> gram_portion_op::get_gram() const
+{
+	std::vector<double> gram(ncol * ncol);
+	for (size_t k = 0; k < grams.size(); k++) {
+		if (grams[k].empty())
+			continue;
+		for (size_t j = 0; j < ncol; j++)
+			for (size_t i = 0; i <= j; i++)
+				gram[j * ncol + i] += grams[k][j * ncol + i];
+	}
+	// Only the upper triangle is computed by dsyrk.
+	for (size_t j = 0; j < ncol; j++)
+		for (size_t i = j + 1; i < ncol; i++)
+			gram[j * ncol + i] = gram[i * ncol + j];
+	return gram;
+}
+
+}
+
+std::vector<double> tall_tsqr(matrix_store::const_ptr mat)
+{
+	assert(mat->get_type() == get_scalar_type<double>());
+	std::vector<matrix_store::const_ptr> ins(1, mat);
+	tsqr_portion_op *op = new tsqr_portion_op(mat->get_num_cols());
+	portion_mapply_op::const_ptr portion_op(op);
+	__mapply_portion(ins, portion_op, matrix_layout_t::L_COL);
+	return op->get_R();
+}
+
+std::vector<double> tall_gram(matrix_store::const_ptr mat)
+{
+	assert(mat->get_type() == get_scalar_type<double>());
+	std::vector<matrix_store::const_ptr> ins(1, mat);
+	gram_portion_op *op = new gram_portion_op(mat->get_num_cols());
+	portion_mapply_op::const_ptr portion_op(op);
+	__mapply_portion(ins, portion_op, matrix_layout_t::L_COL);
+	return op->get_gram();
+}
+
+bool chol_upper(std::vector<double> &a, size_t n)
+{
+	for (size_t j = 0; j < n; j++) {
+		for (size_t i = 0; i <= j; i++) {
+			double sum = a[j * n + i];
+			for (size_t k = 0; k < i; k++)
+				sum -= a[i * n + k] * a[j * n + k];
+			if (i < j)
+				a[j * n + i] = sum / a[i * n + i];
+			else if (sum <= 0)
+				return false;
+			else
+				a[j * n + j] = sqrt(sum);
+		}
+		for (size_t i = j + 1; i < n; i++)
+			a[j * n + i] = 0;
+	}
+	return true;
+}
+
+bool inv_upper(std::vector<double> &a, size_t n)
+{
+	for (size_t j = 0; j < n; j++) {
+		if (a[j * n + j] == 0)
+			return false;
+		a[j * n + j] = 1 / a[j * n + j];
+		// Column j of the inverse is -inv(A[0:j, 0:j]) * A[0:j, j] / A[j, j].
+		// The columns before j already store the inverse.
+		for (size_t i = 0; i < j; i++) {
+			double sum = 0;
+			for (size_t k = i; k < j; k++)
+				sum += a[k * n + i] * a[j * n + k];
+			a[j * n + i] = sum;
+		}
+		for (size_t i = 0; i < j; i++)
+			a[j * n + i] *= -a[j * n + j];
+	}
+	return true;
+}
+
+std::vector<double> mul_upper(const std::vector<double> &a,
+		const std::vector<double> &b, size_t n)
+{
+	std::vector<double> c(n * n);
+	for (size_t j = 0; j < n; j++)
+		for (size_t k = 0; k <= j; k++)
+			for (size_t i = 0; i <= k; i++)
+				c[j * n + i] += a[k * n + i] * b[j * n + k];
+	return c;
+}
+
+}
+
+}
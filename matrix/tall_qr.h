@@ -0,0 +1,71 @@
+#ifndef __FM_TALL_QR_H__
+#define __FM_TALL_QR_H__
+
+/*
+ * Copyright 2017 Open Connectome Project (http://openconnecto.me)
+ * Written by Da Zheng (zhengda1936@gmail.com)
+ *
+ * This file is part of FlashMatrix.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <vector>
+
+#include "matrix_store.h"
+
+namespace fm
+{
+
+namespace detail
+{
+
+/*
+ * These functions help to compute the QR factorization of a tall matrix
+ * of doubles. The small matrices are stored in column-major order in
+ * std::vector.
+ */
+
+/*
+ * Compute the R factor of a tall matrix with TSQR. Each thread factorizes
+ * the portions it reads together with its current R factor, and the R
+ * factors of all threads are factorized at the end. It reads the matrix
+ * only once.
+ */
+std::vector<double> tall_tsqr(matrix_store::const_ptr mat);
+/*
+ * Compute the Gram matrix t(A) %*% A of a tall matrix. It reads the matrix
+ * only once.
+ */
+std::vector<double> tall_gram(matrix_store::const_ptr mat);
+
+/*
+ * Compute the upper-triangular Cholesky factor of a symmetric matrix
+ * in place. It fails if the matrix isn't numerically positive definite.
+ */
+bool chol_upper(std::vector<double> &a, size_t n);
+/*
+ * Invert an upper-triangular matrix in place.
+ */
+bool inv_upper(std::vector<double> &a, size_t n);
+/*
+ * Multiply two upper-triangular matrices.
+ */
+std::vector<double> mul_upper(const std::vector<double> &a,
+		const std::vector<double> &b, size_t n);
+
+}
+
+}
+
+#endif
@@ -0,0 +1,159 @@
+/*
+ * Copyright 2014 Open Connectome Project (http://openconnecto.me)
+ * Written by Da Zheng (zhengda1936@gmail.com)
+ *
+ * This file is part of FlashMatrix.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "io_interface.h"
+#include "safs_file.h"
+
+#include "sparse_matrix.h"
+#include "fm_utils.h"
+#include "spgemm.h"
+
+using namespace fm;
+
+/*
+ * Load the index of a 2D-partitioned matrix from SAFS or
+ * the Linux filesystem.
+ */
+SpM_2d_index::ptr load_index(const std::string &index_file)
+{
+	if (safs::exist_safs_file(index_file))
+		return SpM_2d_index::safs_load(index_file);
+	else if (safs::native_file(index_file).exist())
+		return SpM_2d_index::load(index_file);
+	else
+		return SpM_2d_index::ptr();
+}
+
+safs::file_io_factory::shared_ptr load_image(const std::string &mat_file,
+		SpM_2d_index::ptr index)
+{
+	// We read the matrix in SAFS directly. A matrix in the Linux filesystem
+	// has to be loaded to memory.
+	if (safs::exist_safs_file(mat_file))
+		return safs::create_io_factory(mat_file, safs::REMOTE_ACCESS);
+	else
+		return SpM_2d_storage::load(mat_file, index)->create_io_factory();
+}
+
+void save_matrix(const std::pair<SpM_2d_index::ptr, SpM_2d_storage::ptr> &mat,
+		const std::string &mat_name, bool to_safs)
+{
+	if (to_safs) {
+		mat.first->safs_dump(mat_name + ".mat_idx");
+		mat.second->safs_dump(mat_name + ".mat");
+	}
+	else {
+		mat.first->dump(mat_name + ".mat_idx");
+		mat.second->dump(mat_name + ".mat");
+	}
+}
+
+void print_usage()
+{
+	fprintf(stderr,
+			"convert a 2D-partitioned matrix to the one with encoded blocks\n");
+	fprintf(stderr, "compress_mat [options] conf_file matrix_name new_matrix_name\n");
+	fprintf(stderr, "-e encoding: the encoding of non-zero values (raw, fp16, bf16)\n");
+	fprintf(stderr, "-s: store the new matrix in SAFS\n");
+}
+
+int main(int argc, char *argv[])
+{
+	std::string enc_str = "raw";
+	bool to_safs = false;
+	int opt;
+	while ((opt = getopt(argc, argv, "e:s")) != -1) {
+		switch (opt) {
+			case 'e':
+				enc_str = optarg;
+				break;
+			case 's':
+				to_safs = true;
+				break;
+			default:
+				print_usage();
+				exit(1);
+		}
+	}
+	argv += optind;
+	argc -= optind;
+	if (argc < 3) {
+		print_usage();
+		exit(1);
+	}
+
+	spm_val_encoding val_enc;
+	if (enc_str == "raw")
+		val_enc = spm_val_encoding::RAW;
+	else if (enc_str == "fp16")
+		val_enc = spm_val_encoding::FP16;
+	else if (enc_str == "bf16")
+		val_enc = spm_val_encoding::BF16;
+	else {
+		fprintf(stderr, "unknown encoding: %s\n", enc_str.c_str());
+		exit(1);
+	}
+
+	std::string conf_file = argv[0];
+	std::string mat_name = argv[1];
+	std::string new_mat_name = argv[2];
+	config_map::ptr configs = config_map::create(conf_file);
+	init_flash_matrix(configs);
+	if (to_safs && !safs::is_safs_init()) {
+		fprintf(stderr, "SAFS isn't initialized\n");
+		exit(1);
+	}
+
+	SpM_2d_index::ptr index = load_index(mat_name + ".mat_idx");
+	if (index == NULL) {
+		fprintf(stderr, "can't find the index of %s\n", mat_name.c_str());
+		exit(1);
+	}
+	// An asymmetric matrix has its transpose stored in separate files.
+	SpM_2d_index::ptr t_index = load_index(mat_name + "_t.mat_idx");
+	sparse_matrix::ptr mat;
+	if (t_index)
+		mat = sparse_matrix::create(index, load_image(mat_name + ".mat", index),
+				t_index, load_image(mat_name + "_t.mat", t_index));
+	else
+		mat = sparse_matrix::create(index, load_image(mat_name + ".mat", index));
+
+	printf("convert %s to an edge list\n", mat_name.c_str());
+	data_frame::ptr el = detail::conv2el(*mat);
+	if (el == NULL) {
+		fprintf(stderr, "can't convert %s to an edge list\n", mat_name.c_str());
+		exit(1);
+	}
+	block_2d_size block_size = index->get_header().get_2d_block_size();
+	auto out_mat = create_encoded_2d(el, block_size, mat->get_num_rows(),
+			mat->get_num_cols(), val_enc);
+	if (out_mat.second == NULL)
+		exit(1);
+	save_matrix(out_mat, new_mat_name, to_safs);
+	out_mat = std::pair<SpM_2d_index::ptr, SpM_2d_storage::ptr>();
+	if (t_index) {
+		auto in_mat = create_encoded_2d(el, block_size, mat->get_num_rows(),
+				mat->get_num_cols(), val_enc, true);
+		if (in_mat.second == NULL)
+			exit(1);
+		save_matrix(in_mat, new_mat_name + "_t", to_safs);
+	}
+
+	destroy_flash_matrix();
+}
@@ -0,0 +1,279 @@
+/*
+ * Copyright 2017 Open Connectome Project (http://openconnecto.me)
+ * Written by Da Zheng (zhengda1936@gmail.com)
+ *
+ * This file is part of FlashMatrix.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "columnar_io.h"
+#include "data_frame.h"
+#include "dense_matrix.h"
+#include "mem_vec_store.h"
+#include "encoded_vec_store.h"
+#include "vector.h"
+#include "mem_matrix_store.h"
+#include "sparse_matrix.h"
+
+using namespace fm;
+
+void test_data_frame()
+{
+	printf("test writing and reading a data frame\n");
+	size_t length = 1000000;
+	size_t group_size = 10000;
+	detail::smp_vec_store::ptr vec1 = detail::smp_vec_store::create(length,
+			get_scalar_type<long>());
+	detail::smp_vec_store::ptr vec2 = detail::smp_vec_store::create(length,
+			get_scalar_type<int>());
+	detail::smp_vec_store::ptr vec3 = detail::smp_vec_store::create(length,
+			get_scalar_type<double>());
+	detail::smp_vec_store::ptr vec4 = detail::smp_vec_store::create(length,
+			get_scalar_type<double>());
+	for (size_t i = 0; i < length; i++) {
+		// The values in a row group are close to each other.
+		vec1->set<long>(i, 1000000000000L + i);
+		// A small number of distinct values.
+		vec2->set<int>(i, random() % 1000 * 1000);
+		vec3->set<double>(i, (random() % 10) / 3.0);
+		vec4->set<double>(i, random() / 3.0);
+	}
+	data_frame::ptr df = data_frame::create();
+	df->add_vec("vec1", vec1);
+	df->add_vec("vec2", vec2);
+	df->add_vec("vec3", vec3);
+	df->add_vec("vec4", vec4);
+
+	std::string file = "/tmp/test.col";
+	bool ret = write_columnar(*df, file, group_size);
+	assert(ret);
+	columnar_file::ptr f = columnar_file::open(file);
+	assert(f);
+	assert(f->get_num_rows() == length);
+	assert(f->get_num_cols() == 4);
+	assert(f->get_num_groups() == length / group_size);
+	assert(f->get_col_idx("vec3") == 2);
+	assert(f->get_col_idx("vec5") == -1);
+	assert(f->get_col_type(1) == get_scalar_type<int>());
+	assert(f->get_encoding(0, 0) == col_encoding::FOR);
+	assert(f->get_encoding(1, 0) == col_encoding::DICT);
+	assert(f->get_encoding(2, 0) == col_encoding::DICT);
+	assert(f->get_encoding(3, 0) == col_encoding::RAW);
+	for (size_t i = 0; i < f->get_num_groups(); i++) {
+		assert(*(const long *) f->get_min(0, i)->get_raw()
+				== 1000000000000L + (long) (i * group_size));
+		assert(*(const long *) f->get_max(0, i)->get_raw()
+				== 1000000000000L + (long) ((i + 1) * group_size - 1));
+	}
+
+	// Read part of the columns and the rows.
+	std::vector<std::string> names;
+	names.push_back("vec4");
+	names.push_back("vec2");
+	off_t start = 12345;
+	size_t num = 54321;
+	data_frame::ptr res = f->read_data_frame(names, start, num);
+	assert(res->get_num_vecs() == 2);
+	assert(res->get_num_entries() == num);
+	detail::smp_vec_store::const_ptr res4
+		= detail::smp_vec_store::cast(res->get_vec("vec4"));
+	detail::smp_vec_store::const_ptr res2
+		= detail::smp_vec_store::cast(res->get_vec("vec2"));
+	for (size_t i = 0; i < num; i++) {
+		assert(res4->get<double>(i) == vec4->get<double>(start + i));
+		assert(res2->get<int>(i) == vec2->get<int>(start + i));
+	}
+
+	// Read all data.
+	res = f->read_data_frame(std::vector<std::string>());
+	assert(res->get_num_vecs() == 4);
+	assert(res->get_num_entries() == length);
+	for (size_t i = 0; i < df->get_num_vecs(); i++) {
+		detail::smp_vec_store::const_ptr vec
+			= detail::smp_vec_store::cast(df->get_vec(i));
+		detail::smp_vec_store::const_ptr res_vec
+			= detail::smp_vec_store::cast(res->get_vec(i));
+		assert(memcmp(vec->get_raw_arr(), res_vec->get_raw_arr(),
+					length * vec->get_entry_size()) == 0);
+	}
+
+	// Read out of range.
+	assert(f->read_col(0, length + 1) == NULL);
+	assert(f->read_col(0, length)->get_length() == 0);
+	names.push_back("vec5");
+	assert(f->read_data_frame(names) == NULL);
+}
+
+/*
+ * The values in the row groups are packed with 0 bits if a column has
+ * a constant value or a single distinct value.
+ */
+void test_const_cols()
+{
+	printf("test writing and reading constant columns\n");
+	// The last row group is smaller than the others.
+	size_t length = 100000;
+	size_t group_size = 4096;
+	detail::smp_vec_store::ptr vec1 = detail::smp_vec_store::create(length,
+			get_scalar_type<long>());
+	detail::smp_vec_store::ptr vec2 = detail::smp_vec_store::create(length,
+			get_scalar_type<int>());
+	detail::smp_vec_store::ptr vec3 = detail::smp_vec_store::create(length,
+			get_scalar_type<double>());
+	detail::smp_vec_store::ptr vec4 = detail::smp_vec_store::create(length,
+			get_scalar_type<float>());
+	for (size_t i = 0; i < length; i++) {
+		vec1->set<long>(i, 1000000000000L);
+		vec2->set<int>(i, -7);
+		vec3->set<double>(i, 2.5);
+		vec4->set<float>(i, std::numeric_limits<float>::quiet_NaN());
+	}
+	data_frame::ptr df = data_frame::create();
+	df->add_vec("vec1", vec1);
+	df->add_vec("vec2", vec2);
+	df->add_vec("vec3", vec3);
+	df->add_vec("vec4", vec4);
+
+	std::string file = "/tmp/test.col";
+	bool ret = write_columnar(*df, file, group_size);
+	assert(ret);
+	columnar_file::ptr f = columnar_file::open(file);
+	assert(f);
+	for (size_t i = 0; i < f->get_num_groups(); i++) {
+		assert(f->get_encoding(0, i) == col_encoding::FOR);
+		assert(f->get_encoding(1, i) == col_encoding::FOR);
+		assert(f->get_encoding(2, i) == col_encoding::DICT);
+		assert(f->get_encoding(3, i) == col_encoding::DICT);
+	}
+
+	data_frame::ptr res = f->read_data_frame(std::vector<std::string>());
+	assert(res->get_num_entries() == length);
+	for (size_t i = 0; i < df->get_num_vecs(); i++) {
+		detail::smp_vec_store::const_ptr vec
+			= detail::smp_vec_store::cast(df->get_vec(i));
+		detail::smp_vec_store::const_ptr res_vec
+			= detail::smp_vec_store::cast(res->get_vec(i));
+		assert(memcmp(vec->get_raw_arr(), res_vec->get_raw_arr(),
+					length * vec->get_entry_size()) == 0);
+	}
+	// Read a range that starts and ends in the middle of row groups.
+	detail::vec_store::ptr col = f->read_col(0, 5000, 90000);
+	assert(col->get_length() == 90000);
+	detail::smp_vec_store::const_ptr mem_col = detail::smp_vec_store::cast(col);
+	for (size_t i = 0; i < col->get_length(); i++)
+		assert(mem_col->get<long>(i) == 1000000000000L);
+}
+
+void test_matrix()
+{
+	printf("test writing and reading a dense matrix\n");
+	dense_matrix::ptr mat = dense_matrix::create_randu<double>(0, 1,
+			100000, 10, matrix_layout_t::L_ROW);
+	std::string file = "/tmp/test.col";
+	bool ret = write_columnar(*mat, file, 4096);
+	assert(ret);
+	columnar_file::ptr f = columnar_file::open(file);
+	assert(f);
+	assert(f->get_num_cols() == mat->get_num_cols());
+	assert(f->get_col_name(0) == "V1");
+
+	std::vector<off_t> col_idxs;
+	col_idxs.push_back(7);
+	col_idxs.push_back(2);
+	off_t start = 5000;
+	size_t num = 90000;
+	dense_matrix::ptr res = f->read_matrix(col_idxs, start, num);
+	assert(res->get_num_rows() == num);
+	assert(res->get_num_cols() == col_idxs.size());
+	mat->materialize_self();
+	detail::mem_matrix_store::const_ptr store
+		= detail::mem_matrix_store::cast(mat->get_raw_store());
+	detail::mem_matrix_store::const_ptr res_store
+		= detail::mem_matrix_store::cast(res->get_raw_store());
+	for (size_t i = 0; i < num; i++)
+		for (size_t j = 0; j < col_idxs.size(); j++)
+			assert(res_store->get<double>(i, j)
+					== store->get<double>(start + i, col_idxs[j]));
+}
+
+void test_read_encoded()
+{
+	printf("test reading encoded columns\n");
+	size_t length = 1000000;
+	detail::smp_vec_store::ptr vec1 = detail::smp_vec_store::create(length,
+			get_scalar_type<int>());
+	detail::smp_vec_store::ptr vec2 = detail::smp_vec_store::create(length,
+			get_scalar_type<double>());
+	int max_val = 0;
+	for (size_t i = 0; i < length; i++) {
+		vec1->set<int>(i, random() % 100);
+		vec2->set<double>(i, random() / 3.0);
+		max_val = std::max(max_val, vec1->get<int>(i));
+	}
+	data_frame::ptr df = data_frame::create();
+	df->add_vec("vec1", vec1);
+	df->add_vec("vec2", vec2);
+	std::string file = "/tmp/test.col";
+	bool ret = write_columnar(*df, file);
+	assert(ret);
+	columnar_file::ptr f = columnar_file::open(file);
+	assert(f);
+
+	// The column with a few distinct values is kept encoded. The other
+	// column can't be encoded with less space.
+	data_frame::ptr res = f->read_data_frame(std::vector<std::string>(), 0,
+			length, true);
+	assert(res->get_num_entries() == length);
+	detail::encoded_vec_store::const_ptr enc1
+		= detail::encoded_vec_store::cast(res->get_vec("vec1"));
+	assert(enc1);
+	assert(enc1->get_num_bytes() * 3 < length * sizeof(int));
+	assert(detail::encoded_vec_store::cast(res->get_vec("vec2")) == NULL);
+	std::vector<int> vals(length);
+	enc1->copy_to((char *) vals.data(), length);
+	assert(memcmp(vals.data(), vec1->get_raw_arr(), length * sizeof(int)) == 0);
+
+	// The vector operations work on the encoded column.
+	vector::ptr v = vector::create(enc1);
+	assert(v->max<int>() == max_val);
+	vector::ptr neg = v->sapply(bulk_uoperate::conv2ptr(
+				*get_scalar_type<int>().get_basic_uops().get_op(
+					basic_uops::op_idx::NEG)));
+	assert(detail::encoded_vec_store::cast(neg->get_raw_store()));
+	std::vector<int> neg_vals = neg->conv2std<int>();
+	for (size_t i = 0; i < length; i++)
+		assert(neg_vals[i] == -vals[i]);
+	assert(vector::create(vec1)->sapply(bulk_uoperate::conv2ptr(
+					*get_scalar_type<int>().get_basic_uops().get_op(
+						basic_uops::op_idx::NEG)))->equals(*neg));
+}
+
+int main(int argc, char *argv[])
+{
+	if (argc < 2) {
+		fprintf(stderr, "test conf_file\n");
+		exit(1);
+	}
+
+	std::string conf_file = argv[1];
+	config_map::ptr configs = config_map::create(conf_file);
+	init_flash_matrix(configs);
+
+	test_data_frame();
+	test_const_cols();
+	test_matrix();
+	test_read_encoded();
+
+	destroy_flash_matrix();
+}
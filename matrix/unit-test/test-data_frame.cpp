@@ -7,6 +7,8 @@
 #include "local_vec_store.h"
 #include "EM_vector.h"
 #include "sparse_matrix.h"
+#include "matrix_config.h"
+#include "bulk_operate_ext.h"
 
 using namespace fm;
 
@@ -225,6 +227,221 @@ void test_merge()
 	assert(res->get_num_entries() == tot_num_entries);
 }
 
+template<class T>
+std::vector<T> get_values(const detail::vec_store &vec)
+{
+	std::vector<T> ret(vec.get_length());
+	vec.copy_to((char *) ret.data(), ret.size());
+	return ret;
+}
+
+detail::vec_store::ptr conv_vec(detail::smp_vec_store::ptr vec, bool in_mem)
+{
+	if (in_mem)
+		return vec;
+	detail::vec_store::ptr ret = detail::vec_store::create(0, vec->get_type(),
+			-1, false);
+	ret->append(*vec);
+	return ret;
+}
+
+void test_join(bool in_mem)
+{
+	printf("test joining %s data frames\n", in_mem ? "in-mem" : "EM");
+	size_t lnum = 1000000;
+	size_t rnum = 300000;
+	// The keys in the left data frame are unique.
+	detail::smp_vec_store::ptr lkeys = detail::smp_vec_store::create(lnum,
+			get_scalar_type<long>());
+	detail::smp_vec_store::ptr lvals = detail::smp_vec_store::create(lnum,
+			get_scalar_type<int>());
+	for (size_t i = 0; i < lnum; i++) {
+		lkeys->set<long>(i, lnum - i);
+		lvals->set<int>(i, random());
+	}
+	detail::smp_vec_store::ptr rkeys = detail::smp_vec_store::create(rnum,
+			get_scalar_type<long>());
+	detail::smp_vec_store::ptr rvals = detail::smp_vec_store::create(rnum,
+			get_scalar_type<double>());
+	size_t num_matches = 0;
+	for (size_t i = 0; i < rnum; i++) {
+		long key = random() % (lnum * 2);
+		if (key >= 1 && key <= (long) lnum)
+			num_matches++;
+		rkeys->set<long>(i, key);
+		rvals->set<double>(i, i);
+	}
+	data_frame::ptr left = data_frame::create();
+	left->add_vec("id", conv_vec(lkeys, in_mem));
+	left->add_vec("val", conv_vec(lvals, in_mem));
+	data_frame::ptr right = data_frame::create();
+	right->add_vec("val", conv_vec(rvals, in_mem));
+	right->add_vec("key", conv_vec(rkeys, in_mem));
+
+	// Split EM data frames into partitions.
+	size_t join_buf_size = matrix_conf.get_join_buf_size();
+	matrix_conf.set_join_buf_size(1024 * 1024);
+	data_frame::ptr res = join_data_frame(*left, *right, "id", "key");
+	matrix_conf.set_join_buf_size(join_buf_size);
+	assert(res);
+	assert(res->is_in_mem() == in_mem);
+	assert(res->get_num_vecs() == 3);
+	assert(res->get_vec_name(0) == "id");
+	assert(res->get_vec_name(1) == "val.x");
+	assert(res->get_vec_name(2) == "val.y");
+	assert(res->get_num_entries() == num_matches);
+	std::vector<long> ids = get_values<long>(res->get_vec_ref(0));
+	std::vector<int> vals1 = get_values<int>(res->get_vec_ref(1));
+	std::vector<double> vals2 = get_values<double>(res->get_vec_ref(2));
+	std::vector<bool> found(rnum);
+	for (size_t i = 0; i < ids.size(); i++) {
+		assert(vals1[i] == lvals->get<int>(lnum - ids[i]));
+		size_t ridx = vals2[i];
+		assert(rkeys->get<long>(ridx) == ids[i]);
+		assert(!found[ridx]);
+		found[ridx] = true;
+	}
+
+	assert(join_data_frame(*left, *right, "id", "val") == NULL);
+	assert(join_data_frame(*left, *right, "id", "key1") == NULL);
+}
+
+/*
+ * Both data frames have duplicated keys, and a key appears in a large
+ * fraction of the rows on both sides.
+ */
+void test_join_skew(bool in_mem)
+{
+	printf("test joining %s data frames with skewed keys\n",
+			in_mem ? "in-mem" : "EM");
+	size_t lnum = 20000;
+	size_t rnum = 3000;
+	const long skewed_key = 7;
+	std::map<long, std::pair<size_t, size_t> > counts;
+	detail::smp_vec_store::ptr lkeys = detail::smp_vec_store::create(lnum,
+			get_scalar_type<long>());
+	detail::smp_vec_store::ptr lvals = detail::smp_vec_store::create(lnum,
+			get_scalar_type<int>());
+	for (size_t i = 0; i < lnum; i++) {
+		long key = i % 5 == 0 ? skewed_key : random() % 1000;
+		lkeys->set<long>(i, key);
+		lvals->set<int>(i, i);
+		counts[key].first++;
+	}
+	detail::smp_vec_store::ptr rkeys = detail::smp_vec_store::create(rnum,
+			get_scalar_type<long>());
+	detail::smp_vec_store::ptr rvals = detail::smp_vec_store::create(rnum,
+			get_scalar_type<double>());
+	for (size_t i = 0; i < rnum; i++) {
+		long key = i % 10 == 0 ? skewed_key : random() % 1000;
+		rkeys->set<long>(i, key);
+		rvals->set<double>(i, i);
+		counts[key].second++;
+	}
+	size_t num_matches = 0;
+	for (auto it = counts.begin(); it != counts.end(); it++)
+		num_matches += it->second.first * it->second.second;
+
+	data_frame::ptr left = data_frame::create();
+	left->add_vec("key", conv_vec(lkeys, in_mem));
+	left->add_vec("lval", conv_vec(lvals, in_mem));
+	data_frame::ptr right = data_frame::create();
+	right->add_vec("key", conv_vec(rkeys, in_mem));
+	right->add_vec("rval", conv_vec(rvals, in_mem));
+
+	// The partition of the skewed key doesn't fit in the memory for join,
+	// so EM data frames are split again and then joined block by block.
+	size_t join_buf_size = matrix_conf.get_join_buf_size();
+	matrix_conf.set_join_buf_size(16 * 1024);
+	data_frame::ptr res = join_data_frame(*left, *right, "key", "key");
+	matrix_conf.set_join_buf_size(join_buf_size);
+	assert(res);
+	assert(res->get_num_entries() == num_matches);
+	std::vector<long> ids = get_values<long>(res->get_vec_ref(0));
+	std::vector<int> vals1 = get_values<int>(res->get_vec_ref(1));
+	std::vector<double> vals2 = get_values<double>(res->get_vec_ref(2));
+	// Every pair of the matched rows appears exactly once.
+	std::vector<bool> found(lnum * rnum);
+	for (size_t i = 0; i < ids.size(); i++) {
+		size_t lidx = vals1[i];
+		size_t ridx = vals2[i];
+		assert(lkeys->get<long>(lidx) == ids[i]);
+		assert(rkeys->get<long>(ridx) == ids[i]);
+		assert(!found[lidx * rnum + ridx]);
+		found[lidx * rnum + ridx] = true;
+	}
+}
+
+void test_aggregate(bool in_mem)
+{
+	printf("test aggregating %s data frames\n", in_mem ? "in-mem" : "EM");
+	size_t num_rows = 2000000;
+	size_t num_keys = 200000;
+	detail::smp_vec_store::ptr keys = detail::smp_vec_store::create(num_rows,
+			get_scalar_type<long>());
+	detail::smp_vec_store::ptr vals = detail::smp_vec_store::create(num_rows,
+			get_scalar_type<int>());
+	std::unordered_map<long, std::pair<int, int> > res_map;
+	for (size_t i = 0; i < num_rows; i++) {
+		long key = random() % num_keys;
+		int val = random() % 1000;
+		keys->set<long>(i, key);
+		vals->set<int>(i, val);
+		auto it = res_map.find(key);
+		if (it == res_map.end())
+			res_map.insert(std::pair<long, std::pair<int, int> >(key,
+						std::pair<int, int>(val, val)));
+		else {
+			it->second.first += val;
+			it->second.second = std::max(it->second.second, val);
+		}
+	}
+	data_frame::ptr df = data_frame::create();
+	df->add_vec("key", conv_vec(keys, in_mem));
+	df->add_vec("val", conv_vec(vals, in_mem));
+
+	const agg_ops &ops = get_scalar_type<int>().get_agg_ops();
+	std::vector<std::string> val_cols;
+	std::vector<agg_operate::const_ptr> aggs;
+	val_cols.push_back("val");
+	aggs.push_back(ops.get_op(agg_ops::SUM));
+	val_cols.push_back("val");
+	aggs.push_back(ops.get_op(agg_ops::MAX));
+	val_cols.push_back("val");
+	aggs.push_back(ops.get_count());
+	// The hashtable doesn't fit in the buffer, so the partial results are
+	// written to disks.
+	size_t groupby_buf_size = matrix_conf.get_groupby_buf_size();
+	matrix_conf.set_groupby_buf_size(1024 * 1024);
+	data_frame::ptr res = df->aggregate("key", val_cols, aggs);
+	matrix_conf.set_groupby_buf_size(groupby_buf_size);
+	assert(res);
+	assert(res->get_num_vecs() == 4);
+	assert(res->get_vec_name(1) == "val");
+	assert(res->get_vec_name(2) == "val.2");
+	assert(res->get_num_entries() == res_map.size());
+	std::vector<long> res_keys = get_values<long>(res->get_vec_ref(0));
+	std::vector<int> sums = get_values<int>(res->get_vec_ref(1));
+	std::vector<int> maxs = get_values<int>(res->get_vec_ref(2));
+	std::vector<size_t> counts = get_values<size_t>(res->get_vec_ref(3));
+	size_t tot_count = 0;
+	for (size_t i = 0; i < res_keys.size(); i++) {
+		auto it = res_map.find(res_keys[i]);
+		assert(it != res_map.end());
+		assert(it->second.first == sums[i]);
+		assert(it->second.second == maxs[i]);
+		tot_count += counts[i];
+		// Each key appears once.
+		res_map.erase(it);
+	}
+	assert(tot_count == num_rows);
+	assert(res_map.empty());
+
+	assert(df->aggregate("key1", val_cols, aggs) == NULL);
+	aggs.pop_back();
+	assert(df->aggregate("key", val_cols, aggs) == NULL);
+}
+
 int main(int argc, char *argv[])
 {
 	if (argc < 2) {
@@ -241,6 +458,12 @@ int main(int argc, char *argv[])
 	test_EM_groupby();
 	test_in_mem_sort();
 	test_EM_sort();
+	test_join(true);
+	test_join(false);
+	test_join_skew(true);
+	test_join_skew(false);
+	test_aggregate(true);
+	test_aggregate(false);
 
 	destroy_flash_matrix();
 }
@@ -17,10 +17,21 @@
  * limitations under the License.
  */
 
+#ifdef USE_GZIP
+#include <zlib.h>
+#endif
+#ifdef USE_ZSTD
+#include <zstd.h>
+#endif
+
+#include <cmath>
+
 #include "native_file.h"
 
 #include "data_io.h"
 #include "dense_matrix.h"
+#include "data_frame.h"
+#include "mem_vec_store.h"
 
 using namespace fm;
 
@@ -64,6 +75,174 @@ void test_read_file()
 	}
 }
 
+#if defined(USE_GZIP) || defined(USE_ZSTD)
+
+static void append_le(std::string &buf, size_t val, int num_bytes)
+{
+	for (int i = 0; i < num_bytes; i++)
+		buf.push_back((char) (val >> (i * 8)));
+}
+
+#endif
+
+#ifdef USE_GZIP
+
+/*
+ * Compress the data into a BGZF block.
+ */
+static std::string create_bgzf_block(const char *data, size_t size)
+{
+	std::vector<char> out(compressBound(size));
+	z_stream strm;
+	memset(&strm, 0, sizeof(strm));
+	int ret = deflateInit2(&strm, Z_DEFAULT_COMPRESSION, Z_DEFLATED, -MAX_WBITS,
+			8, Z_DEFAULT_STRATEGY);
+	assert(ret == Z_OK);
+	strm.next_in = (Bytef *) data;
+	strm.avail_in = size;
+	strm.next_out = (Bytef *) out.data();
+	strm.avail_out = out.size();
+	ret = deflate(&strm, Z_FINISH);
+	assert(ret == Z_STREAM_END);
+	size_t compressed_size = strm.total_out;
+	deflateEnd(&strm);
+
+	std::string block("\x1f\x8b\x08\x04", 4);
+	append_le(block, 0, 4);
+	block.push_back(0);
+	block.push_back((char) 0xff);
+	// The extra field stores the block size.
+	append_le(block, 6, 2);
+	block += "BC";
+	append_le(block, 2, 2);
+	append_le(block, compressed_size + 25, 2);
+	block.append(out.data(), compressed_size);
+	append_le(block, crc32(0, (const Bytef *) data, size), 4);
+	append_le(block, size, 4);
+	return block;
+}
+
+void test_read_bgzf()
+{
+	printf("test reading a BGZF file\n");
+	std::string file = "/tmp/tmp.txt.gz";
+	size_t size = 9999999;
+	std::unique_ptr<char []> data = create_text_file("/tmp/tmp.txt", size);
+	FILE *f = fopen(file.c_str(), "w");
+	for (size_t off = 0; off < size; off += 65280) {
+		std::string block = create_bgzf_block(data.get() + off,
+				std::min(size - off, 65280UL));
+		fwrite(block.data(), block.size(), 1, f);
+	}
+	// The EOF block.
+	std::string block = create_bgzf_block(NULL, 0);
+	fwrite(block.data(), block.size(), 1, f);
+	fclose(f);
+
+	file_io::ptr io = file_io::create_gz(file);
+	assert(io);
+	size_t off = 0;
+	while (!io->eof()) {
+		size_t read_size = 0;
+		auto read_buf = io->read_bytes(random() % 1000000 + 1, read_size);
+		assert(read_buf);
+		assert(read_size <= size - off);
+		assert(memcmp(read_buf.get(), data.get() + off, read_size) == 0);
+		off += read_size;
+	}
+	assert(off == size);
+
+	text_io::ptr tio = text_io::create(file);
+	off = 0;
+	while (!tio->eof()) {
+		size_t read_size = 0;
+		auto read_buf = tio->read_lines(random() % 100000 + 1, read_size);
+		assert(memcmp(read_buf.get(), data.get() + off, read_size) == 0);
+		off += read_size;
+	}
+	assert(off == size);
+}
+
+#endif
+
+#ifdef USE_ZSTD
+
+/*
+ * Write the data in the zstd seekable format. The frames have
+ * different sizes.
+ */
+static void create_zstd_seekable(const std::string &file, const char *data,
+		size_t size)
+{
+	FILE *f = fopen(file.c_str(), "w");
+	std::string table;
+	size_t num_frames = 0;
+	for (size_t off = 0; off < size; num_frames++) {
+		size_t frame_size = std::min<size_t>(size - off, random() % 200000 + 1);
+		std::vector<char> out(ZSTD_compressBound(frame_size));
+		size_t compressed_size = ZSTD_compress(out.data(), out.size(),
+				data + off, frame_size, 1);
+		assert(!ZSTD_isError(compressed_size));
+		fwrite(out.data(), compressed_size, 1, f);
+		append_le(table, compressed_size, 4);
+		append_le(table, frame_size, 4);
+		off += frame_size;
+	}
+
+	// The seek table is stored in a skippable frame.
+	std::string frame;
+	append_le(frame, 0x184D2A5E, 4);
+	append_le(frame, table.size() + 9, 4);
+	frame += table;
+	append_le(frame, num_frames, 4);
+	// The frames don't have checksums.
+	frame.push_back(0);
+	append_le(frame, 0x8F92EAB1, 4);
+	fwrite(frame.data(), frame.size(), 1, f);
+	fclose(f);
+}
+
+void test_read_zstd()
+{
+	printf("test reading a zstd seekable file\n");
+	std::string file = "/tmp/tmp.txt.zst";
+	size_t size = 9999999;
+	std::unique_ptr<char []> data = create_text_file("/tmp/tmp.txt", size);
+	create_zstd_seekable(file, data.get(), size);
+
+	file_io::ptr io = file_io::create_zstd(file);
+	assert(io);
+	size_t off = 0;
+	while (!io->eof()) {
+		size_t read_size = 0;
+		auto read_buf = io->read_bytes(random() % 1000000 + 1, read_size);
+		assert(read_buf);
+		assert(read_size <= size - off);
+		assert(memcmp(read_buf.get(), data.get() + off, read_size) == 0);
+		off += read_size;
+	}
+	assert(off == size);
+
+	text_io::ptr tio = text_io::create(file);
+	assert(tio);
+	off = 0;
+	while (!tio->eof()) {
+		size_t read_size = 0;
+		auto read_buf = tio->read_lines(random() % 100000 + 1, read_size);
+		assert(memcmp(read_buf.get(), data.get() + off, read_size) == 0);
+		off += read_size;
+	}
+	assert(off == size);
+
+	// A file without the seek table can't be read.
+	FILE *f = fopen(file.c_str(), "w");
+	fwrite(data.get(), 1000, 1, f);
+	fclose(f);
+	assert(file_io::create_zstd(file) == NULL);
+}
+
+#endif
+
 void test_read_matrix()
 {
 	printf("test reading a dense matrix\n");
@@ -85,8 +264,73 @@ void test_read_matrix()
 	assert(std::abs(scalar_variable::get_val<double>(*diff_sum)) < 1e-6);
 }
 
+void test_parse_num()
+{
+	printf("test parsing numbers\n");
+	std::vector<std::string> strs = {"0", "-0", "12", "  34", "+5", "1.5",
+		"-2.25e3", "1e", "1e+", ".5", "5.", ".", "abc", "1e-22", "12abc",
+		"123456789012345678901234", "1e308", "4.9e-324", "inf", "nan",
+		"0x1p3", "0x1F", "9007199254740993", "0.000000000000000000000123"};
+	for (size_t i = 0; i < 100000; i++) {
+		char buf[64];
+		double v = (random() - RAND_MAX / 2) * pow(10, random() % 40 - 20.0);
+		snprintf(buf, sizeof(buf), "%.*g", (int) (random() % 17 + 1), v);
+		strs.push_back(buf);
+		snprintf(buf, sizeof(buf), "%ld", random() - RAND_MAX / 2);
+		strs.push_back(buf);
+	}
+	for (size_t i = 0; i < strs.size(); i++) {
+		const char *start = strs[i].c_str();
+		const char *end = start + strs[i].size();
+		double d1 = parse_double(start, end);
+		double d2 = strtod(start, NULL);
+		assert(d1 == d2 || (std::isnan(d1) && std::isnan(d2)));
+		assert(parse_long(start, end, 10) == strtol(start, NULL, 10));
+		assert(parse_long(start, end, 16) == strtol(start, NULL, 16));
+	}
+}
+
+void test_parse_lines()
+{
+	printf("test parsing lines\n");
+	std::string file = "/tmp/tmp.txt";
+	FILE *f = fopen(file.c_str(), "w");
+	fprintf(f, "# comment\n1,2.5,3\n  4,,6\r\n7\n\n8,9,10,11\n12,13,14");
+	fclose(f);
+
+	std::vector<ele_parser::const_ptr> parsers(3);
+	parsers[0] = get_ele_parser("L");
+	parsers[1] = get_ele_parser("D");
+	parsers[2] = get_ele_parser("I");
+	std::vector<std::string> files(1, file);
+	data_frame::ptr df = read_data_frame(files, true, true, ",", parsers);
+	assert(df->get_num_entries() == 6);
+	long col0[] = {1, 4, 7, 0, 8, 12};
+	double col1[] = {2.5, 0, 0, 0, 9, 13};
+	int col2[] = {3, 6, 0, 0, 10, 14};
+	detail::smp_vec_store::const_ptr vec0
+		= detail::smp_vec_store::cast(df->get_vec(0));
+	detail::smp_vec_store::const_ptr vec1
+		= detail::smp_vec_store::cast(df->get_vec(1));
+	detail::smp_vec_store::const_ptr vec2
+		= detail::smp_vec_store::cast(df->get_vec(2));
+	for (size_t i = 0; i < df->get_num_entries(); i++) {
+		assert(vec0->get<long>(i) == col0[i]);
+		assert(vec1->get<double>(i) == col1[i]);
+		assert(vec2->get<int>(i) == col2[i]);
+	}
+}
+
 int main()
 {
 	test_read_file();
+#ifdef USE_GZIP
+	test_read_bgzf();
+#endif
+#ifdef USE_ZSTD
+	test_read_zstd();
+#endif
 	test_read_matrix();
+	test_parse_num();
+	test_parse_lines();
 }
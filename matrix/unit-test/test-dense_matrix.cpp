@@ -10,11 +10,13 @@
 #include "EM_dense_matrix.h"
 #include "matrix_stats.h"
 #include "mapply_matrix_store.h"
+#include "fused_mapply_op.h"
 #include "factor.h"
 #include "block_matrix.h"
 #include "project_matrix_store.h"
 #include "data_frame.h"
 #include "mem_vec_store.h"
+#include "mater_planner.h"
 
 #include "eigensolver/block_dense_matrix.h"
 #include "eigensolver/collected_col_matrix_store.h"
@@ -3025,6 +3027,262 @@ void test_materialize_all(int num_nodes)
 	}
 }
 
+void _test_fused_mapply(matrix_layout_t layout, size_t nrow, size_t ncol)
+{
+	dense_matrix::ptr mat1 = dense_matrix::create_randu<double>(0, 1,
+			nrow, ncol, layout);
+	dense_matrix::ptr mat2 = dense_matrix::create_randu<double>(0, 1,
+			nrow, ncol, layout);
+
+	// mat1 is used by multiple operations.
+	dense_matrix::ptr res = mat1->multiply_ele(*mat2)->add(*mat1);
+	res = res->minus(*mat2->multiply_scalar<double>(2))->abs();
+	res = res->pmax(*mat1->add(*mat2));
+	const detail::mapply_matrix_store *store
+		= dynamic_cast<const detail::mapply_matrix_store *>(
+				res->get_raw_store().get());
+	assert(store);
+	// The operations are fused when the matrix is computed.
+	assert(dynamic_cast<const detail::fused_mapply_op *>(
+				store->get_portion_op().get()) == NULL);
+	// All mapply2 and sapply operations are fused into one operation.
+	const detail::fused_mapply_op *op
+		= dynamic_cast<const detail::fused_mapply_op *>(
+				store->get_compute_op().get());
+	assert(op);
+	assert(op->get_steps().size() == 7);
+	assert(store->get_compute_inputs().size() == 2);
+
+	matrix_conf.set_fuse_mapply(false);
+	dense_matrix::ptr res1 = mat1->multiply_ele(*mat2)->add(*mat1);
+	res1 = res1->minus(*mat2->multiply_scalar<double>(2))->abs();
+	res1 = res1->pmax(*mat1->add(*mat2));
+	store = dynamic_cast<const detail::mapply_matrix_store *>(
+			res1->get_raw_store().get());
+	assert(store);
+	assert(dynamic_cast<const detail::fused_mapply_op *>(
+				store->get_compute_op().get()) == NULL);
+	res1->materialize_self();
+	matrix_conf.set_fuse_mapply(true);
+
+	scalar_variable::ptr diff = res->minus(*res1)->abs()->max();
+	assert(*(double *) diff->get_raw() == 0);
+}
+
+void test_fused_mapply()
+{
+	printf("test fused mapply\n");
+	_test_fused_mapply(matrix_layout_t::L_COL, long_dim, 10);
+	_test_fused_mapply(matrix_layout_t::L_ROW, long_dim, 10);
+	_test_fused_mapply(matrix_layout_t::L_COL, 10, long_dim);
+	_test_fused_mapply(matrix_layout_t::L_ROW, 10, long_dim);
+
+	// A matrix whose materialized data is kept isn't inlined.
+	dense_matrix::ptr mat1 = dense_matrix::create_randu<double>(0, 1,
+			long_dim, 10, matrix_layout_t::L_COL);
+	dense_matrix::ptr kept = mat1->multiply_scalar<double>(2);
+	kept->set_materialize_level(materialize_level::MATER_FULL);
+	dense_matrix::ptr res = kept->add(*mat1)->abs();
+	const detail::mapply_matrix_store *store
+		= dynamic_cast<const detail::mapply_matrix_store *>(
+				res->get_raw_store().get());
+	assert(store);
+	assert(store->get_compute_inputs().size() == 2);
+	assert(store->get_compute_inputs()[0] == kept->get_raw_store());
+
+	// A long chain of operations is split into multiple fused operations.
+	res = mat1;
+	for (size_t i = 0; i < detail::fused_mapply_builder::MAX_NUM_STEPS * 2; i++)
+		res = res->add_scalar<double>(1);
+	store = dynamic_cast<const detail::mapply_matrix_store *>(
+			res->get_raw_store().get());
+	assert(store);
+	const detail::fused_mapply_op *op
+		= dynamic_cast<const detail::fused_mapply_op *>(
+				store->get_compute_op().get());
+	assert(op);
+	assert(op->get_steps().size() <= detail::fused_mapply_builder::MAX_NUM_STEPS);
+	scalar_variable::ptr diff = res->minus(*mat1->add_scalar<double>(
+				detail::fused_mapply_builder::MAX_NUM_STEPS * 2))->abs()->max();
+	assert(*(double *) diff->get_raw() < 1e-9);
+}
+
+void test_mater_planner()
+{
+	printf("test materialization planner\n");
+	dense_matrix::ptr mat1 = dense_matrix::create_randu<double>(0, 1,
+			long_dim, 10, matrix_layout_t::L_COL);
+	dense_matrix::ptr mat2 = dense_matrix::create_randu<double>(0, 1,
+			long_dim, 10, matrix_layout_t::L_COL);
+	dense_matrix::ptr shared = mat1->multiply_ele(*mat2);
+	std::vector<dense_matrix::ptr> mats(2);
+	mats[0] = shared->add(*mat1);
+	mats[1] = shared->abs();
+	materialize(mats);
+	// The shared matrix is only cached during the materialization.
+	const detail::mapply_matrix_store *store
+		= dynamic_cast<const detail::mapply_matrix_store *>(
+				shared->get_raw_store().get());
+	assert(store);
+	assert(store->get_materialize_level() == materialize_level::MATER_CPU);
+	assert(!store->has_materialized());
+
+	// The shared matrix is materialized again, so we keep its data.
+	mats.resize(1);
+	mats[0] = shared->minus(*mat2);
+	materialize(mats);
+	assert(store->get_materialize_level() == materialize_level::MATER_FULL);
+	assert(store->has_materialized());
+
+	dense_matrix::ptr res = mat1->multiply_ele(*mat2)->minus(*mat2);
+	scalar_variable::ptr diff = res->minus(*mats[0])->abs()->max();
+	assert(*(double *) diff->get_raw() == 0);
+	diff = shared->minus(*mat1->multiply_ele(*mat2))->abs()->max();
+	assert(*(double *) diff->get_raw() == 0);
+}
+
+void test_mater_planner_self()
+{
+	printf("test materialization planner in materialize_self\n");
+	size_t kept_size = detail::mater_planner::get_kept_mem_size();
+	dense_matrix::ptr mat1 = dense_matrix::create_randu<double>(0, 1,
+			long_dim, 10, matrix_layout_t::L_COL);
+	dense_matrix::ptr mat2 = dense_matrix::create_randu<double>(0, 1,
+			long_dim, 10, matrix_layout_t::L_COL);
+	dense_matrix::ptr shared = mat1->multiply_ele(*mat2);
+	// The shared matrix is referenced twice in the DAG.
+	dense_matrix::ptr res = shared->add(*shared->abs());
+	bool ret = res->materialize_self();
+	assert(ret);
+	const detail::mapply_matrix_store *store
+		= dynamic_cast<const detail::mapply_matrix_store *>(
+				shared->get_raw_store().get());
+	assert(store);
+	assert(store->get_materialize_level() == materialize_level::MATER_CPU);
+	assert(!store->has_materialized());
+	assert(detail::mater_planner::get_kept_mem_size() == kept_size);
+
+	// The shared matrix is materialized again, so we keep its data in memory.
+	res = shared->minus(*mat2);
+	ret = res->materialize_self();
+	assert(ret);
+	assert(store->get_materialize_level() == materialize_level::MATER_FULL);
+	assert(store->has_materialized());
+	assert(detail::mater_planner::get_kept_mem_size()
+			== kept_size + long_dim * 10 * sizeof(double));
+
+	dense_matrix::ptr res2 = mat1->multiply_ele(*mat2)->minus(*mat2);
+	scalar_variable::ptr diff = res2->minus(*res)->abs()->max();
+	assert(*(double *) diff->get_raw() == 0);
+
+	// The memory is returned to the budget when the matrix is freed.
+	store = NULL;
+	shared = NULL;
+	assert(detail::mater_planner::get_kept_mem_size() == kept_size);
+}
+
+void test_mater_planner_fused()
+{
+	printf("test materialization planner with fused operations\n");
+	assert(matrix_conf.is_fuse_mapply());
+	dense_matrix::ptr mat1 = dense_matrix::create_randu<double>(0, 1,
+			long_dim, 10, matrix_layout_t::L_COL);
+	dense_matrix::ptr mat2 = dense_matrix::create_randu<double>(0, 1,
+			long_dim, 10, matrix_layout_t::L_COL);
+	// The shared matrix is computed by element-wise operations.
+	dense_matrix::ptr shared = mat1->multiply_ele(*mat2)->add_scalar<double>(1);
+	std::vector<dense_matrix::ptr> mats(2);
+	mats[0] = shared->add(*mat1)->abs();
+	mats[1] = shared->multiply_scalar<double>(2);
+	const detail::mapply_matrix_store *store
+		= dynamic_cast<const detail::mapply_matrix_store *>(
+				shared->get_raw_store().get());
+	const detail::mapply_matrix_store *store0
+		= dynamic_cast<const detail::mapply_matrix_store *>(
+				mats[0]->get_raw_store().get());
+	const detail::mapply_matrix_store *store1
+		= dynamic_cast<const detail::mapply_matrix_store *>(
+				mats[1]->get_raw_store().get());
+	assert(store && store0 && store1);
+	{
+		std::vector<const detail::matrix_store *> roots(2);
+		roots[0] = store0;
+		roots[1] = store1;
+		detail::dag_mater_scope scope(roots);
+		// The planner sees the shared matrix and keeps its portions
+		// in memory, so it isn't inlined in the matrices that use it.
+		assert(store->get_materialize_level() == materialize_level::MATER_MEM);
+		assert(store0->get_compute_inputs().size() == 2);
+		assert(store0->get_compute_inputs()[0] == shared->get_raw_store());
+		assert(dynamic_cast<const detail::fused_mapply_op *>(
+					store0->get_compute_op().get())->get_steps().size() == 2);
+		assert(store1->get_compute_inputs().size() == 1);
+		assert(store1->get_compute_inputs()[0] == shared->get_raw_store());
+		// The operations that compute the shared matrix are fused.
+		assert(store->get_compute_inputs().size() == 2);
+		assert(dynamic_cast<const detail::fused_mapply_op *>(
+					store->get_compute_op().get())->get_steps().size() == 2);
+	}
+	// Outside the materialization, the shared matrix can be inlined.
+	assert(store->get_materialize_level() == materialize_level::MATER_CPU);
+	assert(store0->get_compute_inputs().size() == 2);
+	assert(store0->get_compute_inputs()[0] != shared->get_raw_store());
+
+	materialize(mats);
+	assert(!store->has_materialized());
+	matrix_conf.set_fuse_mapply(false);
+	dense_matrix::ptr res0 = mat1->multiply_ele(*mat2)->add_scalar<double>(1);
+	dense_matrix::ptr res1 = res0->multiply_scalar<double>(2);
+	res0 = res0->add(*mat1)->abs();
+	res0->materialize_self();
+	res1->materialize_self();
+	matrix_conf.set_fuse_mapply(true);
+	scalar_variable::ptr diff = res0->minus(*mats[0])->abs()->max();
+	assert(*(double *) diff->get_raw() == 0);
+	diff = res1->minus(*mats[1])->abs()->max();
+	assert(*(double *) diff->get_raw() == 0);
+}
+
+void _test_qr(qr_method method, matrix_layout_t layout, bool in_mem)
+{
+	dense_matrix::ptr X = dense_matrix::create_randu<double>(0, 1,
+			long_dim, 10, layout, -1, in_mem);
+	dense_matrix::ptr Q, R;
+	bool ret = X->qr(Q, R, method);
+	assert(ret);
+	assert(Q->get_num_rows() == long_dim && Q->get_num_cols() == 10);
+	assert(Q->is_virtual());
+
+	R = R->conv_store(true, -1);
+	detail::mem_matrix_store::const_ptr Rstore
+		= detail::mem_matrix_store::cast(R->get_raw_store());
+	for (size_t i = 0; i < R->get_num_rows(); i++)
+		for (size_t j = 0; j < i; j++)
+			assert(Rstore->get<double>(i, j) == 0);
+
+	dense_matrix::ptr QtQ = Q->transpose()->multiply(*Q);
+	QtQ = QtQ->conv_store(true, -1);
+	detail::mem_matrix_store::const_ptr store
+		= detail::mem_matrix_store::cast(QtQ->get_raw_store());
+	for (size_t i = 0; i < QtQ->get_num_rows(); i++)
+		for (size_t j = 0; j < QtQ->get_num_cols(); j++)
+			assert(fabs(store->get<double>(i, j) - (i == j)) < 1e-10);
+	scalar_variable::ptr diff = Q->multiply(*R)->minus(*X)->abs()->max();
+	assert(*(double *) diff->get_raw() < 1e-10);
+}
+
+void test_qr()
+{
+	printf("test QR\n");
+	_test_qr(QR_TSQR, matrix_layout_t::L_COL, true);
+	_test_qr(QR_TSQR, matrix_layout_t::L_ROW, true);
+	_test_qr(QR_CHOL2, matrix_layout_t::L_COL, true);
+	if (safs::is_safs_init()) {
+		_test_qr(QR_TSQR, matrix_layout_t::L_COL, false);
+		_test_qr(QR_CHOL2, matrix_layout_t::L_COL, false);
+	}
+}
+
 void test_bmv_multiply_tall()
 {
 	if (!safs::is_safs_init())
@@ -3673,6 +3931,11 @@ int main(int argc, char *argv[])
 	init_flash_matrix(configs);
 	int num_nodes = matrix_conf.get_num_nodes();
 
+	test_fused_mapply();
+	test_mater_planner();
+	test_mater_planner_self();
+	test_mater_planner_fused();
+	test_qr();
 	test_ref_cnts(num_nodes);
 	test_set_rowcols();
 	test_cross_prod();
@@ -0,0 +1,196 @@
+/*
+ * Copyright 2017 Open Connectome Project (http://openconnecto.me)
+ * Written by Da Zheng (zhengda1936@gmail.com)
+ *
+ * This file is part of FlashMatrix.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <math.h>
+
+#include "matrix_config.h"
+#include "dense_matrix.h"
+#include "mem_matrix_store.h"
+#include "col_vec.h"
+#include "sparse_matrix.h"
+#include "eigensolver/eigensolver.h"
+
+using namespace fm;
+using namespace fm::eigen;
+
+/*
+ * This multiplies a dense matrix in memory.
+ */
+class dense_function: public spm_function
+{
+	dense_matrix::ptr mat;
+public:
+	dense_function(dense_matrix::ptr mat) {
+		this->mat = mat;
+	}
+
+	virtual dense_matrix::ptr run(dense_matrix::ptr &x) const {
+		return mat->multiply(*x);
+	}
+	virtual size_t get_num_cols() const {
+		return mat->get_num_cols();
+	}
+	virtual size_t get_num_rows() const {
+		return mat->get_num_rows();
+	}
+};
+
+static detail::mem_matrix_store::const_ptr get_mem_store(
+		const dense_matrix &mat)
+{
+	dense_matrix::ptr mem_mat = mat.conv_store(true, -1);
+	return detail::mem_matrix_store::cast(mem_mat->get_raw_store());
+}
+
+static col_vec::ptr create_col(const std::vector<double> &vals)
+{
+	detail::mem_matrix_store::ptr store = detail::mem_matrix_store::create(
+			vals.size(), 1, matrix_layout_t::L_COL,
+			get_scalar_type<double>(), -1);
+	for (size_t i = 0; i < vals.size(); i++)
+		store->set<double>(i, 0, vals[i]);
+	return col_vec::create(store);
+}
+
+/*
+ * Check that the columns of the matrix are orthonormal.
+ */
+static void check_orth(const dense_matrix &mat, double tol)
+{
+	dense_matrix::ptr prod = mat.transpose()->multiply(mat);
+	detail::mem_matrix_store::const_ptr store = get_mem_store(*prod);
+	for (size_t i = 0; i < store->get_num_rows(); i++)
+		for (size_t j = 0; j < store->get_num_cols(); j++)
+			assert(fabs(store->get<double>(i, j) - (i == j)) < tol);
+}
+
+/*
+ * Get the 2-norm of each column in the matrix.
+ */
+static std::vector<double> get_col_norms(const dense_matrix &mat)
+{
+	detail::mem_matrix_store::const_ptr store = get_mem_store(*mat.col_norm2());
+	std::vector<double> norms(mat.get_num_cols());
+	for (size_t i = 0; i < norms.size(); i++)
+		norms[i] = store->get<double>(i, 0);
+	return norms;
+}
+
+static dense_matrix::ptr create_sym(size_t n)
+{
+	dense_matrix::ptr mat = dense_matrix::create_randu<double>(-1, 1, n, n,
+			matrix_layout_t::L_COL);
+	return mat->add(*mat->transpose())->conv_store(true, -1);
+}
+
+void test_eigen(size_t n, int nev, int block_size, const std::string &which)
+{
+	printf("test LOBPCG: n: %ld, nev: %d, block size: %d, which: %s\n",
+			n, nev, block_size, which.c_str());
+	dense_matrix::ptr A = create_sym(n);
+	eigen_options opts;
+	opts.init(nev, "native");
+	opts.block_size = block_size;
+	opts.which = which;
+	opts.tol = 1e-8;
+	eigen_res res = compute_eigen_native(new dense_function(A), true, opts);
+	assert(res.vals.size() == (size_t) nev);
+	assert(res.vecs->get_num_cols() == (size_t) nev);
+
+	// The residual of each eigenpair is small.
+	dense_matrix::ptr resid = A->multiply(*res.vecs)->minus(
+			*res.vecs->scale_cols(create_col(res.vals)));
+	std::vector<double> resid_norms = get_col_norms(*resid);
+	for (size_t i = 0; i < res.vals.size(); i++)
+		assert(resid_norms[i] <= 1e-6 * std::max(fabs(res.vals[i]), 1.0));
+	check_orth(*res.vecs, 1e-8);
+
+	// The eigenvalues are ordered.
+	for (size_t i = 1; i < res.vals.size(); i++) {
+		if (which == "LA")
+			assert(res.vals[i - 1] >= res.vals[i]);
+		else if (which == "SA")
+			assert(res.vals[i - 1] <= res.vals[i]);
+		else
+			assert(fabs(res.vals[i - 1]) >= fabs(res.vals[i]));
+	}
+}
+
+/*
+ * The matrix is U * diag(vals) * V^T, where U and V have orthonormal
+ * columns.
+ */
+void test_rsvd(size_t nrow, size_t ncol, size_t rank)
+{
+	printf("test RSVD: %ld x %ld, rank: %ld\n", nrow, ncol, rank);
+	dense_matrix::ptr U, V, R;
+	bool ret = dense_matrix::create_randn<double>(0, 1, nrow, rank,
+			matrix_layout_t::L_COL)->qr(U, R);
+	assert(ret);
+	ret = dense_matrix::create_randn<double>(0, 1, ncol, rank,
+			matrix_layout_t::L_COL)->qr(V, R);
+	assert(ret);
+	std::vector<double> vals(rank);
+	for (size_t i = 0; i < rank; i++)
+		vals[i] = 100.0 / (i + 1);
+	dense_matrix::ptr A = U->scale_cols(create_col(vals))->multiply(
+			*V->transpose())->conv_store(true, -1);
+	dense_matrix::ptr At = A->transpose()->conv_store(true, -1);
+
+	size_t nsv = rank - 1;
+	svd_res res = compute_rsvd(spm_function::const_ptr(new dense_function(A)),
+			spm_function::const_ptr(new dense_function(At)), nsv, 5, 1);
+	assert(res.vals.size() == nsv);
+	// The matrix has low rank, so the singular values are exact up to
+	// the rounding errors.
+	for (size_t i = 0; i < nsv; i++)
+		assert(fabs(res.vals[i] - vals[i]) <= 1e-8 * vals[i]);
+	check_orth(*res.U, 1e-8);
+	check_orth(*res.V, 1e-8);
+
+	// A * v = s * u
+	dense_matrix::ptr diff = A->multiply(*res.V)->minus(
+			*res.U->scale_cols(create_col(res.vals)));
+	std::vector<double> diff_norms = get_col_norms(*diff);
+	for (size_t i = 0; i < nsv; i++)
+		assert(diff_norms[i] <= 1e-8 * vals[0]);
+}
+
+int main(int argc, char *argv[])
+{
+	if (argc < 2) {
+		fprintf(stderr, "test conf_file\n");
+		exit(1);
+	}
+
+	std::string conf_file = argv[1];
+	config_map::ptr configs = config_map::create(conf_file);
+	init_flash_matrix(configs);
+
+	test_eigen(200, 4, 8, "LA");
+	test_eigen(200, 4, 8, "SA");
+	test_eigen(200, 3, 0, "LM");
+	// The block fills the entire space, so orth_trans() drops columns
+	// of the subspace in every iteration.
+	test_eigen(10, 6, 10, "LA");
+	test_rsvd(1000, 200, 6);
+	test_rsvd(200, 1000, 6);
+
+	destroy_flash_matrix();
+}
@@ -0,0 +1,352 @@
+/*
+ * Copyright 2017 Open Connectome Project (http://openconnecto.me)
+ * Written by Da Zheng (zhengda1936@gmail.com)
+ *
+ * This file is part of FlashMatrix.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <map>
+#include <algorithm>
+
+#include "encoded_vec_store.h"
+#include "mem_vec_store.h"
+#include "local_vec_store.h"
+#include "bulk_operate_ext.h"
+#include "data_frame.h"
+#include "sparse_matrix.h"
+
+using namespace fm;
+
+template<class T>
+void check_vec(detail::smp_vec_store::const_ptr vec,
+		detail::encoded_vec_store::const_ptr encoded)
+{
+	assert(encoded->get_length() == vec->get_length());
+	assert(encoded->get_type() == vec->get_type());
+
+	detail::smp_vec_store::ptr decoded = encoded->decode();
+	assert(memcmp(decoded->get_raw_arr(), vec->get_raw_arr(),
+				vec->get_length() * sizeof(T)) == 0);
+	for (size_t i = 0; i < 100; i++) {
+		off_t start = random() % vec->get_length();
+		size_t len = random() % (vec->get_length() - start) + 1;
+		local_vec_store::const_ptr portion = encoded->get_portion(start, len);
+		assert(portion->get_length() == len);
+		assert(memcmp(portion->get_raw_arr(), vec->get(start),
+					len * sizeof(T)) == 0);
+	}
+	assert(encoded->get_portion(vec->get_length(), 1) == NULL);
+
+	// The aggregations on the encoded data.
+	const agg_ops &ops = get_scalar_type<T>().get_agg_ops();
+	const T *arr = reinterpret_cast<const T *>(vec->get_raw_arr());
+	T min = *std::min_element(arr, arr + vec->get_length());
+	T max = *std::max_element(arr, arr + vec->get_length());
+	T sum = 0;
+	for (size_t i = 0; i < vec->get_length(); i++)
+		sum += arr[i];
+	scalar_variable::ptr res = encoded->aggregate(*ops.get_op(agg_ops::MIN));
+	assert(scalar_variable::get_val<T>(*res) == min);
+	res = encoded->aggregate(*ops.get_op(agg_ops::MAX));
+	assert(scalar_variable::get_val<T>(*res) == max);
+	res = encoded->aggregate(*ops.get_op(agg_ops::SUM));
+	assert(scalar_variable::get_val<T>(*res) == sum);
+
+	// Apply an operator to each value.
+	const bulk_uoperate &neg = *get_scalar_type<T>().get_basic_uops().get_op(
+			basic_uops::op_idx::NEG);
+	detail::vec_store::ptr neg_vec = encoded->sapply(neg);
+	assert(neg_vec->get_length() == vec->get_length());
+	std::vector<T> neg_vals(vec->get_length());
+	neg_vec->copy_to((char *) neg_vals.data(), neg_vals.size());
+	for (size_t i = 0; i < neg_vals.size(); i++)
+		assert(neg_vals[i] == -arr[i]);
+}
+
+void test_dict()
+{
+	printf("test dictionary encoding\n");
+	size_t length = 1000000;
+	detail::smp_vec_store::ptr vec = detail::smp_vec_store::create(length,
+			get_scalar_type<long>());
+	for (size_t i = 0; i < length; i++)
+		vec->set<long>(i, (random() % 100) * 1000000L);
+	detail::encoded_vec_store::ptr encoded = detail::encoded_vec_store::create(
+			*vec);
+	assert(encoded);
+	assert(encoded->get_encoding() == detail::vec_encoding::DICT);
+	assert(encoded->get_num_bytes() * 8 < vec->get_num_bytes());
+	check_vec<long>(vec, encoded);
+	// The operator is applied to the dictionary.
+	const bulk_uoperate &neg = *get_scalar_type<long>().get_basic_uops().get_op(
+			basic_uops::op_idx::NEG);
+	detail::encoded_vec_store::ptr neg_vec = detail::encoded_vec_store::cast(
+			encoded->sapply(neg));
+	assert(neg_vec && neg_vec->get_encoding() == detail::vec_encoding::DICT);
+
+	// There are too many distinct values for a dictionary.
+	for (size_t i = 0; i < length; i++)
+		vec->set<long>(i, random());
+	assert(detail::encoded_vec_store::create(*vec,
+				detail::vec_encoding::DICT) == NULL);
+}
+
+void test_rle()
+{
+	printf("test run-length encoding\n");
+	size_t length = 1000000;
+	detail::smp_vec_store::ptr vec = detail::smp_vec_store::create(length,
+			get_scalar_type<double>());
+	for (size_t i = 0; i < length; i++)
+		vec->set<double>(i, (i / 1000) * 0.5);
+	detail::encoded_vec_store::ptr encoded = detail::encoded_vec_store::create(
+			*vec);
+	assert(encoded);
+	assert(encoded->get_encoding() == detail::vec_encoding::RLE);
+	assert(encoded->get_num_bytes() * 100 < vec->get_num_bytes());
+	check_vec<double>(vec, encoded);
+}
+
+void test_for()
+{
+	printf("test frame-of-reference encoding\n");
+	size_t length = 1000000;
+	detail::smp_vec_store::ptr vec = detail::smp_vec_store::create(length,
+			get_scalar_type<long>());
+	// The values increase slowly, so the values in a block are close.
+	for (size_t i = 0; i < length; i++)
+		vec->set<long>(i, i / 64 + random() % 16 - 1000);
+	detail::encoded_vec_store::ptr encoded = detail::encoded_vec_store::create(
+			*vec);
+	assert(encoded);
+	assert(encoded->get_encoding() == detail::vec_encoding::FOR);
+	assert(encoded->get_num_bytes() * 4 < vec->get_num_bytes());
+	check_vec<long>(vec, encoded);
+
+	// Frame-of-reference encoding doesn't work for floating-points.
+	detail::smp_vec_store::ptr dvec = detail::smp_vec_store::create(length,
+			get_scalar_type<double>());
+	assert(detail::encoded_vec_store::create(*dvec,
+				detail::vec_encoding::FOR) == NULL);
+	// No encoding can save space for random values.
+	for (size_t i = 0; i < length; i++)
+		dvec->set<double>(i, random() / 3.0);
+	assert(detail::encoded_vec_store::create(*dvec) == NULL);
+}
+
+void test_read_only()
+{
+	printf("test modifying an encoded vector\n");
+	size_t length = 100000;
+	detail::smp_vec_store::ptr vec = detail::smp_vec_store::create(length,
+			get_scalar_type<int>());
+	for (size_t i = 0; i < length; i++)
+		vec->set<int>(i, i % 10);
+	detail::encoded_vec_store::ptr encoded = detail::encoded_vec_store::create(
+			*vec);
+	assert(encoded->is_in_mem());
+	assert(!encoded->append(*vec));
+	assert(!encoded->resize(length + 1));
+	assert(!encoded->set_portion(vec->get_portion(0, 10), 0));
+	assert(encoded->get_length() == length);
+	assert(!encoded->is_sorted());
+}
+
+void test_data_frame()
+{
+	printf("test aggregating a data frame with encoded columns\n");
+	size_t num_rows = 1000000;
+	detail::smp_vec_store::ptr keys = detail::smp_vec_store::create(num_rows,
+			get_scalar_type<long>());
+	detail::smp_vec_store::ptr vals = detail::smp_vec_store::create(num_rows,
+			get_scalar_type<int>());
+	std::map<long, int> res_map;
+	for (size_t i = 0; i < num_rows; i++) {
+		long key = (random() % 1000) * 1000000000000L;
+		int val = random() % 1000;
+		keys->set<long>(i, key);
+		vals->set<int>(i, val);
+		res_map[key] += val;
+	}
+	data_frame::ptr df = data_frame::create();
+	df->add_vec("key", detail::encoded_vec_store::create(*keys));
+	df->add_vec("val", detail::encoded_vec_store::create(*vals));
+
+	std::vector<std::string> val_cols(1, "val");
+	std::vector<agg_operate::const_ptr> aggs(1,
+			get_scalar_type<int>().get_agg_ops().get_op(agg_ops::SUM));
+	data_frame::ptr res = df->aggregate("key", val_cols, aggs);
+	assert(res);
+	assert(res->get_num_entries() == res_map.size());
+	std::vector<long> res_keys(res->get_num_entries());
+	std::vector<int> res_vals(res->get_num_entries());
+	res->get_vec("key")->copy_to((char *) res_keys.data(), res_keys.size());
+	res->get_vec("val")->copy_to((char *) res_vals.data(), res_vals.size());
+	for (size_t i = 0; i < res_keys.size(); i++)
+		assert(res_map[res_keys[i]] == res_vals[i]);
+}
+
+/*
+ * Check that the rows of the data frame are sorted on the column and that
+ * the values in a row still match.
+ */
+void check_sorted_df(data_frame::const_ptr df, const std::string &col_name)
+{
+	assert(df);
+	assert(df->get_vec(col_name)->is_sorted());
+	std::vector<long> keys(df->get_num_entries());
+	std::vector<int> vals(df->get_num_entries());
+	df->get_vec("key")->copy_to((char *) keys.data(), keys.size());
+	df->get_vec("val")->copy_to((char *) vals.data(), vals.size());
+	for (size_t i = 0; i < keys.size(); i++)
+		assert(vals[i] == keys[i] % 10);
+}
+
+void test_sort_data_frame()
+{
+	printf("test sorting a data frame with encoded columns\n");
+	size_t num_rows = 1000000;
+	detail::smp_vec_store::ptr keys = detail::smp_vec_store::create(num_rows,
+			get_scalar_type<long>());
+	detail::smp_vec_store::ptr vals = detail::smp_vec_store::create(num_rows,
+			get_scalar_type<int>());
+	for (size_t i = 0; i < num_rows; i++) {
+		long key = random();
+		keys->set<long>(i, key);
+		vals->set<int>(i, key % 10);
+	}
+	detail::encoded_vec_store::ptr encoded = detail::encoded_vec_store::create(
+			*vals);
+	data_frame::ptr df = data_frame::create();
+	df->add_vec("key", keys);
+	df->add_vec("val", encoded);
+
+	// The encoded column is reordered with the sorted column.
+	check_sorted_df(df->sort("key"), "key");
+
+	// Sort on the encoded column. The sorted column is still encoded.
+	data_frame::const_ptr sorted = df->sort("val");
+	check_sorted_df(sorted, "val");
+	assert(detail::encoded_vec_store::cast(sorted->get_vec("val")));
+	// The original column isn't changed.
+	assert(!encoded->is_sorted());
+	check_vec<int>(vals, encoded);
+}
+
+/*
+ * Create a data frame whose "key" column is a plain vector and whose
+ * "val" column is key % 10. The "val" column may be encoded.
+ */
+data_frame::ptr create_df(size_t num_rows, bool encode_val,
+		std::vector<long> &keys)
+{
+	detail::smp_vec_store::ptr key_vec = detail::smp_vec_store::create(
+			num_rows, get_scalar_type<long>());
+	detail::smp_vec_store::ptr val_vec = detail::smp_vec_store::create(
+			num_rows, get_scalar_type<int>());
+	for (size_t i = 0; i < num_rows; i++) {
+		long key = random();
+		key_vec->set<long>(i, key);
+		val_vec->set<int>(i, key % 10);
+		keys.push_back(key);
+	}
+	data_frame::ptr df = data_frame::create();
+	df->add_vec("key", key_vec);
+	if (encode_val)
+		df->add_vec("val", detail::encoded_vec_store::create(*val_vec,
+					detail::vec_encoding::DICT));
+	else
+		df->add_vec("val", val_vec);
+	return df;
+}
+
+/*
+ * Check that the data frame has the keys in order and that the values
+ * in a row still match.
+ */
+void check_appended_df(data_frame::const_ptr df, const std::vector<long> &keys)
+{
+	assert(df);
+	assert(df->get_num_entries() == keys.size());
+	std::vector<long> df_keys(keys.size());
+	df->get_vec("key")->copy_to((char *) df_keys.data(), df_keys.size());
+	assert(df_keys == keys);
+	check_sorted_df(df->sort("key"), "key");
+}
+
+void test_append_data_frame()
+{
+	printf("test appending data frames with encoded columns\n");
+	std::vector<long> keys1, keys2, keys3;
+	data_frame::ptr df1 = create_df(100000, true, keys1);
+	data_frame::ptr df2 = create_df(200000, true, keys2);
+	data_frame::ptr df3 = create_df(300000, false, keys3);
+	std::vector<long> keys = keys1;
+	keys.insert(keys.end(), keys2.begin(), keys2.end());
+	keys.insert(keys.end(), keys3.begin(), keys3.end());
+
+	// The encoded column of the first data frame stays encoded.
+	std::vector<data_frame::const_ptr> dfs(3);
+	dfs[0] = df1;
+	dfs[1] = df2;
+	dfs[2] = df3;
+	data_frame::ptr merged = merge_data_frame(dfs, true);
+	check_appended_df(merged, keys);
+	assert(detail::encoded_vec_store::cast(merged->get_vec("val")));
+	// The input data frames aren't changed.
+	check_appended_df(df1, keys1);
+
+	// Append encoded columns to plain columns.
+	std::vector<long> plain_keys = keys3;
+	plain_keys.insert(plain_keys.end(), keys1.begin(), keys1.end());
+	data_frame::ptr plain = create_df(0, false, keys3);
+	std::vector<data_frame::ptr> appended(2);
+	appended[0] = df3;
+	appended[1] = df1;
+	assert(plain->append(appended.begin(), appended.end()));
+	check_appended_df(plain, plain_keys);
+	assert(detail::encoded_vec_store::cast(plain->get_vec("val")) == NULL);
+
+	// Append plain and encoded columns to an encoded column.
+	std::vector<long> encoded_keys = keys1;
+	encoded_keys.insert(encoded_keys.end(), keys3.begin(), keys3.end());
+	encoded_keys.insert(encoded_keys.end(), keys2.begin(), keys2.end());
+	assert(df1->append(df3));
+	assert(df1->append(df2));
+	check_appended_df(df1, encoded_keys);
+	assert(detail::encoded_vec_store::cast(df1->get_vec("val")));
+}
+
+int main(int argc, char *argv[])
+{
+	if (argc < 2) {
+		fprintf(stderr, "test conf_file\n");
+		exit(1);
+	}
+
+	std::string conf_file = argv[1];
+	config_map::ptr configs = config_map::create(conf_file);
+	init_flash_matrix(configs);
+
+	test_dict();
+	test_rle();
+	test_for();
+	test_read_only();
+	test_data_frame();
+	test_sort_data_frame();
+	test_append_data_frame();
+
+	destroy_flash_matrix();
+}
@@ -2,7 +2,7 @@
 
 using namespace fm;
 
-int main()
+void test_small()
 {
 	std::vector<int> keys(1000);
 	for (size_t i = 0; i < keys.size(); i++)
@@ -49,6 +49,71 @@ int main()
 		assert(ret != counts.end());
 		assert(ret->second * 2 == val);
 	}
+}
+
+/*
+ * There are many more distinct keys than the initial size of the table,
+ * so the table has to grow. The local tables are merged in parallel.
+ */
+void test_merge()
+{
+	size_t num_tables = 8;
+	size_t num_keys = 200000;
+	bulk_operate::const_ptr add
+		= bulk_operate::conv2ptr(get_scalar_type<long>().get_basic_ops().get_add());
+	agg_operate::const_ptr sum = agg_operate::create(add);
+
+	std::unordered_map<long, long> counts;
+	std::vector<generic_hashtable::ptr> tables(num_tables);
+	for (size_t i = 0; i < num_tables; i++) {
+		// Leave one table empty.
+		if (i == 3)
+			continue;
+		std::vector<long> keys(num_keys);
+		std::vector<long> vals(num_keys);
+		for (size_t j = 0; j < keys.size(); j++) {
+			keys[j] = random() % (num_keys * 2);
+			vals[j] = random() % 100;
+			counts[keys[j]] += vals[j];
+		}
+		tables[i] = generic_hashtable::ptr(
+				new generic_hashtable_impl<long, sizeof(long)>(
+					get_scalar_type<long>()));
+		tables[i]->insert(keys.size(), keys.data(), vals.data(), *sum);
+	}
+	generic_hashtable::ptr res = generic_hashtable::merge(tables, *sum);
+	assert(res->get_num_entries() == counts.size());
+	data_frame::ptr df = res->conv2df();
+	detail::smp_vec_store::const_ptr key_vec = detail::smp_vec_store::cast(
+			df->get_vec(0));
+	detail::smp_vec_store::const_ptr val_vec = detail::smp_vec_store::cast(
+			df->get_vec(1));
+	assert(key_vec->get_length() == counts.size());
+	for (size_t i = 0; i < key_vec->get_length(); i++) {
+		auto ret = counts.find(key_vec->get<long>(i));
+		assert(ret != counts.end());
+		assert(ret->second == val_vec->get<long>(i));
+	}
 
+	// Insert more data to the merged table.
+	std::vector<long> keys(num_keys);
+	std::vector<long> vals(num_keys, 1);
+	for (size_t j = 0; j < keys.size(); j++) {
+		keys[j] = random() % (num_keys * 4);
+		counts[keys[j]] += 1;
+	}
+	res->insert(keys.size(), keys.data(), vals.data(), *sum);
+	assert(res->get_num_entries() == counts.size());
+	df = res->conv2df();
+	key_vec = detail::smp_vec_store::cast(df->get_vec(0));
+	val_vec = detail::smp_vec_store::cast(df->get_vec(1));
+	for (size_t i = 0; i < key_vec->get_length(); i++)
+		assert(counts[key_vec->get<long>(i)] == val_vec->get<long>(i));
+}
+
+int main()
+{
+	test_small();
+	test_merge();
 	return 0;
 }
@@ -0,0 +1,291 @@
+/*
+ * Copyright 2017 Open Connectome Project (http://openconnecto.me)
+ * Written by Da Zheng (zhengda1936@gmail.com)
+ *
+ * This file is part of FlashMatrix.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <omp.h>
+
+#include <vector>
+#include <atomic>
+
+#include "mem_worker_thread.h"
+
+using namespace fm;
+using namespace fm::detail;
+
+/*
+ * Count how many times each task is returned.
+ */
+class task_counts
+{
+	std::unique_ptr<std::atomic<int>[]> counts;
+	size_t num_tasks;
+public:
+	task_counts(size_t num_tasks): counts(new std::atomic<int>[num_tasks]) {
+		this->num_tasks = num_tasks;
+		for (size_t i = 0; i < num_tasks; i++)
+			counts[i] = 0;
+	}
+
+	void add(size_t task) {
+		assert(task < num_tasks);
+		counts[task]++;
+	}
+
+	bool is_all_once() const {
+		for (size_t i = 0; i < num_tasks; i++)
+			if (counts[i] != 1)
+				return false;
+		return true;
+	}
+};
+
+/*
+ * The owner pushes tasks and takes some of them back while the thieves
+ * steal tasks from it.
+ */
+void test_ws_deque(size_t num_tasks, int num_thieves)
+{
+	printf("test work-stealing deque with %ld tasks and %d thieves\n",
+			num_tasks, num_thieves);
+	ws_deque deque(num_tasks);
+	task_counts counts(num_tasks);
+	std::atomic<bool> all_pushed(false);
+#pragma omp parallel num_threads(num_thieves + 1)
+	{
+		if (omp_get_thread_num() == 0) {
+			for (size_t i = 0; i < num_tasks; i++) {
+				deque.push(i);
+				if (i % 3 == 0) {
+					size_t task = deque.take();
+					if (task != ws_deque::EMPTY)
+						counts.add(task);
+				}
+			}
+			all_pushed = true;
+			size_t task;
+			while ((task = deque.take()) != ws_deque::EMPTY)
+				counts.add(task);
+		}
+		else {
+			while (true) {
+				// A steal can only fail on an empty deque after all tasks
+				// have been pushed.
+				bool done = all_pushed;
+				size_t task = deque.steal();
+				if (task == ws_deque::EMPTY && done)
+					break;
+				else if (task != ws_deque::EMPTY && task != ws_deque::ABORT)
+					counts.add(task);
+			}
+		}
+	}
+	assert(counts.is_all_once());
+}
+
+void test_victims(size_t num_nodes, size_t nthreads_per_node)
+{
+	printf("test the steal order of %ld nodes with %ld threads per node\n",
+			num_nodes, nthreads_per_node);
+	mem_thread_pool::ptr pool = mem_thread_pool::create(num_nodes,
+			nthreads_per_node);
+	portion_ws_queue::ptr queue = portion_ws_queue::create(*pool,
+			std::vector<int>());
+	size_t num_threads = num_nodes * nthreads_per_node;
+	for (size_t i = 0; i < num_threads; i++) {
+		const std::vector<int> &victims = queue->get_victims(i);
+		// It steals from every other thread once.
+		assert(victims.size() == num_threads - 1);
+		std::vector<bool> seen(num_threads);
+		seen[i] = true;
+		for (size_t j = 0; j < victims.size(); j++) {
+			assert(!seen[victims[j]]);
+			seen[victims[j]] = true;
+		}
+
+		// The threads in the same cluster come first, then the other threads
+		// in the same node.
+		size_t node_id = i / nthreads_per_node;
+		size_t cluster_id = i % nthreads_per_node / portion_ws_queue::CLUSTER_SIZE;
+		size_t cluster_start = cluster_id * portion_ws_queue::CLUSTER_SIZE;
+		size_t cluster_size = std::min(portion_ws_queue::CLUSTER_SIZE,
+				nthreads_per_node - cluster_start);
+		for (size_t j = 0; j < victims.size(); j++) {
+			size_t victim_node = victims[j] / nthreads_per_node;
+			size_t victim_cluster = victims[j] % nthreads_per_node
+				/ portion_ws_queue::CLUSTER_SIZE;
+			if (j < cluster_size - 1)
+				assert(victim_node == node_id && victim_cluster == cluster_id);
+			else if (j < nthreads_per_node - 1)
+				assert(victim_node == node_id && victim_cluster != cluster_id);
+			else
+				assert(victim_node != node_id);
+		}
+	}
+}
+
+class get_portion_task: public thread_task
+{
+	portion_ws_queue &queue;
+	task_counts &counts;
+public:
+	get_portion_task(portion_ws_queue &_queue,
+			task_counts &_counts): queue(_queue), counts(_counts) {
+	}
+
+	virtual void run() {
+		size_t portion_idx;
+		while ((portion_idx = queue.get_portion_idx())
+				!= portion_ws_queue::INVALID_TASK)
+			counts.add(portion_idx);
+	}
+};
+
+/*
+ * All worker threads in a pool get portions from the queue.
+ */
+void test_portion_queue(size_t num_nodes, size_t nthreads_per_node,
+		size_t num_portions)
+{
+	printf("test getting %ld portions with %ld nodes and %ld threads per node\n",
+			num_portions, num_nodes, nthreads_per_node);
+	mem_thread_pool::ptr pool = mem_thread_pool::create(num_nodes,
+			nthreads_per_node);
+	// Some portions are in a NUMA node and some aren't.
+	std::vector<int> portion_nodes(num_portions);
+	for (size_t i = 0; i < num_portions; i++)
+		portion_nodes[i] = i % 5 == 0 ? -1 : i % num_nodes;
+	portion_ws_queue::ptr queue = portion_ws_queue::create(*pool,
+			portion_nodes);
+	task_counts counts(num_portions);
+	for (size_t i = 0; i < pool->get_num_threads(); i++)
+		pool->process_task(i / nthreads_per_node,
+				new get_portion_task(*queue, counts));
+	pool->wait4complete();
+	assert(counts.is_all_once());
+}
+
+/*
+ * Run tasks that take `compute' microseconds of computation and whose I/O
+ * takes `latency' microseconds. The I/O of a task issued `n' tasks ahead
+ * overlaps with the computation of the n tasks and the stalls for them.
+ * It returns the total stall time.
+ */
+double run_tasks(prefetch_depth &depth, double compute, double latency,
+		size_t num_tasks, size_t &num_issued)
+{
+	double tot_stall = 0;
+	for (size_t i = 0; i < num_tasks; i++) {
+		size_t n = std::min(num_issued, depth.get() - 1);
+		double stall = std::max(0.0, (latency - n * compute) / (n + 1));
+		depth.update(compute, stall);
+		num_issued++;
+		tot_stall += stall;
+	}
+	return tot_stall;
+}
+
+void test_prefetch_io_bound()
+{
+	printf("test prefetch depth of I/O-bound tasks\n");
+	size_t num_issued = 0;
+	prefetch_depth depth(2, 16, 4);
+	run_tasks(depth, 100, 10000, 100, num_issued);
+	assert(depth.get() == 16);
+
+	// The computation is negligible.
+	num_issued = 0;
+	prefetch_depth depth1(2, 16, 4);
+	run_tasks(depth1, 0, 1000, 100, num_issued);
+	assert(depth1.get() == 16);
+}
+
+void test_prefetch_compute_bound()
+{
+	printf("test prefetch depth of compute-bound tasks\n");
+	size_t num_issued = 0;
+	prefetch_depth depth(2, 16, 16);
+	run_tasks(depth, 1000, 100, 100, num_issued);
+	assert(depth.get() == 2);
+
+	// One task ahead can't hide the I/O, but two tasks can. The depth
+	// drops to 2 once in a while to try it, which causes a short stall.
+	num_issued = 0;
+	prefetch_depth depth1(2, 16, 16);
+	run_tasks(depth1, 1000, 1500, 100, num_issued);
+	assert(depth1.get() <= 3);
+	double stall = run_tasks(depth1, 1000, 1500, 100, num_issued);
+	assert(stall < 100 * 1000 * 0.05);
+}
+
+void test_prefetch_overestimate()
+{
+	printf("test prefetch depth after the I/O latency drops\n");
+	size_t num_issued = 0;
+	prefetch_depth depth(2, 16, 4);
+	run_tasks(depth, 1000, 20000, 100, num_issued);
+	assert(depth.get() == 16);
+	// The depth recovers without long stalls.
+	double stall = run_tasks(depth, 1000, 3000, 600, num_issued);
+	assert(depth.get() == 3 || depth.get() == 4);
+	assert(stall < 600 * 1000 * 0.05);
+	// The depth grows again when the I/O becomes slow.
+	run_tasks(depth, 1000, 8000, 100, num_issued);
+	assert(depth.get() == 8 || depth.get() == 9);
+	stall = run_tasks(depth, 1000, 8000, 100, num_issued);
+	assert(stall < 100 * 1000 * 0.05);
+}
+
+void test_prefetch_mem_limit()
+{
+	printf("test prefetch depth limited by memory\n");
+	size_t num_issued = 0;
+	prefetch_depth depth(2, 16, 4);
+	run_tasks(depth, 100, 10000, 100, num_issued);
+	assert(depth.get() == 16);
+	depth.set_mem_limit(64 * 1024 * 1024, 16 * 1024 * 1024);
+	assert(depth.get() == 4);
+	run_tasks(depth, 100, 10000, 100, num_issued);
+	assert(depth.get() == 4);
+	// The depth doesn't go below the min depth.
+	depth.set_mem_limit(1024 * 1024, 16 * 1024 * 1024);
+	assert(depth.get() == 2);
+	// We don't know the size of a task yet.
+	depth.set_mem_limit(1024 * 1024, 0);
+	assert(depth.get() == 16);
+}
+
+int main()
+{
+	test_ws_deque(1, 4);
+	test_ws_deque(1000, 1);
+	test_ws_deque(1000000, 4);
+	test_ws_deque(1000000, 16);
+
+	test_victims(1, 8);
+	test_victims(2, 6);
+	test_victims(4, 3);
+
+	test_portion_queue(1, 8, 10000);
+	test_portion_queue(2, 6, 10000);
+	test_portion_queue(2, 4, 3);
+
+	test_prefetch_io_bound();
+	test_prefetch_compute_bound();
+	test_prefetch_overestimate();
+	test_prefetch_mem_limit();
+}
@@ -0,0 +1,258 @@
+/*
+ * Copyright 2017 Open Connectome Project (http://openconnecto.me)
+ * Written by Da Zheng (zhengda1936@gmail.com)
+ *
+ * This file is part of FlashMatrix.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <math.h>
+#include <string.h>
+
+#include <vector>
+#include <limits>
+
+#include "bulk_operate.h"
+#include "simd_kernels.h"
+
+using namespace fm;
+
+/*
+ * The lengths leave tails of different sizes for the vectors of 4, 8 and
+ * 16 elements.
+ */
+static const size_t lens[] = {1, 3, 7, 8, 9, 15, 16, 17, 31, 33, 63, 100, 1001};
+
+static const simd::isa_level isas[] = {simd::ISA_AVX2, simd::ISA_AVX512};
+
+template<class T>
+bool is_same_val(T v1, T v2, bool approx)
+{
+	if (std::numeric_limits<T>::is_integer)
+		return v1 == v2;
+	if (isnan(v1) || isnan(v2))
+		return isnan(v1) && isnan(v2);
+	if (approx)
+		return fabs(v1 - v2) <= (fabs(v1) + fabs(v2) + 1)
+			* std::numeric_limits<T>::epsilon() * 16;
+	return v1 == v2;
+}
+
+/*
+ * Compare the outputs of an operator. The output type is either T or bool.
+ */
+template<class T>
+bool is_same_out(const scalar_type &out_type, const std::vector<char> &out1,
+		const std::vector<char> &out2, size_t num, bool approx)
+{
+	if (out_type == get_scalar_type<T>()) {
+		const T *arr1 = (const T *) out1.data();
+		const T *arr2 = (const T *) out2.data();
+		for (size_t i = 0; i < num; i++)
+			if (!is_same_val(arr1[i], arr2[i], approx))
+				return false;
+		return true;
+	}
+	else
+		return memcmp(out1.data(), out2.data(),
+				num * out_type.get_size()) == 0;
+}
+
+/*
+ * The input has equal values in both arrays for the comparison operators,
+ * and float-point inputs have NaN.
+ */
+template<class T>
+void get_inputs(size_t num, std::vector<T> &left, std::vector<T> &right)
+{
+	bool is_int = std::numeric_limits<T>::is_integer;
+	left.resize(num);
+	right.resize(num);
+	for (size_t i = 0; i < num; i++) {
+		left[i] = is_int ? random() % 2000 - 1000 : (random() % 2000 - 1000) / 7.0;
+		// The right values aren't 0, so integer division works.
+		right[i] = is_int ? random() % 999 + 1 : (random() % 2000 - 1000) / 3.0;
+		if (i % 5 == 0)
+			right[i] = left[i];
+		if (!is_int && i % 37 == 5)
+			left[i] = std::numeric_limits<T>::quiet_NaN();
+		if (!is_int && i % 41 == 7)
+			right[i] = std::numeric_limits<T>::quiet_NaN();
+	}
+}
+
+template<class T>
+void test_binary(basic_ops::op_idx idx)
+{
+	const bulk_operate &op = *get_scalar_type<T>().get_basic_ops().get_op(idx);
+	// The vectorized kernel multiplies doubles without long double.
+	bool approx = idx == basic_ops::op_idx::MUL;
+	for (size_t k = 0; k < sizeof(lens) / sizeof(lens[0]); k++) {
+		size_t num = lens[k];
+		std::vector<T> left, right;
+		get_inputs(num, left, right);
+		T val = 3;
+		size_t out_size = num * op.output_entry_size();
+		std::vector<char> AA(out_size), AE(out_size), EA(out_size);
+
+		simd::set_max_isa(simd::ISA_NONE);
+		op.runAA(num, left.data(), right.data(), AA.data());
+		op.runAE(num, left.data(), &val, AE.data());
+		op.runEA(num, &val, right.data(), EA.data());
+		for (size_t i = 0; i < sizeof(isas) / sizeof(isas[0]); i++) {
+			simd::set_max_isa(isas[i]);
+			if (simd::get_isa() != isas[i])
+				continue;
+			std::vector<char> out(out_size);
+			op.runAA(num, left.data(), right.data(), out.data());
+			assert(is_same_out<T>(op.get_output_type(), AA, out, num, approx));
+			op.runAE(num, left.data(), &val, out.data());
+			assert(is_same_out<T>(op.get_output_type(), AE, out, num, approx));
+			op.runEA(num, &val, right.data(), out.data());
+			assert(is_same_out<T>(op.get_output_type(), EA, out, num, approx));
+		}
+	}
+}
+
+template<class T>
+void test_agg(basic_ops::op_idx idx)
+{
+	const bulk_operate &op = *get_scalar_type<T>().get_basic_ops().get_op(idx);
+	// The vectorized kernel adds the elements in a different order.
+	bool approx = idx == basic_ops::op_idx::ADD;
+	for (size_t k = 0; k < sizeof(lens) / sizeof(lens[0]); k++) {
+		size_t num = lens[k];
+		std::vector<T> left, right;
+		get_inputs(num, left, right);
+		// The result of min/max of float with NaN depends on the order
+		// of the elements.
+		for (size_t i = 0; i < num; i++)
+			if (isnan(left[i]))
+				left[i] = 0;
+		// The bound of the rounding error of the sum.
+		double err = 0;
+		for (size_t i = 0; i < num; i++)
+			err += fabs(left[i]) * std::numeric_limits<T>::epsilon() * num;
+
+		T expected, res;
+		simd::set_max_isa(simd::ISA_NONE);
+		op.runAgg(num, left.data(), &expected);
+		for (size_t i = 0; i < sizeof(isas) / sizeof(isas[0]); i++) {
+			simd::set_max_isa(isas[i]);
+			if (simd::get_isa() != isas[i])
+				continue;
+			op.runAgg(num, left.data(), &res);
+			assert(is_same_val(expected, res, false)
+					|| (approx && fabs(expected - res) <= err));
+		}
+	}
+}
+
+template<class T>
+void test_cum()
+{
+	const bulk_operate &op = get_scalar_type<T>().get_basic_ops().get_add();
+	for (size_t k = 0; k < sizeof(lens) / sizeof(lens[0]); k++) {
+		size_t num = lens[k];
+		std::vector<T> in(num);
+		for (size_t i = 0; i < num; i++)
+			in[i] = random() % 1000 / 7.0;
+		T prev = 5;
+		std::vector<T> expected(num), expected_prev(num);
+		simd::set_max_isa(simd::ISA_NONE);
+		op.runCum(num, in.data(), NULL, expected.data());
+		op.runCum(num, in.data(), &prev, expected_prev.data());
+		for (size_t i = 0; i < sizeof(isas) / sizeof(isas[0]); i++) {
+			simd::set_max_isa(isas[i]);
+			if (simd::get_isa() != isas[i])
+				continue;
+			std::vector<T> out(num);
+			// The prefix sum adds the elements in a different order,
+			// so the rounding error grows with the length.
+			op.runCum(num, in.data(), NULL, out.data());
+			for (size_t j = 0; j < num; j++)
+				assert(fabs(expected[j] - out[j]) <= fabs(expected[j])
+						* std::numeric_limits<T>::epsilon() * (j + 1));
+			op.runCum(num, in.data(), &prev, out.data());
+			for (size_t j = 0; j < num; j++)
+				assert(fabs(expected_prev[j] - out[j]) <= fabs(expected_prev[j])
+						* std::numeric_limits<T>::epsilon() * (j + 1));
+		}
+	}
+}
+
+template<class T>
+void test_unary(basic_uops::op_idx idx)
+{
+	const bulk_uoperate &op = *get_scalar_type<T>().get_basic_uops().get_op(idx);
+	for (size_t k = 0; k < sizeof(lens) / sizeof(lens[0]); k++) {
+		size_t num = lens[k];
+		std::vector<T> in, tmp;
+		get_inputs(num, in, tmp);
+		size_t out_size = num * op.output_entry_size();
+		std::vector<char> expected(out_size);
+		simd::set_max_isa(simd::ISA_NONE);
+		op.runA(num, in.data(), expected.data());
+		for (size_t i = 0; i < sizeof(isas) / sizeof(isas[0]); i++) {
+			simd::set_max_isa(isas[i]);
+			if (simd::get_isa() != isas[i])
+				continue;
+			std::vector<char> out(out_size);
+			op.runA(num, in.data(), out.data());
+			if (op.get_output_type() == get_scalar_type<double>())
+				assert(is_same_out<double>(op.get_output_type(), expected, out,
+							num, false));
+			else
+				assert(is_same_out<T>(op.get_output_type(), expected, out,
+							num, false));
+		}
+	}
+}
+
+template<class T>
+void test_type()
+{
+	basic_ops::op_idx bops[] = {basic_ops::op_idx::ADD, basic_ops::op_idx::SUB,
+		basic_ops::op_idx::MUL, basic_ops::op_idx::DIV, basic_ops::op_idx::MIN,
+		basic_ops::op_idx::MAX, basic_ops::op_idx::EQ, basic_ops::op_idx::NEQ,
+		basic_ops::op_idx::GT, basic_ops::op_idx::GE, basic_ops::op_idx::LT,
+		basic_ops::op_idx::LE};
+	for (size_t i = 0; i < sizeof(bops) / sizeof(bops[0]); i++)
+		test_binary<T>(bops[i]);
+	test_agg<T>(basic_ops::op_idx::ADD);
+	test_agg<T>(basic_ops::op_idx::MIN);
+	test_agg<T>(basic_ops::op_idx::MAX);
+	test_cum<T>();
+	basic_uops::op_idx uops[] = {basic_uops::op_idx::NEG,
+		basic_uops::op_idx::ABS, basic_uops::op_idx::SQRT};
+	for (size_t i = 0; i < sizeof(uops) / sizeof(uops[0]); i++)
+		test_unary<T>(uops[i]);
+}
+
+int main()
+{
+	simd::isa_level cpu_isa = simd::get_isa();
+	printf("The CPU supports %s\n", simd::get_isa_name(cpu_isa).c_str());
+
+	printf("test double\n");
+	test_type<double>();
+	printf("test float\n");
+	test_type<float>();
+	printf("test long\n");
+	test_type<long>();
+	printf("test int\n");
+	test_type<int>();
+
+	simd::set_max_isa(simd::ISA_AVX512);
+}
@@ -0,0 +1,233 @@
+/*
+ * Copyright 2017 Open Connectome Project (http://openconnecto.me)
+ * Written by Da Zheng (zhengda1936@gmail.com)
+ *
+ * This file is part of FlashMatrix.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <math.h>
+
+#include <algorithm>
+#include <set>
+
+#include "sketch.h"
+#include "data_frame.h"
+#include "dense_matrix.h"
+#include "mem_vec_store.h"
+#include "mem_matrix_store.h"
+#include "sparse_matrix.h"
+
+using namespace fm;
+
+void test_quantile()
+{
+	printf("test quantile sketch\n");
+	size_t num = 1000000;
+	std::vector<double> vals(num);
+	for (size_t i = 0; i < num; i++)
+		vals[i] = random() / 3.0;
+
+	quantile_sketch::ptr s1 = quantile_sketch::create();
+	quantile_sketch::ptr s2 = quantile_sketch::create();
+	s1->add((const char *) vals.data(), num / 2, get_scalar_type<double>());
+	s2->add((const char *) (vals.data() + num / 2), num - num / 2,
+			get_scalar_type<double>());
+	assert(s1->merge(*s2));
+	assert(s1->get_count() == num);
+
+	std::vector<double> sorted = vals;
+	std::sort(sorted.begin(), sorted.end());
+	assert(s1->get_min() == sorted.front());
+	assert(s1->get_max() == sorted.back());
+	for (double q = 0.1; q < 1; q += 0.1) {
+		double est = s1->get_quantile(q);
+		size_t rank = std::lower_bound(sorted.begin(), sorted.end(), est)
+			- sorted.begin();
+		assert(fabs(((double) rank) / num - q) < 0.02);
+		assert(fabs(s1->get_rank(est) - q) < 0.02);
+	}
+
+	// NaN is ignored.
+	double nan = std::numeric_limits<double>::quiet_NaN();
+	s1->add((const char *) &nan, 1, get_scalar_type<double>());
+	assert(s1->get_count() == num);
+	assert(std::isnan(quantile_sketch::create()->get_quantile(0.5)));
+	assert(quantile_sketch::create(4) == NULL);
+	assert(!s1->merge(*quantile_sketch::create(100)));
+	assert(!s1->merge(*distinct_sketch::create()));
+}
+
+void test_distinct()
+{
+	printf("test distinct sketch\n");
+	size_t num = 1000000;
+	size_t num_distinct = 100000;
+	std::vector<long> vals(num);
+	for (size_t i = 0; i < num; i++)
+		vals[i] = random() % num_distinct;
+	distinct_sketch::ptr s1 = distinct_sketch::create();
+	distinct_sketch::ptr s2 = distinct_sketch::create();
+	s1->add((const char *) vals.data(), num / 2, get_scalar_type<long>());
+	s2->add((const char *) (vals.data() + num / 2), num - num / 2,
+			get_scalar_type<long>());
+	assert(s1->merge(*s2));
+	assert(fabs(s1->get_estimate() / num_distinct - 1) < 0.05);
+
+	// Small cardinalities.
+	distinct_sketch::ptr s3 = distinct_sketch::create();
+	s3->add((const char *) vals.data(), 10, get_scalar_type<long>());
+	size_t exact = std::set<long>(vals.begin(), vals.begin() + 10).size();
+	assert(fabs(s3->get_estimate() - exact) < 1);
+
+	// 0 and -0 are the same value.
+	double zeros[2] = {0.0, -0.0};
+	distinct_sketch::ptr s4 = distinct_sketch::create();
+	s4->add((const char *) zeros, 2, get_scalar_type<double>());
+	assert(fabs(s4->get_estimate() - 1) < 0.1);
+
+	assert(distinct_sketch::create(2) == NULL);
+	assert(!s1->merge(*distinct_sketch::create(10)));
+}
+
+void test_histogram()
+{
+	printf("test histogram sketch\n");
+	size_t num = 100000;
+	std::vector<int> vals(num);
+	for (size_t i = 0; i < num; i++)
+		vals[i] = i % 120 - 10;
+	histogram_sketch::ptr s = histogram_sketch::create(0, 100, 10);
+	s->add((const char *) vals.data(), num, get_scalar_type<int>());
+	std::vector<size_t> counts(10);
+	size_t num_under = 0, num_over = 0;
+	for (size_t i = 0; i < num; i++) {
+		if (vals[i] < 0)
+			num_under++;
+		else if (vals[i] >= 100)
+			num_over++;
+		else
+			counts[vals[i] / 10]++;
+	}
+	assert(s->get_num_under() == num_under);
+	assert(s->get_num_over() == num_over);
+	for (size_t i = 0; i < counts.size(); i++) {
+		assert(s->get_count(i) == counts[i]);
+		assert(s->get_bin_range(i).first == i * 10);
+	}
+	assert(s->get_num_nan() == 0);
+
+	assert(histogram_sketch::create(1, 1, 10) == NULL);
+	assert(histogram_sketch::create(0, 1, 0) == NULL);
+	assert(!s->merge(*histogram_sketch::create(0, 100, 20)));
+}
+
+void test_matrix(matrix_layout_t layout, bool in_mem)
+{
+	printf("test sketches on a %s %s matrix\n", in_mem ? "in-mem" : "EM",
+			layout == matrix_layout_t::L_COL ? "col" : "row");
+	size_t num_rows = 1000000;
+	size_t num_cols = 4;
+	dense_matrix::ptr mat = dense_matrix::create_randu<double>(0, 1,
+			num_rows, num_cols, layout, -1, in_mem);
+	histogram_sketch::ptr hist = histogram_sketch::create(0, 1, 10);
+	std::vector<sketch::ptr> hists = sketch_cols(*mat, *hist);
+	assert(hists.size() == num_cols);
+
+	dense_matrix::ptr mem_mat = mat->conv_store(true, -1);
+	detail::mem_matrix_store::const_ptr store
+		= detail::mem_matrix_store::cast(mem_mat->get_raw_store());
+	for (size_t j = 0; j < num_cols; j++) {
+		std::vector<size_t> counts(10);
+		for (size_t i = 0; i < num_rows; i++)
+			counts[std::min(9, (int) (store->get<double>(i, j) * 10))]++;
+		const histogram_sketch &h = dynamic_cast<const histogram_sketch &>(
+				*hists[j]);
+		for (size_t k = 0; k < counts.size(); k++)
+			assert(h.get_count(k) == counts[k]);
+	}
+
+	sketch::ptr q = sketch_all(*mat, *quantile_sketch::create());
+	const quantile_sketch &qs = dynamic_cast<const quantile_sketch &>(*q);
+	assert(qs.get_count() == num_rows * num_cols);
+	assert(fabs(qs.get_quantile(0.5) - 0.5) < 0.02);
+}
+
+void test_data_frame(bool in_mem)
+{
+	printf("test sketches on %s data frame\n", in_mem ? "in-mem" : "EM");
+	size_t length = 1000000;
+	detail::smp_vec_store::ptr vec1 = detail::smp_vec_store::create(length,
+			get_scalar_type<long>());
+	detail::smp_vec_store::ptr vec2 = detail::smp_vec_store::create(length,
+			get_scalar_type<int>());
+	for (size_t i = 0; i < length; i++) {
+		vec1->set<long>(i, i);
+		vec2->set<int>(i, random() % 1000);
+	}
+	data_frame::ptr df = data_frame::create();
+	if (in_mem) {
+		df->add_vec("vec1", vec1);
+		df->add_vec("vec2", vec2);
+	}
+	else {
+		detail::vec_store::ptr em1 = detail::vec_store::create(0,
+				vec1->get_type(), -1, false);
+		em1->append(*vec1);
+		detail::vec_store::ptr em2 = detail::vec_store::create(0,
+				vec2->get_type(), -1, false);
+		em2->append(*vec2);
+		df->add_vec("vec1", em1);
+		df->add_vec("vec2", em2);
+	}
+
+	std::vector<std::string> names;
+	names.push_back("vec1");
+	names.push_back("vec2");
+	std::vector<sketch::ptr> res = sketch_cols(*df, names,
+			*distinct_sketch::create());
+	assert(res.size() == 2);
+	double est1 = dynamic_cast<const distinct_sketch &>(
+			*res[0]).get_estimate();
+	double est2 = dynamic_cast<const distinct_sketch &>(
+			*res[1]).get_estimate();
+	assert(fabs(est1 / length - 1) < 0.05);
+	assert(fabs(est2 / 1000 - 1) < 0.05);
+
+	names.push_back("vec3");
+	assert(sketch_cols(*df, names, *distinct_sketch::create()).empty());
+}
+
+int main(int argc, char *argv[])
+{
+	if (argc < 2) {
+		fprintf(stderr, "test conf_file\n");
+		exit(1);
+	}
+
+	std::string conf_file = argv[1];
+	config_map::ptr configs = config_map::create(conf_file);
+	init_flash_matrix(configs);
+
+	test_quantile();
+	test_distinct();
+	test_histogram();
+	test_matrix(matrix_layout_t::L_COL, true);
+	test_matrix(matrix_layout_t::L_ROW, true);
+	test_matrix(matrix_layout_t::L_COL, false);
+	test_data_frame(true);
+	test_data_frame(false);
+
+	destroy_flash_matrix();
+}
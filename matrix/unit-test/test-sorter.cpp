@@ -1,5 +1,7 @@
 #include <assert.h>
 
+#include <typeinfo>
+
 #include "sorter.h"
 #include "generic_type.h"
 
@@ -67,8 +69,48 @@ void test_merge_with_index()
 		assert(merge_res[i] == merge_res1[i]);
 }
 
+template<class T>
+void test_radix_sort(bool decreasing)
+{
+	printf("test radix sort of %s in %s order\n", typeid(T).name(),
+			decreasing ? "decreasing" : "increasing");
+	type_sorter<T> sort;
+	std::vector<size_t> lens = {100, 10000, vec_len * 10};
+	for (size_t len : lens) {
+		std::vector<T> vals(len);
+		for (size_t i = 0; i < len; i++)
+			vals[i] = (T) (((long) random()) - RAND_MAX / 2) / 7;
+		std::vector<T> expected = vals;
+		if (decreasing)
+			std::sort(expected.begin(), expected.end(), std::greater<T>());
+		else
+			std::sort(expected.begin(), expected.end());
+
+		std::vector<T> res = vals;
+		sort.sort((char *) res.data(), len, decreasing);
+		assert(res == expected);
+		res = vals;
+		sort.serial_sort((char *) res.data(), len, decreasing);
+		assert(res == expected);
+
+		res = vals;
+		std::vector<off_t> offs(len);
+		sort.sort_with_index((char *) res.data(), offs.data(), len,
+				decreasing);
+		assert(res == expected);
+		for (size_t i = 0; i < len; i++)
+			assert(vals[offs[i]] == res[i]);
+	}
+}
+
 int main()
 {
+	test_radix_sort<int>(false);
+	test_radix_sort<long>(true);
+	test_radix_sort<unsigned long>(false);
+	test_radix_sort<float>(true);
+	test_radix_sort<double>(false);
+	test_radix_sort<short>(false);
 	test_merge_with_index();
 	test_sort();
 }
@@ -1,8 +1,13 @@
 #include <unordered_set>
 
+#include "io_interface.h"
+#include "safs_file.h"
+
 #include "fm_utils.h"
 #include "sparse_matrix.h"
+#include "spgemm.h"
 #include "data_frame.h"
+#include "simd_kernels.h"
 
 using namespace fm;
 
@@ -113,6 +118,163 @@ void test_spmm_block(sparse_matrix::ptr spm)
 	assert(scalar_variable::get_val<float>(*diff) == 0);
 }
 
+void test_tune_block(sparse_matrix::ptr spm)
+{
+	printf("test tuning SpMM on 2D-partitioned matrix\n");
+	detail::mem_matrix_store::ptr in_mat
+		= detail::NUMA_row_tall_matrix_store::create(spm->get_num_cols(), 8,
+				num_nodes, get_scalar_type<float>());
+	for (size_t i = 0; i < in_mat->get_num_rows(); i++)
+		for (size_t j = 0; j < in_mat->get_num_cols(); j++)
+			in_mat->set<float>(i, j, random() % 100);
+	dense_matrix::ptr in = dense_matrix::create(in_mat);
+	dense_matrix::ptr out1 = spm->multiply(in);
+	// The blocks may be processed in a different order, so the results
+	// can have different rounding errors.
+	double tot = scalar_variable::get_val<float>(*out1->abs()->sum());
+
+	detail::spmm_params params = spm->tune_spmm(in->get_num_cols(),
+			in->get_type());
+	assert(params.sb_size > 0);
+	dense_matrix::ptr out2 = spm->multiply(in);
+	spm->reset_spmm_params();
+	scalar_variable::ptr diff = out1->minus(*out2)->abs()->sum();
+	assert(scalar_variable::get_val<float>(*diff) <= tot * 1e-5);
+
+	sparse_matrix::ptr new_spm = spm->reblock(params.block_size);
+	assert(new_spm->get_block_size().get_num_rows()
+			== params.block_size.get_num_rows());
+	detail::spmm_params new_params = new_spm->tune_spmm(in->get_num_cols(),
+			in->get_type());
+	dense_matrix::ptr out3 = new_spm->multiply(in);
+	diff = out1->minus(*out3)->abs()->sum();
+	assert(scalar_variable::get_val<float>(*diff) <= tot * 1e-5);
+
+	// The tuned super block size is only used for the dense matrix
+	// of the same width.
+	size_t row_size = in->get_num_cols() * in->get_entry_size();
+	assert(new_spm->get_super_block_size(row_size) == new_params.sb_size);
+	assert(new_spm->get_super_block_size(row_size * 16)
+			== detail::cal_super_block_size(new_spm->get_block_size(),
+				row_size * 16));
+	// The parameters tuned for another block size aren't used.
+	if (params.block_size.get_num_rows() != spm->get_block_size().get_num_rows()) {
+		spm->tune_spmm(in->get_num_cols(), in->get_type());
+		assert(spm->get_super_block_size(row_size)
+				== detail::cal_super_block_size(spm->get_block_size(), row_size));
+		spm->reset_spmm_params();
+	}
+}
+
+void test_compress_block(sparse_matrix::ptr spm)
+{
+	printf("test SpMM on compressed 2D-partitioned matrix\n");
+	detail::mem_matrix_store::ptr in_mat
+		= detail::NUMA_row_tall_matrix_store::create(spm->get_num_cols(), 4,
+				num_nodes, get_scalar_type<float>());
+	for (size_t i = 0; i < in_mat->get_num_rows(); i++)
+		for (size_t j = 0; j < in_mat->get_num_cols(); j++)
+			in_mat->set<float>(i, j, random() % 100);
+	dense_matrix::ptr in = dense_matrix::create(in_mat);
+	dense_matrix::ptr out1 = spm->multiply(in);
+	double tot = scalar_variable::get_val<float>(*out1->abs()->sum());
+
+	sparse_matrix::ptr cmp_spm = spm->compress();
+	assert(cmp_spm);
+	dense_matrix::ptr out2 = cmp_spm->multiply(in);
+	scalar_variable::ptr diff = out1->minus(*out2)->abs()->sum();
+	assert(scalar_variable::get_val<float>(*diff) <= tot * 1e-5);
+
+	if (spm->get_entry_size() > 0) {
+		cmp_spm = spm->compress(spm_val_encoding::BF16);
+		assert(cmp_spm->get_entry_size() == 2);
+		out2 = cmp_spm->multiply(in);
+		diff = out1->minus(*out2)->abs()->sum();
+		// bfloat16 has 8 bits of precision.
+		assert(scalar_variable::get_val<float>(*diff) <= tot * 1e-2);
+	}
+}
+
+/*
+ * Write an encoded matrix to SAFS and run SpMM on the matrix in SAFS.
+ */
+void test_safs_compress_block(sparse_matrix::ptr spm)
+{
+	if (!safs::is_safs_init())
+		return;
+
+	printf("test SpMM on compressed 2D-partitioned matrix in SAFS\n");
+	detail::mem_matrix_store::ptr in_mat
+		= detail::NUMA_row_tall_matrix_store::create(spm->get_num_cols(), 4,
+				num_nodes, get_scalar_type<float>());
+	for (size_t i = 0; i < in_mat->get_num_rows(); i++)
+		for (size_t j = 0; j < in_mat->get_num_cols(); j++)
+			in_mat->set<float>(i, j, random() % 100);
+	dense_matrix::ptr in = dense_matrix::create(in_mat);
+	dense_matrix::ptr out1 = spm->multiply(in);
+	double tot = scalar_variable::get_val<float>(*out1->abs()->sum());
+
+	spm_val_encoding val_enc = spm_val_encoding::RAW;
+	if (spm->is_type<float>() || spm->is_type<double>())
+		val_enc = spm_val_encoding::BF16;
+	data_frame::ptr el = detail::conv2el(*spm);
+	std::vector<std::string> files;
+	SpM_2d_index::ptr idxs[2];
+	for (size_t i = 0; i < 2; i++) {
+		auto mat = create_encoded_2d(el, spm->get_block_size(),
+				spm->get_num_rows(), spm->get_num_cols(), val_enc, i == 1);
+		assert(mat.second);
+		std::string name = i == 0 ? "test.mat" : "test_t.mat";
+		mat.first->safs_dump(name + "_idx");
+		mat.second->safs_dump(name);
+		files.push_back(name + "_idx");
+		files.push_back(name);
+		idxs[i] = SpM_2d_index::safs_load(name + "_idx");
+		assert(idxs[i]->get_header().get_val_encoding() == val_enc);
+	}
+	sparse_matrix::ptr safs_spm = sparse_matrix::create(idxs[0],
+			safs::create_io_factory("test.mat", safs::REMOTE_ACCESS),
+			idxs[1], safs::create_io_factory("test_t.mat", safs::REMOTE_ACCESS));
+	dense_matrix::ptr out2 = safs_spm->multiply(in);
+	scalar_variable::ptr diff = out1->minus(*out2)->abs()->sum();
+	assert(scalar_variable::get_val<float>(*diff) <= tot * 1e-2);
+	dense_matrix::ptr t_out1 = spm->transpose()->multiply(in);
+	dense_matrix::ptr t_out2 = safs_spm->transpose()->multiply(in);
+	tot = scalar_variable::get_val<float>(*t_out1->abs()->sum());
+	diff = t_out1->minus(*t_out2)->abs()->sum();
+	assert(scalar_variable::get_val<float>(*diff) <= tot * 1e-2);
+
+	safs_spm = NULL;
+	for (size_t i = 0; i < files.size(); i++) {
+		safs::safs_file f(safs::get_sys_RAID_conf(), files[i]);
+		assert(f.exist());
+		f.delete_file();
+	}
+}
+
+template<class T>
+void test_simd_spmm_block(sparse_matrix::ptr spm, size_t num_cols)
+{
+	printf("test vectorized SpMM on 2D-partitioned matrix with %ld cols\n",
+			num_cols);
+	detail::mem_matrix_store::ptr in_mat
+		= detail::NUMA_row_tall_matrix_store::create(spm->get_num_cols(),
+				num_cols, num_nodes, get_scalar_type<T>());
+	for (size_t i = 0; i < in_mat->get_num_rows(); i++)
+		for (size_t j = 0; j < in_mat->get_num_cols(); j++)
+			in_mat->set<T>(i, j, random() % 100);
+	dense_matrix::ptr in = dense_matrix::create(in_mat);
+	simd::isa_level isa = simd::get_isa();
+	dense_matrix::ptr out1 = spm->multiply(in);
+	simd::set_max_isa(simd::ISA_NONE);
+	dense_matrix::ptr out2 = spm->multiply(in);
+	simd::set_max_isa(isa);
+	// The vectorized kernels add the values in a different order.
+	double tot = scalar_variable::get_val<T>(*out2->abs()->sum());
+	scalar_variable::ptr diff = out1->minus(*out2)->abs()->sum();
+	assert(scalar_variable::get_val<T>(*diff) <= tot * 1e-5);
+}
+
 void test_multiply_block(data_frame::ptr el)
 {
 	printf("Multiply on 2D-partitioned matrix\n");
@@ -125,6 +287,152 @@ void test_multiply_block(data_frame::ptr el)
 			entry_type, false);
 
 	test_spmm_block(spm);
+	test_tune_block(spm);
+	test_compress_block(spm);
+	test_safs_compress_block(spm);
+	for (size_t num_cols = 1; num_cols <= 64; num_cols *= 2)
+		test_simd_spmm_block<float>(spm, num_cols);
+	test_simd_spmm_block<double>(spm, 1);
+	test_simd_spmm_block<double>(spm, 32);
+}
+
+void test_spgemm_block(data_frame::ptr el)
+{
+	printf("test SpGEMM on 2D-partitioned matrix\n");
+	const block_2d_size block_size(1024, 1024);
+	sparse_matrix::ptr spm = create_2d_matrix(el, block_size, NULL, false);
+	sparse_matrix::ptr spm2 = spm->multiply(spm);
+	assert(spm2);
+	assert(spm2->get_num_rows() == spm->get_num_rows());
+	assert(spm2->get_num_cols() == spm->get_num_cols());
+	assert(spm2->get_type() == get_scalar_type<long>());
+
+	// (A * A) * x should be the same as A * (A * x).
+	detail::mem_matrix_store::ptr in_mat
+		= detail::NUMA_row_tall_matrix_store::create(spm->get_num_cols(), 4,
+				num_nodes, get_scalar_type<long>());
+	for (size_t i = 0; i < in_mat->get_num_rows(); i++)
+		for (size_t j = 0; j < in_mat->get_num_cols(); j++)
+			in_mat->set<long>(i, j, random() % 100);
+	dense_matrix::ptr in = dense_matrix::create(in_mat);
+	dense_matrix::ptr out1 = spm2->multiply(in);
+	dense_matrix::ptr out2 = spm->multiply(spm->multiply(in));
+	scalar_variable::ptr diff = out1->minus(*out2)->abs()->sum();
+	assert(scalar_variable::get_val<long>(*diff) == 0);
+	sparse_matrix::ptr t_spm = spm->transpose();
+	dense_matrix::ptr t_out1 = spm2->transpose()->multiply(in);
+	dense_matrix::ptr t_out2 = t_spm->multiply(t_spm->multiply(in));
+	diff = t_out1->minus(*t_out2)->abs()->sum();
+	assert(scalar_variable::get_val<long>(*diff) == 0);
+
+	// The right matrix is split into many panels.
+	sparse_matrix::ptr spm3 = spm->multiply(spm, "", 1024 * 1024);
+	assert(spm3);
+	dense_matrix::ptr out3 = spm3->multiply(in);
+	diff = out1->minus(*out3)->abs()->sum();
+	assert(scalar_variable::get_val<long>(*diff) == 0);
+	dense_matrix::ptr t_out3 = spm3->transpose()->multiply(in);
+	diff = t_out1->minus(*t_out3)->abs()->sum();
+	assert(scalar_variable::get_val<long>(*diff) == 0);
+
+	// The output matrix is written to SAFS.
+	if (safs::is_safs_init()) {
+		spm3 = spm->multiply(spm, "test_spgemm", 1024 * 1024);
+		assert(spm3);
+		out3 = spm3->multiply(in);
+		diff = out1->minus(*out3)->abs()->sum();
+		assert(scalar_variable::get_val<long>(*diff) == 0);
+		t_out3 = spm3->transpose()->multiply(in);
+		diff = t_out1->minus(*t_out3)->abs()->sum();
+		assert(scalar_variable::get_val<long>(*diff) == 0);
+		spm3 = NULL;
+		const char *files[] = {"test_spgemm.mat", "test_spgemm.mat_idx",
+			"test_spgemm_t.mat", "test_spgemm_t.mat_idx"};
+		for (size_t i = 0; i < 4; i++) {
+			safs::safs_file f(safs::get_sys_RAID_conf(), files[i]);
+			assert(f.exist());
+			f.delete_file();
+		}
+	}
+}
+
+/*
+ * Count the triangles in a random undirected graph with sum(A * (A %*% A)).
+ */
+void test_triangle_count()
+{
+	printf("test counting triangles with SpGEMM\n");
+	size_t num_vertices = 1024 * 4;
+	std::vector<std::vector<uint32_t> > adjs(num_vertices);
+	std::unordered_set<edge_t, hash_edge, edge_equal> edges;
+	for (size_t i = 0; i < 50000; i++) {
+		edge_t e(random() % num_vertices, random() % num_vertices);
+		if (e.first == e.second)
+			continue;
+		if (edges.insert(e).second)
+			adjs[e.first].push_back(e.second);
+		if (edges.insert(edge_t(e.second, e.first)).second)
+			adjs[e.second].push_back(e.first);
+	}
+	detail::smp_vec_store::ptr sources = detail::smp_vec_store::create(
+			edges.size(), get_scalar_type<uint32_t>());
+	detail::smp_vec_store::ptr dests = detail::smp_vec_store::create(
+			edges.size(), get_scalar_type<uint32_t>());
+	size_t idx = 0;
+	BOOST_FOREACH(edge_t e, edges) {
+		sources->set<uint32_t>(idx, e.first);
+		dests->set<uint32_t>(idx, e.second);
+		idx++;
+	}
+	data_frame::ptr el = data_frame::create();
+	el->add_vec("source", sources);
+	el->add_vec("dest", dests);
+
+	// Count the triangles whose vertices are in the ascending order.
+	size_t num_triangles = 0;
+	for (size_t u = 0; u < num_vertices; u++) {
+		std::sort(adjs[u].begin(), adjs[u].end());
+		for (size_t i = 0; i < adjs[u].size(); i++) {
+			uint32_t v = adjs[u][i];
+			if (v <= u)
+				continue;
+			for (size_t j = i + 1; j < adjs[u].size(); j++)
+				if (edges.find(edge_t(v, adjs[u][j])) != edges.end())
+					num_triangles++;
+		}
+	}
+
+	sparse_matrix::ptr spm = create_rect_2d_matrix(el,
+			block_2d_size(1024, 1024), num_vertices, num_vertices, NULL, true);
+	sparse_matrix::ptr paths = spm->multiply(spm);
+	sparse_matrix::ptr closed = spm->multiply_ele(paths);
+	assert(closed);
+	assert(closed->is_symmetric());
+	data_frame::ptr closed_el = detail::conv2el(*closed);
+	detail::smp_vec_store::const_ptr counts
+		= std::dynamic_pointer_cast<const detail::smp_vec_store>(
+				closed_el->get_vec("attr"));
+	long tot = 0;
+	for (size_t i = 0; i < counts->get_length(); i++)
+		tot += counts->get<long>(i);
+	printf("There are %ld triangles\n", num_triangles);
+	assert(tot == (long) num_triangles * 6);
+}
+
+void test_rect_block(data_frame::ptr el)
+{
+	printf("test rectangular 2D-partitioned matrix\n");
+	const block_2d_size block_size(1024, 1024);
+	size_t num_edges = el->get_num_entries();
+	size_t num_rows = 1024 * 16 + 10;
+	size_t num_cols = 1024 * 20;
+	sparse_matrix::ptr spm = create_rect_2d_matrix(el, block_size,
+			num_rows, num_cols, NULL);
+	assert(spm);
+	assert(spm->get_num_rows() == num_rows);
+	assert(spm->get_num_cols() == num_cols);
+	// The invalid edges are added to a copy of the edge list.
+	assert(el->get_num_entries() == num_edges);
 }
 
 int main(int argc, char *argv[])
@@ -140,7 +448,10 @@ int main(int argc, char *argv[])
 	int num_nodes = matrix_conf.get_num_nodes();
 
 	data_frame::ptr el = create_rand_el(false);
+	test_rect_block(el);
 	test_multiply_block(el);
+	test_spgemm_block(el);
+	test_triangle_count();
 
 	el = create_rand_el(true);
 	test_multiply_block(el);
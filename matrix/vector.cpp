@@ -29,6 +29,8 @@
 #include "bulk_operate_ext.h"
 #include "local_matrix_store.h"
 #include "dense_matrix.h"
+#include "mem_vec_store.h"
+#include "encoded_vec_store.h"
 
 namespace fm
 {
@@ -115,15 +117,16 @@ data_frame::ptr vector::groupby(
 		return data_frame::ptr();
 
 	// If the vector hasn't been sorted, we need to sort it.
+	// An encoded vector is decoded first.
 	detail::mem_vec_store::const_ptr sorted_vec;
 	if (!this->is_sorted()) {
 		// We don't want groupby changes the original vector.
 		detail::vec_store::ptr tmp = get_data().deep_copy();
 		tmp->sort();
-		sorted_vec = detail::mem_vec_store::cast(tmp);
+		sorted_vec = detail::get_smp_vec(tmp);
 	}
 	else
-		sorted_vec = detail::mem_vec_store::cast(this->get_raw_store());
+		sorted_vec = detail::get_smp_vec(this->get_raw_store());
 
 	// We need to find the start location for each thread.
 	// The start location is where the value in the sorted array
@@ -172,10 +175,13 @@ bool vector::equals(const vector &vec) const
 		return false;
 	else {
 		assert(is_in_mem());
-		const detail::mem_vec_store &v1
-			= dynamic_cast<const detail::mem_vec_store &>(get_data());
-		const detail::mem_vec_store &v2
-			= dynamic_cast<const detail::mem_vec_store &>(vec.get_data());
+		// The vectors may be encoded.
+		detail::smp_vec_store::const_ptr smp1 = detail::get_smp_vec(
+				get_raw_store());
+		detail::smp_vec_store::const_ptr smp2 = detail::get_smp_vec(
+				vec.get_raw_store());
+		const detail::mem_vec_store &v1 = *smp1;
+		const detail::mem_vec_store &v2 = *smp2;
 		size_t portion_size = std::min(v1.get_portion_size(),
 				v2.get_portion_size());
 		for (size_t idx = 0; idx < v1.get_length(); idx += portion_size) {
@@ -211,8 +217,49 @@ public:
 
 }
 
+vector::ptr vector::sapply(bulk_uoperate::const_ptr op) const
+{
+	if (op->get_input_type() != get_type()) {
+		BOOST_LOG_TRIVIAL(error) << "The input type of the operator is wrong";
+		return vector::ptr();
+	}
+	if (!is_in_mem()) {
+		BOOST_LOG_TRIVIAL(error) << "sapply only works on in-memory vectors";
+		return vector::ptr();
+	}
+
+	detail::encoded_vec_store::const_ptr encoded
+		= detail::encoded_vec_store::cast(store);
+	if (encoded) {
+		detail::vec_store::ptr res = encoded->sapply(*op);
+		return res ? vector::create(res) : vector::ptr();
+	}
+
+	detail::smp_vec_store::ptr res = detail::smp_vec_store::create(
+			get_length(), op->get_output_type());
+	size_t portion_size = get_data().get_portion_size();
+	size_t num_portions = get_data().get_num_portions();
+#pragma omp parallel for
+	for (size_t i = 0; i < num_portions; i++) {
+		off_t start = i * portion_size;
+		size_t length = std::min(portion_size, get_length() - start);
+		local_vec_store::const_ptr portion = get_data().get_portion(start,
+				length);
+		op->runA(length, portion->get_raw_arr(), res->get(start));
+	}
+	return vector::create(res);
+}
+
 scalar_variable::ptr vector::aggregate(const bulk_operate &op) const
 {
+	// An encoded vector can aggregate on the encoded values.
+	detail::encoded_vec_store::const_ptr encoded
+		= detail::encoded_vec_store::cast(store);
+	if (encoded) {
+		bulk_operate::const_ptr op_ptr = bulk_operate::conv2ptr(op);
+		return encoded->aggregate(*agg_operate::create(op_ptr, op_ptr));
+	}
+
 	scalar_variable::ptr res = op.get_output_type().create_scalar();
 	size_t num_portions = get_data().get_num_portions();
 	size_t portion_size = get_data().get_portion_size();
@@ -224,9 +271,8 @@ scalar_variable::ptr vector::aggregate(const bulk_operate &op) const
 	for (size_t i = 0; i < num_portions; i++) {
 		off_t start = i * portion_size;
 		size_t length = std::min(portion_size, get_length() - start);
-		local_vec_store::const_ptr sub_vec
-			= static_cast<const detail::mem_vec_store &>(
-					get_data()).get_portion(start, length);
+		local_vec_store::const_ptr sub_vec = get_data().get_portion(start,
+				length);
 
 		int node_id = sub_vec->get_node_id();
 		if (node_id < 0)
@@ -314,8 +360,7 @@ bool vector::export2(FILE *f) const
 		return false;
 	}
 
-	size_t ret = fwrite(
-			dynamic_cast<const detail::mem_vec_store &>(get_data()).get_raw_arr(),
+	size_t ret = fwrite(detail::get_smp_vec(get_raw_store())->get_raw_arr(),
 			get_length() * get_type().get_size(), 1, f);
 	if (ret == 0) {
 		BOOST_LOG_TRIVIAL(error) << boost::format(
@@ -30,6 +30,7 @@ namespace fm
 {
 
 class bulk_operate;
+class bulk_uoperate;
 class data_frame;
 class agg_operate;
 class dense_matrix;
@@ -119,6 +120,16 @@ public:
 	std::shared_ptr<data_frame> groupby(
 			const gr_apply_operate<local_vec_store> &op, bool with_val) const;
 
+	/*
+	 * Apply the operator on each element of an in-memory vector.
+	 * An encoded vector applies the operator on the encoded values
+	 * directly if possible, and the result is also encoded.
+	 */
+	vector::ptr sapply(std::shared_ptr<const bulk_uoperate> op) const;
+	/*
+	 * Aggregate all elements. An encoded vector computes MIN and MAX
+	 * without decoding the values.
+	 */
 	scalar_variable::ptr aggregate(const bulk_operate &op) const;
 	scalar_variable::ptr dot_prod(const vector &vec) const;
 